@@ -0,0 +1,769 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <QDateTime>
+#include <QSocketNotifier>
+#include <QtEndian>
+
+#ifdef Q_OS_LINUX
+#  include <linux/can.h>
+#  include <linux/can/raw.h>
+#  include <net/if.h>
+#  include <sys/ioctl.h>
+#  include <sys/socket.h>
+#endif
+
+#include "canbus.h"
+#include "candecoder.h"
+#include "command.h"
+#include "constants.h"
+#include "discovery.h"
+#include "spyproto.h"
+
+/******************************************************************************\
+|* Tuning: how long discoveries settle before being written as one batch, and
+|* how often we try to reopen a spy that's gone away
+\******************************************************************************/
+#define CANBUS_SETTLE_MS		2000
+#define CANBUS_REOPEN_MS		5000
+
+/******************************************************************************\
+|* Frame ids carry the 29-bit flag in bit 31, as both SocketCAN and the spy
+|* do it
+\******************************************************************************/
+#define CANBUS_ID_EFF			SPY_ID_EFF
+#define CANBUS_ID_RTR			SPY_ID_RTR
+#define CANBUS_ID_MASK			0x1FFFFFFFu
+#define CANBUS_SFF_MASK			0x7FFu
+
+/******************************************************************************\
+|* Most filters the kernel takes on a socket. Past that, we take every data
+|* frame and let the decoder pick
+\******************************************************************************/
+#ifndef CAN_RAW_FILTER_MAX
+#  define CAN_RAW_FILTER_MAX	512
+#endif
+
+/******************************************************************************\
+|* The names the spy's statistics go by in statsJson()
+\******************************************************************************/
+static const struct
+	{
+	int				key;
+	const char *	name;
+	} _spyStatNames[] =
+	{
+		{SPY_STAT_RX,			"rx"},
+		{SPY_STAT_TX,			"tx"},
+		{SPY_STAT_TX_ATTEMPT,	"txAttempts"},
+		{SPY_STAT_PARSE_ERROR,	"parseErrors"},
+		{SPY_STAT_STUFF_ERROR,	"stuffErrors"},
+		{SPY_STAT_CRC_ERROR,	"crcErrors"},
+		{SPY_STAT_FORM_ERROR,	"formErrors"},
+		{SPY_STAT_ACK_ERROR,	"ackErrors"},
+		{SPY_STAT_RX_FILTERED,	"rxFiltered"},
+		{SPY_STAT_LOST,			"lost"},
+		{SPY_STAT_TIMING_FULL,	"untimed"},
+		{SPY_STAT_IRQ_LATENCY,	"irqLatencyUs"},
+		{SPY_STAT_IRQ_TIME,		"irqTimeUs"},
+	};
+
+/******************************************************************************\
+|* Categorised logging support
+\******************************************************************************/
+Q_LOGGING_CATEGORY(log_can, "reefd:can")
+
+#define LOG qDebug(log_can) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define ERR qCritical(log_can) << QTime::currentTime().toString("hh:mm:ss.zzz")
+
+/******************************************************************************\
+|* Constructor
+\******************************************************************************/
+CanBus::CanBus(const QString& interface, QObject *parent)
+	   :QObject{parent}
+	   ,_connected(false)
+	   ,_online(0)
+	   ,_frames(0)
+	   ,_readings(0)
+	   ,_tx([this](quint32 id, const quint8 *data, int length)
+			{ return _write(id, data, length); }, this)
+	   ,_transmitted(0)
+	   ,_busErrors(0)
+	   ,_held(0)
+	   ,_interface(interface)
+	   ,_fd(-1)
+	   ,_spy(false)
+	   ,_credits(0)
+	   ,_tag(0)
+	   ,_notifier(nullptr)
+	   ,_decoder(nullptr)
+	   ,_settle(this)
+	   ,_sweep(this)
+	   ,_reopen(this)
+	{
+	qRegisterMetaType<QVector<Topology::Module>>("QVector<Topology::Module>");
+
+	_settle.setSingleShot(true);
+	_settle.setInterval(CANBUS_SETTLE_MS);
+	connect(&_settle, &QTimer::timeout, this, &CanBus::_flush);
+
+	_sweep.setInterval(DISCOVERY_PERIOD_MS);
+	connect(&_sweep, &QTimer::timeout, this, &CanBus::_checkNodes);
+
+	_reopen.setSingleShot(true);
+	_reopen.setInterval(CANBUS_REOPEN_MS);
+	connect(&_reopen, &QTimer::timeout, this, &CanBus::_reopenSpy);
+	}
+
+/******************************************************************************\
+|* Destructor
+\******************************************************************************/
+CanBus::~CanBus(void)
+	{
+	stop();
+	}
+
+/******************************************************************************\
+|* Decode data frames from now on. The filters are set when the interface is
+|* opened, so this has to come first
+\******************************************************************************/
+void CanBus::setDecoder(const CanDecoder *decoder, Sink sink)
+	{
+	_decoder	= decoder;
+	_sink		= sink;
+	_decoded.resize(decoder ? qMax(decoder->maxPerFrame(), 1) : 0);
+	}
+
+/******************************************************************************\
+|* The nodeId for a node number
+\******************************************************************************/
+QString CanBus::nodeId(quint16 node)
+	{
+	return QString::asprintf("%04X", node);
+	}
+
+/******************************************************************************\
+|* Render the counters. The spy's are as it last sent them (every
+|* SPY_STATS_MS), with the bus load as a fraction; they're null on SocketCAN
+\******************************************************************************/
+QString CanBus::statsJson(void) const
+	{
+	QString spy = "null";
+	if (_spy && !_spyStats.isEmpty())
+		{
+		spy = QString("{\"load\":%1").arg(_spyStats.value(SPY_STAT_BUS_LOAD)
+										   / 1000.0);
+		for (const auto& stat : _spyStatNames)
+			spy += QString(",\"%1\":%2").arg(stat.name)
+										.arg(_spyStats.value(stat.key));
+		spy += "}";
+		}
+
+	return QString("{\"busStats\":{\"interface\":\"%1\",\"connected\":%2,"
+				   "\"online\":%3,\"frames\":%4,\"readings\":%5,"
+				   "\"transmitted\":%6,\"busErrors\":%7,\"held\":%8,"
+				   "\"spy\":%9}}")
+			.arg(_interface).arg(_connected ? "true" : "false").arg(_online)
+			.arg(_frames).arg(_readings).arg(_transmitted).arg(_busErrors)
+			.arg(_held).arg(spy);
+	}
+
+/******************************************************************************\
+|* Send the stats to whoever asked
+\******************************************************************************/
+void CanBus::fetchStats(QString identifier)
+	{
+	emit fetchedStats(statsJson(), identifier);
+	}
+
+/******************************************************************************\
+|* Open the interface: a SocketCAN one by name, or the spy by its device path
+\******************************************************************************/
+void CanBus::start(void)
+	{
+	if (_interface.isEmpty())
+		{
+		LOG << "No CAN interface configured, discovery is off";
+		return;
+		}
+
+	_spy = _interface.startsWith("/dev/");
+	if (!(_spy ? _openSpy() : _openSocketCan()))
+		return;
+
+	_listen();
+	_sweep.start();
+
+	LOG << "Listening for nodes on" << _interface;
+	}
+
+/******************************************************************************\
+|* Watch the interface we've just opened
+\******************************************************************************/
+void CanBus::_listen(void)
+	{
+	_notifier = new QSocketNotifier(_fd, QSocketNotifier::Read, this);
+	connect(_notifier, &QSocketNotifier::activated, this, &CanBus::_read);
+	_connected = true;
+	}
+
+/******************************************************************************\
+|* Close the interface, sending anything still settling
+\******************************************************************************/
+void CanBus::stop(void)
+	{
+	_sweep.stop();
+	_reopen.stop();
+	if (_settle.isActive())
+		{
+		_settle.stop();
+		_flush();
+		}
+
+	delete _notifier;
+	_notifier	= nullptr;
+	_connected	= false;
+
+	if (_fd >= 0)
+		{
+		::close(_fd);
+		_fd = -1;
+		}
+	}
+
+/******************************************************************************\
+|* Drain the socket. The notifier fires once per wakeup, so read until it's
+|* empty rather than one frame per call
+\******************************************************************************/
+void CanBus::_read(void)
+	{
+	if (_spy)
+		{
+		_readSpy();
+		return;
+		}
+
+#ifdef Q_OS_LINUX
+	struct can_frame frame;
+	for (;;)
+		{
+		ssize_t got = recv(_fd, &frame, sizeof(frame), 0);
+		if (got != sizeof(frame))
+			{
+			if ((got < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK))
+				ERR << "Cannot read from" << _interface << ":" << strerror(errno);
+			return;
+			}
+		_frame(frame.can_id, frame.data, frame.can_dlc);
+		}
+#endif
+	}
+
+/******************************************************************************\
+|* Route a received frame: discovery and acks are ours, anything else with
+|* signals defined for it becomes readings. Remote frames carry no data
+\******************************************************************************/
+void CanBus::_frame(quint32 id, const quint8 *data, int length)
+	{
+	_frames ++;
+	if (id & CANBUS_ID_RTR)
+		return;
+
+	if (id & CANBUS_ID_EFF)
+		{
+		quint32 eid = id & CANBUS_ID_MASK;
+		if ((eid & DISCOVERY_ID_MASK) == DISCOVERY_ID_BASE)
+			{
+			_discovery(static_cast<quint16>(eid & DISCOVERY_NODE_MASK),
+					   data, length);
+			return;
+			}
+		if ((eid & COMMAND_ACK_MASK) == COMMAND_ACK_BASE)
+			{
+			_tx.acknowledged(static_cast<quint16>(eid & COMMAND_NODE_MASK),
+							 data, length);
+			return;
+			}
+		id = eid | CANBUS_ID_EFF;
+		}
+	else
+		id &= CANBUS_SFF_MASK;
+
+	if (_decoder == nullptr)
+		return;
+
+	int count = _decoder->decode(id, data, length,
+								 QDateTime::currentMSecsSinceEpoch(),
+								 _decoded.data());
+	if (count > 0)
+		{
+		_readings += count;
+		_sink(_decoded.constData(), count);
+		}
+	}
+
+/******************************************************************************\
+|* Write a frame. The socket is non-blocking, so a full transmit queue fails
+|* the write rather than stalling the thread
+\******************************************************************************/
+bool CanBus::_write(quint32 id, const quint8 *data, int length)
+	{
+	if (_spy)
+		return _writeSpy(id, data, length);
+
+#ifdef Q_OS_LINUX
+	if ((_fd < 0) || (length > CAN_MAX_DLEN))
+		return false;
+
+	struct can_frame frame;
+	memset(&frame, 0, sizeof(frame));
+	frame.can_id	= (id & CAN_EFF_MASK) | CAN_EFF_FLAG;
+	frame.can_dlc	= length;
+	memcpy(frame.data, data, length);
+
+	if (::write(_fd, &frame, sizeof(frame)) == sizeof(frame))
+		return true;
+
+	if ((errno != ENOBUFS) && (errno != EAGAIN))
+		ERR << "Cannot write to" << _interface << ":" << strerror(errno);
+	return false;
+#else
+	(void)id;
+	(void)data;
+	(void)length;
+	return false;
+#endif
+	}
+
+/******************************************************************************\
+|* Open a SocketCAN interface. The kernel only passes us discovery frames and
+|* acks
+\******************************************************************************/
+bool CanBus::_openSocketCan(void)
+	{
+#ifdef Q_OS_LINUX
+	_fd = socket(PF_CAN, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, CAN_RAW);
+	if (_fd < 0)
+		{
+		ERR << "Cannot create CAN socket:" << strerror(errno);
+		return false;
+		}
+
+	struct ifreq ifr;
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, qPrintable(_interface), IFNAMSIZ - 1);
+
+	struct sockaddr_can addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family = AF_CAN;
+
+	// Discovery, acks, then each id the decoder has signals for
+	QVector<struct can_filter> filters =
+		{
+		{DISCOVERY_ID_BASE | CAN_EFF_FLAG,
+		 DISCOVERY_ID_MASK | CAN_EFF_FLAG | CAN_RTR_FLAG},
+		{COMMAND_ACK_BASE | CAN_EFF_FLAG,
+		 COMMAND_ACK_MASK | CAN_EFF_FLAG | CAN_RTR_FLAG}
+		};
+	if (_decoder)
+		for (quint32 id : _decoder->ids())
+			filters.append({id, ((id & CAN_EFF_FLAG) ? CAN_EFF_MASK : CAN_SFF_MASK)
+								| CAN_EFF_FLAG | CAN_RTR_FLAG});
+	if (filters.size() > CAN_RAW_FILTER_MAX)
+		{
+		LOG << filters.size() << "CAN filters is more than the kernel takes,"
+			<< "passing all data frames";
+		filters = {{0, CAN_RTR_FLAG}};
+		}
+
+	bool ok = (ioctl(_fd, SIOCGIFINDEX, &ifr) == 0);
+	if (ok)
+		{
+		addr.can_ifindex = ifr.ifr_ifindex;
+		ok = (setsockopt(_fd, SOL_CAN_RAW, CAN_RAW_FILTER, filters.constData(),
+						 filters.size() * sizeof(struct can_filter)) == 0)
+		  && (bind(_fd, reinterpret_cast<struct sockaddr *>(&addr),
+				   sizeof(addr)) == 0);
+		}
+
+	if (!ok)
+		{
+		ERR << "Cannot open CAN interface" << _interface << ":"
+			<< strerror(errno);
+		::close(_fd);
+		_fd = -1;
+		}
+	return ok;
+#else
+	ERR << "CAN interfaces need SocketCAN, which this platform doesn't have."
+		<< "Use the spy instead";
+	return false;
+#endif
+	}
+
+
+#pragma mark - Spy
+
+/******************************************************************************\
+|* Open the spy's USB serial port, say hello and set its filters. We can't
+|* transmit until it answers with our credit
+\******************************************************************************/
+bool CanBus::_openSpy(void)
+	{
+	_fd = ::open(qPrintable(_interface), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (_fd < 0)
+		{
+		ERR << "Cannot open spy" << _interface << ":" << strerror(errno);
+		return false;
+		}
+
+	struct termios tio;
+	if (tcgetattr(_fd, &tio) == 0)
+		{
+		cfmakeraw(&tio);
+		tcsetattr(_fd, TCSANOW, &tio);
+		}
+	tcflush(_fd, TCIOFLUSH);
+
+	_credits = 0;
+	_line.clear();
+
+	// Say hello, then have the spy pass on only what the kernel would.
+	// Standard ids are a bitmap there, so any number will do, but it only
+	// holds SPY_ACCEPT_EXT extended filters: past that, take them all
+	QVector<QPair<quint32, quint32>> accept =
+		{
+		{DISCOVERY_ID_BASE | SPY_ID_EFF, DISCOVERY_ID_MASK},
+		{COMMAND_ACK_BASE | SPY_ID_EFF, COMMAND_ACK_MASK}
+		};
+	if (_decoder)
+		{
+		QVector<quint32> extended;
+		for (quint32 id : _decoder->ids())
+			if (id & SPY_ID_EFF)
+				extended.append(id);
+			else
+				accept.append({id, CANBUS_SFF_MASK});
+
+		if (extended.size() + 2 > SPY_ACCEPT_EXT)
+			accept.append({SPY_ID_EFF, 0});
+		else
+			for (quint32 id : std::as_const(extended))
+				accept.append({id, CANBUS_ID_MASK});
+		}
+
+	QByteArray hello;
+	hello.reserve(2 + accept.size() * 18);
+	hello.append(SPY_MSG_HELLO).append('\n');
+	for (const auto& filter : std::as_const(accept))
+		{
+		char line[SPY_MAX_LINE];
+		char *end	= line;
+		*end++		= SPY_MSG_ACCEPT;
+		end			= spy_put_hex(end, filter.first, 8);
+		end			= spy_put_hex(end, filter.second, 8);
+		*end++		= '\n';
+		hello.append(line, end - line);
+		}
+
+	if (::write(_fd, hello.constData(), hello.size()) != hello.size())
+		{
+		ERR << "Cannot talk to spy" << _interface << ":" << strerror(errno);
+		::close(_fd);
+		_fd = -1;
+		return false;
+		}
+	return true;
+	}
+
+/******************************************************************************\
+|* Read what the spy has sent and handle each complete line
+\******************************************************************************/
+void CanBus::_readSpy(void)
+	{
+	char buf[4096];
+	for (;;)
+		{
+		ssize_t got = ::read(_fd, buf, sizeof(buf));
+		if ((got < 0) && (errno == EINTR))
+			continue;
+		if (got <= 0)
+			{
+			// Anything but "nothing more yet" means the port is gone
+			if ((got == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK)))
+				{
+				ERR << "Spy" << _interface << "has gone away:"
+					<< ((got == 0) ? "end of file" : strerror(errno));
+				_lostSpy();
+				}
+			break;
+			}
+		_line.append(buf, got);
+		}
+
+	int from = 0;
+	for (int nl; (nl = _line.indexOf('\n', from)) >= 0; from = nl + 1)
+		{
+		int len = nl - from;
+		if ((len > 0) && (_line[nl - 1] == '\r'))
+			len --;
+		if (len > 0)
+			_spyLine(_line.constData() + from, len);
+		}
+	_line.remove(0, from);
+
+	// Anything left is a partial line. If it's absurdly long it isn't ours
+	if (_line.size() > 4 * SPY_MAX_LINE)
+		_line.clear();
+	}
+
+/******************************************************************************\
+|* Stop watching the spy and close it. We're called from the notifier's own
+|* signal, so it's disabled now and deleted later. Until the spy comes back
+|* and sends its reset (with our credit), nothing can be sent, so the
+|* transmit queue just backs off
+\******************************************************************************/
+void CanBus::_lostSpy(void)
+	{
+	if (_notifier)
+		{
+		_notifier->setEnabled(false);
+		_notifier->deleteLater();
+		_notifier = nullptr;
+		}
+
+	::close(_fd);
+	_fd			= -1;
+	_credits	= 0;
+	_connected	= false;
+	_reopen.start();
+	}
+
+/******************************************************************************\
+|* Slot: Try the spy again, and keep trying until it opens
+\******************************************************************************/
+void CanBus::_reopenSpy(void)
+	{
+	if (!_openSpy())
+		{
+		_reopen.start();
+		return;
+		}
+
+	_listen();
+	LOG << "Spy" << _interface << "is back";
+	}
+
+/******************************************************************************\
+|* Handle one line from the spy
+\******************************************************************************/
+void CanBus::_spyLine(const char *line, int length)
+	{
+	quint32 n, id, dlc, value;
+	quint64 at;
+	quint8 data[8];
+
+	switch (line[0])
+		{
+		case SPY_MSG_FRAME:
+			if ((length > 17) && spy_get_time(line + 1, &at)
+			 && spy_get_frame(line + 17, length - 17, &id, &dlc, data))
+				_frame(id, data, dlc);
+			break;
+
+		case SPY_MSG_REPEATED:
+			if ((length > 25) && spy_get_time(line + 1, &at)
+			 && spy_get_hex(line + 17, 8, &n)
+			 && spy_get_frame(line + 25, length - 25, &id, &dlc, data))
+				{
+				_held += n;
+				_frame(id, data, dlc);
+				}
+			break;
+
+		case SPY_MSG_RESET:
+			if ((length == 3) && spy_get_hex(line + 1, 2, &n))
+				{
+				_credits = n;
+				LOG << "Spy" << _interface << "ready," << n << "frames of credit";
+				_tx.resume();
+				}
+			break;
+
+		case SPY_MSG_CREDIT:
+			if ((length == 3) && spy_get_hex(line + 1, 2, &n))
+				{
+				_credits += n;
+				_tx.resume();
+				}
+			break;
+
+		case SPY_MSG_SENT:
+			_transmitted ++;
+			break;
+
+		case SPY_MSG_DROPPED:
+			ERR << "Spy dropped a frame: we've lost track of our credit";
+			break;
+
+		case SPY_MSG_ERROR:
+			_busErrors ++;
+			break;
+
+		case SPY_MSG_STAT:
+			if ((length == 11) && spy_get_hex(line + 1, 2, &n)
+			 && spy_get_hex(line + 3, 8, &value))
+				_spyStats[n] = value;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+/******************************************************************************\
+|* Ask the spy to send a frame, if we have the credit
+\******************************************************************************/
+bool CanBus::_writeSpy(quint32 id, const quint8 *data, int length)
+	{
+	if ((_fd < 0) || (_credits <= 0) || (length > 8))
+		return false;
+
+	char line[SPY_MAX_LINE];
+	line[0] = SPY_MSG_TRANSMIT;
+	char *end = spy_put_hex(line + 1, _tag++, 2);
+	end = spy_put_frame(end, (id & CANBUS_ID_MASK) | CANBUS_ID_EFF, length, data);
+	*end++ = '\n';
+
+	if (::write(_fd, line, end - line) != end - line)
+		{
+		ERR << "Cannot write to spy" << _interface << ":" << strerror(errno);
+		return false;
+		}
+
+	_credits --;
+	return true;
+	}
+
+
+#pragma mark - Discovery
+
+/******************************************************************************\
+|* Handle an announce or heartbeat
+\******************************************************************************/
+void CanBus::_discovery(quint16 node, const quint8 *data, int length)
+	{
+	if (length < 1)
+		return;
+
+	auto it = _nodes.find(node);
+	if (it == _nodes.end())
+		it = _nodes.insert(node, {QString(), 0, 0, DISCOVERY_STATE_BOOT, false});
+
+	Node& info		= *it;
+	info.lastSeen	= QDateTime::currentMSecsSinceEpoch();
+	if (!info.online)
+		{
+		info.online = true;
+		_online ++;
+		}
+
+	switch (data[0])
+		{
+		case DISCOVERY_ANNOUNCE:
+			{
+			int len = 0;
+			while ((len < DISCOVERY_DRIVER_LEN) && (1 + len < length)
+				&& (data[1 + len] != 0))
+				len ++;
+
+			info.driver = QString::fromLatin1(reinterpret_cast<const char *>(data + 1), len);
+			info.state	= DISCOVERY_STATE_BOOT;
+			info.uptime	= 0;
+			break;
+			}
+
+		case DISCOVERY_HEARTBEAT:
+			if (length >= 6)
+				{
+				info.state	= data[1];
+				info.uptime	= qFromLittleEndian<quint32>(data + 2);
+				}
+			break;
+
+		default:
+			return;
+		}
+
+	_touch(node, info);
+	}
+
+/******************************************************************************\
+|* Queue a node for the topology if it isn't there already as it is. A node
+|* heard again before DbMgr has published the last batch may be queued
+|* twice; DbMgr skips anything that's already up to date
+\******************************************************************************/
+void CanBus::_touch(quint16 node, const Node& info)
+	{
+	if (_dirty.contains(node))
+		return;
+
+	Topology::SnapshotPtr topo = Topology::instance().snapshot();
+	const Topology::Module *module = topo->moduleForNode(nodeId(node));
+	if (module && (info.driver.isEmpty() || (module->driver == info.driver)))
+		return;
+
+	_dirty.insert(node);
+	if (!_settle.isActive())
+		_settle.start();
+	}
+
+/******************************************************************************\
+|* Send the batch. The settle timer isn't restarted by later changes, so
+|* nothing waits longer than CANBUS_SETTLE_MS however busy the bus is
+\******************************************************************************/
+void CanBus::_flush(void)
+	{
+	if (_dirty.isEmpty())
+		return;
+
+	QVector<Topology::Module> modules;
+	modules.reserve(_dirty.size());
+	for (quint16 node : std::as_const(_dirty))
+		{
+		Topology::Module module;
+		module.nodeId	= nodeId(node);
+		module.driver	= _nodes.value(node).driver;
+		modules.append(module);
+		}
+	_dirty.clear();
+
+	LOG << "Discovered" << modules.size() << "new or changed nodes,"
+		<< _online << "online";
+	emit modulesDiscovered(modules);
+	}
+
+/******************************************************************************\
+|* Look for nodes that have gone quiet
+\******************************************************************************/
+void CanBus::_checkNodes(void)
+	{
+	qint64 cutoff	= QDateTime::currentMSecsSinceEpoch() - DISCOVERY_TIMEOUT_MS;
+	int lost		= 0;
+
+	for (Node& info : _nodes)
+		if (info.online && (info.lastSeen < cutoff))
+			{
+			info.online = false;
+			lost ++;
+			}
+
+	if (lost > 0)
+		{
+		_online -= lost;
+		LOG << lost << "nodes have gone silent," << _online << "online";
+		}
+	}
@@ -0,0 +1,207 @@
+#ifndef CANBUS_H
+#define CANBUS_H
+
+#include <functional>
+
+#include <QByteArray>
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QString>
+#include <QTimer>
+#include <QVector>
+
+#include "properties.h"
+#include "reading.h"
+#include "topology.h"
+#include "txqueue.h"
+
+QT_FORWARD_DECLARE_CLASS(QSocketNotifier)
+
+class CanDecoder;
+
+/******************************************************************************\
+|* The connection to the CAN bus: a SocketCAN interface (Linux only), or the
+|* spy over USB serial (spyproto.h) if the interface is a /dev path. It
+|* listens for the node announce and heartbeat frames in discovery.h to keep
+|* track of which nodes are on the bus, and carries output commands
+|* (command.h) out through its transmit queue and the acks back. Given a
+|* decoder, it also turns the data frames the signals are defined for into
+|* readings, and both the kernel's filters and the spy's pass those ids.
+|*
+|* Nodes that aren't in the topology yet, or that announce a different
+|* driver, are handed to DbMgr to be added. Those changes are debounced: the
+|* first one starts a settle timer, and everything that turns up before it
+|* fires goes over as one batch, so a whole bus rebooting at once costs one
+|* transaction and one topology (and so SysInfo) change rather than hundreds.
+|* Nodes that reboot without changing anything cost nothing
+\******************************************************************************/
+class CanBus : public QObject
+	{
+	Q_OBJECT
+
+	public:
+		/**********************************************************************\
+		|* Typedefs and enums
+		\**********************************************************************/
+		struct Node
+			{
+			QString		driver;			// From the last announce
+			qint64		lastSeen;		// ms since the epoch
+			quint32		uptime;			// Seconds, from the last heartbeat
+			quint8		state;			// DISCOVERY_STATE_*
+			bool		online;			// Heard from recently
+			};
+
+		typedef std::function<void(const Reading *readings, int count)> Sink;
+
+	/**************************************************************************\
+	|* Properties
+	\**************************************************************************/
+	GET(bool, connected);				// Interface open and readable
+	GET(int, online);					// Nodes currently online
+	GET(qint64, frames);				// Frames received
+	GET(qint64, readings);				// Readings decoded from them
+	GET(TxQueue, tx);					// Output commands
+	GET(qint64, transmitted);			// Frames the spy says it sent
+	GET(qint64, busErrors);				// Errors the spy has reported
+	GET(qint64, held);					// Repeats the spy didn't forward
+
+	private:
+		/**********************************************************************\
+		|* Private variables
+		\**********************************************************************/
+		QString					_interface;	// eg: can0
+		int						_fd;		// Raw CAN socket, or the spy
+		bool					_spy;		// Talking to the spy
+		int						_credits;	// Frames the spy will take
+		quint8					_tag;		// For the next spy transmit
+		QByteArray				_line;		// Partial line from the spy
+		QSocketNotifier *		_notifier;	// Tells us there's data
+		QTimer					_settle;	// Debounces discoveries (child)
+		QTimer					_sweep;		// Looks for silent nodes (child)
+		QTimer					_reopen;	// Retries a lost spy (child)
+		QHash<quint16, Node>	_nodes;		// Everything we've heard from
+		QSet<quint16>			_dirty;		// To be sent to the topology
+		QHash<int, quint32>		_spyStats;	// SPY_STAT_* -> latest value
+		const CanDecoder *		_decoder;	// Data frames -> readings
+		Sink					_sink;		// Where the readings go
+		QVector<Reading>		_decoded;	// One frame's readings
+
+		/**********************************************************************\
+		|* Open the interface, returning false on failure
+		\**********************************************************************/
+		bool _openSocketCan(void);
+		bool _openSpy(void);
+
+		/**********************************************************************\
+		|* Start watching the open interface for data
+		\**********************************************************************/
+		void _listen(void);
+
+		/**********************************************************************\
+		|* The spy has gone away: stop reading, close it and try to reopen it
+		|* every so often, until it comes back
+		\**********************************************************************/
+		void _lostSpy(void);
+
+		/**********************************************************************\
+		|* Write a frame with a 29-bit id, false if it couldn't be queued
+		\**********************************************************************/
+		bool _write(quint32 id, const quint8 *data, int length);
+		bool _writeSpy(quint32 id, const quint8 *data, int length);
+
+		/**********************************************************************\
+		|* Read and handle the lines from the spy
+		\**********************************************************************/
+		void _readSpy(void);
+		void _spyLine(const char *line, int length);
+
+		/**********************************************************************\
+		|* Route a received frame. The id has the 29-bit flag in bit 31
+		\**********************************************************************/
+		void _frame(quint32 id, const quint8 *data, int length);
+
+		/**********************************************************************\
+		|* Handle a discovery frame from a node
+		\**********************************************************************/
+		void _discovery(quint16 node, const quint8 *data, int length);
+
+		/**********************************************************************\
+		|* Note that a node needs (or may need) writing to the topology
+		\**********************************************************************/
+		void _touch(quint16 node, const Node& info);
+
+	private slots:
+		/**********************************************************************\
+		|* Drain the socket
+		\**********************************************************************/
+		void _read(void);
+
+		/**********************************************************************\
+		|* Try to open the spy again after we lost it
+		\**********************************************************************/
+		void _reopenSpy(void);
+
+		/**********************************************************************\
+		|* Send the nodes that have changed to the topology, as one batch
+		\**********************************************************************/
+		void _flush(void);
+
+		/**********************************************************************\
+		|* Mark nodes we've not heard from in a while as offline
+		\**********************************************************************/
+		void _checkNodes(void);
+
+	public:
+		/**********************************************************************\
+		|* Constructor / Destructor
+		\**********************************************************************/
+		explicit CanBus(const QString& interface, QObject *parent = nullptr);
+		~CanBus(void) override;
+
+		/**********************************************************************\
+		|* Decode data frames with these signals, handing the readings to
+		|* 'sink' on the bus's thread. Call before start()
+		\**********************************************************************/
+		void setDecoder(const CanDecoder *decoder, Sink sink);
+
+		/**********************************************************************\
+		|* The nodeId (as in the modules table) for a node number
+		\**********************************************************************/
+		static QString nodeId(quint16 node);
+
+		/**********************************************************************\
+		|* Render the bus counters, and the spy's statistics, as JSON
+		\**********************************************************************/
+		QString statsJson(void) const;
+
+	public slots:
+		/**********************************************************************\
+		|* Open the interface and start listening. Call on the bus's thread
+		\**********************************************************************/
+		void start(void);
+
+		/**********************************************************************\
+		|* Stop listening and close the interface
+		\**********************************************************************/
+		void stop(void);
+
+		/**********************************************************************\
+		|* Send the stats back to whoever asked
+		\**********************************************************************/
+		void fetchStats(QString identifier);
+
+	signals:
+		/**********************************************************************\
+		|* New or changed nodes. Only nodeId and driver are filled in
+		\**********************************************************************/
+		void modulesDiscovered(QVector<Topology::Module> modules);
+
+		/**********************************************************************\
+		|* The stats someone asked for
+		\**********************************************************************/
+		void fetchedStats(QString json, QString identifier);
+	};
+
+#endif // CANBUS_H
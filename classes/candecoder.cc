@@ -0,0 +1,363 @@
+#include <algorithm>
+#include <cstring>
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRandomGenerator>
+#include <QtEndian>
+
+#include "candecoder.h"
+#include "constants.h"
+#include "topology.h"
+
+/******************************************************************************\
+|* SocketCAN's flag for a 29-bit identifier
+\******************************************************************************/
+#define CAN_EFF_FLAG			0x80000000u
+#define CAN_EFF_MASK			0x1FFFFFFFu
+
+/******************************************************************************\
+|* Largest payload we decode (CAN FD)
+\******************************************************************************/
+#define CAN_MAX_PAYLOAD			64
+
+/******************************************************************************\
+|* Categorised logging support
+\******************************************************************************/
+Q_LOGGING_CATEGORY(log_dec, "reefd:decode")
+
+#define LOG qDebug(log_dec) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define ERR qCritical(log_dec) << QTime::currentTime().toString("hh:mm:ss.zzz")
+
+typedef CanDecoder::Signal Signal;
+
+/******************************************************************************\
+|* Extractors for byte-aligned fields: a single load, plus a swap if needed
+\******************************************************************************/
+static double u8(const quint8 *d, const Signal& s)
+	{ return d[s.first]; }
+static double s8(const quint8 *d, const Signal& s)
+	{ return static_cast<qint8>(d[s.first]); }
+
+static double u16le(const quint8 *d, const Signal& s)
+	{ return qFromLittleEndian<quint16>(d + s.first); }
+static double s16le(const quint8 *d, const Signal& s)
+	{ return qFromLittleEndian<qint16>(d + s.first); }
+static double u16be(const quint8 *d, const Signal& s)
+	{ return qFromBigEndian<quint16>(d + s.first); }
+static double s16be(const quint8 *d, const Signal& s)
+	{ return qFromBigEndian<qint16>(d + s.first); }
+
+static double u32le(const quint8 *d, const Signal& s)
+	{ return qFromLittleEndian<quint32>(d + s.first); }
+static double s32le(const quint8 *d, const Signal& s)
+	{ return qFromLittleEndian<qint32>(d + s.first); }
+static double u32be(const quint8 *d, const Signal& s)
+	{ return qFromBigEndian<quint32>(d + s.first); }
+static double s32be(const quint8 *d, const Signal& s)
+	{ return qFromBigEndian<qint32>(d + s.first); }
+
+/******************************************************************************\
+|* Helper function: Sign-extend (if needed) and convert a raw field
+\******************************************************************************/
+static inline double finish(quint64 raw, const Signal& s)
+	{
+	raw &= s.mask;
+	if (s.sign)
+		return static_cast<double>(static_cast<qint64>((raw ^ s.sign) - s.sign));
+	return static_cast<double>(raw);
+	}
+
+/******************************************************************************\
+|* Generic extractors: place each byte the field spans (up to 9) straight at
+|* its bit offset in the result, starting from the byte holding the LSB. The
+|* shift is under 8, and a ninth byte only occurs when it's non-zero, so no
+|* byte is shifted 64 or more; bits past the top fall off, to be masked
+\******************************************************************************/
+static double genericLe(const quint8 *d, const Signal& s)
+	{
+	quint64 raw = d[s.first] >> s.shift;
+	for (int i=1, bit=8-s.shift; i<s.bytes; i++, bit+=8)
+		raw |= static_cast<quint64>(d[s.first + i]) << bit;
+	return finish(raw, s);
+	}
+
+static double genericBe(const quint8 *d, const Signal& s)
+	{
+	int last = s.first + s.bytes - 1;
+	quint64 raw = d[last] >> s.shift;
+	for (int i=last-1, bit=8-s.shift; i>=s.first; i--, bit+=8)
+		raw |= static_cast<quint64>(d[i]) << bit;
+	return finish(raw, s);
+	}
+
+/******************************************************************************\
+|* Helper function: Pick the extractor and work out the byte span
+\******************************************************************************/
+static bool bind(const CanDecoder::Definition& def, Signal& s)
+	{
+	if ((def.length < 1) || (def.length > 64) || (def.start < 0))
+		return false;
+
+	s.input		= def.input;
+	s.scale		= def.scale;
+	s.offset	= def.offset;
+	s.mask		= (def.length == 64) ? ~0ULL : ((1ULL << def.length) - 1);
+	s.sign		= def.isSigned ? (1ULL << (def.length - 1)) : 0;
+
+	int end;
+	if (!def.bigEndian)
+		{
+		/**********************************************************************\
+		|* Intel: 'start' is the LSB, the field runs up through the bytes
+		\**********************************************************************/
+		s.first	= def.start / 8;
+		s.shift	= def.start % 8;
+		s.bytes	= (s.shift + def.length + 7) / 8;
+		end		= s.first + s.bytes;
+
+		s.extract = genericLe;
+		if (s.shift == 0)
+			switch (def.length)
+				{
+				case 8:  s.extract = def.isSigned ? s8    : u8;    break;
+				case 16: s.extract = def.isSigned ? s16le : u16le; break;
+				case 32: s.extract = def.isSigned ? s32le : u32le; break;
+				}
+		}
+	else
+		{
+		/**********************************************************************\
+		|* Motorola: 'start' is the MSB. Renumber so bit 0 is the MSB of byte 0
+		|* and the field is a plain run of bits from there
+		\**********************************************************************/
+		int pos	= (def.start / 8) * 8 + (7 - def.start % 8);
+		s.first	= pos / 8;
+		s.bytes	= (pos + def.length + 7) / 8 - s.first;
+		s.shift	= s.bytes * 8 - (pos % 8) - def.length;
+		end		= s.first + s.bytes;
+
+		s.extract = genericBe;
+		if (s.shift == 0)
+			switch (def.length)
+				{
+				case 8:  s.extract = def.isSigned ? s8    : u8;    break;
+				case 16: s.extract = def.isSigned ? s16be : u16be; break;
+				case 32: s.extract = def.isSigned ? s32be : u32be; break;
+				}
+		}
+
+	if ((end > CAN_MAX_PAYLOAD) || (s.bytes > 9))
+		return false;
+	s.needed = end;
+	return true;
+	}
+
+/******************************************************************************\
+|* Constructor
+\******************************************************************************/
+CanDecoder::CanDecoder(void)
+		   :_maxPerFrame(0)
+	{
+	memset(_standard, 0, sizeof(_standard));
+	}
+
+/******************************************************************************\
+|* Compile definitions into the dispatch table
+\******************************************************************************/
+bool CanDecoder::compile(const QVector<Definition>& definitions)
+	{
+	QVector<Definition> sorted = definitions;
+	std::stable_sort(sorted.begin(), sorted.end(),
+		[](const Definition& a, const Definition& b) { return a.id < b.id; });
+
+	QVector<Signal> compiled;
+	compiled.reserve(sorted.size());
+	for (const Definition& def : std::as_const(sorted))
+		{
+		Signal signal;
+		if (((def.id & CAN_EFF_FLAG) == 0) && (def.id >= 2048))
+			{
+			ERR << "Signal for input" << def.input << "has bad id" << def.id;
+			return false;
+			}
+		if (!bind(def, signal))
+			{
+			ERR << "Signal for input" << def.input << "on id" << def.id
+				<< "has a bad position: start" << def.start << "length"
+				<< def.length;
+			return false;
+			}
+		compiled.append(signal);
+		}
+
+	/**************************************************************************\
+	|* Point each id at its run of signals
+	\**************************************************************************/
+	memset(_standard, 0, sizeof(_standard));
+	_extended.clear();
+	_ids.clear();
+	_maxPerFrame = 0;
+
+	int ids = 0;
+	for (int i=0; i<sorted.size(); ids++)
+		{
+		int j = i;
+		while ((j < sorted.size()) && (sorted[j].id == sorted[i].id))
+			j ++;
+
+		Range range = {static_cast<quint32>(i), static_cast<quint32>(j - i)};
+		if (sorted[i].id & CAN_EFF_FLAG)
+			_extended.insert(sorted[i].id, range);
+		else
+			_standard[sorted[i].id] = range;
+		_ids.append(sorted[i].id);
+
+		_maxPerFrame = qMax(_maxPerFrame, j - i);
+		i = j;
+		}
+
+	_signals = compiled;
+	LOG << "Compiled" << _signals.size() << "signals for" << ids << "CAN ids";
+	return true;
+	}
+
+/******************************************************************************\
+|* Load definitions from a JSON file
+\******************************************************************************/
+bool CanDecoder::load(const QString& file)
+	{
+	QFile f(file);
+	if (!f.open(QFile::ReadOnly))
+		{
+		ERR << "Cannot open" << file;
+		return false;
+		}
+
+	QJsonParseError error;
+	QJsonDocument doc = QJsonDocument::fromJson(f.readAll(), &error);
+	if (!doc.isArray())
+		{
+		ERR << "Cannot parse" << file << ":" << error.errorString();
+		return false;
+		}
+
+	/**************************************************************************\
+	|* Inputs may be given by name
+	\**************************************************************************/
+	QHash<QString, qint64> names;
+	Topology::SnapshotPtr topo = Topology::instance().snapshot();
+	for (const Topology::Input& input : topo->inputs)
+		names.insert(input.name, input.id);
+
+	QVector<Definition> definitions;
+	for (const QJsonValue& value : doc.array())
+		{
+		QJsonObject obj = value.toObject();
+		Definition def;
+
+		QJsonValue id = obj.value("id");
+		bool ok = true;
+		def.id = id.isString() ? id.toString().toUInt(&ok, 0)
+							   : static_cast<quint32>(id.toVariant().toLongLong());
+		if (!ok || (def.id > CAN_EFF_MASK))
+			{
+			ERR << "Bad CAN id in" << file << ":" << id;
+			return false;
+			}
+		if (obj.value("extended").toBool(def.id >= 2048))
+			def.id |= CAN_EFF_FLAG;
+
+		QJsonValue input = obj.value("input");
+		def.input = input.isString() ? names.value(input.toString(), -1)
+									 : input.toVariant().toLongLong();
+		if (def.input < 0)
+			{
+			ERR << "Unknown input in" << file << ":" << input;
+			return false;
+			}
+
+		QString order	= obj.value("order").toString("little").toLower();
+		def.bigEndian	= (order == "big") || (order == "motorola");
+		def.start		= obj.value("start").toInt(-1);
+		def.length		= obj.value("length").toInt(0);
+		def.isSigned	= obj.value("signed").toBool(false);
+		def.scale		= obj.value("scale").toDouble(1.0);
+		def.offset		= obj.value("offset").toDouble(0.0);
+		definitions.append(def);
+		}
+
+	return compile(definitions);
+	}
+
+/******************************************************************************\
+|* Decode a frame onto the end of a list
+\******************************************************************************/
+void CanDecoder::decode(quint32 id,
+						const quint8 *data,
+						int length,
+						qint64 at,
+						Readings& out) const
+	{
+	int used = out.size();
+	out.resize(used + _maxPerFrame);
+	out.resize(used + decode(id, data, length, at, out.data() + used));
+	}
+
+/******************************************************************************\
+|* Benchmark: 256 ids with four signals each, one of each shape (aligned
+|* little-endian, aligned big-endian, and unaligned in both orders), decoding
+|* a few thousand pre-built random frames over and over
+\******************************************************************************/
+void CanDecoder::benchmark(int frames)
+	{
+	QVector<Definition> definitions;
+	for (quint32 id=0x100; id<0x200; id++)
+		{
+		definitions.append({id, id * 4 + 0,  0, 16, false, false, 0.01, 0});
+		definitions.append({id, id * 4 + 1, 23, 16, true,  true,  0.1, -40});
+		definitions.append({id, id * 4 + 2, 36, 12, false, true,  0.5, 0});
+		definitions.append({id, id * 4 + 3, 55, 12, true,  false, 1.0, 0});
+		}
+
+	CanDecoder decoder;
+	if (!decoder.compile(definitions))
+		return;
+
+	struct Frame
+		{
+		quint32 id;
+		quint8	data[8];
+		};
+	QVector<Frame> pool(4096);
+	QRandomGenerator *random = QRandomGenerator::global();
+	for (Frame& frame : pool)
+		{
+		frame.id = 0x100 + random->bounded(256);
+		for (quint8& byte : frame.data)
+			byte = static_cast<quint8>(random->bounded(256));
+		}
+
+	QVector<Reading> out(decoder.maxPerFrame());
+	double checksum = 0;
+	qint64 decoded	= 0;
+
+	QElapsedTimer timer;
+	timer.start();
+	for (int i=0; i<frames; i++)
+		{
+		const Frame& frame = pool[i & 4095];
+		int n = decoder.decode(frame.id, frame.data, 8, i, out.data());
+		decoded += n;
+		checksum += out[n - 1].value;
+		}
+	qint64 ns = qMax(timer.nsecsElapsed(), 1LL);
+
+	LOG << "Decoded" << frames << "frames," << decoded << "signals in"
+		<< ns / 1000000 << "ms:" << (double)ns / frames << "ns/frame,"
+		<< (double)ns / qMax(decoded, 1LL) << "ns/signal (checksum"
+		<< checksum << ")";
+	}
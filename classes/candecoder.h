@@ -0,0 +1,152 @@
+#ifndef CANDECODER_H
+#define CANDECODER_H
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+#include "properties.h"
+#include "reading.h"
+
+/******************************************************************************\
+|* Turns raw CAN payloads into readings, DBC-style. Each signal definition
+|* gives the CAN id, the start bit and length, the byte order, whether it's
+|* signed, and a scale and offset to get engineering units. Definitions are
+|* loaded from JSON, an array of:
+|*
+|*   {"id": "0x123", "extended": false, "input": 5 | "Tank temp",
+|*    "start": 0, "length": 16, "order": "little" | "big",
+|*    "signed": true, "scale": 0.01, "offset": 0}
+|*
+|* Bit numbering is the DBC one: 'start' is the least significant bit for
+|* little-endian (Intel) signals, and the most significant bit for
+|* big-endian (Motorola) ones, counting bit 0 as the LSB of byte 0.
+|*
+|* At load time the definitions are compiled into a table indexed directly
+|* by standard CAN id (extended ids go through a hash), with each signal
+|* bound to an extractor specialised for its shape: byte-aligned 8/16/32-bit
+|* fields are a single load (and byte swap), anything else is a shift and
+|* mask. Extended ids carry SocketCAN's CAN_EFF_FLAG (bit 31)
+\******************************************************************************/
+class CanDecoder
+	{
+	public:
+		/**********************************************************************\
+		|* Typedefs and enums
+		\**********************************************************************/
+		struct Definition
+			{
+			quint32		id;				// CAN id (| CAN_EFF_FLAG if extended)
+			qint64		input;			// Input the value is a reading for
+			int			start;			// DBC start bit
+			int			length;			// Bits, 1..64
+			bool		bigEndian;		// Motorola byte order
+			bool		isSigned;		// Two's complement
+			double		scale;			// value = raw * scale + offset
+			double		offset;
+			};
+
+		struct Signal;
+		typedef double (*Extract)(const quint8 *data, const Signal& signal);
+
+		struct Signal
+			{
+			Extract		extract;		// Specialised for this shape
+			qint64		input;			// Where the reading goes
+			double		scale;			// value = raw * scale + offset
+			double		offset;
+			quint64		mask;			// Low 'length' bits set
+			quint64		sign;			// Sign bit, 0 if unsigned
+			quint8		first;			// First payload byte touched
+			quint8		bytes;			// Payload bytes touched
+			quint8		shift;			// Right shift after the load
+			quint8		needed;			// Minimum frame length
+			};
+
+	/**************************************************************************\
+	|* Properties
+	\**************************************************************************/
+	GET(int, maxPerFrame);				// Most signals in one frame
+	GET(QVector<quint32>, ids);			// CAN ids with signals, in order
+
+	private:
+		/**********************************************************************\
+		|* Private variables
+		\**********************************************************************/
+		struct Range
+			{
+			quint32		first;			// Index into _signals
+			quint32		count;			// Number of signals
+			};
+
+		QVector<Signal>				_signals;	// Grouped by CAN id
+		Range						_standard[2048];// By 11-bit id
+		QHash<quint32, Range>		_extended;	// By 29-bit id | EFF
+
+		/**********************************************************************\
+		|* Look up the signals for an id
+		\**********************************************************************/
+		inline const Range& _range(quint32 id) const
+			{
+			static const Range none = {0, 0};
+			if (id < 2048)
+				return _standard[id];
+			auto it = _extended.constFind(id);
+			return (it == _extended.constEnd()) ? none : *it;
+			}
+
+	public:
+		/**********************************************************************\
+		|* Constructor
+		\**********************************************************************/
+		CanDecoder(void);
+
+		/**********************************************************************\
+		|* Compile a set of definitions, replacing any already loaded. Returns
+		|* false (loading nothing) if any definition is invalid
+		\**********************************************************************/
+		bool compile(const QVector<Definition>& definitions);
+
+		/**********************************************************************\
+		|* Load and compile definitions from a JSON file
+		\**********************************************************************/
+		bool load(const QString& file);
+
+		/**********************************************************************\
+		|* Decode a frame into 'out', which must have room for maxPerFrame()
+		|* readings. Returns the number written. Thread-safe once compiled
+		\**********************************************************************/
+		inline int decode(quint32 id,
+						  const quint8 *data,
+						  int length,
+						  qint64 at,
+						  Reading *out) const
+			{
+			const Range& range = _range(id);
+			const Signal *signal = _signals.constData() + range.first;
+			int n = 0;
+			for (quint32 i=0; i<range.count; i++, signal++)
+				if (length >= signal->needed)
+					out[n++] = {signal->input,
+								at,
+								signal->extract(data, *signal) * signal->scale
+									+ signal->offset};
+			return n;
+			}
+
+		/**********************************************************************\
+		|* Decode a frame, appending to a list of readings
+		\**********************************************************************/
+		void decode(quint32 id,
+					const quint8 *data,
+					int length,
+					qint64 at,
+					Readings& out) const;
+
+		/**********************************************************************\
+		|* Time decoding synthetic frames, logging ns per frame and per signal
+		\**********************************************************************/
+		static void benchmark(int frames);
+	};
+
+#endif // CANDECODER_H
@@ -0,0 +1,730 @@
+#include <climits>
+
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+
+#include "compactor.h"
+#include "constants.h"
+
+/******************************************************************************\
+|* Tuning: how often we run, how long and how much work one slice may take,
+|* and how long we rest once there's nothing to do
+\******************************************************************************/
+#define COMPACT_TICK_MS			250
+#define COMPACT_IDLE_MS			60000
+#define COMPACT_SLICE_MS		5
+#define COMPACT_ROWS_PER_TICK	2000
+#define COMPACT_VACUUM_PAGES	64
+
+/******************************************************************************\
+|* Segments are rolled up once they've been finished this long (to give late
+|* readings a chance to arrive), and only merged once they're this old
+\******************************************************************************/
+#define COMPACT_ROLLUP_DELAY_MS	(5 * 60 * 1000LL)
+#define COMPACT_SEAL_MS			(24 * 3600 * 1000LL)
+#define COMPACT_MERGE_ROWS		4096
+
+/******************************************************************************\
+|* How much of a segment is rolled up in one go. A whole number of minutes
+\******************************************************************************/
+#define COMPACT_ROLLUP_SPAN_MS	(10 * 60 * 1000LL)
+
+/******************************************************************************\
+|* Default retention: a week of raw data, a year of minutes, hours forever
+\******************************************************************************/
+#define DAY_MS					(24 * 3600 * 1000LL)
+#define RETAIN_RAW_DAYS			7
+#define RETAIN_MINUTE_DAYS		365
+#define RETAIN_HOUR_DAYS		0
+
+/******************************************************************************\
+|* Categorised logging support
+\******************************************************************************/
+Q_LOGGING_CATEGORY(log_cmp, "reefd:compact")
+
+#define LOG qDebug(log_cmp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define ERR qCritical(log_cmp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+
+/******************************************************************************\
+|* Helper function: The time before which data kept for 'days' has expired,
+|* or LLONG_MIN if it's kept forever
+\******************************************************************************/
+static inline qint64 cutoff(qint64 now, int days)
+	{
+	return (days > 0) ? now - days * DAY_MS : LLONG_MIN;
+	}
+
+/******************************************************************************\
+|* Constructor
+\******************************************************************************/
+Compactor::Compactor(QObject *parent)
+		  :QObject{parent}
+		  ,_rowsDeleted(0)
+		  ,_segmentsMerged(0)
+		  ,_pagesFreed(0)
+		  ,_timer(this)
+		  ,_phase(ROLLUP)
+		  ,_idle(0)
+		  ,_next(-1)
+		  ,_lapStart(-1)
+		  ,_quiet(0)
+		  ,_rolling({-1, 0, 0, 0, 0, 0})
+		  ,_canVacuum(false)
+		  ,_default({RETAIN_RAW_DAYS, RETAIN_MINUTE_DAYS, RETAIN_HOUR_DAYS})
+	{
+	_timer.setInterval(COMPACT_TICK_MS);
+	connect(&_timer, &QTimer::timeout, this, &Compactor::_tick);
+	}
+
+/******************************************************************************\
+|* Start compacting
+\******************************************************************************/
+void Compactor::start(void)
+	{
+	QSqlQuery query;
+	if (query.exec("PRAGMA auto_vacuum") && query.next())
+		_canVacuum = (query.value(0).toInt() == 2);
+	query.finish();
+
+	if (!_canVacuum)
+		LOG << "Database isn't in incremental auto-vacuum mode: free pages"
+			<< "will be reused but not returned";
+
+	_loadPolicies();
+	_timer.start();
+	}
+
+/******************************************************************************\
+|* Stop compacting
+\******************************************************************************/
+void Compactor::stop(void)
+	{
+	_timer.stop();
+	}
+
+/******************************************************************************\
+|* Set the retention policy for an input
+\******************************************************************************/
+void Compactor::setPolicy(qint64 input, Compactor::Policy policy)
+	{
+	QSqlQuery query;
+	query.prepare("INSERT OR REPLACE INTO retention "
+				  "(input, rawDays, minuteDays, hourDays) VALUES (?, ?, ?, ?)");
+	query.bindValue(0, input);
+	query.bindValue(1, policy.rawDays);
+	query.bindValue(2, policy.minuteDays);
+	query.bindValue(3, policy.hourDays);
+	if (!query.exec())
+		{
+		ERR << "Cannot set retention for" << input << ":"
+			<< query.lastError().text();
+		return;
+		}
+
+	if (input == 0)
+		_default = policy;
+	else
+		_policies.insert(input, policy);
+
+	// Policy changes are worth acting on now rather than after a rest
+	_idle = 0;
+	_timer.setInterval(COMPACT_TICK_MS);
+	}
+
+/******************************************************************************\
+|* Roll up everything that's outstanding. Minute rollups come from one pass
+|* over the readings; hour rollups are then built from the minute ones
+\******************************************************************************/
+bool Compactor::rollupAll(void)
+	{
+	QSqlDatabase db = QSqlDatabase::database();
+	QSqlQuery query;
+
+	db.transaction();
+	query.prepare("INSERT OR REPLACE INTO rollups "
+				  "(input, period, at, count, minValue, maxValue, total) "
+				  "SELECT s.input, ?, r.at - (r.at % ?) AS bucket, COUNT(*), "
+				  "MIN(r.value), MAX(r.value), SUM(r.value) "
+				  "FROM segments s JOIN readings r ON r.segment = s.id "
+				  "WHERE s.rolled = 0 GROUP BY s.input, bucket");
+	query.bindValue(0, ROLLUP_MINUTE_MS);
+	query.bindValue(1, ROLLUP_MINUTE_MS);
+	bool ok = query.exec();
+
+	if (ok)
+		{
+		query.prepare("INSERT OR REPLACE INTO rollups "
+					  "(input, period, at, count, minValue, maxValue, total) "
+					  "SELECT m.input, ?, m.at - (m.at % ?) AS bucket, "
+					  "SUM(m.count), MIN(m.minValue), MAX(m.maxValue), "
+					  "SUM(m.total) FROM segments s JOIN rollups m "
+					  "ON m.input = s.input AND m.period = ? "
+					  "AND m.at >= s.startAt AND m.at < s.endAt "
+					  "WHERE s.rolled = 0 GROUP BY m.input, bucket");
+		query.bindValue(0, ROLLUP_HOUR_MS);
+		query.bindValue(1, ROLLUP_HOUR_MS);
+		query.bindValue(2, ROLLUP_MINUTE_MS);
+		ok = query.exec();
+		}
+
+	if (ok)
+		ok = query.exec("UPDATE segments SET rolled = 1 WHERE rolled = 0");
+
+	if (!ok || !db.commit())
+		{
+		ERR << "Cannot build rollups:" << query.lastError().text()
+			<< db.lastError().text();
+		db.rollback();
+		return false;
+		}
+	return true;
+	}
+
+
+#pragma mark - Private methods
+
+/******************************************************************************\
+|* Load the policies. Input 0, if present, overrides the built-in default
+\******************************************************************************/
+void Compactor::_loadPolicies(void)
+	{
+	_policies.clear();
+	_default = {RETAIN_RAW_DAYS, RETAIN_MINUTE_DAYS, RETAIN_HOUR_DAYS};
+
+	QSqlQuery query;
+	query.setForwardOnly(true);
+	if (!query.exec("SELECT input, rawDays, minuteDays, hourDays "
+					"FROM retention"))
+		{
+		ERR << "Cannot load retention policies:" << query.lastError().text();
+		return;
+		}
+
+	while (query.next())
+		{
+		qint64 input	= query.value(0).toLongLong();
+		Policy policy	= {query.value(1).toInt(),
+						   query.value(2).toInt(),
+						   query.value(3).toInt()};
+		if (input == 0)
+			_default = policy;
+		else
+			_policies.insert(input, policy);
+		}
+	}
+
+/******************************************************************************\
+|* Return the policy for an input
+\******************************************************************************/
+Compactor::Policy Compactor::_policy(qint64 input)
+	{
+	return _policies.value(input, _default);
+	}
+
+/******************************************************************************\
+|* Step round the inputs that have segments or summaries stored, in id order.
+|* That's what's in the database rather than what's in the topology, so an
+|* input that's been removed still has its data expired. Callers reset
+|* _quiet when they find work, so this gives up after one full lap without
+\******************************************************************************/
+qint64 Compactor::_nextInput(void)
+	{
+	QSqlQuery query;
+	query.setForwardOnly(true);
+	query.prepare("SELECT MIN(input) FROM ("
+				  "SELECT MIN(input) AS input FROM segments WHERE input > ? "
+				  "UNION ALL "
+				  "SELECT MIN(input) FROM rollups WHERE input > ?)");
+
+	qint64 input = -1;
+	for (qint64 after : {_next, (qint64)-1})
+		{
+		query.bindValue(0, after);
+		query.bindValue(1, after);
+		if (!query.exec())
+			{
+			ERR << "Cannot find the next input:" << query.lastError().text();
+			return -1;
+			}
+		if (query.next() && !query.isNull(0))
+			{
+			input = query.value(0).toLongLong();
+			break;
+			}
+		query.finish();
+		}
+	if (input < 0)
+		return -1;
+
+	if (_quiet == 0)
+		_lapStart = input;
+	else if (input == _lapStart)
+		return -1;
+
+	_quiet ++;
+	_next = input;
+	return input;
+	}
+
+/******************************************************************************\
+|* Roll the oldest finished segment up into minute and hour summaries. The
+|* summaries are rebuilt from every segment overlapping the range, so they
+|* stay correct after merges and if the segment is later rolled up again.
+|* A segment is done COMPACT_ROLLUP_SPAN_MS at a time, each in its own
+|* transaction, carrying on where the last left off on the next call
+\******************************************************************************/
+int Compactor::_rollup(qint64 now)
+	{
+	if (_rolling.segment >= 0)
+		return (_rolling.at < _rolling.endAt) ? _rollupStep() : _rollupFinish();
+
+	QSqlQuery query;
+	query.setForwardOnly(true);
+
+	query.prepare("SELECT id, input, startAt, endAt, rows FROM segments "
+				  "WHERE rolled = 0 AND endAt <= ? ORDER BY endAt LIMIT 1");
+	query.bindValue(0, now - COMPACT_ROLLUP_DELAY_MS);
+	if (!query.exec() || !query.next())
+		return 0;
+
+	_rolling.segment	= query.value(0).toLongLong();
+	_rolling.input		= query.value(1).toLongLong();
+	_rolling.startAt	= query.value(2).toLongLong();
+	_rolling.endAt		= query.value(3).toLongLong();
+	_rolling.rows		= query.value(4).toLongLong();
+	_rolling.at			= _rolling.startAt;
+	query.finish();
+
+	/**************************************************************************\
+	|* A late reading for a period whose raw data has already gone would only
+	|* give a partial summary, so leave the existing one alone
+	\**************************************************************************/
+	if (_rolling.endAt <= cutoff(now, _policy(_rolling.input).rawDays))
+		{
+		qint64 segment		= _rolling.segment;
+		_rolling.segment	= -1;
+
+		query.prepare("UPDATE segments SET rolled = 1 WHERE id = ?");
+		query.bindValue(0, segment);
+		if (!query.exec())
+			{
+			ERR << "Cannot mark segment" << segment << "rolled up:"
+				<< query.lastError().text();
+			return 0;
+			}
+		return 1;
+		}
+
+	return _rollupStep();
+	}
+
+/******************************************************************************\
+|* Rebuild the minute summaries for the next stretch of the segment being
+|* rolled up. Stretches are whole minutes, since segments start on one
+\******************************************************************************/
+int Compactor::_rollupStep(void)
+	{
+	qint64 from	= _rolling.at;
+	qint64 to	= qMin(from + COMPACT_ROLLUP_SPAN_MS, _rolling.endAt);
+
+	QSqlQuery query;
+	query.prepare("INSERT OR REPLACE INTO rollups "
+				  "(input, period, at, count, minValue, maxValue, total) "
+				  "SELECT ?, ?, r.at - (r.at % ?) AS bucket, COUNT(*), "
+				  "MIN(r.value), MAX(r.value), SUM(r.value) "
+				  "FROM segments s JOIN readings r ON r.segment = s.id "
+				  "WHERE s.input = ? AND s.startAt < ? AND s.endAt > ? "
+				  "AND r.at >= ? AND r.at < ? "
+				  "GROUP BY bucket");
+	query.bindValue(0, _rolling.input);
+	query.bindValue(1, ROLLUP_MINUTE_MS);
+	query.bindValue(2, ROLLUP_MINUTE_MS);
+	query.bindValue(3, _rolling.input);
+	query.bindValue(4, to);
+	query.bindValue(5, from);
+	query.bindValue(6, from);
+	query.bindValue(7, to);
+	if (!query.exec())
+		{
+		ERR << "Cannot roll up segment" << _rolling.segment << "from" << from
+			<< ":" << query.lastError().text();
+		_rolling.segment = -1;
+		return 0;
+		}
+
+	_rolling.at = to;
+	return qMax(query.numRowsAffected(), 1);
+	}
+
+/******************************************************************************\
+|* Build the hour summaries from the minute ones and mark the segment rolled
+|* up. If readings have arrived since we started, some of the minutes may
+|* be stale, so start it again instead
+\******************************************************************************/
+int Compactor::_rollupFinish(void)
+	{
+	QSqlDatabase db = QSqlDatabase::database();
+	QSqlQuery query;
+
+	qint64 segment		= _rolling.segment;
+	_rolling.segment	= -1;
+
+	db.transaction();
+	query.prepare("INSERT OR REPLACE INTO rollups "
+				  "(input, period, at, count, minValue, maxValue, total) "
+				  "SELECT ?, ?, at - (at % ?) AS bucket, SUM(count), "
+				  "MIN(minValue), MAX(maxValue), SUM(total) FROM rollups "
+				  "WHERE input = ? AND period = ? AND at >= ? AND at < ? "
+				  "GROUP BY bucket");
+	query.bindValue(0, _rolling.input);
+	query.bindValue(1, ROLLUP_HOUR_MS);
+	query.bindValue(2, ROLLUP_HOUR_MS);
+	query.bindValue(3, _rolling.input);
+	query.bindValue(4, ROLLUP_MINUTE_MS);
+	query.bindValue(5, _rolling.startAt);
+	query.bindValue(6, _rolling.endAt);
+	bool ok = query.exec();
+
+	if (ok)
+		{
+		query.prepare("UPDATE segments SET rolled = 1 "
+					  "WHERE id = ? AND rows = ?");
+		query.bindValue(0, segment);
+		query.bindValue(1, _rolling.rows);
+		ok = query.exec();
+		}
+
+	if (ok && (query.numRowsAffected() == 0))
+		{
+		LOG << "Segment" << segment << "changed while rolling up, restarting";
+		db.rollback();
+		return 1;
+		}
+
+	if (!ok || !db.commit())
+		{
+		ERR << "Cannot roll up segment" << segment << ":"
+			<< query.lastError().text() << db.lastError().text();
+		db.rollback();
+		return 0;
+		}
+	return qMax((int)_rolling.rows, 1);
+	}
+
+/******************************************************************************\
+|* Delete a batch of expired raw readings from the oldest segment of the next
+|* input that has any. Only rolled-up segments are expired
+\******************************************************************************/
+int Compactor::_expireRaw(qint64 now, int budget)
+	{
+	QSqlDatabase db = QSqlDatabase::database();
+	QSqlQuery query;
+	query.setForwardOnly(true);
+
+	for (qint64 input = _nextInput(); input >= 0; input = _nextInput())
+		{
+		query.prepare("SELECT id, startAt, endAt, rolled FROM segments "
+					  "WHERE input = ? ORDER BY startAt LIMIT 1");
+		query.bindValue(0, input);
+		if (!query.exec() || !query.next())
+			continue;
+
+		qint64 segment	= query.value(0).toLongLong();
+		qint64 startAt	= query.value(1).toLongLong();
+		qint64 endAt	= query.value(2).toLongLong();
+		bool rolled		= query.value(3).toBool();
+		query.finish();
+
+		if (!rolled || (endAt > cutoff(now, _policy(input).rawDays)))
+			continue;
+
+		/**********************************************************************\
+		|* Delete up to 'budget' of the oldest rows, and the segment itself
+		|* once it's empty
+		\**********************************************************************/
+		db.transaction();
+		query.prepare("DELETE FROM readings WHERE segment = ? AND at <= "
+					  "COALESCE((SELECT at FROM readings WHERE segment = ? "
+					  "ORDER BY at LIMIT 1 OFFSET ?), ?)");
+		query.bindValue(0, segment);
+		query.bindValue(1, segment);
+		query.bindValue(2, budget - 1);
+		query.bindValue(3, LLONG_MAX);
+		bool ok		= query.exec();
+		int deleted	= ok ? query.numRowsAffected() : 0;
+		bool empty	= ok && (deleted < budget);
+
+		if (ok)
+			{
+			if (empty)
+				query.prepare("DELETE FROM segments WHERE id = ?");
+			else
+				{
+				query.prepare("UPDATE segments SET rows = MAX(rows - ?, 0) "
+							  "WHERE id = ?");
+				query.addBindValue(deleted);
+				}
+			query.addBindValue(segment);
+			ok = query.exec();
+			}
+
+		if (!ok || !db.commit())
+			{
+			ERR << "Cannot expire segment" << segment << ":"
+				<< query.lastError().text() << db.lastError().text();
+			db.rollback();
+			return 0;
+			}
+
+		_rowsDeleted += deleted;
+		_quiet = 0;
+		if (empty)
+			emit segmentDropped(input, startAt);
+		return qMax(deleted, 1);
+		}
+	return 0;
+	}
+
+/******************************************************************************\
+|* Delete a batch of expired minute and hour summaries for the next input
+|* that has any
+\******************************************************************************/
+int Compactor::_expireRollups(qint64 now, int budget)
+	{
+	QSqlDatabase db = QSqlDatabase::database();
+	QSqlQuery query;
+
+	for (qint64 input = _nextInput(); input >= 0; input = _nextInput())
+		{
+		Policy policy = _policy(input);
+		int deleted = 0;
+
+		db.transaction();
+		bool ok = true;
+		for (qint64 period : {ROLLUP_MINUTE_MS, ROLLUP_HOUR_MS})
+			{
+			int days = (period == ROLLUP_MINUTE_MS) ? policy.minuteDays
+													: policy.hourDays;
+			if (days <= 0)
+				continue;
+
+			qint64 before = cutoff(now, days);
+			query.prepare("DELETE FROM rollups WHERE input = ? AND period = ? "
+						  "AND at < MIN(?, COALESCE((SELECT at FROM rollups "
+						  "WHERE input = ? AND period = ? "
+						  "ORDER BY at LIMIT 1 OFFSET ?), ?))");
+			query.bindValue(0, input);
+			query.bindValue(1, period);
+			query.bindValue(2, before);
+			query.bindValue(3, input);
+			query.bindValue(4, period);
+			query.bindValue(5, budget);
+			query.bindValue(6, before);
+			if (!(ok = query.exec()))
+				break;
+			deleted += query.numRowsAffected();
+			}
+
+		if (!ok || !db.commit())
+			{
+			ERR << "Cannot expire rollups for input" << input << ":"
+				<< query.lastError().text() << db.lastError().text();
+			db.rollback();
+			return 0;
+			}
+
+		if (deleted > 0)
+			{
+			_rowsDeleted += deleted;
+			_quiet = 0;
+			return deleted;
+			}
+		}
+	return 0;
+	}
+
+/******************************************************************************\
+|* Merge a pair of adjacent, sealed, rolled-up segments for the next input
+|* that has any, when they're small enough together
+\******************************************************************************/
+int Compactor::_merge(qint64 now)
+	{
+	QSqlDatabase db = QSqlDatabase::database();
+	QSqlQuery query;
+	query.setForwardOnly(true);
+
+	for (qint64 input = _nextInput(); input >= 0; input = _nextInput())
+		{
+		query.prepare("SELECT a.id, b.id, b.startAt, b.endAt, b.rows, "
+					  "b.minValue, b.maxValue FROM segments a "
+					  "JOIN segments b ON b.input = a.input "
+					  "AND b.startAt = a.endAt "
+					  "WHERE a.input = ? AND a.rolled = 1 AND b.rolled = 1 "
+					  "AND b.endAt <= ? AND a.rows + b.rows < ? "
+					  "ORDER BY a.startAt LIMIT 1");
+		query.bindValue(0, input);
+		query.bindValue(1, now - COMPACT_SEAL_MS);
+		query.bindValue(2, COMPACT_MERGE_ROWS);
+		if (!query.exec() || !query.next())
+			continue;
+
+		qint64 into		= query.value(0).toLongLong();
+		qint64 from		= query.value(1).toLongLong();
+		qint64 startAt	= query.value(2).toLongLong();
+		qint64 endAt	= query.value(3).toLongLong();
+		int rows		= query.value(4).toInt();
+		QVariant min	= query.value(5);
+		QVariant max	= query.value(6);
+		query.finish();
+
+		/**********************************************************************\
+		|* Move the later segment's rows into the earlier one and extend it
+		\**********************************************************************/
+		db.transaction();
+		query.prepare("UPDATE readings SET segment = ? WHERE segment = ?");
+		query.bindValue(0, into);
+		query.bindValue(1, from);
+		bool ok = query.exec();
+
+		if (ok)
+			{
+			query.prepare("UPDATE segments SET endAt = ?, rows = rows + ?, "
+						  "minValue = MIN(COALESCE(minValue, ?), "
+						  "COALESCE(?, minValue)), "
+						  "maxValue = MAX(COALESCE(maxValue, ?), "
+						  "COALESCE(?, maxValue)) WHERE id = ?");
+			query.bindValue(0, endAt);
+			query.bindValue(1, rows);
+			query.bindValue(2, min);
+			query.bindValue(3, min);
+			query.bindValue(4, max);
+			query.bindValue(5, max);
+			query.bindValue(6, into);
+			ok = query.exec();
+			}
+
+		if (ok)
+			{
+			query.prepare("DELETE FROM segments WHERE id = ?");
+			query.bindValue(0, from);
+			ok = query.exec();
+			}
+
+		if (!ok || !db.commit())
+			{
+			ERR << "Cannot merge segment" << from << "into" << into << ":"
+				<< query.lastError().text() << db.lastError().text();
+			db.rollback();
+			return 0;
+			}
+
+		_segmentsMerged ++;
+		_quiet = 0;
+		emit segmentDropped(input, startAt);
+		return qMax(rows, 1);
+		}
+	return 0;
+	}
+
+/******************************************************************************\
+|* Return a few free pages to the filesystem. SQLite frees one page per step
+|* of incremental_vacuum, so the statement has to be stepped to the end
+\******************************************************************************/
+int Compactor::_vacuum(void)
+	{
+	if (!_canVacuum)
+		return 0;
+
+	QSqlQuery query;
+	int before = 0;
+	if (query.exec("PRAGMA freelist_count") && query.next())
+		before = query.value(0).toInt();
+	query.finish();
+	if (before == 0)
+		return 0;
+
+	if (!query.exec(QString("PRAGMA incremental_vacuum(%1)")
+					.arg(COMPACT_VACUUM_PAGES)))
+		{
+		ERR << "Cannot vacuum:" << query.lastError().text();
+		return 0;
+		}
+	while (query.next())
+		;
+	query.finish();
+
+	int after = before;
+	if (query.exec("PRAGMA freelist_count") && query.next())
+		after = query.value(0).toInt();
+	query.finish();
+
+	_pagesFreed += before - after;
+	return before - after;
+	}
+
+
+#pragma mark - Private slots
+
+/******************************************************************************\
+|* Do one slice: keep going through the phases until we've used up the time
+|* or row budget, or every phase has come up empty, in which case rest
+\******************************************************************************/
+void Compactor::_tick(void)
+	{
+	QElapsedTimer slice;
+	slice.start();
+
+	qint64 now	= QDateTime::currentMSecsSinceEpoch();
+	int budget	= COMPACT_ROWS_PER_TICK;
+
+	while ((budget > 0) && (slice.elapsed() < COMPACT_SLICE_MS))
+		{
+		int done = 0;
+		switch (_phase)
+			{
+			case ROLLUP:
+				done = _rollup(now);
+				break;
+			case EXPIRE_RAW:
+				done = _expireRaw(now, budget);
+				break;
+			case EXPIRE_ROLLUPS:
+				done = _expireRollups(now, budget);
+				break;
+			case MERGE:
+				done = _merge(now);
+				break;
+			case VACUUM:
+				done = _vacuum();
+				break;
+			}
+
+		if (done > 0)
+			{
+			budget -= done;
+			_idle	= 0;
+			continue;
+			}
+
+		/**********************************************************************\
+		|* Nothing left in this phase, move on to the next
+		\**********************************************************************/
+		_quiet = 0;
+		_phase = (_phase + 1) % PHASES;
+		if (_phase == ROLLUP)
+			_loadPolicies();
+		if (++_idle >= PHASES)
+			break;
+		}
+
+	if (_idle >= PHASES)
+		{
+		_idle = 0;
+		_timer.setInterval(COMPACT_IDLE_MS);
+		}
+	else
+		_timer.setInterval(COMPACT_TICK_MS);
+	}
@@ -0,0 +1,164 @@
+#ifndef COMPACTOR_H
+#define COMPACTOR_H
+
+#include <QHash>
+#include <QObject>
+#include <QTimer>
+
+#include "properties.h"
+
+/******************************************************************************\
+|* Rollup periods, as stored in the 'period' column of the rollups table
+\******************************************************************************/
+#define ROLLUP_MINUTE_MS		(60 * 1000LL)
+#define ROLLUP_HOUR_MS			(3600 * 1000LL)
+
+/******************************************************************************\
+|* Background retention and compaction for the readings store. On each tick
+|* it does a small, time-boxed slice of work, cycling through:
+|*
+|*   - rolling up finished segments into minute and hour summaries
+|*   - deleting raw readings past each input's retention, in batches
+|*   - deleting minute/hour summaries past their retention
+|*   - merging adjacent small segments
+|*   - returning free pages to the filesystem (incremental vacuum)
+|*
+|* It shares DbMgr's thread and connection, so keeping each slice short is
+|* what keeps it out of request latency
+\******************************************************************************/
+class Compactor : public QObject
+	{
+	Q_OBJECT
+
+	public:
+		/**********************************************************************\
+		|* Typedefs and enums
+		\**********************************************************************/
+		struct Policy
+			{
+			int			rawDays;		// Raw readings (0 = forever)
+			int			minuteDays;		// Minute rollups (0 = forever)
+			int			hourDays;		// Hour rollups (0 = forever)
+			};
+
+		enum Phase
+			{
+			ROLLUP = 0,
+			EXPIRE_RAW,
+			EXPIRE_ROLLUPS,
+			MERGE,
+			VACUUM,
+			PHASES
+			};
+
+	/**************************************************************************\
+	|* Properties
+	\**************************************************************************/
+	GET(qint64, rowsDeleted);			// Raw + rollup rows deleted
+	GET(qint64, segmentsMerged);		// Segment merges done
+	GET(qint64, pagesFreed);			// Pages returned by vacuum
+
+	private:
+		/**********************************************************************\
+		|* A segment part-way through being rolled up
+		\**********************************************************************/
+		struct Rolling
+			{
+			qint64		segment;		// segments.id, -1 for none
+			qint64		input;			// segments.input
+			qint64		startAt;		// segments.startAt
+			qint64		endAt;			// segments.endAt
+			qint64		rows;			// segments.rows when we began
+			qint64		at;				// Rolled up to here so far
+			};
+
+		/**********************************************************************\
+		|* Private variables
+		\**********************************************************************/
+		QTimer					_timer;			// Drives the slices
+		int						_phase;			// Current phase
+		int						_idle;			// Phases in a row with no work
+		qint64					_next;			// Last input looked at
+		qint64					_lapStart;		// First input of a quiet lap
+		int						_quiet;			// Inputs in a row with no work
+		Rolling					_rolling;		// Rollup in progress
+		bool					_canVacuum;		// auto_vacuum is incremental
+		QHash<qint64, Policy>	_policies;		// Per-input overrides
+		Policy					_default;		// For everything else
+
+		/**********************************************************************\
+		|* Load the policies from the retention table
+		\**********************************************************************/
+		void _loadPolicies(void);
+
+		/**********************************************************************\
+		|* Return the policy for an input
+		\**********************************************************************/
+		Policy _policy(qint64 input);
+
+		/**********************************************************************\
+		|* Return the next input id to look at, cycling through the inputs that
+		|* have anything stored, or -1 once we've been round them all without
+		|* finding any work
+		\**********************************************************************/
+		qint64 _nextInput(void);
+
+		/**********************************************************************\
+		|* Work for each phase. Each does one transaction's worth, and returns
+		|* the number of rows (or pages) it touched, or 0 if there was nothing
+		\**********************************************************************/
+		int _rollup(qint64 now);
+		int _expireRaw(qint64 now, int budget);
+		int _expireRollups(qint64 now, int budget);
+		int _merge(qint64 now);
+		int _vacuum(void);
+
+		/**********************************************************************\
+		|* Rollup helpers: summarise the next stretch of the segment in
+		|* _rolling, and once it's all done, build its hours and mark it
+		\**********************************************************************/
+		int _rollupStep(void);
+		int _rollupFinish(void);
+
+	private slots:
+		/**********************************************************************\
+		|* Do one slice of work
+		\**********************************************************************/
+		void _tick(void);
+
+	public:
+		/**********************************************************************\
+		|* Constructor
+		\**********************************************************************/
+		explicit Compactor(QObject *parent = nullptr);
+
+		/**********************************************************************\
+		|* Roll up every segment that needs it in one pass over the readings,
+		|* in one transaction. For use after a bulk load
+		\**********************************************************************/
+		bool rollupAll(void);
+
+	public slots:
+		/**********************************************************************\
+		|* Load the policies and start working
+		\**********************************************************************/
+		void start(void);
+
+		/**********************************************************************\
+		|* Stop working
+		\**********************************************************************/
+		void stop(void);
+
+		/**********************************************************************\
+		|* Set the retention policy for an input. Input 0 sets the default
+		\**********************************************************************/
+		void setPolicy(qint64 input, Compactor::Policy policy);
+
+	signals:
+		/**********************************************************************\
+		|* A segment row has been deleted (expired or merged away)
+		\**********************************************************************/
+		void segmentDropped(qint64 input, qint64 startAt);
+	};
+
+#endif // COMPACTOR_H
@@ -28,6 +28,10 @@
 #define NETWORK_GROUP			"network"
 #define NETWORK_PORT_KEY		"network-port"
 #define NETWORK_PORT_DFLT		"5417"
+#define NETWORK_EXPORT_KEY		"export-port"
+#define NETWORK_EXPORT_DFLT		"5418"
+#define NETWORK_CAN_KEY			"can-interface"
+#define NETWORK_CAN_DFLT		"can0"
 
 #define DECODE(x,k,dflt) (x.value(k,dflt).toString())
 
@@ -62,6 +66,46 @@ Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
 						   "Network socket port number",
 						   NETWORK_PORT_DFLT))
 
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+						  _exportPort,
+						  ({"e", NETWORK_EXPORT_KEY},
+						   "HTTP export port number (0 to disable)",
+						   NETWORK_EXPORT_DFLT))
+
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+						  _canInterface,
+						  ({"c", NETWORK_CAN_KEY},
+						   "CAN interface (eg: can0), or the spy's serial "
+						   "device (eg: /dev/ttyACM0). Empty to disable",
+						   NETWORK_CAN_DFLT))
+
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+						  _import,
+						  ({"import"},
+						   "Import historical readings from a CSV, NDJSON or "
+						   "candump file, then exit. May be repeated",
+						   "file"))
+
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+						  _benchDecode,
+						  ({"bench-decode"},
+						   "Time the CAN signal decoder on synthetic frames, "
+						   "then exit",
+						   "frames"))
+
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+						  _benchSysInfo,
+						  ({"bench-sysinfo"},
+						   "Time SysInfo requests against a synthetic "
+						   "topology, then exit",
+						   "requests"))
+
+Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
+						  _checkPlans,
+						  ({"check-plans"},
+						   "Check the database's hot lookups are answered "
+						   "from an index, then exit non-zero if not"))
+
 Q_GLOBAL_STATIC_WITH_ARGS(const QCommandLineOption,
 						  _version,
 						  ({"v", "version"},
@@ -73,8 +117,14 @@ Config::Config()
 	|* Configure the parser
 	\**************************************************************************/
 	_parser.setApplicationDescription("Mail daemon");
+	_parser.addOption(*_benchDecode);
+	_parser.addOption(*_benchSysInfo);
+	_parser.addOption(*_canInterface);
+	_parser.addOption(*_checkPlans);
 	_parser.addOption(*_dataDir);
+	_parser.addOption(*_exportPort);
 	_parser.addOption(*_help);
+	_parser.addOption(*_import);
 	_parser.addOption(*_reInit);
 	_parser.addOption(*_networkPort);
 	_parser.addOption(*_version);
@@ -142,6 +192,76 @@ int Config::networkPort(void)
 	return port.toInt();
 	}
 
+/******************************************************************************\
+|* Get the port number to serve HTTP exports on
+\******************************************************************************/
+int Config::exportPort(void)
+	{
+	if (_parser.isSet(*_exportPort))
+		return _parser.value(*_exportPort).toInt();
+
+	QSettings s;
+	s.beginGroup(NETWORK_GROUP);
+	QString port = DECODE(s, NETWORK_EXPORT_KEY, NETWORK_EXPORT_DFLT);
+	s.endGroup();
+	return port.toInt();
+	}
+
+/******************************************************************************\
+|* Get the CAN interface to use
+\******************************************************************************/
+QString Config::canInterface(void)
+	{
+	if (_parser.isSet(*_canInterface))
+		return _parser.value(*_canInterface);
+
+	QSettings s;
+	s.beginGroup(NETWORK_GROUP);
+	QString interface = DECODE(s, NETWORK_CAN_KEY, NETWORK_CAN_DFLT);
+	s.endGroup();
+	return interface;
+	}
+
+/******************************************************************************\
+|* Get the files to bulk-import, if any
+\******************************************************************************/
+QStringList Config::importFiles(void)
+	{
+	return _parser.values(*_import);
+	}
+
+/******************************************************************************\
+|* Get the number of frames to benchmark the decoder with, 0 for none
+\******************************************************************************/
+int Config::benchDecode(void)
+	{
+	return _parser.value(*_benchDecode).toInt();
+	}
+
+/******************************************************************************\
+|* Get the number of SysInfo requests to benchmark, 0 for none
+\******************************************************************************/
+int Config::benchSysInfo(void)
+	{
+	return _parser.value(*_benchSysInfo).toInt();
+	}
+
+/******************************************************************************\
+|* Get whether to check the query plans and stop
+\******************************************************************************/
+bool Config::checkPlans(void)
+	{
+	return _parser.isSet(*_checkPlans);
+	}
+
+/******************************************************************************\
+|* Get the file CAN signal definitions are loaded from
+\******************************************************************************/
+QString Config::signalsFile(void)
+	{
+	return databaseDir() + "/signals.json";
+	}
+
 /******************************************************************************\
 |* Determine if we should reset to factory defaults
 \******************************************************************************/
@@ -36,6 +36,41 @@ class Config : public Singleton<Config>
 	\**********************************************************************/
 	int cacheSize(void);
 
+	/**********************************************************************\
+	|* Return the port to serve HTTP exports on, or 0 for none
+	\**********************************************************************/
+	int exportPort(void);
+
+	/**********************************************************************\
+	|* Return the CAN interface nodes are on, or empty for none
+	\**********************************************************************/
+	QString canInterface(void);
+
+	/**********************************************************************\
+	|* Return the files to bulk-import (--import), empty for normal running
+	\**********************************************************************/
+	QStringList importFiles(void);
+
+	/**********************************************************************\
+	|* Return the number of frames for --bench-decode, 0 for normal running
+	\**********************************************************************/
+	int benchDecode(void);
+
+	/**********************************************************************\
+	|* Return the number of requests for --bench-sysinfo, 0 for normal running
+	\**********************************************************************/
+	int benchSysInfo(void);
+
+	/**********************************************************************\
+	|* Return whether to check query plans (--check-plans) and exit
+	\**********************************************************************/
+	bool checkPlans(void);
+
+	/**********************************************************************\
+	|* Return the file holding the CAN signal definitions
+	\**********************************************************************/
+	QString signalsFile(void);
+
 	/**********************************************************************\
 	|* Set if we want a clean start, deletes everything
 	\**********************************************************************/
@@ -1,17 +1,33 @@
+#include <QDateTime>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
+#include <QThread>
 #include <QWebSocket>
+#include <QSqlError>
 #include <QSqlQuery>
 
 #include "QtCore/qfile.h"
 #include "config.h"
 #include "constants.h"
 #include "dmbgr.h"
+#include "journal.h"
+#include "sqlscript.h"
 
 #define REEF_DB_ID		"mail"
 
+/******************************************************************************\
+|* Readings are stored in segments covering this much time per input
+\******************************************************************************/
+#define SEGMENT_SPAN_MS		(3600 * 1000LL)
+
+/******************************************************************************\
+|* How long to wait before retrying a journal batch that failed to apply
+\******************************************************************************/
+#define JOURNAL_RETRY_MS	1000
+
 /******************************************************************************\
 |* Categorised logging support
 \******************************************************************************/
@@ -20,12 +36,137 @@ Q_LOGGING_CATEGORY(log_db, "reefd:db")
 #define LOG qDebug(log_db) << QTime::currentTime().toString("hh:mm:ss.zzz")
 #define ERR qCritical(log_db) << QTime::currentTime().toString("hh:mm:ss.zzz")
 
+/******************************************************************************\
+|* The topology is read as one statement: every row carries its section
+|* (0=modules, 1=inputs, 2=outputs) so it can be loaded in a single pass
+\******************************************************************************/
+#define SQL_SYSINFO		"SELECT 0 AS kind, id, name, nodeId, driver, render "	\
+						"FROM modules "											\
+						"UNION ALL "											\
+						"SELECT 1, id, name, module, driver, render "			\
+						"FROM inputs "											\
+						"UNION ALL "											\
+						"SELECT 2, id, name, module, driver, render "			\
+						"FROM outputs "											\
+						"ORDER BY kind, name"
+
+/******************************************************************************\
+|* The segment a reading goes in, looked up for every reading stored. It must
+|* be answered from an index (see checkQueryPlans)
+\******************************************************************************/
+#define SQL_SEGMENT_FOR			"SELECT id FROM segments "						\
+								"WHERE input = ? AND startAt = ?"
+
+/******************************************************************************\
+|* Helper function: Append a JSON-escaped string to the output, or null for a
+|* null string (a NULL column)
+\******************************************************************************/
+static void jsonString(QByteArray& out, const QString& value)
+	{
+	if (value.isNull())
+		{
+		out.append("null");
+		return;
+		}
+
+	const QByteArray utf8 = value.toUtf8();
+
+	out.append('"');
+	for (char c : utf8)
+		switch (c)
+			{
+			case '"':
+				out.append("\\\"");
+				break;
+			case '\\':
+				out.append("\\\\");
+				break;
+			case '\b':
+				out.append("\\b");
+				break;
+			case '\f':
+				out.append("\\f");
+				break;
+			case '\n':
+				out.append("\\n");
+				break;
+			case '\r':
+				out.append("\\r");
+				break;
+			case '\t':
+				out.append("\\t");
+				break;
+			default:
+				if (static_cast<uint8_t>(c) < 0x20)
+					{
+					char esc[8];
+					snprintf(esc, sizeof(esc), "\\u%04x", c);
+					out.append(esc);
+					}
+				else
+					out.append(c);
+				break;
+			}
+	out.append('"');
+	}
+
+/******************************************************************************\
+|* Helper function: Append an indented "key": prefix to the output. The
+|* layout is QJsonDocument's indented one, four spaces a level
+\******************************************************************************/
+static inline void jsonKey(QByteArray& out, int depth, const char *key)
+	{
+	out.append(4 * depth, ' ').append('"').append(key).append("\": ");
+	}
+
+/******************************************************************************\
+|* Helper function: Append a list of inputs or outputs, keys sorted as a
+|* QJsonObject keeps them
+\******************************************************************************/
+static void jsonChannels(QByteArray& out,
+						 const char *key,
+						 const QVector<Topology::Channel>& channels)
+	{
+	jsonKey(out, 1, key);
+	out.append("[\n");
+	for (int i=0; i<channels.size(); i++)
+		{
+		const Topology::Channel& channel = channels[i];
+		if (i > 0)
+			out.append(",\n");
+		out.append(8, ' ').append("{\n");
+		jsonKey(out, 3, "driver");
+		jsonString(out, channel.driver);
+		out.append(",\n");
+		jsonKey(out, 3, "id");
+		out.append(QByteArray::number(channel.id)).append(",\n");
+		jsonKey(out, 3, "module");
+		out.append(QByteArray::number(channel.module)).append(",\n");
+		jsonKey(out, 3, "name");
+		jsonString(out, channel.name);
+		out.append(",\n");
+		jsonKey(out, 3, "renderer");
+		jsonString(out, channel.render);
+		out.append('\n').append(8, ' ').append('}');
+		}
+	if (!channels.isEmpty())
+		out.append('\n');
+	out.append(4, ' ').append(']');
+	}
+
 /******************************************************************************\
 |* Constructor
 \******************************************************************************/
 DbMgr::DbMgr(QObject *parent)
 	  :QObject{parent}
+	  ,_sysInfoVersion(0)
+	  ,_synchronous(-1)
+	  ,_retry(this)
 	{
+	qRegisterMetaType<Topology::Module>();
+	qRegisterMetaType<Topology::Channel>();
+	qRegisterMetaType<Readings>("Readings");
+
 	QString dbFile = Config::instance().databaseDir() + "/reef.db";
 
 	/**************************************************************************\
@@ -47,7 +188,26 @@ DbMgr::DbMgr(QObject *parent)
 	_dbOk = db.open();
 
 	if (_dbOk)
+		{
+		/**********************************************************************\
+		|* auto_vacuum only takes effect on a new database, before any tables
+		|* exist. It lets the compactor hand free pages back a few at a time.
+		|* WAL lets the history readers run alongside our writes
+		\**********************************************************************/
+		QSqlQuery pragma;
+		pragma.exec("PRAGMA auto_vacuum = INCREMENTAL");
+		pragma.exec("PRAGMA journal_mode = WAL");
+		pragma.finish();
+
+		connect(&_compactor, &Compactor::segmentDropped,
+				this, &DbMgr::_forgetSegment);
+
+		_retry.setSingleShot(true);
+		_retry.setInterval(JOURNAL_RETRY_MS);
+		connect(&_retry, &QTimer::timeout, this, &DbMgr::_applyUnapplied);
 		_upgradeDb();
+		_loadTopology();
+		}
 	}
 
 
@@ -56,11 +216,44 @@ DbMgr::DbMgr(QObject *parent)
 \******************************************************************************/
 DbMgr::~DbMgr(void)
 	{
+	qDeleteAll(_statements);
+	_statements.clear();
 	QSqlDatabase::database().close();
 	}
 
 #pragma mark - private methods
 
+/******************************************************************************\
+|* Private method - return the cached prepared statement for this SQL, or
+|*                  prepare and cache it if this is the first time it's used
+\******************************************************************************/
+QSqlQuery * DbMgr::_prepare(const QString& sql)
+	{
+	QSqlQuery *query = _statements.value(sql, nullptr);
+	if (query == nullptr)
+		{
+		query = new QSqlQuery(QSqlDatabase::database());
+		query->setForwardOnly(true);
+		if (!query->prepare(sql))
+			ERR << "Cannot prepare" << sql << ":" << query->lastError().text();
+		_statements.insert(sql, query);
+		}
+	return query;
+	}
+
+/******************************************************************************\
+|* Private method - run a cached statement that returns no rows
+\******************************************************************************/
+bool DbMgr::_exec(const QString& sql)
+	{
+	QSqlQuery *query = _prepare(sql);
+	bool ok = query->exec();
+	if (!ok)
+		ERR << "Cannot run" << sql << ":" << query->lastError().text();
+	query->finish();
+	return ok;
+	}
+
 /******************************************************************************\
 |* Private method - create the tables in the DB if this is a virgin system and
 |*                  upgrade the database if needed
@@ -70,28 +263,365 @@ void DbMgr::_upgradeDb(void)
 	/**************************************************************************\
 	|* Read the schema version, and see if we need to update it
 	\**************************************************************************/
+	int version = 0;
 	QSqlQuery query;
 	if (query.exec("SELECT version FROM system") == false)
 		{
 		_createInitialSchema();
+		version = 1;
 		}
-	else
+	else if (query.next())
+		version = query.value(0).toInt();
+	query.finish();
+
+	/**************************************************************************\
+	|* Apply each step in turn from the current version onwards. Heavy steps
+	|* carry on in the background once we're up and serving
+	\**************************************************************************/
+	_migrator.add({2, "Index module-scoped lookups",
+				   [this](QSqlDatabase db) { return _upgradeToV2(db); },
+				   nullptr, nullptr, nullptr});
+	_migrator.add({3, "Create the readings store",
+				   [this](QSqlDatabase db) { return _upgradeToV3(db); },
+				   nullptr, nullptr, nullptr});
+	_migrator.add({4, "Add retention policies and rollups",
+				   [this](QSqlDatabase db) { return _upgradeToV4(db); },
+				   [this](QSqlDatabase db, qint64& cursor, int limit)
+						{ return _backfillV4(db, cursor, limit); },
+				   [this](QSqlDatabase db) { return _backfillV4Rows(db); },
+				   nullptr});
+
+	connect(&_migrator, &Migrator::finished, this, &DbMgr::checkQueryPlans);
+	connect(&_migrator, &Migrator::finished, &_compactor, &Compactor::start);
+	_migrator.start(version);
+	}
+
+/******************************************************************************\
+|* Private method - schema v2: secondary indexes for module-scoped lookups
+\******************************************************************************/
+bool DbMgr::_upgradeToV2(QSqlDatabase db)
+	{
+	QSqlQuery query(db);
+
+	if (!query.exec("CREATE INDEX IF NOT EXISTS inputs_module "
+					"ON inputs (module)")
+	 || !query.exec("CREATE INDEX IF NOT EXISTS outputs_module "
+					"ON outputs (module)")
+	 || !query.exec("CREATE INDEX IF NOT EXISTS modules_nodeId "
+					"ON modules (nodeId)"))
+		{
+		ERR << "Cannot create v2 indexes:" << query.lastError().text();
+		return false;
+		}
+	return true;
+	}
+
+/******************************************************************************\
+|* Private method - schema v3: the readings store. Readings are grouped into
+|*                  per-input time segments, each of which tracks its row
+|*                  count and value range. The journal table records how far
+|*                  into the write-ahead journal we've applied
+\******************************************************************************/
+bool DbMgr::_upgradeToV3(QSqlDatabase db)
+	{
+	QSqlQuery query(db);
+
+	if (!query.exec("CREATE TABLE IF NOT EXISTS segments\n"
+					"(\n"
+					"id       INTEGER PRIMARY KEY,\n"
+					"input    INTEGER NOT NULL,\n"
+					"startAt  INTEGER NOT NULL,\n"
+					"endAt    INTEGER NOT NULL,\n"
+					"rows     INTEGER NOT NULL DEFAULT 0,\n"
+					"minValue REAL,\n"
+					"maxValue REAL,\n"
+					"UNIQUE (input, startAt)\n"
+					")\n")
+	 || !query.exec("CREATE TABLE IF NOT EXISTS readings\n"
+					"(\n"
+					"segment  INTEGER NOT NULL,\n"
+					"at       INTEGER NOT NULL,\n"
+					"value    REAL NOT NULL,\n"
+					"PRIMARY KEY (segment, at)\n"
+					") WITHOUT ROWID\n")
+	 || !query.exec("CREATE TABLE IF NOT EXISTS journal\n"
+					"(\n"
+					"generation INTEGER NOT NULL DEFAULT 0,\n"
+					"applied    INTEGER NOT NULL DEFAULT 0\n"
+					")\n")
+	 || !query.exec("INSERT INTO journal (generation, applied) VALUES (0, 0)"))
+		{
+		ERR << "Cannot create readings store:" << query.lastError().text();
+		return false;
+		}
+	return true;
+	}
+
+/******************************************************************************\
+|* Private method - schema v4: retention. Per-input retention policies (input
+|*                  0 is the default), minute and hour rollups of readings,
+|*                  and a flag on each segment saying whether its readings
+|*                  are reflected in the rollups yet
+\******************************************************************************/
+bool DbMgr::_upgradeToV4(QSqlDatabase db)
+	{
+	QSqlQuery query(db);
+
+	if (!query.exec("CREATE TABLE IF NOT EXISTS retention\n"
+					"(\n"
+					"input      INTEGER PRIMARY KEY,\n"
+					"rawDays    INTEGER NOT NULL,\n"
+					"minuteDays INTEGER NOT NULL,\n"
+					"hourDays   INTEGER NOT NULL\n"
+					")\n")
+	 || !query.exec("CREATE TABLE IF NOT EXISTS rollups\n"
+					"(\n"
+					"input    INTEGER NOT NULL,\n"
+					"period   INTEGER NOT NULL,\n"
+					"at       INTEGER NOT NULL,\n"
+					"count    INTEGER NOT NULL,\n"
+					"minValue REAL NOT NULL,\n"
+					"maxValue REAL NOT NULL,\n"
+					"total    REAL NOT NULL,\n"
+					"PRIMARY KEY (input, period, at)\n"
+					") WITHOUT ROWID\n")
+	 || !query.exec("ALTER TABLE segments "
+					"ADD COLUMN rolled INTEGER NOT NULL DEFAULT 0")
+	 || !query.exec("CREATE INDEX IF NOT EXISTS segments_rolled "
+					"ON segments (rolled, endAt)"))
+		{
+		ERR << "Cannot create retention tables:" << query.lastError().text();
+		return false;
+		}
+	return true;
+	}
+
+/******************************************************************************\
+|* Private method - v4 backfill: roll up the next few finished segments after
+|*                  'cursor' (by id) into minute and hour summaries, as the
+|*                  compactor would, stopping once about 'limit' readings have
+|*                  been summarised. Segments still filling are left to the
+|*                  compactor, as are any that get late readings afterwards
+|*                  (which clears 'rolled' again)
+\******************************************************************************/
+int DbMgr::_backfillV4(QSqlDatabase db, qint64& cursor, int limit)
+	{
+	struct Segment
+		{
+		qint64 id, input, startAt, endAt, rows;
+		};
+	QVector<Segment> batch;
+
+	/**************************************************************************\
+	|* Pick the segments first: marking them rolled changes the index the
+	|* search walks
+	\**************************************************************************/
+	QSqlQuery query(db);
+	query.setForwardOnly(true);
+	query.prepare("SELECT id, input, startAt, endAt, rows FROM segments "
+				  "WHERE id > ? AND rolled = 0 AND endAt <= ? "
+				  "ORDER BY id LIMIT ?");
+	query.bindValue(0, cursor);
+	query.bindValue(1, QDateTime::currentMSecsSinceEpoch());
+	query.bindValue(2, limit);
+	if (!query.exec())
+		{
+		ERR << "Cannot find segments to roll up:" << query.lastError().text();
+		return -1;
+		}
+
+	qint64 rows = 0;
+	while ((rows < limit) && query.next())
+		{
+		batch.append({query.value(0).toLongLong(), query.value(1).toLongLong(),
+					  query.value(2).toLongLong(), query.value(3).toLongLong(),
+					  query.value(4).toLongLong()});
+		rows += qMax(batch.last().rows, 1LL);
+		}
+	query.finish();
+
+	/**************************************************************************\
+	|* Minutes from the readings, hours from the minutes, then mark it done
+	\**************************************************************************/
+	for (const Segment& segment : std::as_const(batch))
+		{
+		query.prepare("INSERT OR REPLACE INTO rollups "
+					  "(input, period, at, count, minValue, maxValue, total) "
+					  "SELECT ?, ?, at - (at % ?) AS bucket, COUNT(*), "
+					  "MIN(value), MAX(value), SUM(value) FROM readings "
+					  "WHERE segment = ? GROUP BY bucket");
+		query.bindValue(0, segment.input);
+		query.bindValue(1, ROLLUP_MINUTE_MS);
+		query.bindValue(2, ROLLUP_MINUTE_MS);
+		query.bindValue(3, segment.id);
+		bool ok = query.exec();
+
+		if (ok)
+			{
+			query.prepare("INSERT OR REPLACE INTO rollups "
+						  "(input, period, at, count, minValue, maxValue, "
+						  "total) SELECT ?, ?, at - (at % ?) AS bucket, "
+						  "SUM(count), MIN(minValue), MAX(maxValue), "
+						  "SUM(total) FROM rollups WHERE input = ? "
+						  "AND period = ? AND at >= ? AND at < ? "
+						  "GROUP BY bucket");
+			query.bindValue(0, segment.input);
+			query.bindValue(1, ROLLUP_HOUR_MS);
+			query.bindValue(2, ROLLUP_HOUR_MS);
+			query.bindValue(3, segment.input);
+			query.bindValue(4, ROLLUP_MINUTE_MS);
+			query.bindValue(5, segment.startAt);
+			query.bindValue(6, segment.endAt);
+			ok = query.exec();
+			}
+
+		if (ok)
+			{
+			query.prepare("UPDATE segments SET rolled = 1 WHERE id = ?");
+			query.bindValue(0, segment.id);
+			ok = query.exec();
+			}
+
+		if (!ok)
+			{
+			ERR << "Cannot roll up segment" << segment.id << ":"
+				<< query.lastError().text();
+			return -1;
+			}
+		cursor = segment.id;
+		}
+	return (int)rows;
+	}
+
+/******************************************************************************\
+|* Private method - v4 backfill: how many readings there are to roll up
+\******************************************************************************/
+qint64 DbMgr::_backfillV4Rows(QSqlDatabase db)
+	{
+	QSqlQuery query(db);
+	if (!query.exec("SELECT COALESCE(SUM(rows), 0) FROM segments") || !query.next())
+		return -1;
+	return query.value(0).toLongLong();
+	}
+
+/******************************************************************************\
+|* Private method - find (or create) the segment a reading belongs in.
+|*                  Segments are fixed time buckets, so replaying the same
+|*                  reading always lands it in the same place
+\******************************************************************************/
+qint64 DbMgr::_segmentFor(qint64 input, qint64 at)
+	{
+	qint64 startAt = at - (((at % SEGMENT_SPAN_MS) + SEGMENT_SPAN_MS)
+						   % SEGMENT_SPAN_MS);
+	QPair<qint64, qint64> key(input, startAt);
+
+	qint64 segment = _segments.value(key, -1);
+	if (segment >= 0)
+		return segment;
+
+	QSqlQuery *query = _prepare("INSERT OR IGNORE INTO segments "
+								"(input, startAt, endAt) VALUES (?, ?, ?)");
+	query->bindValue(0, input);
+	query->bindValue(1, startAt);
+	query->bindValue(2, startAt + SEGMENT_SPAN_MS);
+	if (!query->exec())
+		{
+		ERR << "Cannot create segment:" << query->lastError().text();
+		return -1;
+		}
+	query->finish();
+
+	query = _prepare(SQL_SEGMENT_FOR);
+	query->bindValue(0, input);
+	query->bindValue(1, startAt);
+	if (query->exec() && query->next())
+		segment = query->value(0).toLongLong();
+	query->finish();
+
+	if (segment >= 0)
+		_segments.insert(key, segment);
+	return segment;
+	}
+
+/******************************************************************************\
+|* Private method - write readings into the store, within the caller's
+|*                  transaction. Readings already present are ignored, which
+|*                  makes replaying the journal safe
+\******************************************************************************/
+bool DbMgr::_storeReadings(const Readings& readings)
+	{
+	struct Stats
+		{
+		qint64 rows;
+		double min, max;
+		};
+	QHash<qint64, Stats> touched;
+
+	QSqlQuery *insert = _prepare("INSERT OR IGNORE INTO readings "
+								 "(segment, at, value) VALUES (?, ?, ?)");
+	for (const Reading& reading : readings)
 		{
-		while (query.next())
+		qint64 segment = _segmentFor(reading.input, reading.at);
+		if (segment < 0)
+			return false;
+
+		insert->bindValue(0, segment);
+		insert->bindValue(1, reading.at);
+		insert->bindValue(2, reading.value);
+		if (!insert->exec())
 			{
-			int version = query.value(0).toInt();
-			switch (version)
-				{
-				default:
-					break;
-				}
+			ERR << "Cannot store reading:" << insert->lastError().text();
+			return false;
+			}
+		if (insert->numRowsAffected() <= 0)
+			continue;
 
-			// no upgrading yet :)
-			break;
+		auto it = touched.find(segment);
+		if (it == touched.end())
+			touched.insert(segment, {1, reading.value, reading.value});
+		else
+			{
+			it->rows ++;
+			it->min = qMin(it->min, reading.value);
+			it->max = qMax(it->max, reading.value);
 			}
 		}
+	insert->finish();
+
+	/**************************************************************************\
+	|* Roll the new rows into each segment's summary, and flag the segment for
+	|* the compactor to (re-)roll up
+	\**************************************************************************/
+	QSqlQuery *update = _prepare("UPDATE segments SET rows = rows + ?, "
+								 "rolled = 0, "
+								 "minValue = MIN(COALESCE(minValue, ?), ?), "
+								 "maxValue = MAX(COALESCE(maxValue, ?), ?) "
+								 "WHERE id = ?");
+	for (auto it = touched.cbegin(); it != touched.cend(); ++it)
+		{
+		update->bindValue(0, it->rows);
+		update->bindValue(1, it->min);
+		update->bindValue(2, it->min);
+		update->bindValue(3, it->max);
+		update->bindValue(4, it->max);
+		update->bindValue(5, it.key());
+		if (!update->exec())
+			{
+			ERR << "Cannot update segment:" << update->lastError().text();
+			return false;
+			}
+		}
+	update->finish();
+	return true;
 	}
 
+/******************************************************************************\
+|* Private method - the compactor has deleted a segment, so forget its id
+\******************************************************************************/
+void DbMgr::_forgetSegment(qint64 input, qint64 startAt)
+	{
+	_segments.remove(qMakePair(input, startAt));
+	}
 
 /******************************************************************************\
 |* Private method - create the initial schema
@@ -107,7 +637,7 @@ void DbMgr::_createInitialSchema(void)
 				")\n"))
 		ERR <<"Cannot create system table";
 
-	if (!query.exec("INSERT OR REPLACE INTO system (version) VALUES (1)"))
+	if (!query.exec("INSERT INTO system (version) VALUES (1)"))
 		ERR << "Cannot insert system version";
 
 	if (!query.exec("CREATE TABLE IF NOT EXISTS inputs\n"
@@ -140,102 +670,770 @@ void DbMgr::_createInitialSchema(void)
 					")\n"))
 		ERR << "Cannot create modules table";
 
-	QFile f(Config::instance().databaseDir() + "/reef.sql");
-	if (f.open(QFile::ReadOnly))
+	/**************************************************************************\
+	|* Seed the database from reef.sql if present, as a single transaction
+	\**************************************************************************/
+	QString dir = Config::instance().databaseDir();
+	QElapsedTimer timer;
+	timer.start();
+
+	int lastPercent = -1;
+	auto progress = [&](qint64 done, qint64 total)
 		{
-		QString content = QString::fromUtf8(f.readAll());
-		f.close();
-		QStringList statements = content.split(";");
-		for (QString& statement : statements)
-			query.exec(statement);
+		if (total > 0)
+			{
+			int percent = (int)(done * 100 / total);
+			if (percent / 10 != lastPercent / 10)
+				LOG << "Seeding:" << percent << "%";
+			lastPercent = percent;
+			}
+		else
+			LOG << "Seeding:" << done << "rows";
+		};
+
+	if (QFile::exists(dir + "/reef.sql"))
+		if (SqlScript::run(db, dir + "/reef.sql", progress))
+			LOG << "Loaded reef.sql in" << timer.elapsed() << "ms";
+
+	/**************************************************************************\
+	|* Then bulk-load any inventory files (<table>.csv or <table>.json)
+	\**************************************************************************/
+	for (const char *table : {"modules", "inputs", "outputs"})
+		{
+		QString base = dir + "/" + table;
+		qint64 rows = -1;
+
+		timer.restart();
+		lastPercent = -1;
+		if (QFile::exists(base + ".csv"))
+			rows = SqlScript::loadCsv(db, base + ".csv", table, progress);
+		else if (QFile::exists(base + ".json"))
+			rows = SqlScript::loadJson(db, base + ".json", table, progress);
+
+		if (rows >= 0)
+			LOG << "Loaded" << rows << table << "in" << timer.elapsed() << "ms";
 		}
 	}
 
 
-#pragma mark - slots
+/******************************************************************************\
+|* Private method - read the topology tables into a new snapshot and publish
+|*                  it. Uses the same single-pass statement as SysInfo used to
+\******************************************************************************/
+void DbMgr::_loadTopology(void)
+	{
+	Topology::Snapshot *topo = _readTopology(_prepare(SQL_SYSINFO));
+	if (topo == nullptr)
+		return;
 
+	Topology::instance().publish(topo);
+	LOG << "Loaded topology:" << topo->modules.size() << "modules,"
+		<< topo->inputs.size() << "inputs," << topo->outputs.size() << "outputs";
+	emit topologyChanged(topo->version);
+	}
 
 /******************************************************************************\
-|* Slot: Get the system configuration for a given user's view. Currently all
-|*       users get the same view
+|* Private method - run the topology statement into a new snapshot, or
+|*                  return nullptr if it failed
 \******************************************************************************/
-void DbMgr::fetchSystemInfo(QString user, QString identifier)
+Topology::Snapshot * DbMgr::_readTopology(QSqlQuery *query)
 	{
-	(void)user;
+	if (!query->exec())
+		{
+		ERR << "Cannot load topology:" << query->lastError().text();
+		return nullptr;
+		}
 
-	QSqlDatabase db = QSqlDatabase::database();
+	Topology::Snapshot *topo = new Topology::Snapshot;
+	while (query->next())
+		{
+		int kind = query->value(0).toInt();
+		if (kind == 0)
+			{
+			Topology::Module module;
+			module.id		= query->value(1).toLongLong();
+			module.name		= query->value(2).toString();
+			module.nodeId	= query->value(3).toString();
+			module.driver	= query->value(4).toString();
+			module.render	= query->value(5).toString();
+			topo->modules.append(module);
+			}
+		else
+			{
+			Topology::Channel channel;
+			channel.id		= query->value(1).toLongLong();
+			channel.name	= query->value(2).toString();
+			channel.module	= query->value(3).toLongLong();
+			channel.driver	= query->value(4).toString();
+			channel.render	= query->value(5).toString();
+			if (kind == 1)
+				topo->inputs.append(channel);
+			else
+				topo->outputs.append(channel);
+			}
+		}
+	query->finish();
+	return topo;
+	}
 
-	/**************************************************************************\
-	|* Add the list of known modules to the results
-	\**************************************************************************/
-	QSqlQuery query;
-	query.exec("SELECT id, name, nodeId, driver, render "
-			   "FROM modules "
-			   "ORDER BY name");
+/******************************************************************************\
+|* Private method - insert or replace a module row. A new id is written back
+|*                  into the module if it didn't have one
+\******************************************************************************/
+bool DbMgr::_writeModule(Topology::Module& module)
+	{
+	QSqlQuery *query = _prepare("INSERT OR REPLACE INTO modules "
+								"(id, name, driver, nodeId, render) "
+								"VALUES (?, ?, ?, ?, ?)");
+	query->bindValue(0, (module.id < 0) ? QVariant() : QVariant(module.id));
+	query->bindValue(1, module.name);
+	query->bindValue(2, module.driver);
+	query->bindValue(3, module.nodeId);
+	query->bindValue(4, module.render);
+	if (!query->exec())
+		{
+		ERR << "Cannot write module:" << query->lastError().text();
+		return false;
+		}
+	if (module.id < 0)
+		module.id = query->lastInsertId().toLongLong();
+	query->finish();
+	return true;
+	}
+
+/******************************************************************************\
+|* Private method - insert or replace an input/output row. A new id is
+|*                  written back into the channel if it didn't have one
+\******************************************************************************/
+bool DbMgr::_upsertChannel(const char *table, Topology::Channel& channel)
+	{
+	QSqlQuery *query = _prepare(QString("INSERT OR REPLACE INTO %1 "
+										"(id, name, module, driver, render) "
+										"VALUES (?, ?, ?, ?, ?)").arg(table));
+	query->bindValue(0, (channel.id < 0) ? QVariant() : QVariant(channel.id));
+	query->bindValue(1, channel.name);
+	query->bindValue(2, channel.module);
+	query->bindValue(3, channel.driver);
+	query->bindValue(4, channel.render);
+	if (!query->exec())
+		{
+		ERR << "Cannot write" << table << ":" << query->lastError().text();
+		return false;
+		}
 
-	QJsonObject records;
-	QJsonArray modules;
-	QJsonObject module;
-	while (query.next())
+	if (channel.id < 0)
+		channel.id = query->lastInsertId().toLongLong();
+	query->finish();
+	return true;
+	}
+
+/******************************************************************************\
+|* Private method - delete a row from one of the topology tables
+\******************************************************************************/
+bool DbMgr::_remove(const char *table, qint64 id)
+	{
+	QSqlQuery *query = _prepare(QString("DELETE FROM %1 WHERE id = ?").arg(table));
+	query->bindValue(0, id);
+	if (!query->exec())
 		{
-		module.insert("id", QJsonValue::fromVariant(query.value(0)));
-		module.insert("name", QJsonValue::fromVariant(query.value(1)));
-		module.insert("nodeId", QJsonValue::fromVariant(query.value(2)));
-		module.insert("driver", QJsonValue::fromVariant(query.value(3)));
-		module.insert("renderer", QJsonValue::fromVariant(query.value(4)));
-		modules.push_back(module);
+		ERR << "Cannot delete from" << table << ":" << query->lastError().text();
+		return false;
 		}
-	records.insert("modules", modules);
+	query->finish();
+	return true;
+	}
+
+/******************************************************************************\
+|* Private method - render a topology snapshot as SysInfo JSON, writing each
+|*                  field straight into the text. The layout (indented, keys
+|*                  sorted) is what QJsonDocument gave clients before
+\******************************************************************************/
+QString DbMgr::_renderSysInfo(const Topology::Snapshot *topo)
+	{
+	QByteArray json;
+	json.reserve(4096);
+	json.append("{\n");
+
+	jsonChannels(json, "inputs", topo->inputs);
+	json.append(",\n");
 
 	/**************************************************************************\
-	|* Add the list of known inputs to the results
+	|* Add the name of this return-type
 	\**************************************************************************/
-	query.exec("SELECT id, name, module, driver, render "
-			   "FROM inputs "
-			   "ORDER BY name");
+	jsonKey(json, 1, "method");
+	json.append("\"SysInfo\",\n");
+
+	/**************************************************************************\
+	|* Then the modules
+	\**************************************************************************/
+	jsonKey(json, 1, "modules");
+	json.append("[\n");
+	for (int i=0; i<topo->modules.size(); i++)
+		{
+		const Topology::Module& module = topo->modules[i];
+		if (i > 0)
+			json.append(",\n");
+		json.append(8, ' ').append("{\n");
+		jsonKey(json, 3, "driver");
+		jsonString(json, module.driver);
+		json.append(",\n");
+		jsonKey(json, 3, "id");
+		json.append(QByteArray::number(module.id)).append(",\n");
+		jsonKey(json, 3, "name");
+		jsonString(json, module.name);
+		json.append(",\n");
+		jsonKey(json, 3, "nodeId");
+		jsonString(json, module.nodeId);
+		json.append(",\n");
+		jsonKey(json, 3, "renderer");
+		jsonString(json, module.render);
+		json.append('\n').append(8, ' ').append('}');
+		}
+	if (!topo->modules.isEmpty())
+		json.append('\n');
+	json.append(4, ' ').append("],\n");
+
+	jsonChannels(json, "outputs", topo->outputs);
+	json.append("\n}\n");
+
+	return QString::fromUtf8(json);
+	}
+
+
+#pragma mark - readers
+
+/******************************************************************************\
+|* Return a read-only connection for the calling thread, opening it on first
+|* use. The database is in WAL mode, so these never block our writes
+\******************************************************************************/
+QSqlDatabase DbMgr::readerConnection(void)
+	{
+	QString name = QStringLiteral("reader-%1")
+		.arg(reinterpret_cast<quintptr>(QThread::currentThreadId()));
+	if (QSqlDatabase::contains(name))
+		return QSqlDatabase::database(name);
+
+	QSqlDatabase db = QSqlDatabase::cloneDatabase(
+						QLatin1String(QSqlDatabase::defaultConnection), name);
+	db.setConnectOptions("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=5000");
+	if (!db.open())
+		ERR << "Cannot open reader connection:" << db.lastError().text();
+	return db;
+	}
+
+
+#pragma mark - bulk loading
+
+/******************************************************************************\
+|* Store readings without going through the journal. The caller is expected
+|* to be able to re-run the load if we crash part way through
+\******************************************************************************/
+bool DbMgr::importReadings(const Readings& readings)
+	{
+	QSqlDatabase db = QSqlDatabase::database();
+	db.transaction();
+	if (!_storeReadings(readings) || !db.commit())
+		{
+		ERR << "Cannot import" << readings.size() << "readings:"
+			<< db.lastError().text();
+		db.rollback();
+		_segments.clear();
+		return false;
+		}
+	return true;
+	}
+
+/******************************************************************************\
+|* Turn bulk-load mode on or off. While it's on, commits don't wait for the
+|* disk, and the page cache is large enough to hold the hot index pages
+\******************************************************************************/
+void DbMgr::setBulkLoad(bool bulk)
+	{
+	if (bulk)
+		{
+		QSqlQuery *query = _prepare("PRAGMA synchronous");
+		if (query->exec() && query->next())
+			_synchronous = query->value(0).toInt();
+		query->finish();
+
+		_exec("PRAGMA synchronous = OFF");
+		_exec("PRAGMA cache_size = -262144");
+		_exec("PRAGMA temp_store = MEMORY");
+		}
+	else if (_synchronous >= 0)
+		{
+		_exec(QString("PRAGMA synchronous = %1").arg(_synchronous));
+		_exec("PRAGMA cache_size = -2000");
+		_exec("PRAGMA wal_checkpoint(TRUNCATE)");
+		_synchronous = -1;
+		}
+	}
 
-	QJsonArray inputs;
-	QJsonObject input;
-	while (query.next())
+
+/******************************************************************************\
+|* Benchmark: SysInfo for a synthetic topology of BENCH_MODULES modules with
+|* four inputs and two outputs each, in a private in-memory database. Per
+|* request, three ways:
+|*
+|*   - as it used to be: three ad-hoc queries, QJsonValue::fromVariant per
+|*     column and a QJsonDocument
+|*   - after a topology change: the prepared single-pass statement into a
+|*     snapshot, rendered straight to text
+|*   - with the topology unchanged: the cached rendering
+\******************************************************************************/
+#define BENCH_MODULES		64
+#define BENCH_DB			"sysinfo-bench"
+
+void DbMgr::benchmark(int requests)
+	{
+	{
+	QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", BENCH_DB);
+	db.setDatabaseName(":memory:");
+	if (!db.open())
 		{
-		input.insert("id", QJsonValue::fromVariant(query.value(0)));
-		input.insert("name", QJsonValue::fromVariant(query.value(1)));
-		input.insert("module", QJsonValue::fromVariant(query.value(2)));
-		input.insert("driver", QJsonValue::fromVariant(query.value(3)));
-		input.insert("renderer", QJsonValue::fromVariant(query.value(4)));
-		inputs.push_back(input);
+		ERR << "Cannot open the benchmark database";
+		return;
+		}
+
+	QSqlQuery query(db);
+	for (const char *table : {"inputs", "outputs"})
+		query.exec(QString("CREATE TABLE %1 (id INTEGER PRIMARY KEY, "
+						   "name VARCHAR(128), module INTEGER, "
+						   "driver VARCHAR(128), render VARCHAR(128))")
+						.arg(table));
+	query.exec("CREATE TABLE modules (id INTEGER PRIMARY KEY, "
+			   "name VARCHAR(128), driver VARCHAR(128), nodeId VARCHAR(32), "
+			   "render VARCHAR(128))");
+
+	db.transaction();
+	for (int m=1; m<=BENCH_MODULES; m++)
+		{
+		query.prepare("INSERT INTO modules (id, name, driver, nodeId, render) "
+					  "VALUES (?, ?, 'probe', ?, 'gauge')");
+		query.addBindValue(m);
+		query.addBindValue(QString("Module %1").arg(m));
+		query.addBindValue(QString("%1").arg(m, 8, 16, QChar('0')));
+		query.exec();
+
+		for (int c=0; c<6; c++)
+			{
+			query.prepare(QString("INSERT INTO %1 (name, module, driver, "
+								  "render) VALUES (?, ?, 'temp', 'chart')")
+							.arg((c < 4) ? "inputs" : "outputs"));
+			query.addBindValue(QString("Channel %1.%2").arg(m).arg(c));
+			query.addBindValue(m);
+			query.exec();
+			}
 		}
-	records.insert("inputs", inputs);
+	db.commit();
+
+	QElapsedTimer timer;
+	qint64 bytes = 0;
 
 	/**************************************************************************\
-	|* Add the list of known outputs to the results
+	|* The old way
 	\**************************************************************************/
-	query.exec("SELECT id, name, module, driver, render "
-			   "FROM outputs "
-			   "ORDER BY name");
-
-	QJsonArray outputs;
-	QJsonObject output;
-	while (query.next())
+	timer.start();
+	for (int i=0; i<requests; i++)
 		{
-		output.insert("id", QJsonValue::fromVariant(query.value(0)));
-		output.insert("name", QJsonValue::fromVariant(query.value(1)));
-		output.insert("module", QJsonValue::fromVariant(query.value(2)));
-		output.insert("driver", QJsonValue::fromVariant(query.value(3)));
-		output.insert("renderer", QJsonValue::fromVariant(query.value(4)));
-		outputs.push_back(output);
+		QJsonObject records;
+		for (int kind=0; kind<3; kind++)
+			{
+			static const char *sql[] =
+				{
+				"SELECT id, name, nodeId, driver, render FROM modules "
+				"ORDER BY name",
+				"SELECT id, name, module, driver, render FROM inputs "
+				"ORDER BY name",
+				"SELECT id, name, module, driver, render FROM outputs "
+				"ORDER BY name"
+				};
+			static const char *keys[]	= {"modules", "inputs", "outputs"};
+			const char *ref				= (kind == 0) ? "nodeId" : "module";
+
+			QSqlQuery legacy(db);
+			legacy.exec(sql[kind]);
+
+			QJsonArray rows;
+			QJsonObject row;
+			while (legacy.next())
+				{
+				row.insert("id", QJsonValue::fromVariant(legacy.value(0)));
+				row.insert("name", QJsonValue::fromVariant(legacy.value(1)));
+				row.insert(ref, QJsonValue::fromVariant(legacy.value(2)));
+				row.insert("driver", QJsonValue::fromVariant(legacy.value(3)));
+				row.insert("renderer", QJsonValue::fromVariant(legacy.value(4)));
+				rows.push_back(row);
+				}
+			records.insert(keys[kind], rows);
+			}
+		records.insert("method", QJsonValue("SysInfo"));
+		bytes += QString(QJsonDocument(records).toJson()).size();
 		}
-	records.insert("outputs", outputs);
+	qint64 before = qMax(timer.nsecsElapsed(), 1LL);
 
 	/**************************************************************************\
-	|* Add the name of this return-type
+	|* After a topology change
 	\**************************************************************************/
-	QJsonValue methodName = "SysInfo";
-	records.insert("method", methodName);
+	QSqlQuery prepared(db);
+	prepared.setForwardOnly(true);
+	prepared.prepare(SQL_SYSINFO);
+
+	Topology::SnapshotPtr current(_readTopology(&prepared));
+	if (current == nullptr)
+		current.reset(new Topology::Snapshot);
+
+	timer.restart();
+	for (int i=0; i<requests; i++)
+		{
+		Topology::Snapshot *topo = _readTopology(&prepared);
+		if (topo == nullptr)
+			break;
+		topo->reindex();
+		bytes += _renderSysInfo(topo).size();
+		delete topo;
+		}
+	qint64 changed = qMax(timer.nsecsElapsed(), 1LL);
 
 	/**************************************************************************\
-	|* Create the JSON record and send to the client who called us
+	|* With it unchanged, as fetchSystemInfo does it
 	\**************************************************************************/
-	QJsonDocument result(records);
-	emit fetchedSystemInfo(result.toJson(), identifier);
+	quint64 version	= current->version;
+	QString cached	= _renderSysInfo(current.get());
+
+	timer.restart();
+	for (int i=0; i<requests; i++)
+		{
+		Topology::SnapshotPtr topo = current;	// As snapshot() hands out
+		if (cached.isEmpty() || (version != topo->version))
+			cached = _renderSysInfo(topo.get());
+		QString reply = cached;
+		bytes += reply.size();
+		}
+	qint64 unchanged = qMax(timer.nsecsElapsed(), 1LL);
+
+	LOG << "SysInfo for" << BENCH_MODULES << "modules," << cached.size()
+		<< "chars, per request: before" << (double)before / requests
+		<< "ns, after a topology change" << (double)changed / requests
+		<< "ns, unchanged" << (double)unchanged / requests
+		<< "ns (" << bytes << "chars in all)";
+	}
+	QSqlDatabase::removeDatabase(BENCH_DB);
+	}
+
+/******************************************************************************\
+|* Check that the hot lookups are answered from an index rather than by a
+|* full table scan. Returns false if any isn't
+\******************************************************************************/
+bool DbMgr::checkQueryPlans(void)
+	{
+	bool ok = true;
+	for (const char *sql : {SQL_SEGMENT_FOR})
+		{
+		QSqlQuery *query = _prepare(QString("EXPLAIN QUERY PLAN ") + sql);
+		for (int i=QString(sql).count('?') - 1; i>=0; i--)
+			query->bindValue(i, 0);
+		if (!query->exec())
+			{
+			ERR << "Cannot explain" << sql << ":" << query->lastError().text();
+			ok = false;
+			continue;
+			}
+
+		while (query->next())
+			{
+			QString detail = query->value(3).toString();
+			if (detail.startsWith("SCAN"))
+				{
+				ERR << "Full scan in" << sql << ":" << detail;
+				ok = false;
+				}
+			}
+		query->finish();
+		}
+	return ok;
+	}
+
+
+#pragma mark - journal
+
+/******************************************************************************\
+|* Store a journal batch, recording how far we've got in the same transaction
+\******************************************************************************/
+bool DbMgr::_applyBatch(const Batch& batch)
+	{
+	QSqlDatabase db = QSqlDatabase::database();
+	db.transaction();
+
+	QSqlQuery *query = _prepare("UPDATE journal SET generation = ?, applied = ?");
+	query->bindValue(0, batch.generation);
+	query->bindValue(1, batch.offset);
+
+	if (!_storeReadings(batch.readings) || !query->exec() || !db.commit())
+		{
+		ERR << "Cannot apply" << batch.readings.size() << "readings:"
+			<< db.lastError().text();
+		db.rollback();
+
+		// Segment ids cached during the failed transaction may not exist
+		_segments.clear();
+		return false;
+		}
+	query->finish();
+	return true;
+	}
+
+/******************************************************************************\
+|* Apply what's waiting, oldest first. A failure leaves it (and everything
+|* after it) waiting, and tries again later
+\******************************************************************************/
+void DbMgr::_applyUnapplied(void)
+	{
+	while (!_unapplied.isEmpty())
+		{
+		const Batch& batch = _unapplied.first();
+		if (!_applyBatch(batch))
+			{
+			_retry.start();
+			return;
+			}
+
+		emit journalApplied(batch.generation, batch.offset);
+		_unapplied.removeFirst();
+		}
+	}
+
+/******************************************************************************\
+|* Replay anything in the journal that didn't make it into the store before
+|* we last stopped. Call before the journal itself is started
+\******************************************************************************/
+void DbMgr::replayJournal(const QString& path)
+	{
+	qint64 generation	= 0;
+	qint64 applied		= 0;
+
+	QSqlQuery *query = _prepare("SELECT generation, applied FROM journal");
+	if (query->exec() && query->next())
+		{
+		generation	= query->value(0).toLongLong();
+		applied		= query->value(1).toLongLong();
+		}
+	query->finish();
+
+	QElapsedTimer timer;
+	timer.start();
+	qint64 replayed = Journal::replay(path, generation, applied,
+		[this](const Readings& readings, qint64 generation, qint64 offset)
+			{
+			applyReadings(readings, generation, offset);
+			});
+
+	if (replayed > 0)
+		LOG << "Replayed" << replayed << "readings from the journal in"
+			<< timer.elapsed() << "ms";
+	}
+
+
+#pragma mark - slots
+
+
+/******************************************************************************\
+|* Slot: Get the system configuration for a given user's view. Currently all
+|*       users get the same view, rendered from the in-memory topology and
+|*       cached until the topology version changes
+\******************************************************************************/
+void DbMgr::fetchSystemInfo(QString user, QString identifier)
+	{
+	(void)user;
+
+	Topology::SnapshotPtr topo = Topology::instance().snapshot();
+	if (_sysInfo.isEmpty() || (_sysInfoVersion != topo->version))
+		{
+		_sysInfo		= _renderSysInfo(topo.get());
+		_sysInfoVersion	= topo->version;
+		}
+
+	emit fetchedSystemInfo(_sysInfo, identifier);
+	}
+
+/******************************************************************************\
+|* Slot: Apply a durable batch from the journal. It goes behind any that
+|*       haven't been applied yet, so they're always stored in order
+\******************************************************************************/
+void DbMgr::applyReadings(Readings readings, qint64 generation, qint64 offset)
+	{
+	_unapplied.append({readings, generation, offset});
+	if (!_retry.isActive())
+		_applyUnapplied();
+	}
+
+/******************************************************************************\
+|* Slot: Add or update a module
+\******************************************************************************/
+void DbMgr::upsertModule(Topology::Module module)
+	{
+	if (!_writeModule(module))
+		return;
+
+	Topology::Snapshot *topo = new Topology::Snapshot(*Topology::instance().snapshot());
+	int idx = topo->moduleIds.value(module.id, -1);
+	if (idx < 0)
+		topo->modules.append(module);
+	else
+		topo->modules[idx] = module;
+
+	Topology::instance().publish(topo);
+	emit topologyChanged(topo->version);
+	}
+
+/******************************************************************************\
+|* Slot: Add or update modules found on the bus, by nodeId. Existing modules
+|* keep their name and renderer; new ones are named after the driver. The
+|* whole batch is one transaction and one new snapshot
+\******************************************************************************/
+void DbMgr::upsertDiscovered(QVector<Topology::Module> modules)
+	{
+	Topology::SnapshotPtr current = Topology::instance().snapshot();
+	QVector<Topology::Module> changed;
+
+	for (const Topology::Module& found : std::as_const(modules))
+		{
+		const Topology::Module *known = current->moduleForNode(found.nodeId);
+		Topology::Module module;
+		if (known)
+			{
+			if (found.driver.isEmpty() || (found.driver == known->driver))
+				continue;
+			module = *known;
+			}
+		else
+			module.name = (found.driver.isEmpty() ? "Node" : found.driver)
+						+ " " + found.nodeId;
+
+		module.nodeId = found.nodeId;
+		if (!found.driver.isEmpty())
+			module.driver = found.driver;
+		changed.append(module);
+		}
+
+	if (changed.isEmpty())
+		return;
+
+	QSqlDatabase db = QSqlDatabase::database();
+	db.transaction();
+	for (Topology::Module& module : changed)
+		if (!_writeModule(module))
+			{
+			db.rollback();
+			return;
+			}
+	if (!db.commit())
+		{
+		ERR << "Cannot store discovered modules:" << db.lastError().text();
+		db.rollback();
+		return;
+		}
+
+	Topology::Snapshot *topo = new Topology::Snapshot(*current);
+	for (const Topology::Module& module : std::as_const(changed))
+		{
+		int idx = topo->moduleIds.value(module.id, -1);
+		if (idx < 0)
+			topo->modules.append(module);
+		else
+			topo->modules[idx] = module;
+		}
+
+	Topology::instance().publish(topo);
+	LOG << "Stored" << changed.size() << "discovered modules";
+	emit topologyChanged(topo->version);
+	}
+
+/******************************************************************************\
+|* Slot: Add or update an input
+\******************************************************************************/
+void DbMgr::upsertInput(Topology::Input input)
+	{
+	if (!_upsertChannel("inputs", input))
+		return;
+
+	Topology::Snapshot *topo = new Topology::Snapshot(*Topology::instance().snapshot());
+	int idx = topo->inputIds.value(input.id, -1);
+	if (idx < 0)
+		topo->inputs.append(input);
+	else
+		topo->inputs[idx] = input;
+
+	Topology::instance().publish(topo);
+	emit topologyChanged(topo->version);
+	}
+
+/******************************************************************************\
+|* Slot: Add or update an output
+\******************************************************************************/
+void DbMgr::upsertOutput(Topology::Output output)
+	{
+	if (!_upsertChannel("outputs", output))
+		return;
+
+	Topology::Snapshot *topo = new Topology::Snapshot(*Topology::instance().snapshot());
+	int idx = topo->outputIds.value(output.id, -1);
+	if (idx < 0)
+		topo->outputs.append(output);
+	else
+		topo->outputs[idx] = output;
+
+	Topology::instance().publish(topo);
+	emit topologyChanged(topo->version);
+	}
+
+/******************************************************************************\
+|* Slot: Remove a module
+\******************************************************************************/
+void DbMgr::removeModule(qint64 id)
+	{
+	if (!_remove("modules", id))
+		return;
+
+	Topology::Snapshot *topo = new Topology::Snapshot(*Topology::instance().snapshot());
+	int idx = topo->moduleIds.value(id, -1);
+	if (idx >= 0)
+		topo->modules.remove(idx);
+
+	Topology::instance().publish(topo);
+	emit topologyChanged(topo->version);
+	}
+
+/******************************************************************************\
+|* Slot: Remove an input
+\******************************************************************************/
+void DbMgr::removeInput(qint64 id)
+	{
+	if (!_remove("inputs", id))
+		return;
+
+	Topology::Snapshot *topo = new Topology::Snapshot(*Topology::instance().snapshot());
+	int idx = topo->inputIds.value(id, -1);
+	if (idx >= 0)
+		topo->inputs.remove(idx);
+
+	Topology::instance().publish(topo);
+	emit topologyChanged(topo->version);
+	}
+
+/******************************************************************************\
+|* Slot: Remove an output
+\******************************************************************************/
+void DbMgr::removeOutput(qint64 id)
+	{
+	if (!_remove("outputs", id))
+		return;
+
+	Topology::Snapshot *topo = new Topology::Snapshot(*Topology::instance().snapshot());
+	int idx = topo->outputIds.value(id, -1);
+	if (idx >= 0)
+		topo->outputs.remove(idx);
+
+	Topology::instance().publish(topo);
+	emit topologyChanged(topo->version);
 	}
@@ -1,10 +1,21 @@
 #ifndef DMBGR_H
 #define DMBGR_H
 
+#include <QHash>
 #include <QObject>
+#include <QPair>
+#include <QList>
+#include <QSqlDatabase>
+#include <QTimer>
+#include <QVariant>
 
+#include "compactor.h"
+#include "migrator.h"
 #include "properties.h"
+#include "reading.h"
+#include "topology.h"
 
+QT_FORWARD_DECLARE_CLASS(QSqlQuery)
 QT_FORWARD_DECLARE_CLASS(QWebSocket)
 
 class DbMgr : public QObject
@@ -15,8 +26,42 @@ class DbMgr : public QObject
 	|* Properties
 	\**************************************************************************/
 	GET(bool, dbOk);				// Whether the database could open
+	GET(Compactor, compactor);		// Retention and compaction
 
 	private:
+		/**********************************************************************\
+		|* A batch from the journal, and where in it the batch ends
+		\**********************************************************************/
+		struct Batch
+			{
+			Readings	readings;
+			qint64		generation;
+			qint64		offset;
+			};
+
+		/**********************************************************************\
+		|* Private variables
+		\**********************************************************************/
+		QHash<QString, QSqlQuery *>	_statements;	// Prepared-statement cache
+		quint64						_sysInfoVersion;// Topology _sysInfo is for
+		QString						_sysInfo;		// Cached SysInfo JSON
+		Migrator					_migrator;		// Schema upgrades
+		QHash<QPair<qint64, qint64>, qint64>
+									_segments;		// (input, start) -> id
+		int							_synchronous;	// To restore after bulk load
+		QList<Batch>				_unapplied;		// Journal batches, in order
+		QTimer						_retry;			// Retries _unapplied (child)
+
+		/**********************************************************************\
+		|* Return a prepared statement for this SQL, preparing it on first use
+		\**********************************************************************/
+		QSqlQuery * _prepare(const QString& sql);
+
+		/**********************************************************************\
+		|* Run a cached statement that returns nothing, false if it failed
+		\**********************************************************************/
+		bool _exec(const QString& sql);
+
 		/**********************************************************************\
 		|* Upgrade the schema if necessary
 		\**********************************************************************/
@@ -27,6 +72,71 @@ class DbMgr : public QObject
 		\**********************************************************************/
 		void _createInitialSchema(void);
 
+		/**********************************************************************\
+		|* Schema upgrade steps, returning false if the step failed
+		\**********************************************************************/
+		bool _upgradeToV2(QSqlDatabase db);
+		bool _upgradeToV3(QSqlDatabase db);
+		bool _upgradeToV4(QSqlDatabase db);
+
+		/**********************************************************************\
+		|* The v4 backfill, run in the background: roll up the segments that
+		|* were stored before there were rollups. Counted in readings
+		\**********************************************************************/
+		int _backfillV4(QSqlDatabase db, qint64& cursor, int limit);
+		qint64 _backfillV4Rows(QSqlDatabase db);
+
+		/**********************************************************************\
+		|* Find or create the segment for a reading
+		\**********************************************************************/
+		qint64 _segmentFor(qint64 input, qint64 at);
+
+		/**********************************************************************\
+		|* Write readings into the store (within the caller's transaction)
+		\**********************************************************************/
+		bool _storeReadings(const Readings& readings);
+
+		/**********************************************************************\
+		|* Store a journal batch and record how far we've got, in one
+		|* transaction. Returns false (having rolled back) if it failed
+		\**********************************************************************/
+		bool _applyBatch(const Batch& batch);
+
+		/**********************************************************************\
+		|* Load the topology (modules, inputs, outputs) into memory
+		\**********************************************************************/
+		void _loadTopology(void);
+
+		/**********************************************************************\
+		|* Run the topology statement into a new snapshot (nullptr on error)
+		\**********************************************************************/
+		static Topology::Snapshot * _readTopology(QSqlQuery *query);
+
+		/**********************************************************************\
+		|* Write-through helpers for the topology tables
+		\**********************************************************************/
+		bool _writeModule(Topology::Module& module);
+		bool _upsertChannel(const char *table, Topology::Channel& channel);
+		bool _remove(const char *table, qint64 id);
+
+		/**********************************************************************\
+		|* Render a topology snapshot as SysInfo JSON
+		\**********************************************************************/
+		static QString _renderSysInfo(const Topology::Snapshot *topo);
+
+	private slots:
+		/**********************************************************************\
+		|* The compactor has deleted (expired or merged away) a segment
+		\**********************************************************************/
+		void _forgetSegment(qint64 input, qint64 startAt);
+
+		/**********************************************************************\
+		|* Apply the journal batches waiting, in order, stopping at the first
+		|* that fails (to be retried), so the journal is never told it can
+		|* drop a batch that isn't stored
+		\**********************************************************************/
+		void _applyUnapplied(void);
+
 	public:
 		/**********************************************************************\
 		|* Constructor / Destructor
@@ -34,18 +144,87 @@ class DbMgr : public QObject
 		explicit DbMgr(QObject *parent = nullptr);
 		~DbMgr(void);
 
+		/**********************************************************************\
+		|* A read-only connection for the calling thread, for use off the
+		|* DbMgr thread. Each thread gets its own, kept open
+		\**********************************************************************/
+		static QSqlDatabase readerConnection(void);
+
+		/**********************************************************************\
+		|* Replay unapplied journal records. Call before starting the journal
+		\**********************************************************************/
+		void replayJournal(const QString& path);
+
+		/**********************************************************************\
+		|* Store readings directly, bypassing the journal, in one transaction.
+		|* For bulk loading only
+		\**********************************************************************/
+		bool importReadings(const Readings& readings);
+
+		/**********************************************************************\
+		|* Relax (or restore) syncing and enlarge the cache for a bulk load
+		\**********************************************************************/
+		void setBulkLoad(bool bulk);
+
+		/**********************************************************************\
+		|* Time SysInfo requests against a synthetic topology, the old way and
+		|* the current one, logging the cost per request
+		\**********************************************************************/
+		static void benchmark(int requests);
+
+		/**********************************************************************\
+		|* Check the hot lookups don't fall back to a full table scan, logging
+		|* any that do. Returns false if one does
+		\**********************************************************************/
+		bool checkQueryPlans(void);
+
 	signals:
 		/**********************************************************************\
 		|* Tell the world we have the JSON ready
 		\**********************************************************************/
 		void fetchedSystemInfo(QString json, QString identifier);
 
+		/**********************************************************************\
+		|* Tell the world a new topology snapshot has been published
+		\**********************************************************************/
+		void topologyChanged(quint64 version);
+
+		/**********************************************************************\
+		|* Tell the journal how far we've applied it
+		\**********************************************************************/
+		void journalApplied(qint64 generation, qint64 offset);
+
 	public slots:
 		/**********************************************************************\
 		|* Accept a request to find the groups for a user
 		\**********************************************************************/
 		void fetchSystemInfo(QString user, QString identifier);
 
+		/**********************************************************************\
+		|* Apply a durable batch of readings from the journal
+		\**********************************************************************/
+		void applyReadings(Readings readings, qint64 generation, qint64 offset);
+
+		/**********************************************************************\
+		|* Add or update topology entries, writing through to the database. An
+		|* id of -1 creates a new row
+		\**********************************************************************/
+		void upsertModule(Topology::Module module);
+		void upsertInput(Topology::Input input);
+		void upsertOutput(Topology::Output output);
+
+		/**********************************************************************\
+		|* Add or update modules discovered on the CAN bus, matched by nodeId,
+		|* as one batch
+		\**********************************************************************/
+		void upsertDiscovered(QVector<Topology::Module> modules);
+
+		/**********************************************************************\
+		|* Remove topology entries, writing through to the database
+		\**********************************************************************/
+		void removeModule(qint64 id);
+		void removeInput(qint64 id);
+		void removeOutput(qint64 id);
 	};
 
 #endif // DMBGR_H
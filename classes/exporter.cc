@@ -0,0 +1,393 @@
+#include <charconv>
+
+#include <QSqlError>
+#include <QSqlQuery>
+
+#include "constants.h"
+#include "dmbgr.h"
+#include "exporter.h"
+#include "topology.h"
+
+/******************************************************************************\
+|* Tuning: how many rows we read per transaction, how much text we compress
+|* at a time, and how much the transport may have queued before we stop
+|* producing
+\******************************************************************************/
+#define EXPORT_BATCH_ROWS		4096
+#define EXPORT_CHUNK_BYTES		(64 * 1024)
+#define EXPORT_HIGH_WATER		(256 * 1024)
+#define EXPORT_GZIP_LEVEL		1
+
+/******************************************************************************\
+|* A batch of rows for one input, in time order: outer loop on the (input,
+|* startAt) index, inner on the (segment, at) primary key, so there's no sort
+\******************************************************************************/
+#define SQL_EXPORT		"SELECT r.at, r.value FROM segments s "				\
+						"JOIN readings r ON r.segment = s.id "				\
+						"WHERE s.input = ? AND s.startAt < ? AND s.endAt > ? "	\
+						"AND r.at >= ? AND r.at < ? "						\
+						"ORDER BY s.startAt, r.at LIMIT ?"
+
+/******************************************************************************\
+|* Categorised logging support
+\******************************************************************************/
+Q_LOGGING_CATEGORY(log_exp, "reefd:export")
+
+#define LOG qDebug(log_exp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define ERR qCritical(log_exp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+
+/******************************************************************************\
+|* Helper function: Append a number in its shortest round-trip form
+\******************************************************************************/
+template <typename T>
+static inline void appendNumber(QByteArray& out, T value)
+	{
+	char buf[32];
+	auto result = std::to_chars(buf, buf + sizeof(buf), value);
+	out.append(buf, static_cast<int>(result.ptr - buf));
+	}
+
+/******************************************************************************\
+|* Helper function: An input's name as a CSV field
+\******************************************************************************/
+static QByteArray csvField(const QString& value)
+	{
+	QByteArray utf8 = value.toUtf8();
+	if (!utf8.contains(',') && !utf8.contains('"')
+	 && !utf8.contains('\n') && !utf8.contains('\r'))
+		return utf8;
+
+	utf8.replace("\"", "\"\"");
+	return "\"" + utf8 + "\"";
+	}
+
+/******************************************************************************\
+|* Helper function: An input's name as a JSON string
+\******************************************************************************/
+static QByteArray jsonField(const QString& value)
+	{
+	QByteArray out("\"");
+	for (char c : value.toUtf8())
+		{
+		if ((c == '"') || (c == '\\'))
+			out.append('\\').append(c);
+		else if (static_cast<uint8_t>(c) < 0x20)
+			{
+			char esc[8];
+			snprintf(esc, sizeof(esc), "\\u%04x", c);
+			out.append(esc);
+			}
+		else
+			out.append(c);
+		}
+	return out.append('"');
+	}
+
+/******************************************************************************\
+|* Constructor
+\******************************************************************************/
+Exporter::Exporter(Format format,
+				   const QVector<qint64>& inputs,
+				   qint64 from,
+				   qint64 to,
+				   Write write,
+				   Queued queued,
+				   QObject *parent)
+		 :QObject{parent}
+		 ,_format(format)
+		 ,_rows(0)
+		 ,_bytes(0)
+		 ,_inputs(inputs)
+		 ,_from(from)
+		 ,_to(to)
+		 ,_write(write)
+		 ,_queued(queued)
+		 ,_next(0)
+		 ,_input(-1)
+		 ,_resume(from)
+		 ,_more(false)
+		 ,_read(0)
+		 ,_started(false)
+		 ,_done(false)
+	{
+	if (_inputs.isEmpty())
+		{
+		Topology::SnapshotPtr topo = Topology::instance().snapshot();
+		for (const Topology::Input& input : topo->inputs)
+			_inputs.append(input.id);
+		}
+
+	_batch.reserve(EXPORT_BATCH_ROWS);
+	_text.reserve(EXPORT_CHUNK_BYTES + 256);
+	_out.reserve(EXPORT_CHUNK_BYTES);
+
+	// windowBits + 16 asks for a gzip wrapper rather than raw zlib
+	memset(&_zs, 0, sizeof(_zs));
+	if (deflateInit2(&_zs, EXPORT_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8,
+					 Z_DEFAULT_STRATEGY) != Z_OK)
+		{
+		ERR << "Cannot initialise compressor";
+		_done = true;
+		}
+	}
+
+/******************************************************************************\
+|* Destructor
+\******************************************************************************/
+Exporter::~Exporter(void)
+	{
+	deflateEnd(&_zs);
+	}
+
+/******************************************************************************\
+|* Parse an export request
+\******************************************************************************/
+bool Exporter::parse(const QString& request,
+					 Format& format,
+					 QVector<qint64>& inputs,
+					 qint64& from,
+					 qint64& to)
+	{
+	QStringList parts = request.split(' ', Qt::SkipEmptyParts);
+	if (parts.size() != 4)
+		return false;
+
+	if (parts[0].compare("csv", Qt::CaseInsensitive) == 0)
+		format = CSV;
+	else if (parts[0].compare("ndjson", Qt::CaseInsensitive) == 0)
+		format = NDJSON;
+	else
+		return false;
+
+	inputs.clear();
+	if (parts[1] != "*")
+		for (const QString& id : parts[1].split(',', Qt::SkipEmptyParts))
+			{
+			bool ok;
+			inputs.append(id.toLongLong(&ok));
+			if (!ok)
+				return false;
+			}
+
+	bool fromOk, toOk;
+	from	= parts[2].toLongLong(&fromOk);
+	to		= parts[3].toLongLong(&toOk);
+	return fromOk && toOk && (from < to);
+	}
+
+/******************************************************************************\
+|* MIME type of the (uncompressed) output
+\******************************************************************************/
+const char * Exporter::contentType(Format format)
+	{
+	return (format == CSV) ? "text/csv" : "application/x-ndjson";
+	}
+
+
+#pragma mark - Private methods
+
+/******************************************************************************\
+|* Move on to the next input that exists
+\******************************************************************************/
+bool Exporter::_nextInput(void)
+	{
+	_batch.clear();
+	_read	= 0;
+	_more	= false;
+
+	Topology::SnapshotPtr topo = Topology::instance().snapshot();
+	while (_next < _inputs.size())
+		{
+		const Topology::Input *input = topo->input(_inputs[_next++]);
+		if (input == nullptr)
+			continue;
+
+		_label = (_format == CSV) ? csvField(input->name) : jsonField(input->name);
+		_input	= input->id;
+		_resume	= _from;
+		_more	= true;
+		return true;
+		}
+	return false;
+	}
+
+/******************************************************************************\
+|* Read the next batch for the current input, carrying on just after the last
+|* row we read. The statement is finished once the batch is in, so its read
+|* transaction ends there rather than lasting the whole export
+\******************************************************************************/
+bool Exporter::_readBatch(void)
+	{
+	if (!_query)
+		{
+		_query.reset(new QSqlQuery(DbMgr::readerConnection()));
+		_query->setForwardOnly(true);
+		if (!_query->prepare(SQL_EXPORT))
+			{
+			ERR << "Cannot prepare export:" << _query->lastError().text();
+			_finish(false);
+			return false;
+			}
+		}
+
+	_query->bindValue(0, _input);
+	_query->bindValue(1, _to);
+	_query->bindValue(2, _resume);
+	_query->bindValue(3, _resume);
+	_query->bindValue(4, _to);
+	_query->bindValue(5, EXPORT_BATCH_ROWS);
+	if (!_query->exec())
+		{
+		ERR << "Cannot export input" << _input << ":"
+			<< _query->lastError().text();
+		_finish(false);
+		return false;
+		}
+
+	_batch.clear();
+	_read = 0;
+	while (_query->next())
+		_batch.append({_query->value(0).toLongLong(),
+					   _query->value(1).toDouble()});
+	_query->finish();
+
+	_more = (_batch.size() == EXPORT_BATCH_ROWS);
+	if (_more)
+		_resume = _batch.last().at + 1;
+	return true;
+	}
+
+/******************************************************************************\
+|* Encode a row
+\******************************************************************************/
+void Exporter::_encode(qint64 at, double value)
+	{
+	if (_format == CSV)
+		{
+		appendNumber(_text, at);
+		_text.append(',').append(_label).append(',');
+		appendNumber(_text, value);
+		_text.append('\n');
+		}
+	else
+		{
+		_text.append("{\"at\":");
+		appendNumber(_text, at);
+		_text.append(",\"input\":").append(_label).append(",\"value\":");
+		appendNumber(_text, value);
+		_text.append("}\n");
+		}
+	_rows ++;
+	}
+
+/******************************************************************************\
+|* Compress whatever's in _text onto the end of _out
+\******************************************************************************/
+bool Exporter::_deflate(bool last)
+	{
+	_zs.next_in		= reinterpret_cast<Bytef *>(_text.data());
+	_zs.avail_in	= static_cast<uInt>(_text.size());
+
+	int rc;
+	do
+		{
+		int used = _out.size();
+		_out.resize(used + EXPORT_CHUNK_BYTES);
+		_zs.next_out	= reinterpret_cast<Bytef *>(_out.data() + used);
+		_zs.avail_out	= EXPORT_CHUNK_BYTES;
+
+		rc = deflate(&_zs, last ? Z_FINISH : Z_NO_FLUSH);
+		_out.resize(used + EXPORT_CHUNK_BYTES - _zs.avail_out);
+		if ((rc != Z_OK) && (rc != Z_STREAM_END) && (rc != Z_BUF_ERROR))
+			return false;
+		}
+	while ((_zs.avail_out == 0) || (last && (rc != Z_STREAM_END)));
+
+	_text.clear();
+	return true;
+	}
+
+/******************************************************************************\
+|* All done, one way or the other
+\******************************************************************************/
+void Exporter::_finish(bool ok)
+	{
+	_done = true;
+	_query.reset();
+	LOG << "Export" << (ok ? "complete:" : "failed after") << _rows << "rows,"
+		<< _bytes << "bytes";
+	emit finished(_rows, ok);
+	}
+
+
+#pragma mark - Slots
+
+/******************************************************************************\
+|* Slot: Produce chunks until the transport has enough queued, or we're done
+\******************************************************************************/
+void Exporter::pump(void)
+	{
+	if (_done)
+		return;
+
+	if (!_started)
+		{
+		_started = true;
+		if (_format == CSV)
+			_text.append("at,input,value\n");
+		}
+
+	while (_queued() < EXPORT_HIGH_WATER)
+		{
+		/**********************************************************************\
+		|* Encode a chunk's worth of rows, reading batches as we need them
+		|* and moving through the inputs
+		\**********************************************************************/
+		bool last = false;
+		while (_text.size() < EXPORT_CHUNK_BYTES)
+			{
+			if (_read < _batch.size())
+				{
+				const Row& row = _batch[_read++];
+				_encode(row.at, row.value);
+				}
+			else if (_more)
+				{
+				if (!_readBatch())
+					return;
+				}
+			else if (!_nextInput())
+				{
+				last = true;
+				break;
+				}
+			}
+
+		/**********************************************************************\
+		|* Compress it and hand on whatever the compressor has produced
+		\**********************************************************************/
+		if (!_deflate(last))
+			{
+			ERR << "Compression failed:" << _zs.msg;
+			_finish(false);
+			return;
+			}
+
+		if (!_out.isEmpty())
+			{
+			if (!_write(_out))
+				{
+				_finish(false);
+				return;
+				}
+			_bytes += _out.size();
+			_out.clear();
+			}
+
+		if (last)
+			{
+			_finish(true);
+			return;
+			}
+		}
+	}
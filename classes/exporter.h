@@ -0,0 +1,147 @@
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+#include <functional>
+#include <memory>
+
+#include <zlib.h>
+
+#include <QObject>
+#include <QVector>
+
+#include "properties.h"
+
+QT_FORWARD_DECLARE_CLASS(QSqlQuery)
+
+/******************************************************************************\
+|* Streams readings out as gzipped CSV or NDJSON. Rows are read a batch at
+|* a time, each batch in its own short read transaction carrying on from the
+|* last row's time, so a long export never holds the database open. They go
+|* through the encoder and the compressor to the transport a chunk at a
+|* time, and we stop producing whenever the transport has more than a little
+|* queued, so memory use doesn't depend on the size of the export. The
+|* transport calls pump() as it drains.
+\******************************************************************************/
+class Exporter : public QObject
+	{
+	Q_OBJECT
+
+	public:
+		/**********************************************************************\
+		|* Typedefs and enums
+		\**********************************************************************/
+		enum Format
+			{
+			CSV = 0,
+			NDJSON
+			};
+
+		typedef std::function<bool(const QByteArray& data)> Write;
+		typedef std::function<qint64(void)> Queued;
+
+	/**************************************************************************\
+	|* Properties
+	\**************************************************************************/
+	GET(Format, format);				// Output format
+	GET(qint64, rows);					// Rows written so far
+	GET(qint64, bytes);					// Compressed bytes written so far
+
+	private:
+		/**********************************************************************\
+		|* A row read, not yet encoded
+		\**********************************************************************/
+		struct Row
+			{
+			qint64	at;
+			double	value;
+			};
+
+		/**********************************************************************\
+		|* Private variables
+		\**********************************************************************/
+		QVector<qint64>				_inputs;	// What to export
+		qint64						_from;		// Start time (ms, inclusive)
+		qint64						_to;		// End time (ms, exclusive)
+		Write						_write;		// Hand data to the transport
+		Queued						_queued;	// Bytes the transport holds
+		int							_next;		// Next entry in _inputs
+		std::unique_ptr<QSqlQuery>	_query;		// Reads a batch of rows
+		qint64						_input;		// Current input
+		qint64						_resume;	// Read on from here (ms)
+		bool						_more;		// Input may have more rows
+		QVector<Row>				_batch;		// Rows read, not encoded
+		int							_read;		// Next entry in _batch
+		QByteArray					_label;		// Encoded current input
+		QByteArray					_text;		// Encoded, not compressed
+		QByteArray					_out;		// Compressed, not written
+		z_stream					_zs;		// gzip state
+		bool						_started;	// Header written
+		bool						_done;		// Finished (or failed)
+
+		/**********************************************************************\
+		|* Move on to the next input, false if there are no more
+		\**********************************************************************/
+		bool _nextInput(void);
+
+		/**********************************************************************\
+		|* Read the next batch of the current input's rows. Returns false if
+		|* that failed (and the export is finished)
+		\**********************************************************************/
+		bool _readBatch(void);
+
+		/**********************************************************************\
+		|* Encode one row into _text
+		\**********************************************************************/
+		void _encode(qint64 at, double value);
+
+		/**********************************************************************\
+		|* Compress _text into _out, finishing the stream if 'last'
+		\**********************************************************************/
+		bool _deflate(bool last);
+
+		/**********************************************************************\
+		|* Stop, telling the world how it went
+		\**********************************************************************/
+		void _finish(bool ok);
+
+	public:
+		/**********************************************************************\
+		|* Constructor / Destructor. An empty input list means all inputs
+		\**********************************************************************/
+		explicit Exporter(Format format,
+						  const QVector<qint64>& inputs,
+						  qint64 from,
+						  qint64 to,
+						  Write write,
+						  Queued queued,
+						  QObject *parent = nullptr);
+		~Exporter(void) override;
+
+		/**********************************************************************\
+		|* Parse "<csv|ndjson> <input>[,<input>...]|* <from> <to>"
+		\**********************************************************************/
+		static bool parse(const QString& request,
+						  Format& format,
+						  QVector<qint64>& inputs,
+						  qint64& from,
+						  qint64& to);
+
+		/**********************************************************************\
+		|* MIME type for a format
+		\**********************************************************************/
+		static const char * contentType(Format format);
+
+	public slots:
+		/**********************************************************************\
+		|* Produce output until the transport is full or we're done
+		\**********************************************************************/
+		void pump(void);
+
+	signals:
+		/**********************************************************************\
+		|* The export has ended, successfully or not
+		\**********************************************************************/
+		void finished(qint64 rows, bool ok);
+	};
+
+#endif // EXPORTER_H
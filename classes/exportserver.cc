@@ -0,0 +1,174 @@
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QUrl>
+#include <QUrlQuery>
+
+#include "constants.h"
+#include "exporter.h"
+#include "exportserver.h"
+
+/******************************************************************************\
+|* Requests larger than this are refused rather than buffered
+\******************************************************************************/
+#define EXPORT_MAX_HEAD			8192
+
+/******************************************************************************\
+|* Categorised logging support
+\******************************************************************************/
+Q_LOGGING_CATEGORY(log_http, "reefd:http")
+
+#define LOG qDebug(log_http) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define ERR qCritical(log_http) << QTime::currentTime().toString("hh:mm:ss.zzz")
+
+/******************************************************************************\
+|* Constructor
+\******************************************************************************/
+ExportServer::ExportServer(QObject *parent)
+			 :QObject{parent}
+			 ,_server(nullptr)
+	{
+	}
+
+/******************************************************************************\
+|* Initialise
+\******************************************************************************/
+void ExportServer::init(int port)
+	{
+	if (port <= 0)
+		return;
+
+	_server = new QTcpServer(this);
+	if (_server->listen(QHostAddress::Any, port))
+		{
+		LOG << "Starting export server on port" << port;
+		connect(_server, &QTcpServer::newConnection,
+				this, &ExportServer::_onNewConnection);
+		}
+	else
+		ERR << "Cannot start export server on port" << port;
+	}
+
+
+#pragma mark - Private methods
+
+/******************************************************************************\
+|* Send an error status and hang up
+\******************************************************************************/
+void ExportServer::_fail(QTcpSocket *peer, const char *status)
+	{
+	peer->write(QByteArray("HTTP/1.1 ") + status + "\r\n"
+				"Content-Length: 0\r\n"
+				"Connection: close\r\n\r\n");
+	peer->disconnectFromHost();
+	}
+
+/******************************************************************************\
+|* Parse the request line and start the export. The query parameters are
+|* turned into the same request string the WebSocket uses
+\******************************************************************************/
+void ExportServer::_handle(QTcpSocket *peer, const QByteArray& head)
+	{
+	QList<QByteArray> line = head.left(head.indexOf("\r\n")).split(' ');
+	if ((line.size() != 3) || (line[0] != "GET"))
+		{
+		_fail(peer, "405 Method Not Allowed");
+		return;
+		}
+
+	QUrl url(QString::fromLatin1(line[1]));
+	QString format;
+	if (url.path() == "/export.csv")
+		format = "csv";
+	else if (url.path() == "/export.ndjson")
+		format = "ndjson";
+	else
+		{
+		_fail(peer, "404 Not Found");
+		return;
+		}
+
+	QUrlQuery params(url);
+	QString inputs = params.queryItemValue("inputs");
+	QString request = QString("%1 %2 %3 %4")
+		.arg(format,
+			 inputs.isEmpty() ? "*" : inputs,
+			 params.queryItemValue("from"),
+			 params.queryItemValue("to"));
+
+	Exporter::Format fmt;
+	QVector<qint64> ids;
+	qint64 from, to;
+	if (!Exporter::parse(request, fmt, ids, from, to))
+		{
+		_fail(peer, "400 Bad Request");
+		return;
+		}
+
+	LOG << "Export for" << peer->peerAddress().toString() << ":" << request;
+	peer->write(QByteArray("HTTP/1.1 200 OK\r\n"
+						   "Content-Type: ") + Exporter::contentType(fmt) +
+				"\r\nContent-Encoding: gzip\r\n"
+				"Content-Disposition: attachment; filename=\"export." +
+				format.toLatin1() + "\"\r\n"
+				"Connection: close\r\n\r\n");
+
+	Exporter *exporter = new Exporter(fmt, ids, from, to,
+		[peer](const QByteArray& data)
+			{
+			return peer->write(data) == data.size();
+			},
+		[peer]()
+			{
+			return peer->bytesToWrite();
+			},
+		peer);
+
+	connect(peer, &QTcpSocket::bytesWritten, exporter, &Exporter::pump);
+	connect(exporter, &Exporter::finished, peer,
+		[peer](qint64, bool)
+			{
+			peer->disconnectFromHost();
+			});
+
+	exporter->pump();
+	}
+
+
+#pragma mark - Private slots
+
+/******************************************************************************\
+|* Handle a client connecting
+\******************************************************************************/
+void ExportServer::_onNewConnection(void)
+	{
+	while (QTcpSocket *peer = _server->nextPendingConnection())
+		{
+		connect(peer, &QTcpSocket::readyRead,
+				this, &ExportServer::_onReadyRead);
+		connect(peer, &QTcpSocket::disconnected,
+				peer, &QTcpSocket::deleteLater);
+		}
+	}
+
+/******************************************************************************\
+|* Collect the request head. Only the first request on a connection is
+|* served, anything after it is ignored
+\******************************************************************************/
+void ExportServer::_onReadyRead(void)
+	{
+	QTcpSocket *peer = qobject_cast<QTcpSocket *>(sender());
+	if (peer == nullptr)
+		return;
+
+	QByteArray head = peer->property("head").toByteArray() + peer->readAll();
+	if (head.contains("\r\n\r\n"))
+		{
+		disconnect(peer, &QTcpSocket::readyRead,
+				   this, &ExportServer::_onReadyRead);
+		_handle(peer, head);
+		}
+	else if (head.size() > EXPORT_MAX_HEAD)
+		_fail(peer, "431 Request Header Fields Too Large");
+	else
+		peer->setProperty("head", head);
+	}
@@ -0,0 +1,59 @@
+#ifndef EXPORTSERVER_H
+#define EXPORTSERVER_H
+
+#include <QObject>
+
+#include "properties.h"
+
+QT_FORWARD_DECLARE_CLASS(QTcpServer)
+QT_FORWARD_DECLARE_CLASS(QTcpSocket)
+
+/******************************************************************************\
+|* A minimal HTTP endpoint so exports can be fetched with a browser or curl:
+|*
+|*   GET /export.csv?inputs=1,2&from=<ms>&to=<ms>
+|*   GET /export.ndjson?from=<ms>&to=<ms>          (all inputs)
+|*
+|* The body is the Exporter's gzip stream, sent with Content-Encoding: gzip
+|* and delimited by closing the connection. Lives on the network thread
+\******************************************************************************/
+class ExportServer : public QObject
+	{
+	Q_OBJECT
+
+	private:
+		/**********************************************************************\
+		|* Private variables
+		\**********************************************************************/
+		QTcpServer *		_server;		// Listening socket
+
+		/**********************************************************************\
+		|* Send a bodyless response and close
+		\**********************************************************************/
+		void _fail(QTcpSocket *peer, const char *status);
+
+		/**********************************************************************\
+		|* Handle a complete request head
+		\**********************************************************************/
+		void _handle(QTcpSocket *peer, const QByteArray& head);
+
+	private slots:
+		/**********************************************************************\
+		|* Private slots - for the TCP server
+		\**********************************************************************/
+		void _onNewConnection(void);
+		void _onReadyRead(void);
+
+	public:
+		/**********************************************************************\
+		|* Constructor
+		\**********************************************************************/
+		explicit ExportServer(QObject *parent = nullptr);
+
+		/**********************************************************************\
+		|* Start listening
+		\**********************************************************************/
+		void init(int port);
+	};
+
+#endif // EXPORTSERVER_H
@@ -0,0 +1,394 @@
+#include <atomic>
+#include <memory>
+#include <queue>
+#include <vector>
+
+#include <QElapsedTimer>
+#include <QRunnable>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QThread>
+
+#include "constants.h"
+#include "dmbgr.h"
+#include "history.h"
+
+/******************************************************************************\
+|* Tuning: roughly how many rows each pool task should read. Small segments
+|* are grouped so we don't pay per-task overhead on every one
+\******************************************************************************/
+#define HISTORY_TASK_ROWS		32768
+
+/******************************************************************************\
+|* The reply when the query can't be answered
+\******************************************************************************/
+#define HISTORY_NULL			"{\"history\":null,\"method\":\"History\"}"
+
+/******************************************************************************\
+|* The scans, with and without a value filter. Both are range searches on the
+|* (segment, at) primary key, and the merge relies on each run being in time
+|* order, so that's asked for rather than assumed
+\******************************************************************************/
+#define SQL_SCAN				"SELECT at, value FROM readings "				\
+								"WHERE segment = ? AND at >= ? AND at < ? "		\
+								"ORDER BY at"
+#define SQL_SCAN_FILTERED		"SELECT at, value FROM readings "				\
+								"WHERE segment = ? AND at >= ? AND at < ? "		\
+								"AND value BETWEEN ? AND ? ORDER BY at"
+
+/******************************************************************************\
+|* Categorised logging support
+\******************************************************************************/
+Q_LOGGING_CATEGORY(log_hist, "reefd:history")
+
+#define LOG qDebug(log_hist) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define ERR qCritical(log_hist) << QTime::currentTime().toString("hh:mm:ss.zzz")
+
+/******************************************************************************\
+|* One segment to read, and which run its rows go into
+\******************************************************************************/
+typedef struct
+	{
+	qint64		segment;			// segments.id
+	qint64		input;				// segments.input
+	bool		filter;				// Segment range isn't wholly wanted
+	size_t		run;				// Index into Job::runs
+	} Scan;
+
+/******************************************************************************\
+|* A query in flight, shared by all its tasks. Each task writes only to its
+|* own runs, and whichever finishes last merges them and sends the result
+\******************************************************************************/
+typedef struct
+	{
+	History *				owner;		// To emit the result through
+	QString					identifier;	// Who asked
+	History::Query			query;		// What they asked for
+	std::vector<Readings>	runs;		// One per scanned segment
+	std::atomic<int>		remaining;	// Tasks still running
+	std::atomic<bool>		failed;		// A scan went wrong
+	QElapsedTimer			timer;		// Time since the query started
+	} Job;
+
+/******************************************************************************\
+|* Helper function: Render the result as JSON
+\******************************************************************************/
+static QString render(const History::Query& query, const Readings& rows)
+	{
+	QByteArray json;
+	json.reserve(64 + rows.size() * 32);
+
+	json.append("{\"history\":{\"inputs\":[");
+	for (int i=0; i<query.inputs.size(); i++)
+		{
+		if (i > 0)
+			json.append(',');
+		json.append(QByteArray::number(query.inputs[i]));
+		}
+	json.append("],\"from\":").append(QByteArray::number(query.from));
+	json.append(",\"to\":").append(QByteArray::number(query.to));
+	json.append(",\"rows\":[");
+
+	bool first = true;
+	for (const Reading& row : rows)
+		{
+		if (!first)
+			json.append(',');
+		first = false;
+
+		json.append('[').append(QByteArray::number(row.at));
+		json.append(',').append(QByteArray::number(row.input));
+		json.append(',').append(QByteArray::number(row.value, 'g', 10));
+		json.append(']');
+		}
+	json.append("]},\"method\":\"History\"}");
+	return QString::fromUtf8(json);
+	}
+
+/******************************************************************************\
+|* Helper function: Everything's been read, merge it and send it on
+\******************************************************************************/
+static void finish(std::shared_ptr<Job> job)
+	{
+	if (job->failed)
+		{
+		emit job->owner->fetchedHistory(HISTORY_NULL, job->identifier);
+		return;
+		}
+
+	QVector<Readings> runs;
+	runs.reserve(static_cast<int>(job->runs.size()));
+	for (Readings& run : job->runs)
+		runs.append(std::move(run));
+
+	Readings rows = History::merge(runs);
+	LOG << "History for" << job->query.inputs.size() << "inputs:" << rows.size()
+		<< "rows from" << runs.size() << "segments in" << job->timer.elapsed()
+		<< "ms";
+	emit job->owner->fetchedHistory(render(job->query, rows), job->identifier);
+	}
+
+/******************************************************************************\
+|* Pool task: read a group of segments, each into its own run
+\******************************************************************************/
+class ScanTask : public QRunnable
+	{
+	private:
+		std::shared_ptr<Job>	_job;
+		QVector<Scan>			_scans;
+
+	public:
+		ScanTask(std::shared_ptr<Job> job, const QVector<Scan>& scans)
+			:_job(job)
+			,_scans(scans)
+			{
+			setAutoDelete(true);
+			}
+
+		void run(void) override
+			{
+			QSqlDatabase db = DbMgr::readerConnection();
+			QSqlQuery plain(db);
+			QSqlQuery filtered(db);
+			plain.setForwardOnly(true);
+			filtered.setForwardOnly(true);
+			plain.prepare(SQL_SCAN);
+			filtered.prepare(SQL_SCAN_FILTERED);
+
+			const History::Query& query = _job->query;
+			for (const Scan& scan : std::as_const(_scans))
+				{
+				QSqlQuery& sql = scan.filter ? filtered : plain;
+				sql.bindValue(0, scan.segment);
+				sql.bindValue(1, query.from);
+				sql.bindValue(2, query.to);
+				if (scan.filter)
+					{
+					sql.bindValue(3, query.minValue);
+					sql.bindValue(4, query.maxValue);
+					}
+
+				if (!sql.exec())
+					{
+					ERR << "Cannot scan segment" << scan.segment << ":"
+						<< sql.lastError().text();
+					_job->failed = true;
+					break;
+					}
+
+				Readings& run = _job->runs[scan.run];
+				while (sql.next())
+					run.append({scan.input,
+								sql.value(0).toLongLong(),
+								sql.value(1).toDouble()});
+				sql.finish();
+				}
+
+			if (--_job->remaining == 0)
+				finish(_job);
+			}
+	};
+
+/******************************************************************************\
+|* Constructor
+\******************************************************************************/
+History::History(QObject *parent)
+		:QObject{parent}
+		,_segmentsPruned(0)
+		,_segmentsScanned(0)
+	{
+	// Threads keep their reader connection, so don't let them expire
+	_pool.setExpiryTimeout(-1);
+	_pool.setMaxThreadCount(QThread::idealThreadCount());
+	}
+
+/******************************************************************************\
+|* Destructor
+\******************************************************************************/
+History::~History(void)
+	{
+	_pool.waitForDone();
+	}
+
+/******************************************************************************\
+|* Plan the scans for a query and hand them to the pool. Call on the DbMgr
+|* thread, which owns the default connection
+\******************************************************************************/
+void History::run(const Query& query, const QString& identifier)
+	{
+	std::shared_ptr<Job> job = std::make_shared<Job>();
+	job->owner		= this;
+	job->identifier	= identifier;
+	job->query		= query;
+	job->remaining	= 0;
+	job->failed		= false;
+	job->timer.start();
+
+	/**************************************************************************\
+	|* Find the segments overlapping the time range, dropping any whose value
+	|* range can't contain anything wanted
+	\**************************************************************************/
+	QVector<Scan> scans;
+	QVector<qint64> rows;
+
+	QSqlQuery sql;
+	sql.setForwardOnly(true);
+	sql.prepare("SELECT id, startAt, endAt, rows, minValue, maxValue "
+				"FROM segments WHERE input = ? AND startAt < ? AND endAt > ? "
+				"ORDER BY startAt");
+	for (qint64 input : query.inputs)
+		{
+		sql.bindValue(0, input);
+		sql.bindValue(1, query.to);
+		sql.bindValue(2, query.from);
+		if (!sql.exec())
+			{
+			ERR << "Cannot plan history for input" << input << ":"
+				<< sql.lastError().text();
+			continue;
+			}
+
+		while (sql.next())
+			{
+			qint64 count	= sql.value(3).toLongLong();
+			double min		= sql.value(4).toDouble();
+			double max		= sql.value(5).toDouble();
+
+			if ((count == 0)
+			 || (query.filtered && ((max < query.minValue)
+								 || (min > query.maxValue))))
+				{
+				_segmentsPruned ++;
+				continue;
+				}
+
+			bool inside = !query.filtered
+					   || ((min >= query.minValue) && (max <= query.maxValue));
+			scans.append({sql.value(0).toLongLong(), input, !inside,
+						  static_cast<size_t>(scans.size())});
+			rows.append(count);
+			}
+		sql.finish();
+		}
+
+	_segmentsScanned += scans.size();
+	job->runs.resize(scans.size());
+	if (scans.isEmpty())
+		{
+		finish(job);
+		return;
+		}
+
+	/**************************************************************************\
+	|* Group the scans into tasks of about HISTORY_TASK_ROWS rows each. All
+	|* the tasks are counted before any start, so none can finish early
+	\**************************************************************************/
+	QVector<QVector<Scan>> tasks;
+	qint64 taskRows = HISTORY_TASK_ROWS;
+	for (int i=0; i<scans.size(); i++)
+		{
+		if (taskRows >= HISTORY_TASK_ROWS)
+			{
+			tasks.append(QVector<Scan>());
+			taskRows = 0;
+			}
+		tasks.last().append(scans[i]);
+		taskRows += rows[i];
+		}
+
+	job->remaining = tasks.size();
+	for (const QVector<Scan>& task : std::as_const(tasks))
+		_pool.start(new ScanTask(job, task));
+	}
+
+/******************************************************************************\
+|* k-way merge of the time-sorted runs, ties broken by run order
+\******************************************************************************/
+Readings History::merge(const QVector<Readings>& runs)
+	{
+	if (runs.size() == 1)
+		return runs.first();
+
+	typedef std::pair<qint64, int> Head;		// (at, run)
+	std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+	std::vector<int> next(runs.size(), 0);
+
+	int total = 0;
+	for (int i=0; i<runs.size(); i++)
+		{
+		total += runs[i].size();
+		if (!runs[i].isEmpty())
+			heads.push({runs[i].first().at, i});
+		}
+
+	Readings merged;
+	merged.reserve(total);
+	while (!heads.empty())
+		{
+		int run = heads.top().second;
+		heads.pop();
+
+		merged.append(runs[run][next[run]]);
+		if (++next[run] < runs[run].size())
+			heads.push({runs[run][next[run]].at, run});
+		}
+	return merged;
+	}
+
+
+#pragma mark - Private methods
+
+/******************************************************************************\
+|* Parse "<input>[,<input>...] <from> <to> [<minValue> <maxValue>]"
+\******************************************************************************/
+bool History::_parse(const QString& request, Query& query)
+	{
+	QStringList parts = request.split(' ', Qt::SkipEmptyParts);
+	if ((parts.size() != 3) && (parts.size() != 5))
+		return false;
+
+	bool ok = true;
+	query.inputs.clear();
+	for (const QString& id : parts[0].split(',', Qt::SkipEmptyParts))
+		{
+		query.inputs.append(id.toLongLong(&ok));
+		if (!ok)
+			return false;
+		}
+
+	bool fromOk, toOk;
+	query.from		= parts[1].toLongLong(&fromOk);
+	query.to		= parts[2].toLongLong(&toOk);
+	query.filtered	= (parts.size() == 5);
+	if (!fromOk || !toOk || query.inputs.isEmpty())
+		return false;
+
+	if (query.filtered)
+		{
+		bool minOk, maxOk;
+		query.minValue = parts[3].toDouble(&minOk);
+		query.maxValue = parts[4].toDouble(&maxOk);
+		if (!minOk || !maxOk)
+			return false;
+		}
+	return true;
+	}
+
+
+#pragma mark - Slots
+
+/******************************************************************************\
+|* Slot: Run a history query for a client
+\******************************************************************************/
+void History::fetchHistory(QString request, QString identifier)
+	{
+	Query query;
+	if (!_parse(request, query))
+		{
+		ERR << "Bad history request" << request;
+		emit fetchedHistory(HISTORY_NULL, identifier);
+		return;
+		}
+	run(query, identifier);
+	}
@@ -0,0 +1,85 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <QObject>
+#include <QThreadPool>
+#include <QVector>
+
+#include "properties.h"
+#include "reading.h"
+
+/******************************************************************************\
+|* Range queries over the readings store. A query names some inputs, a time
+|* range and optionally a value range. The segments it touches are found on
+|* the calling (DbMgr) thread, pruned on their time span and min/max values,
+|* then scanned in parallel on a thread pool, each pool thread using its own
+|* read-only connection. Each scan produces a run sorted by time, and the
+|* runs are merged into one time-ordered result by the last scan to finish
+\******************************************************************************/
+class History : public QObject
+	{
+	Q_OBJECT
+
+	public:
+		/**********************************************************************\
+		|* Typedefs and enums
+		\**********************************************************************/
+		struct Query
+			{
+			QVector<qint64>	inputs;			// Inputs to fetch
+			qint64			from;			// Start time (ms, inclusive)
+			qint64			to;				// End time (ms, exclusive)
+			bool			filtered;		// Apply the value range
+			double			minValue;		// Lowest value wanted
+			double			maxValue;		// Highest value wanted
+			};
+
+	/**************************************************************************\
+	|* Properties
+	\**************************************************************************/
+	GET(qint64, segmentsPruned);		// Segments skipped without a scan
+	GET(qint64, segmentsScanned);		// Segments actually read
+
+	private:
+		/**********************************************************************\
+		|* Private variables
+		\**********************************************************************/
+		QThreadPool			_pool;			// Runs the segment scans
+
+		/**********************************************************************\
+		|* Parse a "History" request, returning false if it's malformed
+		\**********************************************************************/
+		bool _parse(const QString& request, Query& query);
+
+	public:
+		/**********************************************************************\
+		|* Constructor / Destructor
+		\**********************************************************************/
+		explicit History(QObject *parent = nullptr);
+		~History(void) override;
+
+		/**********************************************************************\
+		|* Run a query. The result arrives later via fetchedHistory()
+		\**********************************************************************/
+		void run(const Query& query, const QString& identifier);
+
+		/**********************************************************************\
+		|* Merge time-sorted runs into one time-sorted list
+		\**********************************************************************/
+		static Readings merge(const QVector<Readings>& runs);
+
+	signals:
+		/**********************************************************************\
+		|* Tell the world we have the JSON ready. Emitted from a pool thread
+		\**********************************************************************/
+		void fetchedHistory(QString json, QString identifier);
+
+	public slots:
+		/**********************************************************************\
+		|* Accept a request of the form:
+		|*   <input>[,<input>...] <from> <to> [<minValue> <maxValue>]
+		\**********************************************************************/
+		void fetchHistory(QString request, QString identifier);
+	};
+
+#endif // HISTORY_H
@@ -0,0 +1,555 @@
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QSemaphore>
+#include <QThread>
+
+#include "compactor.h"
+#include "constants.h"
+#include "dmbgr.h"
+#include "importer.h"
+#include "topology.h"
+
+/******************************************************************************\
+|* Tuning: how much of the file is parsed at once. Two windows' worth of
+|* readings are in memory at any time: one being written, one being parsed
+\******************************************************************************/
+#define IMPORT_WINDOW_BYTES		(64 * 1024 * 1024LL)
+
+/******************************************************************************\
+|* Integer times below this are seconds since the epoch, not ms (it's about
+|* 1973 in ms, or the year 5138 in seconds)
+\******************************************************************************/
+#define IMPORT_MS_THRESHOLD		100000000000LL
+
+/******************************************************************************\
+|* SocketCAN's flag for a 29-bit identifier, used for 8-digit candump ids
+\******************************************************************************/
+#define CAN_EFF_FLAG			0x80000000u
+
+/******************************************************************************\
+|* Categorised logging support
+\******************************************************************************/
+Q_LOGGING_CATEGORY(log_imp, "reefd:import")
+
+#define LOG qDebug(log_imp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define ERR qCritical(log_imp) << QTime::currentTime().toString("hh:mm:ss.zzz")
+
+/******************************************************************************\
+|* Parsing a line gives one of these
+\******************************************************************************/
+enum
+	{
+	LINE_REJECT	= -1,
+	LINE_SKIP	= 0,
+	LINE_OK		= 1
+	};
+
+/******************************************************************************\
+|* One window of a file being parsed: a run of readings per chunk. Each
+|* chunk's task releases the semaphore once when it's done
+\******************************************************************************/
+typedef struct
+	{
+	std::vector<Readings>	chunks;			// Parsed readings per chunk
+	std::vector<qint64>		rejected;		// Bad lines per chunk
+	QSemaphore				done;			// Released once per chunk
+	qint64					bytes;			// Size of the window
+	} Window;
+
+/******************************************************************************\
+|* Helper function: Step to just past the next newline at or after 'p'
+\******************************************************************************/
+static inline const char * nextLine(const char *p, const char *end)
+	{
+	if (p >= end)
+		return end;
+	const char *nl = static_cast<const char *>(memchr(p, '\n', end - p));
+	return nl ? nl + 1 : end;
+	}
+
+/******************************************************************************\
+|* Helper function: Trim spaces (and a CR) from both ends of a field
+\******************************************************************************/
+static inline void trim(const char *& p, const char *& e)
+	{
+	while ((p < e) && ((*p == ' ') || (*p == '\t')))
+		p ++;
+	while ((e > p) && ((e[-1] == ' ') || (e[-1] == '\t') || (e[-1] == '\r')))
+		e --;
+	}
+
+/******************************************************************************\
+|* Helper function: Parse a whole field as a number
+\******************************************************************************/
+template <typename T>
+static inline bool number(const char *p, const char *e, T& value)
+	{
+	auto result = std::from_chars(p, e, value);
+	return (result.ec == std::errc()) && (result.ptr == e);
+	}
+
+/******************************************************************************\
+|* Helper function: Parse a time as ms since the epoch. See the class notes
+\******************************************************************************/
+static bool parseTime(const char *p, const char *e, qint64& at)
+	{
+	if (memchr(p, '.', e - p) != nullptr)
+		{
+		double seconds;
+		if (!number(p, e, seconds))
+			return false;
+		at = std::llround(seconds * 1000.0);
+		return true;
+		}
+
+	if (!number(p, e, at))
+		return false;
+	if (at < IMPORT_MS_THRESHOLD)
+		at *= 1000;
+	return true;
+	}
+
+/******************************************************************************\
+|* Helper function: Resolve an input given as an id or a name
+\******************************************************************************/
+static bool parseInput(const char *p,
+					   const char *e,
+					   const Importer::Names& names,
+					   qint64& input)
+	{
+	if (number(p, e, input))
+		return true;
+
+	input = names.value(QByteArray::fromRawData(p, static_cast<int>(e - p)), -1);
+	return input >= 0;
+	}
+
+/******************************************************************************\
+|* Helper function: Parse "at,input,value". The input may be quoted
+\******************************************************************************/
+static int parseCsv(const char *p,
+					const char *e,
+					const Importer::Names& names,
+					Readings& out)
+	{
+	if ((*p == '#') || isalpha(static_cast<unsigned char>(*p)))
+		return LINE_SKIP;			// Comment or header
+
+	const char *c1 = static_cast<const char *>(memchr(p, ',', e - p));
+	if (c1 == nullptr)
+		return LINE_REJECT;
+
+	const char *ip = c1 + 1;
+	const char *ie;
+	QByteArray quoted;
+	if ((ip < e) && (*ip == '"'))
+		{
+		for (ie = ip + 1; ie < e; ie ++)
+			if (*ie == '"')
+				{
+				if ((ie + 1 < e) && (ie[1] == '"'))
+					quoted.append(*ie++);
+				else
+					break;
+				}
+			else
+				quoted.append(*ie);
+		if (ie >= e)
+			return LINE_REJECT;
+		ie ++;
+		}
+	else
+		ie = static_cast<const char *>(memchr(ip, ',', e - ip));
+
+	if ((ie == nullptr) || (ie >= e) || (*ie != ','))
+		return LINE_REJECT;
+
+	const char *tp = p, *te = c1;
+	const char *vp = ie + 1, *ve = e;
+	trim(tp, te);
+	trim(vp, ve);
+
+	Reading reading;
+	bool ok = parseTime(tp, te, reading.at) && number(vp, ve, reading.value);
+	if (quoted.isEmpty())
+		{
+		trim(ip, ie);
+		ok = ok && parseInput(ip, ie, names, reading.input);
+		}
+	else
+		ok = ok && parseInput(quoted.constData(),
+							  quoted.constData() + quoted.size(),
+							  names, reading.input);
+	if (!ok)
+		return LINE_REJECT;
+
+	out.append(reading);
+	return LINE_OK;
+	}
+
+/******************************************************************************\
+|* Helper function: Find the value for a key in a flat JSON object, returning
+|* its extent. Strings are returned without their quotes
+\******************************************************************************/
+static bool jsonValue(const char *p,
+					  const char *e,
+					  const char *key,
+					  const char *& vp,
+					  const char *& ve)
+	{
+	size_t len = strlen(key);
+	const char *k = std::search(p, e, key, key + len);
+	if (k == e)
+		return false;
+
+	vp = k + len;
+	while ((vp < e) && ((*vp == ' ') || (*vp == ':')))
+		vp ++;
+	if (vp >= e)
+		return false;
+
+	if (*vp == '"')
+		{
+		vp ++;
+		ve = static_cast<const char *>(memchr(vp, '"', e - vp));
+		return ve != nullptr;
+		}
+
+	for (ve = vp; (ve < e) && (*ve != ',') && (*ve != '}') && (*ve != ' '); ve ++)
+		;
+	return true;
+	}
+
+/******************************************************************************\
+|* Helper function: Parse {"at":..,"input":..,"value":..}
+\******************************************************************************/
+static int parseNdjson(const char *p,
+					   const char *e,
+					   const Importer::Names& names,
+					   Readings& out)
+	{
+	if (*p != '{')
+		return LINE_REJECT;
+
+	const char *ap, *ae, *ip, *ie, *vp, *ve;
+	Reading reading;
+	if (!jsonValue(p, e, "\"at\"", ap, ae)
+	 || !jsonValue(p, e, "\"input\"", ip, ie)
+	 || !jsonValue(p, e, "\"value\"", vp, ve)
+	 || !parseTime(ap, ae, reading.at)
+	 || !parseInput(ip, ie, names, reading.input)
+	 || !number(vp, ve, reading.value))
+		return LINE_REJECT;
+
+	out.append(reading);
+	return LINE_OK;
+	}
+
+/******************************************************************************\
+|* Helper function: Parse a candump -l line and hand the frame to the decoder
+\******************************************************************************/
+static int parseCandump(const char *p,
+						const char *e,
+						const Importer::Decode& decode,
+						Readings& out)
+	{
+	if (*p != '(')
+		return LINE_REJECT;
+
+	const char *tp = p + 1;
+	const char *te = static_cast<const char *>(memchr(tp, ')', e - tp));
+	qint64 at;
+	if ((te == nullptr) || !parseTime(tp, te, at))
+		return LINE_REJECT;
+
+	// Skip the interface name
+	const char *q = te + 1;
+	while ((q < e) && (*q == ' '))
+		q ++;
+	while ((q < e) && (*q != ' '))
+		q ++;
+	while ((q < e) && (*q == ' '))
+		q ++;
+
+	const char *hash = static_cast<const char *>(memchr(q, '#', e - q));
+	quint32 id;
+	if ((hash == nullptr)
+	 || (std::from_chars(q, hash, id, 16).ptr != hash))
+		return LINE_REJECT;
+	if (hash - q == 8)
+		id |= CAN_EFF_FLAG;
+
+	const char *d = hash + 1;
+	if ((d < e) && (*d == 'R'))
+		return LINE_SKIP;			// Remote frame, no data
+	if ((d < e) && (*d == '#'))
+		d += 2;						// CAN FD: "##<flags>"
+
+	quint8 data[64];
+	int length = 0;
+	while ((d + 1 < e) && (length < (int)sizeof(data)))
+		{
+		if (*d == '.')
+			{
+			d ++;
+			continue;
+			}
+		if (std::from_chars(d, d + 2, data[length], 16).ptr != d + 2)
+			return LINE_REJECT;
+		length ++;
+		d += 2;
+		}
+
+	decode(id, data, length, at, out);
+	return LINE_OK;
+	}
+
+/******************************************************************************\
+|* Constructor
+\******************************************************************************/
+Importer::Importer(DbMgr *db)
+		 :_rows(0)
+		 ,_rejected(0)
+		 ,_db(db)
+	{
+	Topology::SnapshotPtr topo = Topology::instance().snapshot();
+	for (const Topology::Input& input : topo->inputs)
+		_names.insert(input.name.toUtf8(), input.id);
+	}
+
+/******************************************************************************\
+|* Set the candump decoder
+\******************************************************************************/
+void Importer::setDecoder(Decode decode)
+	{
+	_decode = decode;
+	}
+
+/******************************************************************************\
+|* Parse a run of lines. Each chunk is sorted by input and time before it's
+|* written, which keeps the inserts close together in the b-trees
+\******************************************************************************/
+void Importer::parse(Format format,
+					 const char *begin,
+					 const char *end,
+					 const Names& names,
+					 const Decode& decode,
+					 Readings& out,
+					 qint64& rejected)
+	{
+	out.reserve(static_cast<int>((end - begin) / 24));
+
+	for (const char *p = begin; p < end; )
+		{
+		const char *next	= nextLine(p, end);
+		const char *e		= (next > p) && (next[-1] == '\n') ? next - 1 : next;
+		trim(p, e);
+
+		if (p < e)
+			{
+			int rc = LINE_REJECT;
+			switch (format)
+				{
+				case CSV:
+					rc = parseCsv(p, e, names, out);
+					break;
+				case NDJSON:
+					rc = parseNdjson(p, e, names, out);
+					break;
+				case CANDUMP:
+					rc = parseCandump(p, e, decode, out);
+					break;
+				default:
+					break;
+				}
+			if (rc == LINE_REJECT)
+				rejected ++;
+			}
+		p = next;
+		}
+
+	std::sort(out.begin(), out.end(), [](const Reading& a, const Reading& b)
+		{
+		return (a.input < b.input) || ((a.input == b.input) && (a.at < b.at));
+		});
+	}
+
+/******************************************************************************\
+|* Import everything, then roll it all up
+\******************************************************************************/
+bool Importer::run(const QStringList& files)
+	{
+	QElapsedTimer timer;
+	timer.start();
+
+	_db->setBulkLoad(true);
+	bool ok = true;
+	for (const QString& file : files)
+		if (!(ok = _importFile(file)))
+			break;
+	_db->setBulkLoad(false);
+
+	if (ok)
+		{
+		QElapsedTimer rollups;
+		rollups.start();
+		ok = _db->compactor().rollupAll();
+		LOG << "Built rollups in" << rollups.elapsed() << "ms";
+		}
+
+	qint64 ms = qMax(timer.elapsed(), 1LL);
+	LOG << "Imported" << _rows << "rows (" << _rejected << "rejected) in"
+		<< ms << "ms:" << (_rows * 1000 / ms) << "rows/s";
+	return ok;
+	}
+
+
+#pragma mark - Private methods
+
+/******************************************************************************\
+|* Work out what's in a file
+\******************************************************************************/
+Importer::Format Importer::_formatOf(const QString& path,
+									 const char *data,
+									 qint64 size)
+	{
+	QString suffix = QFileInfo(path).suffix().toLower();
+	if (suffix == "csv")
+		return CSV;
+	if ((suffix == "ndjson") || (suffix == "jsonl") || (suffix == "json"))
+		return NDJSON;
+	if ((suffix == "log") || (suffix == "candump"))
+		return CANDUMP;
+
+	for (qint64 i=0; i<size; i++)
+		{
+		if (isspace(static_cast<unsigned char>(data[i])))
+			continue;
+		if (data[i] == '{')
+			return NDJSON;
+		if (data[i] == '(')
+			return CANDUMP;
+		return CSV;
+		}
+	return UNKNOWN;
+	}
+
+/******************************************************************************\
+|* Import one file, parsing the next window while the current one is written
+\******************************************************************************/
+bool Importer::_importFile(const QString& path)
+	{
+	QFile file(path);
+	if (!file.open(QFile::ReadOnly))
+		{
+		ERR << "Cannot open" << path;
+		return false;
+		}
+
+	qint64 size = file.size();
+	if (size == 0)
+		return true;
+
+	const char *data = reinterpret_cast<const char *>(file.map(0, size));
+	if (data == nullptr)
+		{
+		ERR << "Cannot map" << path << ":" << file.errorString();
+		return false;
+		}
+	const char *end = data + size;
+
+	Format format = _formatOf(path, data, size);
+	if (format == UNKNOWN)
+		{
+		ERR << "Cannot tell the format of" << path;
+		return false;
+		}
+	if ((format == CANDUMP) && !_decode)
+		{
+		ERR << "Cannot import" << path << ": candump files need signal definitions";
+		return false;
+		}
+
+	/**************************************************************************\
+	|* Start parsing the window at 'pos', one chunk per core
+	\**************************************************************************/
+	int threads = qMax(QThread::idealThreadCount(), 1);
+	const char *pos = data;
+	auto start = [&]() -> std::unique_ptr<Window>
+		{
+		if (pos >= end)
+			return nullptr;
+
+		const char *stop = (end - pos > IMPORT_WINDOW_BYTES)
+						 ? nextLine(pos + IMPORT_WINDOW_BYTES, end)
+						 : end;
+
+		std::unique_ptr<Window> window(new Window);
+		window->chunks.resize(threads);
+		window->rejected.assign(threads, 0);
+		window->bytes = stop - pos;
+
+		const char *from = pos;
+		for (int i=0; i<threads; i++)
+			{
+			const char *to = (i == threads - 1)
+						   ? stop
+						   : qMax(from, nextLine(pos + (stop - pos) * (i + 1) / threads,
+												 stop));
+			Window *w = window.get();
+			_pool.start([this, w, i, format, from, to]()
+				{
+				parse(format, from, to, _names, _decode,
+					  w->chunks[i], w->rejected[i]);
+				w->done.release();
+				});
+			from = to;
+			}
+
+		pos = stop;
+		return window;
+		};
+
+	/**************************************************************************\
+	|* Write each window in turn, with the next one parsing meanwhile
+	\**************************************************************************/
+	QElapsedTimer timer;
+	timer.start();
+	qint64 rows = 0, bytes = 0;
+
+	std::unique_ptr<Window> current = start();
+	while (current)
+		{
+		current->done.acquire(threads);
+		std::unique_ptr<Window> next = start();
+
+		for (int i=0; i<threads; i++)
+			{
+			if (!_db->importReadings(current->chunks[i]))
+				{
+				_pool.waitForDone();
+				return false;
+				}
+			rows		+= current->chunks[i].size();
+			_rejected	+= current->rejected[i];
+			}
+		bytes += current->bytes;
+
+		qint64 ms = qMax(timer.elapsed(), 1LL);
+		LOG << path << ":" << (bytes * 100 / qMax(size, 1LL)) << "%," << rows
+			<< "rows," << (rows * 1000 / ms) << "rows/s";
+
+		current = std::move(next);
+		}
+
+	_rows += rows;
+	return true;
+	}
@@ -0,0 +1,108 @@
+#ifndef IMPORTER_H
+#define IMPORTER_H
+
+#include <functional>
+
+#include <QByteArray>
+#include <QHash>
+#include <QStringList>
+#include <QThreadPool>
+
+#include "properties.h"
+#include "reading.h"
+
+class DbMgr;
+
+/******************************************************************************\
+|* Bulk loader for historical readings (reefd --import). Files are mapped,
+|* cut into windows, and each window is cut into one chunk per core at line
+|* boundaries and parsed in parallel, while the previous window is being
+|* written. Rows go through the normal segment store, one transaction per
+|* chunk, with syncing relaxed for the duration. Rollups are built in one
+|* pass at the end. Understands:
+|*
+|*   CSV     at,input,value            (the Export format)
+|*   NDJSON  {"at":..,"input":..,"value":..}
+|*   candump (1436509052.249713) can0 123#DEADBEEF   (needs a decoder)
+|*
+|* 'input' may be an id or an input name. Times with a fraction, or too
+|* small to be ms since the epoch, are taken as seconds
+\******************************************************************************/
+class Importer
+	{
+	public:
+		/**********************************************************************\
+		|* Typedefs and enums
+		\**********************************************************************/
+		enum Format
+			{
+			UNKNOWN = 0,
+			CSV,
+			NDJSON,
+			CANDUMP
+			};
+
+		// Turn a CAN frame into readings. Called from several threads at once
+		typedef std::function<void(quint32 id,
+								   const quint8 *data,
+								   int length,
+								   qint64 at,
+								   Readings& out)> Decode;
+
+		// Names of inputs, to resolve 'input' fields that aren't ids
+		typedef QHash<QByteArray, qint64> Names;
+
+	/**************************************************************************\
+	|* Properties
+	\**************************************************************************/
+	GET(qint64, rows);					// Rows parsed
+	GET(qint64, rejected);				// Lines that couldn't be parsed
+
+	private:
+		/**********************************************************************\
+		|* Private variables
+		\**********************************************************************/
+		DbMgr *				_db;			// Where the readings go
+		Decode				_decode;		// For candump files
+		Names				_names;			// Input name -> id
+		QThreadPool			_pool;			// Parses chunks
+
+		/**********************************************************************\
+		|* Work out the format of a file from its name and first line
+		\**********************************************************************/
+		static Format _formatOf(const QString& path, const char *data, qint64 size);
+
+		/**********************************************************************\
+		|* Import a single file
+		\**********************************************************************/
+		bool _importFile(const QString& path);
+
+	public:
+		/**********************************************************************\
+		|* Constructor
+		\**********************************************************************/
+		explicit Importer(DbMgr *db);
+
+		/**********************************************************************\
+		|* Set the decoder for candump files
+		\**********************************************************************/
+		void setDecoder(Decode decode);
+
+		/**********************************************************************\
+		|* Import the files and build the rollups. Returns false on any error
+		\**********************************************************************/
+		bool run(const QStringList& files);
+
+		/**********************************************************************\
+		|* Parse the lines in [begin, end) into readings. Thread-safe
+		\**********************************************************************/
+		static void parse(Format format,
+						  const char *begin,
+						  const char *end,
+						  const Names& names,
+						  const Decode& decode,
+						  Readings& out,
+						  qint64& rejected);
+	};
+
+#endif // IMPORTER_H
@@ -0,0 +1,380 @@
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+#include <QDateTime>
+
+#include "constants.h"
+#include "journal.h"
+
+/******************************************************************************\
+|* Tuning: how often we sync, and how big the file gets before we truncate
+\******************************************************************************/
+#define JOURNAL_COMMIT_MS		50
+#define JOURNAL_ROTATE_BYTES	(4 * 1024 * 1024)
+#define JOURNAL_REPLAY_BATCH	4096
+
+/******************************************************************************\
+|* File layout: a header, then fixed-size records each carrying a checksum so
+|* a torn write at the tail can be detected
+\******************************************************************************/
+#define JOURNAL_MAGIC			"REEFJNL1"
+#define JOURNAL_RECORD_MAGIC	0x52454546u
+
+typedef struct
+	{
+	char		magic[8];			// JOURNAL_MAGIC
+	qint64		generation;			// Bumped on every truncation
+	} JournalHeader;
+
+typedef struct
+	{
+	qint64		input;				// Reading::input
+	qint64		at;					// Reading::at
+	double		value;				// Reading::value
+	quint32		check;				// Checksum of the above
+	quint32		magic;				// JOURNAL_RECORD_MAGIC
+	} JournalRecord;
+
+static_assert(sizeof(JournalHeader) == 16, "Journal header must be 16 bytes");
+static_assert(sizeof(JournalRecord) == 32, "Journal record must be 32 bytes");
+
+/******************************************************************************\
+|* Categorised logging support
+\******************************************************************************/
+Q_LOGGING_CATEGORY(log_jnl, "reefd:journal")
+
+#define LOG qDebug(log_jnl) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define ERR qCritical(log_jnl) << QTime::currentTime().toString("hh:mm:ss.zzz")
+
+/******************************************************************************\
+|* Helper function: FNV-1a checksum over the data part of a record
+\******************************************************************************/
+static quint32 checksum(const JournalRecord& record)
+	{
+	const uint8_t *data = reinterpret_cast<const uint8_t *>(&record);
+	quint32 hash = 2166136261u;
+	for (size_t i=0; i<offsetof(JournalRecord, check); i++)
+		hash = (hash ^ data[i]) * 16777619u;
+	return hash;
+	}
+
+/******************************************************************************\
+|* Helper function: Is this record intact
+\******************************************************************************/
+static bool valid(const JournalRecord& record)
+	{
+	return (record.magic == JOURNAL_RECORD_MAGIC)
+		&& (record.check == checksum(record));
+	}
+
+/******************************************************************************\
+|* Helper function: Read and check the header, returning the generation or -1
+\******************************************************************************/
+static qint64 readHeader(QFile& file)
+	{
+	JournalHeader header;
+	if (!file.seek(0)
+	 || (file.read(reinterpret_cast<char *>(&header), sizeof(header))
+			!= sizeof(header))
+	 || (memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0))
+		return -1;
+	return header.generation;
+	}
+
+/******************************************************************************\
+|* Helper function: Flush Qt's buffer and get the data onto the disk
+\******************************************************************************/
+static bool sync(QFile& file)
+	{
+	if (!file.flush())
+		return false;
+#ifdef Q_OS_LINUX
+	return ::fdatasync(file.handle()) == 0;
+#else
+	return ::fsync(file.handle()) == 0;
+#endif
+	}
+
+/******************************************************************************\
+|* Constructor
+\******************************************************************************/
+Journal::Journal(const QString& path, QObject *parent)
+		:QObject{parent}
+		,_generation(0)
+		,_written(0)
+		,_path(path)
+		,_timer(this)
+		,_applied(-1)
+	{
+	_timer.setInterval(JOURNAL_COMMIT_MS);
+	connect(&_timer, &QTimer::timeout, this, &Journal::_commit);
+	}
+
+/******************************************************************************\
+|* Destructor
+\******************************************************************************/
+Journal::~Journal(void)
+	{
+	if (_file.isOpen())
+		stop();
+	}
+
+/******************************************************************************\
+|* Replay everything after (generation, offset)
+\******************************************************************************/
+qint64 Journal::replay(const QString& path,
+					   qint64 generation,
+					   qint64 offset,
+					   Replay apply)
+	{
+	QFile file(path);
+	if (!file.open(QFile::ReadOnly))
+		return 0;
+
+	/**************************************************************************\
+	|* A newer generation than the applier has seen means all of it is new
+	\**************************************************************************/
+	qint64 fileGeneration = readHeader(file);
+	if (fileGeneration < 0)
+		{
+		ERR << "Journal" << path << "has no valid header - not replaying";
+		return 0;
+		}
+	if (fileGeneration < generation)
+		return 0;
+	if ((fileGeneration > generation) || (offset < (qint64)sizeof(JournalHeader)))
+		offset = sizeof(JournalHeader);
+
+	/**************************************************************************\
+	|* Replay whole records in batches until the end or a torn record
+	\**************************************************************************/
+	offset -= (offset - sizeof(JournalHeader)) % sizeof(JournalRecord);
+	if (!file.seek(offset))
+		return 0;
+
+	qint64 total = 0;
+	Readings batch;
+	batch.reserve(JOURNAL_REPLAY_BATCH);
+
+	JournalRecord record;
+	while (file.read(reinterpret_cast<char *>(&record), sizeof(record))
+			== sizeof(record))
+		{
+		if (!valid(record))
+			break;
+
+		batch.append({record.input, record.at, record.value});
+		offset += sizeof(record);
+		if (batch.size() == JOURNAL_REPLAY_BATCH)
+			{
+			apply(batch, fileGeneration, offset);
+			total += batch.size();
+			batch.clear();
+			}
+		}
+
+	if (!batch.isEmpty())
+		{
+		apply(batch, fileGeneration, offset);
+		total += batch.size();
+		}
+	return total;
+	}
+
+/******************************************************************************\
+|* Append a reading
+\******************************************************************************/
+void Journal::append(const Reading& reading)
+	{
+	QMutexLocker guard(&_lock);
+	_pending.append(reading);
+	}
+
+/******************************************************************************\
+|* Append several readings
+\******************************************************************************/
+void Journal::append(const Readings& readings)
+	{
+	QMutexLocker guard(&_lock);
+	_pending.append(readings);
+	}
+
+/******************************************************************************\
+|* Append a run of readings, eg: all those from one CAN frame, under one lock
+\******************************************************************************/
+void Journal::append(const Reading *readings, int count)
+	{
+	QMutexLocker guard(&_lock);
+	for (int i=0; i<count; i++)
+		_pending.append(readings[i]);
+	}
+
+
+#pragma mark - Private methods
+
+/******************************************************************************\
+|* Start a new, empty generation. The new file is written and synced aside,
+|* then renamed over the old one so there's never a moment without a valid
+|* header. The generation is time-based so it always moves forward
+\******************************************************************************/
+bool Journal::_rotate(void)
+	{
+	QString next = _path + ".new";
+	QFile file(next);
+	if (!file.open(QFile::WriteOnly | QFile::Truncate))
+		{
+		ERR << "Cannot create" << next;
+		return false;
+		}
+
+	JournalHeader header;
+	memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+	header.generation = qMax(_generation + 1, QDateTime::currentMSecsSinceEpoch());
+
+	if ((file.write(reinterpret_cast<const char *>(&header), sizeof(header))
+			!= sizeof(header))
+	 || !sync(file))
+		{
+		ERR << "Cannot write" << next;
+		return false;
+		}
+	file.close();
+
+	if (::rename(QFile::encodeName(next).constData(),
+				 QFile::encodeName(_path).constData()) != 0)
+		{
+		ERR << "Cannot rename" << next << "to" << _path;
+		return false;
+		}
+
+	_file.close();
+	_file.setFileName(_path);
+	if (!_file.open(QFile::ReadWrite) || !_file.seek(sizeof(header)))
+		{
+		ERR << "Cannot reopen" << _path;
+		return false;
+		}
+
+	_generation = header.generation;
+	_written	= sizeof(header);
+	return true;
+	}
+
+
+#pragma mark - Slots
+
+/******************************************************************************\
+|* Open the journal, keeping only the intact records
+\******************************************************************************/
+void Journal::start(void)
+	{
+	_file.setFileName(_path);
+	if (!_file.open(QFile::ReadWrite))
+		{
+		ERR << "Cannot open journal" << _path;
+		return;
+		}
+
+	_generation = readHeader(_file);
+	if (_generation < 0)
+		{
+		_generation = 0;
+		if (!_rotate())
+			return;
+		}
+	else
+		{
+		/**********************************************************************\
+		|* Find the end of the intact records and cut off anything after it
+		\**********************************************************************/
+		qint64 end = sizeof(JournalHeader);
+		JournalRecord record;
+		while ((_file.read(reinterpret_cast<char *>(&record), sizeof(record))
+				== sizeof(record)) && valid(record))
+			end += sizeof(record);
+
+		if (end != _file.size())
+			{
+			LOG << "Dropping" << _file.size() - end << "bytes of torn journal";
+			_file.resize(end);
+			sync(_file);
+			}
+		_file.seek(end);
+		_written = end;
+		}
+
+	LOG << "Journal" << _path << "open, generation" << _generation;
+	_timer.start();
+	}
+
+/******************************************************************************\
+|* Write everything out and stop
+\******************************************************************************/
+void Journal::stop(void)
+	{
+	_timer.stop();
+	_commit();
+	_file.close();
+	}
+
+/******************************************************************************\
+|* Note how far the applier has got, and truncate if it's caught up
+\******************************************************************************/
+void Journal::applied(qint64 generation, qint64 offset)
+	{
+	if (generation != _generation)
+		return;
+
+	_applied = offset;
+	if ((_applied >= _written) && (_written > JOURNAL_ROTATE_BYTES))
+		_rotate();
+	}
+
+/******************************************************************************\
+|* Group commit: write all pending readings, sync once, and pass them on
+\******************************************************************************/
+void Journal::_commit(void)
+	{
+	Readings batch;
+	{
+	QMutexLocker guard(&_lock);
+	batch.swap(_pending);
+	}
+
+	if (batch.isEmpty() || !_file.isOpen())
+		return;
+
+	QByteArray data;
+	data.resize(batch.size() * sizeof(JournalRecord));
+	JournalRecord *record = reinterpret_cast<JournalRecord *>(data.data());
+	for (const Reading& reading : std::as_const(batch))
+		{
+		memset(record, 0, sizeof(*record));
+		record->input	= reading.input;
+		record->at		= reading.at;
+		record->value	= reading.value;
+		record->magic	= JOURNAL_RECORD_MAGIC;
+		record->check	= checksum(*record);
+		record ++;
+		}
+
+	/**************************************************************************\
+	|* If the write fails, put the batch back to be retried next time round
+	\**************************************************************************/
+	if ((_file.write(data) != data.size()) || !sync(_file))
+		{
+		ERR << "Cannot write journal:" << _file.errorString();
+		_file.resize(_written);
+		_file.seek(_written);
+
+		QMutexLocker guard(&_lock);
+		batch.append(_pending);
+		_pending.swap(batch);
+		return;
+		}
+
+	_written = _file.pos();
+	emit committed(batch, _generation, _written);
+	}
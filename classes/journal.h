@@ -0,0 +1,110 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <functional>
+
+#include <QFile>
+#include <QMutex>
+#include <QObject>
+#include <QTimer>
+
+#include "properties.h"
+#include "reading.h"
+
+/******************************************************************************\
+|* Append-only write-ahead journal for readings. Any thread may append(); the
+|* journal's own thread writes the pending records out and syncs them to disk
+|* once per commit interval (group commit), then hands the now-durable batch
+|* to the applier (DbMgr) along with the journal position it ends at. DbMgr
+|* stores that position in the same transaction as the readings, so on start
+|* up anything after it can be replayed. Once the applier has caught up and
+|* the file is large, it is truncated and the generation number bumped.
+\******************************************************************************/
+class Journal : public QObject
+	{
+	Q_OBJECT
+
+	public:
+		/**********************************************************************\
+		|* Typedefs and enums
+		\**********************************************************************/
+		typedef std::function<void(const Readings& readings,
+								   qint64 generation,
+								   qint64 offset)> Replay;
+
+	/**************************************************************************\
+	|* Properties
+	\**************************************************************************/
+	GET(qint64, generation);			// Bumped on every truncation
+	GET(qint64, written);				// Offset of the end of synced data
+
+	private:
+		/**********************************************************************\
+		|* Private variables
+		\**********************************************************************/
+		QString			_path;			// Journal file
+		QFile			_file;			// Open journal file
+		QTimer			_timer;			// Group commit timer (child)
+		QMutex			_lock;			// Protects _pending
+		Readings		_pending;		// Appended, not yet written
+		qint64			_applied;		// Offset the applier has reached
+
+		/**********************************************************************\
+		|* Start a new generation, discarding what's already applied
+		\**********************************************************************/
+		bool _rotate(void);
+
+	private slots:
+		/**********************************************************************\
+		|* Write and sync everything pending
+		\**********************************************************************/
+		void _commit(void);
+
+	public:
+		/**********************************************************************\
+		|* Constructor / Destructor
+		\**********************************************************************/
+		explicit Journal(const QString& path, QObject *parent = nullptr);
+		~Journal(void) override;
+
+		/**********************************************************************\
+		|* Replay the records in a journal file after the given position,
+		|* in batches. Stops at the first torn or corrupt record. Returns the
+		|* number of readings replayed
+		\**********************************************************************/
+		static qint64 replay(const QString& path,
+							 qint64 generation,
+							 qint64 offset,
+							 Replay apply);
+
+		/**********************************************************************\
+		|* Append a reading. Safe to call from any thread
+		\**********************************************************************/
+		void append(const Reading& reading);
+		void append(const Readings& readings);
+		void append(const Reading *readings, int count);
+
+	public slots:
+		/**********************************************************************\
+		|* Open the journal (dropping any torn tail) and start group commits
+		\**********************************************************************/
+		void start(void);
+
+		/**********************************************************************\
+		|* Flush anything pending and stop
+		\**********************************************************************/
+		void stop(void);
+
+		/**********************************************************************\
+		|* The applier has stored everything up to this position
+		\**********************************************************************/
+		void applied(qint64 generation, qint64 offset);
+
+	signals:
+		/**********************************************************************\
+		|* A batch of readings is durable, ending at this position
+		\**********************************************************************/
+		void committed(Readings readings, qint64 generation, qint64 offset);
+	};
+
+#endif // JOURNAL_H
@@ -0,0 +1,285 @@
+#include <QSqlError>
+#include <QSqlQuery>
+
+#include "constants.h"
+#include "migrator.h"
+
+/******************************************************************************\
+|* Tuning: how often background batches run, how long each one should take,
+|* and how often progress is logged
+\******************************************************************************/
+#define MIGRATION_TICK_MS		10
+#define MIGRATION_BATCH_MS		20
+#define MIGRATION_MIN_ROWS		16
+#define MIGRATION_MAX_ROWS		65536
+#define MIGRATION_REPORT_MS		5000
+
+/******************************************************************************\
+|* Categorised logging support
+\******************************************************************************/
+Q_LOGGING_CATEGORY(log_mig, "reefd:migrate")
+
+#define LOG qDebug(log_mig) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define ERR qCritical(log_mig) << QTime::currentTime().toString("hh:mm:ss.zzz")
+
+/******************************************************************************\
+|* Constructor
+\******************************************************************************/
+Migrator::Migrator(QObject *parent)
+		 :QObject{parent}
+		 ,_version(0)
+		 ,_current(0)
+		 ,_cursor(0)
+		 ,_done(0)
+		 ,_total(0)
+		 ,_limit(256)
+		 ,_lastReport(0)
+	{
+	_timer.setInterval(MIGRATION_TICK_MS);
+	connect(&_timer, &QTimer::timeout, this, &Migrator::_tick);
+	}
+
+/******************************************************************************\
+|* Add a step
+\******************************************************************************/
+void Migrator::add(const Step& step)
+	{
+	_steps.append(step);
+	}
+
+/******************************************************************************\
+|* Start migrating
+\******************************************************************************/
+void Migrator::start(int version)
+	{
+	_version = version;
+
+	QSqlQuery query;
+	if (!query.exec("CREATE TABLE IF NOT EXISTS migrations\n"
+					"(\n"
+					"version INTEGER PRIMARY KEY,\n"
+					"cursor  INTEGER NOT NULL DEFAULT 0,\n"
+					"done    INTEGER NOT NULL DEFAULT 0\n"
+					")\n"))
+		ERR << "Cannot create migrations table:" << query.lastError().text();
+
+	/**************************************************************************\
+	|* Skip everything we've already applied
+	\**************************************************************************/
+	_current = 0;
+	while ((_current < _steps.size()) && (_steps[_current].version <= version))
+		_current ++;
+
+	if (_advance() && !busy())
+		emit finished(_version);
+	}
+
+/******************************************************************************\
+|* Return whether there's background work running
+\******************************************************************************/
+bool Migrator::busy(void)
+	{
+	return _timer.isActive();
+	}
+
+
+#pragma mark - Private methods
+
+/******************************************************************************\
+|* Apply foreground steps until we hit a heavy one, which is then handed off
+|* to the timer. Returns false if a step failed
+\******************************************************************************/
+bool Migrator::_advance(void)
+	{
+	QSqlDatabase db = QSqlDatabase::database();
+
+	while (_current < _steps.size())
+		{
+		const Step& step = _steps[_current];
+
+		if (step.batch)
+			{
+			if (!_resume(step))
+				{
+				emit failed(_version);
+				return false;
+				}
+			LOG << "Migrating to version" << step.version << "in the background:"
+				<< step.name << "(" << _done << "/" << _total << ")";
+			_timer.start();
+			return true;
+			}
+
+		/**********************************************************************\
+		|* Simple step - prepare, finish and version bump in one transaction
+		\**********************************************************************/
+		LOG << "Migrating to version" << step.version << ":" << step.name;
+		db.transaction();
+		bool ok = (!step.prepare || step.prepare(db))
+			   && (!step.finish || step.finish(db))
+			   && _complete(step);
+		if (!ok || !db.commit())
+			{
+			ERR << "Migration to version" << step.version << "failed:"
+				<< db.lastError().text();
+			db.rollback();
+			emit failed(_version);
+			return false;
+			}
+
+		_version = step.version;
+		_current ++;
+		}
+	return true;
+	}
+
+/******************************************************************************\
+|* Record a step as done, within the caller's transaction
+\******************************************************************************/
+bool Migrator::_complete(const Step& step)
+	{
+	QSqlQuery query;
+	query.prepare("UPDATE system SET version = ?");
+	query.bindValue(0, step.version);
+	if (!query.exec())
+		return false;
+
+	query.prepare("DELETE FROM migrations WHERE version = ?");
+	query.bindValue(0, step.version);
+	return query.exec();
+	}
+
+/******************************************************************************\
+|* Pick up where a heavy step left off, or prepare it if it's new
+\******************************************************************************/
+bool Migrator::_resume(const Step& step)
+	{
+	QSqlDatabase db = QSqlDatabase::database();
+	QSqlQuery query;
+
+	query.prepare("SELECT cursor, done FROM migrations WHERE version = ?");
+	query.bindValue(0, step.version);
+	if (query.exec() && query.next())
+		{
+		_cursor = query.value(0).toLongLong();
+		_done	= query.value(1).toLongLong();
+		LOG << "Resuming migration to version" << step.version << "at" << _cursor;
+		}
+	else
+		{
+		query.finish();
+
+		/**********************************************************************\
+		|* New step - run its foreground part and record that it's started
+		\**********************************************************************/
+		_cursor = _done = 0;
+		db.transaction();
+		query.prepare("INSERT INTO migrations (version) VALUES (?)");
+		query.bindValue(0, step.version);
+		bool ok = (!step.prepare || step.prepare(db)) && query.exec();
+		if (!ok || !db.commit())
+			{
+			ERR << "Cannot prepare migration to version" << step.version << ":"
+				<< db.lastError().text() << query.lastError().text();
+			db.rollback();
+			return false;
+			}
+		}
+	query.finish();
+
+	_total		= step.count ? step.count(db) : -1;
+	_lastReport	= 0;
+	_elapsed.start();
+	return true;
+	}
+
+
+#pragma mark - Private slots
+
+/******************************************************************************\
+|* Run one batch of the current heavy step in its own small transaction, and
+|* adapt the batch size so each batch takes about MIGRATION_BATCH_MS
+\******************************************************************************/
+void Migrator::_tick(void)
+	{
+	QSqlDatabase db = QSqlDatabase::database();
+	const Step& step = _steps[_current];
+
+	QElapsedTimer batchTime;
+	batchTime.start();
+
+	db.transaction();
+	qint64 cursor = _cursor;
+	int rows = step.batch(db, cursor, _limit);
+
+	QSqlQuery query;
+	bool ok = (rows >= 0);
+	if (ok)
+		{
+		query.prepare("UPDATE migrations SET cursor = ?, done = ? "
+					  "WHERE version = ?");
+		query.bindValue(0, cursor);
+		query.bindValue(1, _done + rows);
+		query.bindValue(2, step.version);
+		ok = query.exec();
+		}
+
+	/**************************************************************************\
+	|* The last (empty) batch also runs the finish step and the version bump,
+	|* so the step is either wholly done or will be resumed
+	\**************************************************************************/
+	if (ok && (rows == 0))
+		ok = (!step.finish || step.finish(db)) && _complete(step);
+
+	if (!ok || !db.commit())
+		{
+		ERR << "Migration to version" << step.version << "failed at" << _cursor
+			<< ":" << db.lastError().text() << query.lastError().text();
+		db.rollback();
+		_timer.stop();
+		emit failed(_version);
+		return;
+		}
+
+	_cursor = cursor;
+	_done  += rows;
+
+	/**************************************************************************\
+	|* Adapt the batch size towards the target time per batch
+	\**************************************************************************/
+	qint64 ms = batchTime.elapsed();
+	if ((ms < MIGRATION_BATCH_MS / 2) && (_limit < MIGRATION_MAX_ROWS))
+		_limit *= 2;
+	else if ((ms > MIGRATION_BATCH_MS * 2) && (_limit > MIGRATION_MIN_ROWS))
+		_limit /= 2;
+
+	/**************************************************************************\
+	|* Report progress and an ETA every so often
+	\**************************************************************************/
+	qint64 now = _elapsed.elapsed();
+	if ((rows == 0) || (now - _lastReport >= MIGRATION_REPORT_MS))
+		{
+		qint64 eta = -1;
+		if ((_total > 0) && (_done > 0) && (_done < _total))
+			eta = (now * (_total - _done)) / _done / 1000;
+
+		LOG << "Migration to version" << step.version << ":" << _done << "/"
+			<< _total << "rows, ETA" << eta << "s";
+		emit progress(step.version, _done, _total, eta);
+		_lastReport = now;
+		}
+
+	if (rows > 0)
+		return;
+
+	/**************************************************************************\
+	|* Step done - move on to the rest
+	\**************************************************************************/
+	_timer.stop();
+	_version = step.version;
+	_current ++;
+	LOG << "Migration to version" << _version << "complete in" << now << "ms";
+
+	if (_advance() && !busy())
+		emit finished(_version);
+	}
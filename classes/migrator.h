@@ -0,0 +1,127 @@
+#ifndef MIGRATOR_H
+#define MIGRATOR_H
+
+#include <functional>
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QSqlDatabase>
+#include <QTimer>
+#include <QVector>
+
+#include "properties.h"
+
+/******************************************************************************\
+|* Applies ordered, versioned schema migrations. A step without a batch
+|* function is applied in one transaction while we start up. A step with a
+|* batch function is a "heavy" step: its prepare function runs first, then
+|* the batch function is called from the event loop with small transactions
+|* until it reports there's nothing left, while reefd carries on serving.
+|* The batch cursor is saved in the 'migrations' table with every batch, so
+|* a heavy step resumes where it left off after a crash or restart
+\******************************************************************************/
+class Migrator : public QObject
+	{
+	Q_OBJECT
+
+	public:
+		/**********************************************************************\
+		|* Typedefs and enums
+		\**********************************************************************/
+		typedef std::function<bool(QSqlDatabase db)> Apply;
+		typedef std::function<qint64(QSqlDatabase db)> Count;
+
+		// Process up to 'limit' rows after 'cursor', move the cursor past
+		// them and return how many were done: 0 when finished, -1 on error
+		typedef std::function<int(QSqlDatabase db, qint64& cursor, int limit)> Batch;
+
+		struct Step
+			{
+			int			version;		// Schema version after this step
+			QString		name;			// Description for the logs
+			Apply		prepare;		// Foreground part (may be null)
+			Batch		batch;			// Background part (null = none)
+			Count		count;			// Estimate of total batch rows
+			Apply		finish;			// Run after the last batch
+			};
+
+	/**************************************************************************\
+	|* Properties
+	\**************************************************************************/
+	GET(int, version);					// Current schema version
+
+	private:
+		/**********************************************************************\
+		|* Private variables
+		\**********************************************************************/
+		QVector<Step>		_steps;			// All known steps, in order
+		int					_current;		// Index of step being run
+		qint64				_cursor;		// Batch cursor in current step
+		qint64				_done;			// Rows done in current step
+		qint64				_total;			// Estimated rows in current step
+		int					_limit;			// Rows per batch (adaptive)
+		QTimer				_timer;			// Drives background batches
+		QElapsedTimer		_elapsed;		// Time spent on current step
+		qint64				_lastReport;	// When we last logged progress
+
+		/**********************************************************************\
+		|* Run the foreground part of steps until a heavy step (or the end)
+		\**********************************************************************/
+		bool _advance(void);
+
+		/**********************************************************************\
+		|* Mark a step complete, bumping the schema version
+		\**********************************************************************/
+		bool _complete(const Step& step);
+
+		/**********************************************************************\
+		|* Load or create the resume state for a heavy step
+		\**********************************************************************/
+		bool _resume(const Step& step);
+
+	private slots:
+		/**********************************************************************\
+		|* Run the next background batch
+		\**********************************************************************/
+		void _tick(void);
+
+	public:
+		/**********************************************************************\
+		|* Constructor
+		\**********************************************************************/
+		explicit Migrator(QObject *parent = nullptr);
+
+		/**********************************************************************\
+		|* Add a step. Steps must be added in version order
+		\**********************************************************************/
+		void add(const Step& step);
+
+		/**********************************************************************\
+		|* Start migrating from the given version. Returns once any heavy step
+		|* has been handed to the background, or everything is done
+		\**********************************************************************/
+		void start(int version);
+
+		/**********************************************************************\
+		|* Whether there's still background work in progress
+		\**********************************************************************/
+		bool busy(void);
+
+	signals:
+		/**********************************************************************\
+		|* Progress through a heavy step. 'eta' is in seconds, or -1
+		\**********************************************************************/
+		void progress(int version, qint64 done, qint64 total, qint64 eta);
+
+		/**********************************************************************\
+		|* All steps have been applied
+		\**********************************************************************/
+		void finished(int version);
+
+		/**********************************************************************\
+		|* A step failed, migration has stopped at the given version
+		\**********************************************************************/
+		void failed(int version);
+	};
+
+#endif // MIGRATOR_H
@@ -0,0 +1,22 @@
+#ifndef READING_H
+#define READING_H
+
+#include <QMetaType>
+#include <QVector>
+
+/******************************************************************************\
+|* A single value from an input at a point in time (ms since the epoch)
+\******************************************************************************/
+struct Reading
+	{
+	qint64		input;				// Input id (inputs.id)
+	qint64		at;					// Timestamp, ms since the epoch
+	double		value;				// Value in engineering units
+	};
+
+typedef QVector<Reading> Readings;
+
+Q_DECLARE_METATYPE(Reading)
+Q_DECLARE_METATYPE(Readings)
+
+#endif // READING_H
@@ -1,6 +1,10 @@
+#include <memory>
+
 #include <QtWebSockets>
 #include <QWebSocketServer>
 
+#include "command.h"
+#include "exporter.h"
 #include "socket.h"
 
 /******************************************************************************\
@@ -9,6 +13,11 @@
 #define MSG_SYSINFO				"SysInfo"
 #define MSG_DESKTOP_ICONS		"DesktopIcons"
 #define MSG_DESKTOP_APPS		"DesktopApps"
+#define MSG_HISTORY				"History"
+#define MSG_EXPORT				"Export"
+#define MSG_SET_OUTPUT			"SetOutput"
+#define MSG_OUTPUT_STATS		"OutputStats"
+#define MSG_BUS_STATS			"BusStats"
 
 /******************************************************************************\
 |* Categorised logging support
@@ -101,10 +110,98 @@ void Socket::processTextMessage(const QString& msg)
 	else if (msg.startsWith(MSG_DESKTOP_APPS))
 		emit fetchDesktopApps(msg.mid(11).trimmed(), getIdentifier(client));
 
+	else if (msg.startsWith(MSG_HISTORY))
+		emit fetchHistory(msg.mid(7).trimmed(), getIdentifier(client));
+
+	else if (msg.startsWith(MSG_EXPORT))
+		_startExport(client, msg.mid(6).trimmed());
+
+	else if (msg.startsWith(MSG_SET_OUTPUT))
+		_setOutput(client, msg.mid(9).trimmed());
+
+	else if (msg.startsWith(MSG_OUTPUT_STATS))
+		emit fetchOutputStats(getIdentifier(client));
+
+	else if (msg.startsWith(MSG_BUS_STATS))
+		emit fetchBusStats(getIdentifier(client));
+
 	else
 		LOG << "Unknown message " << msg;
 	}
 
+/******************************************************************************\
+|* Stream an export to a client as binary messages of gzipped data, followed
+|* by a text message with the row count. We only produce more once the socket
+|* has written most of what we've given it
+\******************************************************************************/
+void Socket::_startExport(QWebSocket *client, const QString& request)
+	{
+	Exporter::Format format;
+	QVector<qint64> inputs;
+	qint64 from, to;
+	if (!Exporter::parse(request, format, inputs, from, to))
+		{
+		ERR << "Bad export request" << request;
+		client->sendTextMessage("{\"export\":null}");
+		return;
+		}
+
+	std::shared_ptr<qint64> queued = std::make_shared<qint64>(0);
+	Exporter *exporter = new Exporter(format, inputs, from, to,
+		[client, queued](const QByteArray& data)
+			{
+			*queued += client->sendBinaryMessage(data);
+			return client->isValid();
+			},
+		[queued]()
+			{
+			return *queued;
+			},
+		client);
+
+	connect(client, &QWebSocket::bytesWritten, exporter,
+		[exporter, queued](qint64 bytes)
+			{
+			*queued = qMax(*queued - bytes, 0LL);
+			exporter->pump();
+			});
+	connect(exporter, &Exporter::finished, client,
+		[client, exporter](qint64 rows, bool ok)
+			{
+			client->sendTextMessage(ok ? QString("{\"export\":{\"rows\":%1}}")
+												.arg(rows)
+									   : QString("{\"export\":null}"));
+			exporter->deleteLater();
+			});
+
+	exporter->pump();
+	}
+
+/******************************************************************************\
+|* Parse "SetOutput <output> <value> [priority]" and pass it on. The answer
+|* comes back once the node has acknowledged it (or hasn't)
+\******************************************************************************/
+void Socket::_setOutput(QWebSocket *client, const QString& request)
+	{
+	const QStringList args = request.split(' ', Qt::SkipEmptyParts);
+	bool okOutput = false, okValue = false, okPriority = true;
+
+	qint64 output	= (args.size() > 0) ? args[0].toLongLong(&okOutput) : -1;
+	double value	= (args.size() > 1) ? args[1].toDouble(&okValue) : 0;
+	int priority	= (args.size() > 2) ? args[2].toInt(&okPriority)
+										: COMMAND_PRIO_DEFAULT;
+
+	if (!okOutput || !okValue || !okPriority || !qIsFinite(value)
+	 || (args.size() > 3))
+		{
+		ERR << "Bad output command" << request;
+		client->sendTextMessage("{\"setOutput\":null}");
+		return;
+		}
+
+	emit setOutput(output, value, priority, getIdentifier(client));
+	}
+
 /******************************************************************************\
 |* Handle a client binary message
 \******************************************************************************/
@@ -191,3 +288,35 @@ void Socket::sendDesktopApps(QString json, QString identifier)
 	{
 	sendText(json, identifier);
 	}
+
+/******************************************************************************\
+|* Slot: Send a history message to a specific client
+\******************************************************************************/
+void Socket::sendHistory(QString json, QString identifier)
+	{
+	sendText(json, identifier);
+	}
+
+/******************************************************************************\
+|* Slot: Send the result of an output command to a specific client
+\******************************************************************************/
+void Socket::sendOutputResult(QString json, QString identifier)
+	{
+	sendText(json, identifier);
+	}
+
+/******************************************************************************\
+|* Slot: Send the output command stats to a specific client
+\******************************************************************************/
+void Socket::sendOutputStats(QString json, QString identifier)
+	{
+	sendText(json, identifier);
+	}
+
+/******************************************************************************\
+|* Slot: Send the CAN bus stats to a specific client
+\******************************************************************************/
+void Socket::sendBusStats(QString json, QString identifier)
+	{
+	sendText(json, identifier);
+	}
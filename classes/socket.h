@@ -31,6 +31,15 @@ class Socket : public QObject
 		QMap<QString,QWebSocket *>	_clients;		// Map of connected clients
 		QMutex						_lock;			// Thread safety
 
+		/**********************************************************************\
+		|* Start streaming an export to a client
+		\**********************************************************************/
+		void _startExport(QWebSocket *client, const QString& request);
+
+		/**********************************************************************\
+		|* Parse an output command and pass it on
+		\**********************************************************************/
+		void _setOutput(QWebSocket *client, const QString& request);
 
 	private slots:
 		/**********************************************************************\
@@ -81,6 +90,27 @@ class Socket : public QObject
 		\**********************************************************************/
 		void fetchDesktopApps(QString user, QString identifier);
 
+		/**********************************************************************\
+		|* Request readings for some inputs over a time range
+		\**********************************************************************/
+		void fetchHistory(QString request, QString identifier);
+
+		/**********************************************************************\
+		|* Set an output on a node. Priority 0 is the most urgent
+		\**********************************************************************/
+		void setOutput(qint64 output, double value, int priority,
+					   QString identifier);
+
+		/**********************************************************************\
+		|* Request the output command counters and latency histogram
+		\**********************************************************************/
+		void fetchOutputStats(QString identifier);
+
+		/**********************************************************************\
+		|* Request the CAN bus counters, load and error breakdown
+		\**********************************************************************/
+		void fetchBusStats(QString identifier);
+
 
 	public slots:
 		/**********************************************************************\
@@ -97,6 +127,26 @@ class Socket : public QObject
 		|* Send the app info back to the caller
 		\**********************************************************************/
 		void sendDesktopApps(QString json, QString identifier);
+
+		/**********************************************************************\
+		|* Send the history back to the caller
+		\**********************************************************************/
+		void sendHistory(QString json, QString identifier);
+
+		/**********************************************************************\
+		|* Send the outcome of an output command back to the caller
+		\**********************************************************************/
+		void sendOutputResult(QString json, QString identifier);
+
+		/**********************************************************************\
+		|* Send the output command stats back to the caller
+		\**********************************************************************/
+		void sendOutputStats(QString json, QString identifier);
+
+		/**********************************************************************\
+		|* Send the CAN bus stats back to the caller
+		\**********************************************************************/
+		void sendBusStats(QString json, QString identifier);
 	};
 
 #endif // SOCKET_H
@@ -0,0 +1,448 @@
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <QSqlError>
+#include <QSqlQuery>
+
+#include "constants.h"
+#include "sqlscript.h"
+
+/******************************************************************************\
+|* Categorised logging support
+\******************************************************************************/
+Q_LOGGING_CATEGORY(log_sql, "reefd:sql")
+
+#define LOG qDebug(log_sql) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define ERR qCritical(log_sql) << QTime::currentTime().toString("hh:mm:ss.zzz")
+
+/******************************************************************************\
+|* Produces the next row of values to insert, returns false when exhausted
+\******************************************************************************/
+typedef std::function<bool(QVariantList& row)> RowSource;
+
+/******************************************************************************\
+|* Helper function: The columns that may be bulk-loaded, by table. This also
+|* stops a data file's header from injecting SQL
+\******************************************************************************/
+static QStringList allowedColumns(const QString& table)
+	{
+	if (table == "modules")
+		return {"id", "name", "driver", "nodeId", "render"};
+	if ((table == "inputs") || (table == "outputs"))
+		return {"id", "name", "module", "driver", "render"};
+	return {};
+	}
+
+/******************************************************************************\
+|* Helper function: Read a whole file, logging if we can't
+\******************************************************************************/
+static bool readFile(const QString& file, QByteArray& content)
+	{
+	QFile f(file);
+	if (!f.open(QFile::ReadOnly))
+		{
+		ERR << "Cannot open" << file;
+		return false;
+		}
+	content = f.readAll();
+	return true;
+	}
+
+/******************************************************************************\
+|* Helper function: Parse the next CSV record starting at 'pos'. Handles
+|* quoted fields (with "" as an escaped quote, and embedded newlines) and both
+|* LF and CRLF line endings. Returns false at end of data
+\******************************************************************************/
+static bool nextCsvRecord(const QByteArray& data, int& pos, QStringList& fields)
+	{
+	const int len = data.size();
+	fields.clear();
+
+	// Skip blank lines between records
+	while ((pos < len) && ((data[pos] == '\n') || (data[pos] == '\r')))
+		pos ++;
+	if (pos >= len)
+		return false;
+
+	QByteArray field;
+	bool quoted = false;
+	for (;;)
+		{
+		if (pos >= len)
+			{
+			fields.append(QString::fromUtf8(field));
+			return true;
+			}
+
+		char c = data[pos++];
+		if (quoted)
+			{
+			if (c != '"')
+				field.append(c);
+			else if ((pos < len) && (data[pos] == '"'))
+				{
+				field.append('"');
+				pos ++;
+				}
+			else
+				quoted = false;
+			}
+		else if (c == '"')
+			quoted = true;
+		else if (c == ',')
+			{
+			fields.append(QString::fromUtf8(field));
+			field.clear();
+			}
+		else if ((c == '\n') || (c == '\r'))
+			{
+			fields.append(QString::fromUtf8(field));
+			return true;
+			}
+		else
+			field.append(c);
+		}
+	}
+
+/******************************************************************************\
+|* Helper function: Insert every row from 'source' into 'table' with a single
+|* prepared statement inside a single transaction
+\******************************************************************************/
+static qint64 insertAll(QSqlDatabase db,
+						const QString& table,
+						const QStringList& columns,
+						qint64 total,
+						RowSource source,
+						SqlScript::Progress progress)
+	{
+	/**************************************************************************\
+	|* Validate the columns before they go anywhere near the SQL
+	\**************************************************************************/
+	QStringList allowed = allowedColumns(table);
+	if (allowed.isEmpty())
+		{
+		ERR << "Cannot bulk-load into table" << table;
+		return -1;
+		}
+	for (const QString& column : columns)
+		if (!allowed.contains(column))
+			{
+			ERR << "Unknown column" << column << "for table" << table;
+			return -1;
+			}
+	int idColumn = columns.indexOf("id");
+
+	QStringList marks;
+	for (int i=0; i<columns.size(); i++)
+		marks << "?";
+
+	/**************************************************************************\
+	|* Insert everything in one transaction
+	\**************************************************************************/
+	if (!db.transaction())
+		{
+		ERR << "Cannot start transaction:" << db.lastError().text();
+		return -1;
+		}
+
+	QSqlQuery query(db);
+	if (!query.prepare(QString("INSERT OR REPLACE INTO %1 (%2) VALUES (%3)")
+							.arg(table, columns.join(", "), marks.join(", "))))
+		{
+		ERR << "Cannot prepare insert for" << table << ":"
+			<< query.lastError().text();
+		db.rollback();
+		return -1;
+		}
+
+	qint64 rows = 0;
+	QVariantList row;
+	while (source(row))
+		{
+		if (row.size() != columns.size())
+			{
+			ERR << "Row" << rows + 1 << "of" << table << "has" << row.size()
+				<< "fields, expected" << columns.size();
+			db.rollback();
+			return -1;
+			}
+
+		// An empty id lets the database assign one
+		for (int i=0; i<row.size(); i++)
+			query.bindValue(i, ((i == idColumn) && row[i].toString().isEmpty())
+								? QVariant()
+								: row[i]);
+
+		if (!query.exec())
+			{
+			ERR << "Cannot insert row" << rows + 1 << "of" << table << ":"
+				<< query.lastError().text();
+			db.rollback();
+			return -1;
+			}
+
+		rows ++;
+		if (progress && ((rows & 1023) == 0))
+			progress(rows, total);
+		}
+
+	if (!db.commit())
+		{
+		ERR << "Cannot commit" << table << ":" << db.lastError().text();
+		db.rollback();
+		return -1;
+		}
+
+	if (progress)
+		progress(rows, total);
+	return rows;
+	}
+
+
+/******************************************************************************\
+|* Split a script into separate statements
+\******************************************************************************/
+QStringList SqlScript::split(const QString& script)
+	{
+	static const QRegularExpression trigger(
+			"^CREATE\\s+(TEMP\\s+|TEMPORARY\\s+)?TRIGGER\\b",
+			QRegularExpression::CaseInsensitiveOption);
+
+	QStringList statements;
+	QString current;
+	const int len = script.length();
+	int depth = 0;					// Open BEGINs and CASEs in a trigger
+	int i = 0;
+
+	while (i < len)
+		{
+		QChar c		= script[i];
+		QChar next	= (i + 1 < len) ? script[i + 1] : QChar();
+
+		/**********************************************************************\
+		|* Quoted strings and identifiers are copied through verbatim. A
+		|* doubled quote is an escaped quote, except in [bracketed] names
+		\**********************************************************************/
+		if ((c == '\'') || (c == '"') || (c == '`') || (c == '['))
+			{
+			QChar close = (c == '[') ? QChar(']') : c;
+			int j = i + 1;
+			while (j < len)
+				{
+				if (script[j] == close)
+					{
+					if ((close != ']') && (j + 1 < len) && (script[j+1] == close))
+						{
+						j += 2;
+						continue;
+						}
+					break;
+					}
+				j ++;
+				}
+			j = (j < len) ? j + 1 : len;
+			current += script.mid(i, j - i);
+			i = j;
+			}
+
+		/**********************************************************************\
+		|* Comments are dropped
+		\**********************************************************************/
+		else if ((c == '-') && (next == '-'))
+			{
+			int j = script.indexOf('\n', i);
+			i = (j < 0) ? len : j;
+			}
+		else if ((c == '/') && (next == '*'))
+			{
+			int j = script.indexOf("*/", i + 2);
+			i = (j < 0) ? len : j + 2;
+			current += ' ';
+			}
+
+		/**********************************************************************\
+		|* Words are copied whole, so a trigger's BEGIN and CASEs can be
+		|* matched with their ENDs. Outside a trigger they aren't counted, as
+		|* a BEGIN there starts a transaction
+		\**********************************************************************/
+		else if (c.isLetter() || (c == '_'))
+			{
+			int j = i + 1;
+			while ((j < len) && (script[j].isLetterOrNumber()
+								 || (script[j] == '_') || (script[j] == '$')))
+				j ++;
+			QString word = script.mid(i, j - i);
+
+			if ((word.compare("BEGIN", Qt::CaseInsensitive) == 0)
+			 || (word.compare("CASE", Qt::CaseInsensitive) == 0))
+				{
+				if ((depth > 0) || trigger.match(current.trimmed()).hasMatch())
+					depth ++;
+				}
+			else if ((depth > 0)
+				  && (word.compare("END", Qt::CaseInsensitive) == 0))
+				depth --;
+
+			current += word;
+			i = j;
+			}
+
+		/**********************************************************************\
+		|* A semicolon ends the statement, unless we're inside a trigger body
+		\**********************************************************************/
+		else if (c == ';')
+			{
+			if (depth > 0)
+				current += c;
+			else
+				{
+				QString statement = current.trimmed();
+				if (!statement.isEmpty())
+					statements << statement;
+				current.clear();
+				}
+			i ++;
+			}
+		else
+			{
+			current += c;
+			i ++;
+			}
+		}
+
+	QString statement = current.trimmed();
+	if (!statement.isEmpty())
+		statements << statement;
+	return statements;
+	}
+
+/******************************************************************************\
+|* Run a script file. We already hold a transaction, so any the script opens
+|* and closes itself would fail: those statements are left out
+\******************************************************************************/
+bool SqlScript::run(QSqlDatabase db, const QString& file, Progress progress)
+	{
+	static const QRegularExpression control(
+			"^(BEGIN(\\s+(DEFERRED|IMMEDIATE|EXCLUSIVE))?|COMMIT|END)"
+			"(\\s+TRANSACTION)?$",
+			QRegularExpression::CaseInsensitiveOption);
+
+	QByteArray content;
+	if (!readFile(file, content))
+		return false;
+
+	QStringList statements = split(QString::fromUtf8(content));
+	qint64 total = statements.size();
+
+	if (!db.transaction())
+		{
+		ERR << "Cannot start transaction:" << db.lastError().text();
+		return false;
+		}
+
+	QSqlQuery query(db);
+	for (qint64 i=0; i<total; i++)
+		{
+		if (control.match(statements[i]).hasMatch())
+			LOG << "Statement" << i + 1 << "of" << file << "skipped:"
+				<< statements[i];
+		else if (!query.exec(statements[i]))
+			{
+			ERR << "Statement" << i + 1 << "of" << file << "failed:"
+				<< query.lastError().text();
+			db.rollback();
+			return false;
+			}
+		if (progress)
+			progress(i + 1, total);
+		}
+
+	if (!db.commit())
+		{
+		ERR << "Cannot commit" << file << ":" << db.lastError().text();
+		db.rollback();
+		return false;
+		}
+	return true;
+	}
+
+/******************************************************************************\
+|* Bulk-load a CSV file
+\******************************************************************************/
+qint64 SqlScript::loadCsv(QSqlDatabase db,
+						  const QString& file,
+						  const QString& table,
+						  Progress progress)
+	{
+	QByteArray content;
+	if (!readFile(file, content))
+		return -1;
+
+	int pos = 0;
+	QStringList columns;
+	if (!nextCsvRecord(content, pos, columns))
+		{
+		ERR << "No header row in" << file;
+		return -1;
+		}
+	for (QString& column : columns)
+		column = column.trimmed();
+
+	QStringList fields;
+	RowSource source = [&](QVariantList& row)
+		{
+		if (!nextCsvRecord(content, pos, fields))
+			return false;
+		row.clear();
+		for (const QString& field : std::as_const(fields))
+			row << field;
+		return true;
+		};
+
+	// The row count isn't known up front, so progress reports a total of -1
+	return insertAll(db, table, columns, -1, source, progress);
+	}
+
+/******************************************************************************\
+|* Bulk-load a JSON array of objects. Every object must have the same keys as
+|* the first one
+\******************************************************************************/
+qint64 SqlScript::loadJson(QSqlDatabase db,
+						   const QString& file,
+						   const QString& table,
+						   Progress progress)
+	{
+	QByteArray content;
+	if (!readFile(file, content))
+		return -1;
+
+	QJsonParseError error;
+	QJsonDocument doc = QJsonDocument::fromJson(content, &error);
+	if (!doc.isArray())
+		{
+		ERR << "Expected a JSON array in" << file << ":" << error.errorString();
+		return -1;
+		}
+
+	QJsonArray records = doc.array();
+	if (records.isEmpty())
+		return 0;
+
+	QStringList columns = records.first().toObject().keys();
+	int next = 0;
+	RowSource source = [&](QVariantList& row)
+		{
+		if (next >= records.size())
+			return false;
+		QJsonObject record = records[next++].toObject();
+		row.clear();
+		for (const QString& column : std::as_const(columns))
+			if (record.contains(column))
+				row << record.value(column).toVariant();
+		return true;
+		};
+
+	return insertAll(db, table, columns, records.size(), source, progress);
+	}
@@ -0,0 +1,54 @@
+#ifndef SQLSCRIPT_H
+#define SQLSCRIPT_H
+
+#include <functional>
+
+#include <QSqlDatabase>
+#include <QStringList>
+
+/******************************************************************************\
+|* Load SQL scripts and bulk data files into the database. Everything runs
+|* inside a single transaction, so a script costs one sync rather than one
+|* per statement, and a failure leaves the database as it was
+\******************************************************************************/
+class SqlScript
+	{
+	public:
+		/**********************************************************************\
+		|* Typedefs and enums
+		\**********************************************************************/
+		typedef std::function<void(qint64 done, qint64 total)> Progress;
+
+		/**********************************************************************\
+		|* Split a script into statements. Semicolons inside quoted strings,
+		|* quoted identifiers, comments or trigger bodies (up to the END that
+		|* closes BEGIN, with any CASE...END inside it) don't split
+		\**********************************************************************/
+		static QStringList split(const QString& script);
+
+		/**********************************************************************\
+		|* Run a script file as one transaction. The script's own BEGIN,
+		|* COMMIT and END statements (as in sqlite3 .dump output) are skipped
+		|* in favour of ours. Returns false (and rolls back) if any statement
+		|* fails
+		\**********************************************************************/
+		static bool run(QSqlDatabase db,
+						const QString& file,
+						Progress progress = nullptr);
+
+		/**********************************************************************\
+		|* Bulk-load rows into one of the topology tables from a CSV file
+		|* (first row names the columns) or a JSON array of objects. Returns
+		|* the number of rows loaded, or -1 on error (and rolls back)
+		\**********************************************************************/
+		static qint64 loadCsv(QSqlDatabase db,
+							  const QString& file,
+							  const QString& table,
+							  Progress progress = nullptr);
+		static qint64 loadJson(QSqlDatabase db,
+							   const QString& file,
+							   const QString& table,
+							   Progress progress = nullptr);
+	};
+
+#endif // SQLSCRIPT_H
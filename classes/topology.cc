@@ -0,0 +1,128 @@
+#include <algorithm>
+
+#include "topology.h"
+
+/******************************************************************************\
+|* Helper function: sort a list of records by name, then map id -> index
+\******************************************************************************/
+template <typename T>
+static void sortAndIndex(QVector<T>& items, QHash<qint64, int>& ids)
+	{
+	std::stable_sort(items.begin(), items.end(),
+					 [](const T& a, const T& b) { return a.name < b.name; });
+
+	ids.clear();
+	ids.reserve(items.size());
+	for (int i=0; i<items.size(); i++)
+		ids.insert(items[i].id, i);
+	}
+
+/******************************************************************************\
+|* Constructor
+\******************************************************************************/
+Topology::Topology()
+		:_current(new Snapshot)
+		,_version(0)
+	{
+	}
+
+/******************************************************************************\
+|* Return the currently published snapshot. The thread's cached one will do
+|* if the version hasn't moved since; versions are never reused, so a match
+|* means it is the current snapshot
+\******************************************************************************/
+Topology::SnapshotPtr Topology::snapshot(void) const
+	{
+	thread_local struct
+		{
+		const Topology *	owner	= nullptr;
+		SnapshotPtr			snapshot;
+		} cached;
+
+	quint64 version = _version.load(std::memory_order_acquire);
+	if ((cached.owner == this) && (cached.snapshot->version == version))
+		return cached.snapshot;
+
+	QMutexLocker guard(&_lock);
+	cached.owner	= this;
+	cached.snapshot	= _current;
+	return cached.snapshot;
+	}
+
+/******************************************************************************\
+|* Return the currently published version
+\******************************************************************************/
+quint64 Topology::version(void) const
+	{
+	return _version.load(std::memory_order_acquire);
+	}
+
+/******************************************************************************\
+|* Publish a new snapshot. Readers on other threads may still be walking the
+|* old one: it goes when the last of them drops its reference
+\******************************************************************************/
+void Topology::publish(Snapshot *next)
+	{
+	next->version = _version.load(std::memory_order_relaxed) + 1;
+	next->reindex();
+
+	SnapshotPtr previous(next);			// Let go of after the lock is
+	QMutexLocker guard(&_lock);
+	_current.swap(previous);
+	_version.store(next->version, std::memory_order_release);
+	}
+
+
+#pragma mark - Snapshot
+
+/******************************************************************************\
+|* Sort and rebuild the lookup tables
+\******************************************************************************/
+void Topology::Snapshot::reindex(void)
+	{
+	sortAndIndex(modules, moduleIds);
+	sortAndIndex(inputs, inputIds);
+	sortAndIndex(outputs, outputIds);
+
+	nodeIds.clear();
+	nodeIds.reserve(modules.size());
+	for (int i=0; i<modules.size(); i++)
+		if (!modules[i].nodeId.isEmpty())
+			nodeIds.insert(modules[i].nodeId, i);
+	}
+
+/******************************************************************************\
+|* Find a module by id
+\******************************************************************************/
+const Topology::Module * Topology::Snapshot::module(qint64 id) const
+	{
+	int idx = moduleIds.value(id, -1);
+	return (idx < 0) ? nullptr : &modules[idx];
+	}
+
+/******************************************************************************\
+|* Find a module by its CAN node id
+\******************************************************************************/
+const Topology::Module * Topology::Snapshot::moduleForNode(const QString& nodeId) const
+	{
+	int idx = nodeIds.value(nodeId, -1);
+	return (idx < 0) ? nullptr : &modules[idx];
+	}
+
+/******************************************************************************\
+|* Find an input by id
+\******************************************************************************/
+const Topology::Input * Topology::Snapshot::input(qint64 id) const
+	{
+	int idx = inputIds.value(id, -1);
+	return (idx < 0) ? nullptr : &inputs[idx];
+	}
+
+/******************************************************************************\
+|* Find an output by id
+\******************************************************************************/
+const Topology::Output * Topology::Snapshot::output(qint64 id) const
+	{
+	int idx = outputIds.value(id, -1);
+	return (idx < 0) ? nullptr : &outputs[idx];
+	}
@@ -0,0 +1,117 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <atomic>
+#include <memory>
+
+#include <QHash>
+#include <QList>
+#include <QMetaType>
+#include <QMutex>
+#include <QPair>
+#include <QString>
+#include <QVector>
+
+#include "singleton.h"
+
+/******************************************************************************\
+|* The topology is the set of modules, inputs and outputs in the system. It is
+|* owned and written by DbMgr (write-through to SQLite), and any thread may
+|* read it via snapshot(). Each change publishes a new immutable snapshot
+|* with a higher version number. Snapshots are shared: one is freed when the
+|* last reader holding it lets go, however long that takes, so a reader keeps
+|* the SnapshotPtr for as long as it uses the data.
+|*
+|* The version is a plain atomic, and each thread caches the last snapshot
+|* it was handed, so while the topology is unchanged snapshot() is a load and
+|* a reference count bump with no lock. Only the first call after a change
+|* takes the (writer's) lock to pick up the new one. A thread's cached
+|* snapshot lives until that thread next asks, or exits.
+\******************************************************************************/
+class Topology : public Singleton<Topology>
+	{
+	public:
+		/**********************************************************************\
+		|* Typedefs and enums
+		\**********************************************************************/
+		struct Module
+			{
+			qint64		id		= -1;		// Database id
+			QString		name;				// Human-readable name
+			QString		driver;				// Driver for the module
+			QString		nodeId;				// CAN node identifier
+			QString		render;				// Renderer in the web-app
+			};
+
+		struct Channel
+			{
+			qint64		id		= -1;		// Database id
+			QString		name;				// Human-readable name
+			qint64		module	= -1;		// Module this belongs to
+			QString		driver;				// Driver for the channel
+			QString		render;				// Renderer in the web-app
+			};
+		typedef Channel Input;
+		typedef Channel Output;
+
+		struct Snapshot
+			{
+			quint64				version = 0;	// Topology version number
+			QVector<Module>		modules;		// Sorted by name
+			QVector<Input>		inputs;			// Sorted by name
+			QVector<Output>		outputs;		// Sorted by name
+
+			QHash<qint64, int>	moduleIds;		// id -> index in modules
+			QHash<qint64, int>	inputIds;		// id -> index in inputs
+			QHash<qint64, int>	outputIds;		// id -> index in outputs
+			QHash<QString, int>	nodeIds;		// nodeId -> index in modules
+
+			/******************************************************************\
+			|* Sort by name and rebuild the lookup tables after a change
+			\******************************************************************/
+			void reindex(void);
+
+			/******************************************************************\
+			|* Lookups, returning nullptr if not found
+			\******************************************************************/
+			const Module * module(qint64 id) const;
+			const Module * moduleForNode(const QString& nodeId) const;
+			const Input  * input(qint64 id) const;
+			const Output * output(qint64 id) const;
+			};
+		typedef std::shared_ptr<const Snapshot> SnapshotPtr;
+
+	private:
+		/**********************************************************************\
+		|* Private variables
+		\**********************************************************************/
+		mutable QMutex			_lock;		// Protects _current
+		SnapshotPtr				_current;	// Published view
+		std::atomic<quint64>	_version;	// Its version, read without _lock
+
+	public:
+		/**********************************************************************\
+		|* Constructor
+		\**********************************************************************/
+		explicit Topology();
+
+		/**********************************************************************\
+		|* Return the current snapshot. Safe to call from any thread
+		\**********************************************************************/
+		SnapshotPtr snapshot(void) const;
+
+		/**********************************************************************\
+		|* Return the current topology version. Safe to call from any thread
+		\**********************************************************************/
+		quint64 version(void) const;
+
+		/**********************************************************************\
+		|* Publish a new snapshot, taking ownership. Writer (DbMgr) only
+		\**********************************************************************/
+		void publish(Snapshot *next);
+	};
+
+Q_DECLARE_METATYPE(Topology::Module)
+Q_DECLARE_METATYPE(Topology::Channel)
+
+#endif // TOPOLOGY_H
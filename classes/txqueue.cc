@@ -0,0 +1,422 @@
+#include <cstring>
+
+#include <QtEndian>
+
+#include "command.h"
+#include "constants.h"
+#include "topology.h"
+#include "txqueue.h"
+
+/******************************************************************************\
+|* Tuning: how long a node has to ack (doubling on each retry), how many
+|* times we send, and how much we put on the bus per pass of the event loop
+\******************************************************************************/
+#define TX_ACK_TIMEOUT_MS		50
+#define TX_MAX_ATTEMPTS			4
+#define TX_TICK_MS				5
+#define TX_BATCH				32
+#define TX_MAX_IN_FLIGHT		64
+#define TX_BACKOFF_MS			10
+
+/******************************************************************************\
+|* Categorised logging support
+\******************************************************************************/
+Q_LOGGING_CATEGORY(log_tx, "reefd:tx")
+
+#define LOG qDebug(log_tx) << QTime::currentTime().toString("hh:mm:ss.zzz")
+#define ERR qCritical(log_tx) << QTime::currentTime().toString("hh:mm:ss.zzz")
+
+/******************************************************************************\
+|* Helper function: Key for a command in flight
+\******************************************************************************/
+static inline quint32 flightKey(quint16 node, quint8 seq)
+	{
+	return (static_cast<quint32>(node) << 8) | seq;
+	}
+
+/******************************************************************************\
+|* Helper function: The upper bound of a latency bucket, or -1 for the last
+\******************************************************************************/
+static inline qint64 bucketLimit(int bucket)
+	{
+	return (bucket < TX_LATENCY_BUCKETS - 1)
+		 ? (static_cast<qint64>(TX_LATENCY_BASE_US) << bucket)
+		 : -1;
+	}
+
+/******************************************************************************\
+|* Constructor
+\******************************************************************************/
+TxQueue::TxQueue(Send send, QObject *parent)
+		:QObject{parent}
+		,_sent(0)
+		,_acked(0)
+		,_rejected(0)
+		,_retries(0)
+		,_timeouts(0)
+		,_superseded(0)
+		,_send(send)
+		,_timer(this)
+		,_pumpQueued(false)
+		,_order(0)
+	{
+	memset(_latency, 0, sizeof(_latency));
+	_clock.start();
+
+	_timer.setInterval(TX_TICK_MS);
+	connect(&_timer, &QTimer::timeout, this, &TxQueue::_checkTimeouts);
+	}
+
+/******************************************************************************\
+|* Render a status
+\******************************************************************************/
+const char * TxQueue::statusName(Status status)
+	{
+	switch (status)
+		{
+		case OK:			return "ok";
+		case REJECTED:		return "rejected";
+		case TIMEOUT:		return "timeout";
+		case SUPERSEDED:	return "superseded";
+		case UNROUTABLE:	return "unroutable";
+		}
+	return "unknown";
+	}
+
+/******************************************************************************\
+|* Queue a command. If there's already one waiting for this output it's
+|* replaced, and this one goes to the back of the queue for its id
+\******************************************************************************/
+void TxQueue::setOutput(qint64 output, double value, int priority,
+						QString identifier)
+	{
+	Command command;
+	command.output		= output;
+	command.value		= value;
+	command.seq			= 0;
+	command.attempts	= 0;
+	command.queuedAt	= _clock.nsecsElapsed();
+	command.deadline	= 0;
+	command.identifier	= identifier;
+
+	if (!_route(output, command.node, command.channel))
+		{
+		_finish(command, UNROUTABLE);
+		return;
+		}
+
+	priority		= qBound(0, priority, (int)COMMAND_PRIO_MAX);
+	command.canId	= COMMAND_ID_BASE
+					| (static_cast<quint32>(priority) << COMMAND_PRIO_SHIFT)
+					| command.node;
+
+	auto old = _waitingFor.find(output);
+	if (old != _waitingFor.end())
+		{
+		_finish(_waiting.take(*old), SUPERSEDED);
+		_waitingFor.erase(old);
+		}
+
+	quint64 key = (static_cast<quint64>(command.canId) << 32) | _order++;
+	_waiting.insert(key, command);
+	_waitingFor.insert(output, key);
+	_schedulePump();
+	}
+
+/******************************************************************************\
+|* Send the stats back
+\******************************************************************************/
+void TxQueue::fetchStats(QString identifier)
+	{
+	emit fetchedStats(statsJson(), identifier);
+	}
+
+/******************************************************************************\
+|* An ACK has arrived. Late or duplicate ones match nothing and are dropped
+\******************************************************************************/
+void TxQueue::acknowledged(quint16 node, const quint8 *data, int length)
+	{
+	if (length < COMMAND_ACK_LEN)
+		return;
+
+	auto it = _inFlight.find(flightKey(node, data[0]));
+	if (it == _inFlight.end())
+		return;
+
+	Command command = *it;
+	_inFlight.erase(it);
+	_busy.remove(command.output);
+
+	if (data[2] == COMMAND_STATUS_OK)
+		{
+		qint64 us = (_clock.nsecsElapsed() - command.queuedAt) / 1000;
+		int bucket = 0;
+		while ((bucket < TX_LATENCY_BUCKETS - 1) && (us >= bucketLimit(bucket)))
+			bucket ++;
+		_latency[bucket] ++;
+
+		_finish(command, OK);
+		}
+	else
+		_finish(command, REJECTED);
+
+	// Anything waiting behind this one for the same output can go now
+	if (!_waiting.isEmpty())
+		_schedulePump();
+	}
+
+/******************************************************************************\
+|* The bus has room again
+\******************************************************************************/
+void TxQueue::resume(void)
+	{
+	if (!_waiting.isEmpty())
+		_schedulePump();
+	}
+
+/******************************************************************************\
+|* Render the counters and the histogram. Percentiles are the upper bound of
+|* the bucket they fall in
+\******************************************************************************/
+QString TxQueue::statsJson(void) const
+	{
+	quint64 total = 0;
+	for (int i=0; i<TX_LATENCY_BUCKETS; i++)
+		total += _latency[i];
+
+	QByteArray bounds, counts, p50, p90, p99;
+	quint64 seen = 0;
+	for (int i=0; i<TX_LATENCY_BUCKETS; i++)
+		{
+		if (i > 0)
+			{
+			bounds.append(',');
+			counts.append(',');
+			}
+		qint64 limit = bucketLimit(i);
+		QByteArray bound = (limit < 0) ? QByteArray("null")
+									   : QByteArray::number(limit);
+		bounds.append(bound);
+		counts.append(QByteArray::number(_latency[i]));
+
+		seen += _latency[i];
+		if (total > 0)
+			{
+			if (p50.isEmpty() && (seen * 100 >= total * 50))
+				p50 = bound;
+			if (p90.isEmpty() && (seen * 100 >= total * 90))
+				p90 = bound;
+			if (p99.isEmpty() && (seen * 100 >= total * 99))
+				p99 = bound;
+			}
+		}
+
+	if (total == 0)
+		p50 = p90 = p99 = "null";
+
+	return QString("{\"outputStats\":{\"sent\":%1,\"acked\":%2,\"rejected\":%3,"
+				   "\"retries\":%4,\"timeouts\":%5,\"superseded\":%6,"
+				   "\"waiting\":%7,\"inFlight\":%8,"
+				   "\"latencyUs\":{\"le\":[%9],\"counts\":[%10],"
+				   "\"p50\":%11,\"p90\":%12,\"p99\":%13}}}")
+			.arg(_sent).arg(_acked).arg(_rejected)
+			.arg(_retries).arg(_timeouts).arg(_superseded)
+			.arg(_waiting.size()).arg(_inFlight.size())
+			.arg(QString::fromLatin1(bounds), QString::fromLatin1(counts),
+				 QString::fromLatin1(p50), QString::fromLatin1(p90),
+				 QString::fromLatin1(p99));
+	}
+
+
+#pragma mark - Private methods
+
+/******************************************************************************\
+|* Find the node and channel for an output. Channels are numbered from 0 in
+|* id order among the module's outputs
+\******************************************************************************/
+bool TxQueue::_route(qint64 output, quint16& node, quint8& channel)
+	{
+	Topology::SnapshotPtr topo = Topology::instance().snapshot();
+	const Topology::Output *out = topo->output(output);
+	if (!out)
+		return false;
+
+	const Topology::Module *module = topo->module(out->module);
+	if (!module || module->nodeId.isEmpty())
+		return false;
+
+	bool ok;
+	uint number = module->nodeId.toUInt(&ok, 16);
+	if (!ok || (number > COMMAND_NODE_MASK))
+		return false;
+
+	int index = 0;
+	for (const Topology::Output& other : topo->outputs)
+		if ((other.module == out->module) && (other.id < output))
+			index ++;
+	if (index > 255)
+		return false;
+
+	node	= static_cast<quint16>(number);
+	channel	= static_cast<quint8>(index);
+	return true;
+	}
+
+/******************************************************************************\
+|* Write a command and put it in flight. A retry reuses the sequence number,
+|* so an ack for an earlier attempt still counts. If the write fails (the
+|* bus is backed up) it still counts as an attempt, and the timeout retries it
+\******************************************************************************/
+bool TxQueue::_transmit(Command& command)
+	{
+	if (command.attempts == 0)
+		command.seq = _seqs[command.node] ++;
+
+	float value = static_cast<float>(command.value);
+	quint32 bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	quint8 data[COMMAND_SET_LEN];
+	data[0] = command.seq;
+	data[1] = command.channel;
+	qToLittleEndian<quint32>(bits, data + 2);
+
+	bool ok = _send(command.canId, data, sizeof(data));
+	if (ok)
+		_sent ++;
+
+	command.attempts ++;
+	command.deadline = _clock.nsecsElapsed()
+					 + (TX_ACK_TIMEOUT_MS * 1000000LL << (command.attempts - 1));
+
+	quint32 key = flightKey(command.node, command.seq);
+	_inFlight.insert(key, command);
+	_busy.insert(command.output, key);
+
+	if (!_timer.isActive())
+		_timer.start();
+	return ok;
+	}
+
+/******************************************************************************\
+|* Tell the requester how it went
+\******************************************************************************/
+void TxQueue::_finish(const Command& command, Status status)
+	{
+	switch (status)
+		{
+		case OK:			_acked ++;		break;
+		case REJECTED:		_rejected ++;	break;
+		case TIMEOUT:		_timeouts ++;	break;
+		case SUPERSEDED:	_superseded ++;	break;
+		case UNROUTABLE:	break;
+		}
+
+	if (status != OK)
+		LOG << "Output" << command.output << "not set:" << statusName(status);
+
+	QString json = QString("{\"setOutput\":{\"id\":%1,\"value\":%2,"
+						   "\"status\":\"%3\",\"attempts\":%4}}")
+					.arg(command.output)
+					.arg(command.value)
+					.arg(statusName(status))
+					.arg(command.attempts);
+	emit outputSet(json, command.identifier);
+	}
+
+/******************************************************************************\
+|* Pump on the next pass of the event loop, so everything submitted in this
+|* one goes out as a single sorted batch
+\******************************************************************************/
+void TxQueue::_schedulePump(void)
+	{
+	if (_pumpQueued)
+		return;
+
+	_pumpQueued = true;
+	QMetaObject::invokeMethod(this, "_pump", Qt::QueuedConnection);
+	}
+
+
+#pragma mark - Private slots
+
+/******************************************************************************\
+|* Send waiting commands in id order, skipping outputs that already have one
+|* in flight. Stops at the batch size (to come back after other events), at
+|* the in-flight limit, or when the bus pushes back (trying again shortly)
+\******************************************************************************/
+void TxQueue::_pump(void)
+	{
+	_pumpQueued = false;
+
+	int budget = TX_BATCH;
+	auto it = _waiting.begin();
+	while ((it != _waiting.end()) && (budget > 0)
+		&& (_inFlight.size() < TX_MAX_IN_FLIGHT))
+		{
+		if (_busy.contains(it->output))
+			{
+			++ it;
+			continue;
+			}
+
+		Command command = *it;
+		_waitingFor.remove(command.output);
+		it = _waiting.erase(it);
+		budget --;
+
+		if (!_transmit(command))
+			{
+			// The bus pushed back: come back for the rest once it's drained
+			_pumpQueued = true;
+			QTimer::singleShot(TX_BACKOFF_MS, this, &TxQueue::_pump);
+			return;
+			}
+		}
+
+	if ((budget == 0) && (it != _waiting.end()))
+		_schedulePump();
+	}
+
+/******************************************************************************\
+|* Deal with overdue acks
+\******************************************************************************/
+void TxQueue::_checkTimeouts(void)
+	{
+	qint64 now = _clock.nsecsElapsed();
+	bool freed = false;
+
+	const QList<quint32> keys = _inFlight.keys();
+	for (quint32 key : keys)
+		{
+		const Command& command = _inFlight[key];
+		if (command.deadline > now)
+			continue;
+
+		if (_waitingFor.contains(command.output))
+			{
+			Command done = _inFlight.take(key);
+			_busy.remove(done.output);
+			_finish(done, SUPERSEDED);
+			freed = true;
+			}
+		else if (command.attempts >= TX_MAX_ATTEMPTS)
+			{
+			Command done = _inFlight.take(key);
+			_busy.remove(done.output);
+			_finish(done, TIMEOUT);
+			freed = true;
+			}
+		else
+			{
+			Command retry = _inFlight.take(key);
+			_retries ++;
+			_transmit(retry);
+			}
+		}
+
+	if (_inFlight.isEmpty())
+		_timer.stop();
+	if (freed)
+		_schedulePump();
+	}
@@ -0,0 +1,180 @@
+#ifndef TXQUEUE_H
+#define TXQUEUE_H
+
+#include <functional>
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMap>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+
+#include "properties.h"
+
+/******************************************************************************\
+|* Latency histogram buckets: bucket i counts acks that took less than
+|* TX_LATENCY_BASE_US << i microseconds; the last bucket is everything slower
+\******************************************************************************/
+#define TX_LATENCY_BASE_US		125
+#define TX_LATENCY_BUCKETS		16
+
+/******************************************************************************\
+|* The queue of output commands waiting to go out on the CAN bus, and those
+|* sent and waiting for the node to acknowledge them.
+|*
+|* Commands submitted together are sent together: submit() only schedules a
+|* pump for the next pass of the event loop, so a burst is sorted and sent
+|* as one batch. Waiting commands go in CAN id order (priority, then node),
+|* FIFO within an id. A new command for an output that's still waiting
+|* replaces the old one, which is answered as superseded. Each output has at
+|* most one command in flight, so they can't be applied out of order.
+|*
+|* A command not acknowledged in time is sent again, with the timeout
+|* doubling each time, unless a newer one for that output is waiting, in
+|* which case it's superseded instead. The time from submit to ack goes into
+|* a log2 histogram
+\******************************************************************************/
+class TxQueue : public QObject
+	{
+	Q_OBJECT
+
+	public:
+		/**********************************************************************\
+		|* Typedefs and enums
+		\**********************************************************************/
+		typedef std::function<bool(quint32 id,
+								   const quint8 *data,
+								   int length)> Send;
+
+		enum Status
+			{
+			OK = 0,
+			REJECTED,				// The node said no
+			TIMEOUT,				// No ack after all the retries
+			SUPERSEDED,				// Replaced by a newer command
+			UNROUTABLE				// Output isn't on a node we know
+			};
+
+		struct Command
+			{
+			qint64		output;		// outputs.id
+			double		value;		// What to set it to
+			quint32		canId;		// Includes priority and node
+			quint16		node;		// Node number
+			quint8		channel;	// Output on the node
+			quint8		seq;		// Sequence number, once sent
+			int			attempts;	// Times sent
+			qint64		queuedAt;	// ns, on _clock
+			qint64		deadline;	// ns, on _clock, when in flight
+			QString		identifier;	// Who asked
+			};
+
+	/**************************************************************************\
+	|* Properties
+	\**************************************************************************/
+	GET(qint64, sent);					// Frames written, including retries
+	GET(qint64, acked);					// Commands acknowledged OK
+	GET(qint64, rejected);				// Commands the node refused
+	GET(qint64, retries);				// Resends after a timeout
+	GET(qint64, timeouts);				// Commands given up on
+	GET(qint64, superseded);			// Commands replaced before an ack
+
+	private:
+		/**********************************************************************\
+		|* Private variables
+		\**********************************************************************/
+		Send						_send;		// Write a frame to the bus
+		QElapsedTimer				_clock;		// Monotonic time base
+		QTimer						_timer;		// Ack timeouts (child)
+		bool						_pumpQueued;// A pump is scheduled
+		quint32						_order;		// FIFO tiebreak for _waiting
+		QMap<quint64, Command>		_waiting;	// (canId, order) -> command
+		QHash<qint64, quint64>		_waitingFor;// output -> _waiting key
+		QHash<quint32, Command>		_inFlight;	// (node, seq) -> command
+		QHash<qint64, quint32>		_busy;		// output -> _inFlight key
+		QHash<quint16, quint8>		_seqs;		// Next sequence, per node
+		quint64						_latency[TX_LATENCY_BUCKETS];
+
+		/**********************************************************************\
+		|* Work out where an output is on the bus, false if we can't
+		\**********************************************************************/
+		bool _route(qint64 output, quint16& node, quint8& channel);
+
+		/**********************************************************************\
+		|* Write a command to the bus and put it in flight
+		\**********************************************************************/
+		bool _transmit(Command& command);
+
+		/**********************************************************************\
+		|* Answer the requester and update the counters
+		\**********************************************************************/
+		void _finish(const Command& command, Status status);
+
+		/**********************************************************************\
+		|* Schedule a pump for the next pass of the event loop
+		\**********************************************************************/
+		void _schedulePump(void);
+
+	private slots:
+		/**********************************************************************\
+		|* Send as much of the waiting queue as we can
+		\**********************************************************************/
+		void _pump(void);
+
+		/**********************************************************************\
+		|* Retry or give up on commands whose ack is overdue
+		\**********************************************************************/
+		void _checkTimeouts(void);
+
+	public:
+		/**********************************************************************\
+		|* Constructor
+		\**********************************************************************/
+		explicit TxQueue(Send send, QObject *parent = nullptr);
+
+		/**********************************************************************\
+		|* Handle an ACK frame from a node. Called by the bus
+		\**********************************************************************/
+		void acknowledged(quint16 node, const quint8 *data, int length);
+
+		/**********************************************************************\
+		|* The bus has room again: carry on sending what's waiting
+		\**********************************************************************/
+		void resume(void);
+
+		/**********************************************************************\
+		|* Render the counters and latency histogram as JSON
+		\**********************************************************************/
+		QString statsJson(void) const;
+
+		/**********************************************************************\
+		|* Render a status as a string
+		\**********************************************************************/
+		static const char * statusName(Status status);
+
+	public slots:
+		/**********************************************************************\
+		|* Queue a command to set an output. Priority 0 is the most urgent
+		\**********************************************************************/
+		void setOutput(qint64 output, double value, int priority,
+					   QString identifier);
+
+		/**********************************************************************\
+		|* Send the stats back to whoever asked
+		\**********************************************************************/
+		void fetchStats(QString identifier);
+
+	signals:
+		/**********************************************************************\
+		|* A command has been acknowledged, refused, or given up on
+		\**********************************************************************/
+		void outputSet(QString json, QString identifier);
+
+		/**********************************************************************\
+		|* The stats someone asked for
+		\**********************************************************************/
+		void fetchedStats(QString json, QString identifier);
+	};
+
+#endif // TXQUEUE_H
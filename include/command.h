@@ -0,0 +1,43 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+/*****************************************************************************\
+|* Output commands over CAN, shared by reefd and the modules.
+|*
+|* reefd sets an output on a node by sending SET on a 29-bit id carrying the
+|* command priority and the node number:
+|*
+|*   COMMAND_ID_BASE | (priority << COMMAND_PRIO_SHIFT) | node
+|*
+|* so lower priority numbers win arbitration, and every command beats the
+|* discovery traffic. The node answers with ACK on COMMAND_ACK_BASE | node.
+|*
+|*   SET   [0] sequence number, per node, echoed in the ACK
+|*         [1] channel: the output's index among the module's outputs,
+|*             in id order
+|*         [2..5] value, IEEE-754 float, little-endian
+|*
+|*   ACK   [0] sequence number
+|*         [1] channel
+|*         [2] status (COMMAND_STATUS_*)
+\*****************************************************************************/
+#define COMMAND_ID_BASE			0x10000000u
+#define COMMAND_ID_MASK			0x1FF80000u
+#define COMMAND_PRIO_SHIFT		16
+#define COMMAND_PRIO_MAX		7
+#define COMMAND_PRIO_DEFAULT	4
+
+#define COMMAND_ACK_BASE		0x10800000u
+#define COMMAND_ACK_MASK		0x1FFF0000u
+
+#define COMMAND_NODE_MASK		0x0000FFFFu
+
+#define COMMAND_SET_LEN			6
+#define COMMAND_ACK_LEN			3
+
+#define COMMAND_STATUS_OK		0x00
+#define COMMAND_STATUS_CHANNEL	0x01	// No such channel
+#define COMMAND_STATUS_RANGE	0x02	// Value out of range
+#define COMMAND_STATUS_FAULT	0x03	// Output is faulted
+
+#endif /* COMMAND_H */
@@ -0,0 +1,39 @@
+#ifndef DISCOVERY_H
+#define DISCOVERY_H
+
+/*****************************************************************************\
+|* Node discovery over CAN, shared by reefd, the modules and the simulator.
+|*
+|* Every node sends on its own 29-bit id, DISCOVERY_ID_BASE | node, where
+|* 'node' is a 16-bit number unique on the bus. The first payload byte says
+|* what the frame is:
+|*
+|*   ANNOUNCE   sent once at boot
+|*              [0] DISCOVERY_ANNOUNCE
+|*              [1..7] driver name, ASCII, NUL-padded
+|*
+|*   HEARTBEAT  sent every DISCOVERY_PERIOD_MS while running
+|*              [0] DISCOVERY_HEARTBEAT
+|*              [1] node state (DISCOVERY_STATE_*)
+|*              [2..5] uptime in seconds, little-endian
+|*
+|* A node that has not been heard from for DISCOVERY_TIMEOUT_MS is offline.
+|* Its module is found by nodeId, which is the node number as 4 hex digits
+\*****************************************************************************/
+#define DISCOVERY_ID_BASE		0x1F000000u
+#define DISCOVERY_ID_MASK		0x1FFF0000u
+#define DISCOVERY_NODE_MASK		0x0000FFFFu
+
+#define DISCOVERY_ANNOUNCE		0x01
+#define DISCOVERY_HEARTBEAT		0x02
+
+#define DISCOVERY_STATE_BOOT	0x00
+#define DISCOVERY_STATE_RUN		0x01
+#define DISCOVERY_STATE_FAULT	0x02
+
+#define DISCOVERY_DRIVER_LEN	7
+
+#define DISCOVERY_PERIOD_MS		1000
+#define DISCOVERY_TIMEOUT_MS	3500
+
+#endif /* DISCOVERY_H */
@@ -0,0 +1,203 @@
+#ifndef SPYPROTO_H
+#define SPYPROTO_H
+
+#include <stdint.h>
+
+/*****************************************************************************\
+|* The line protocol between reefd and the spy over USB serial, shared by
+|* both ends. Each message is one line of ASCII: a letter, then fixed-width
+|* hex fields, then '\n'. Lines starting with anything else ('#' by
+|* convention) are for humans and are ignored.
+|*
+|* Host -> spy
+|*   H                              Hello: reset the link. Anything queued is
+|*                                  dropped and credit starts again from R
+|*   T tt iiiiiiii l dd..           Transmit, with a tag to match the K
+|*   P nn pppp iiiiiiii l dd..      Transmit every p ms from periodic slot
+|*                                  nn, until replaced. p=0 frees the slot
+|*                                  (and needs no frame). No K is sent for
+|*                                  these, and they cost no credit
+|*   A iiiiiiii mmmmmmmm            Only pass on frames whose id matches i
+|*                                  in the bits set in m. Each A adds to the
+|*                                  list; H goes back to passing everything
+|*   Q iiiiiiii f pppp              Forward frames with id i less often:
+|*                                  if f has SPY_FWD_CHANGED, only when the
+|*                                  payload changes, and if p isn't 0, at
+|*                                  most every p ms (but with CHANGED, at
+|*                                  least every p ms too). Without CHANGED,
+|*                                  the last frame held back goes out (as
+|*                                  a U) once the p ms are up, so the host
+|*                                  always ends up with the latest. f=0 and
+|*                                  p=0 go back to forwarding everything
+|*
+|* Spy -> host
+|*   R cc                           Link reset; the host has cc credits
+|*   C cc                           cc more credits
+|*   F s{16} iiiiiiii l dd..        Frame received at time s
+|*   U s{16} rrrrrrrr               As F, but r frames with this id were
+|*     iiiiiiii l dd..              held back (by Q) since the last one
+|*   K tt s{16}                     Frame tagged tt went out at time s
+|*   D tt                           Frame tagged tt dropped (no credit)
+|*   E s{16} xxxxxxxx               Bus error at time s
+|*   S kk vvvvvvvv                  Statistic k (SPY_STAT_*) is v. Sent for
+|*                                  each, every SPY_STATS_MS
+|*   I iiiiiiii nnnnnnnn            Timing for id i over the last
+|*     mmmmmmmm aaaaaaaa            SPY_STATS_MS: n frames, m/a/x the
+|*     xxxxxxxx jjjjjjjj            min/average/max us between them, and
+|*                                  j the jitter in us. Sent with the S
+|*                                  lines, for the ids heard since the last
+|*
+|* (spaces above are for reading only; there are none on the wire). Ids use
+|* can2040's (and SocketCAN's) flags in the top bits. Times (s{16}) are the
+|* spy's 64-bit microsecond clock, taken as the frame ends, in 16 digits.
+|* It starts at 0 when the spy does, and doesn't wrap.
+|*
+|* Flow control is by credit: each T costs the host one credit, and the spy
+|* hands credits back (in batches) as frames move from its queue to the CAN
+|* controller, so the host can never overrun the queue
+\*****************************************************************************/
+#define SPY_ID_EFF				(1u << 31)
+#define SPY_ID_RTR				(1u << 30)
+
+#define SPY_MSG_HELLO			'H'
+#define SPY_MSG_TRANSMIT		'T'
+#define SPY_MSG_PERIODIC		'P'
+#define SPY_MSG_ACCEPT			'A'
+#define SPY_MSG_FORWARD			'Q'
+#define SPY_MSG_RESET			'R'
+#define SPY_MSG_CREDIT			'C'
+#define SPY_MSG_FRAME			'F'
+#define SPY_MSG_REPEATED		'U'
+#define SPY_MSG_SENT			'K'
+#define SPY_MSG_DROPPED			'D'
+#define SPY_MSG_ERROR			'E'
+#define SPY_MSG_STAT			'S'
+#define SPY_MSG_TIMING			'I'
+
+#define SPY_TX_QUEUE			64		// Frames the spy will queue
+#define SPY_CREDIT_BATCH		8		// Credits returned at a time
+#define SPY_PERIODIC			8		// Periodic transmit slots
+#define SPY_FORWARD_RULES		16		// Ids Q can be set for
+#define SPY_ACCEPT_EXT			8		// Extended A filters, CAN2040_FILTER_EXT
+#define SPY_FWD_CHANGED			0x1		// Q: forward when the payload changes
+#define SPY_STATS_MS			1000	// How often statistics are sent
+#define SPY_MAX_LINE			64		// Longest line, with the '\n'
+
+/*****************************************************************************\
+|* Statistics. Counts are since the spy started
+\*****************************************************************************/
+#define SPY_STAT_RX				0x01	// Frames received
+#define SPY_STAT_TX				0x02	// Frames sent
+#define SPY_STAT_TX_ATTEMPT		0x03	// Attempts to send
+#define SPY_STAT_PARSE_ERROR	0x04	// Frames that didn't parse
+#define SPY_STAT_RX_FILTERED	0x05	// Frames dropped by the A filters
+#define SPY_STAT_LOST			0x06	// Events the main loop fell behind on
+#define SPY_STAT_IRQ_LATENCY	0x07	// us, worst wait for the CAN IRQ
+#define SPY_STAT_IRQ_TIME		0x08	// us, longest in the CAN IRQ
+#define SPY_STAT_TIMING_FULL	0x09	// Frames not timed: too many ids
+#define SPY_STAT_BUS_LOAD		0x0A	// Per mille busy, over the last second
+#define SPY_STAT_STUFF_ERROR	0x0B	// Frames with a stuff error
+#define SPY_STAT_CRC_ERROR		0x0C	// .. with a bad CRC
+#define SPY_STAT_FORM_ERROR		0x0D	// .. with a bad delimiter or EOF
+#define SPY_STAT_ACK_ERROR		0x0E	// .. that nobody acked
+
+/*****************************************************************************\
+|* Helper functions: hex fields
+\*****************************************************************************/
+static inline char * spy_put_hex(char *out, uint32_t value, int digits)
+	{
+	static const char hex[] = "0123456789abcdef";
+	for (int i=digits-1; i>=0; i--)
+		{
+		out[i] = hex[value & 0xF];
+		value >>= 4;
+		}
+	return out + digits;
+	}
+
+static inline int spy_get_hex(const char *in, int digits, uint32_t *value)
+	{
+	uint32_t v = 0;
+	for (int i=0; i<digits; i++)
+		{
+		char c = in[i];
+		int n;
+		if ((c >= '0') && (c <= '9'))
+			n = c - '0';
+		else if ((c >= 'a') && (c <= 'f'))
+			n = c - 'a' + 10;
+		else if ((c >= 'A') && (c <= 'F'))
+			n = c - 'A' + 10;
+		else
+			return 0;
+		v = (v << 4) | n;
+		}
+	*value = v;
+	return 1;
+	}
+
+/*****************************************************************************\
+|* Helper functions: 64-bit times, as 16 hex digits
+\*****************************************************************************/
+static inline char * spy_put_time(char *out, uint64_t at)
+	{
+	out = spy_put_hex(out, (uint32_t)(at >> 32), 8);
+	return spy_put_hex(out, (uint32_t)at, 8);
+	}
+
+static inline int spy_get_time(const char *in, uint64_t *at)
+	{
+	uint32_t hi, lo;
+	if (!spy_get_hex(in, 8, &hi) || !spy_get_hex(in + 8, 8, &lo))
+		return 0;
+	*at = ((uint64_t)hi << 32) | lo;
+	return 1;
+	}
+
+/*****************************************************************************\
+|* Helper function: Write "iiiiiiii l dd.." for a frame, returning the end
+\*****************************************************************************/
+static inline char * spy_put_frame(char *out,
+								   uint32_t id,
+								   uint32_t dlc,
+								   const uint8_t *data)
+	{
+	if (dlc > 8)
+		dlc = 8;
+	out = spy_put_hex(out, id, 8);
+	out = spy_put_hex(out, dlc, 1);
+	if (!(id & SPY_ID_RTR))
+		for (uint32_t i=0; i<dlc; i++)
+			out = spy_put_hex(out, data[i], 2);
+	return out;
+	}
+
+/*****************************************************************************\
+|* Helper function: Parse "iiiiiiii l dd.." from a line of 'len' characters
+|* (without the '\n'). Returns 0 if it's malformed
+\*****************************************************************************/
+static inline int spy_get_frame(const char *in,
+								int len,
+								uint32_t *id,
+								uint32_t *dlc,
+								uint8_t *data)
+	{
+	if ((len < 9) || !spy_get_hex(in, 8, id) || !spy_get_hex(in + 8, 1, dlc)
+	 || (*dlc > 8))
+		return 0;
+
+	int bytes = (*id & SPY_ID_RTR) ? 0 : (int)*dlc;
+	if (len != 9 + 2 * bytes)
+		return 0;
+
+	for (int i=0; i<bytes; i++)
+		{
+		uint32_t b;
+		if (!spy_get_hex(in + 9 + 2 * i, 2, &b))
+			return 0;
+		data[i] = (uint8_t)b;
+		}
+	return 1;
+	}
+
+#endif /* SPYPROTO_H */
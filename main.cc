@@ -1,11 +1,18 @@
 #include <QCoreApplication>
+#include <QFile>
 #include <QThread>
 #include <QWebSocket>
 
+#include "canbus.h"
+#include "candecoder.h"
 #include "config.h"
 #include "constants.h"
 #include "desktop.h"
 #include "dmbgr.h"
+#include "exportserver.h"
+#include "history.h"
+#include "importer.h"
+#include "journal.h"
 #include "socket.h"
 
 #define CONNECT		QObject::connect
@@ -28,6 +35,58 @@ int main(int argc, char *argv[])
 	\**************************************************************************/
 	Config &cfg = Config::instance();
 
+	/**************************************************************************\
+	|* Decoder benchmark mode: time it and stop
+	\**************************************************************************/
+	if (cfg.benchDecode() > 0)
+		{
+		CanDecoder::benchmark(cfg.benchDecode());
+		return 0;
+		}
+
+	/**************************************************************************\
+	|* SysInfo benchmark mode: likewise
+	\**************************************************************************/
+	if (cfg.benchSysInfo() > 0)
+		{
+		DbMgr::benchmark(cfg.benchSysInfo());
+		return 0;
+		}
+
+	/**************************************************************************\
+	|* Query plan check mode: fail if a hot lookup would scan a whole table
+	\**************************************************************************/
+	if (cfg.checkPlans())
+		{
+		DbMgr db;
+		return (db.dbOk() && db.checkQueryPlans()) ? 0 : 1;
+		}
+
+	/**************************************************************************\
+	|* Bulk import mode: load the files into the database and stop. candump
+	|* files are decoded with the signal definitions, if there are any
+	\**************************************************************************/
+	QStringList imports = cfg.importFiles();
+	if (!imports.isEmpty())
+		{
+		DbMgr db;
+		if (!db.dbOk())
+			return 1;
+
+		Importer importer(&db);
+		CanDecoder decoder;
+		if (QFile::exists(cfg.signalsFile()) && decoder.load(cfg.signalsFile()))
+			importer.setDecoder([&decoder](quint32 id,
+										   const quint8 *data,
+										   int length,
+										   qint64 at,
+										   Readings& out)
+				{
+				decoder.decode(id, data, length, at, out);
+				});
+		return importer.run(imports) ? 0 : 1;
+		}
+
 	/**************************************************************************\
 	|* Configure the message i/o handler (websocket-based)
 	\**************************************************************************/
@@ -36,6 +95,13 @@ int main(int argc, char *argv[])
 	ws.init(cfg.networkPort());
 
 	ws.moveToThread(&networkThread);
+
+	/**************************************************************************\
+	|* .. and the HTTP export endpoint, on the same thread
+	\**************************************************************************/
+	ExportServer exports;
+	exports.init(cfg.exportPort());
+	exports.moveToThread(&networkThread);
 	networkThread.start();
 
 	/**************************************************************************\
@@ -63,5 +129,78 @@ int main(int argc, char *argv[])
 	CONNECT(&ws, &Socket::fetchDesktopApps, &dt, &Desktop::fetchDesktopApps);
 	CONNECT(&dt, &Desktop::fetchedDesktopApps, &ws, &Socket::sendDesktopApps);
 
+	/**************************************************************************\
+	|* .. and for history queries, which are planned on this thread and then
+	|* scanned in parallel
+	\**************************************************************************/
+	History history;
+	CONNECT(&ws, &Socket::fetchHistory, &history, &History::fetchHistory);
+	CONNECT(&history, &History::fetchedHistory, &ws, &Socket::sendHistory);
+
+	/**************************************************************************\
+	|* Bring the readings store up to date from anything left in the
+	|* write-ahead journal
+	\**************************************************************************/
+	QString journalFile = cfg.databaseDir() + "/reef.journal";
+	db.replayJournal(journalFile);
+
+	/**************************************************************************\
+	|* Listen on the CAN bus for nodes, on its own thread, adding any new ones
+	|* to the topology. With signals defined, the readings their frames carry
+	|* go into the journal, which runs on its own thread so its syncs don't
+	|* stall anything
+	\**************************************************************************/
+	QThread journalThread;
+	Journal journal(journalFile);
+	QThread canThread;
+	CanBus can(cfg.canInterface());
+	CanDecoder decoder;
+	if (QFile::exists(cfg.signalsFile()) && decoder.load(cfg.signalsFile()))
+		{
+		journal.moveToThread(&journalThread);
+		CONNECT(&journalThread, &QThread::started, &journal, &Journal::start);
+		CONNECT(&journal, &Journal::committed, &db, &DbMgr::applyReadings);
+		CONNECT(&db, &DbMgr::journalApplied, &journal, &Journal::applied);
+		journalThread.start();
+
+		can.setDecoder(&decoder, [&journal](const Reading *readings, int count)
+			{
+			journal.append(readings, count);
+			});
+		}
+	can.moveToThread(&canThread);
+
+	CONNECT(&canThread, &QThread::started, &can, &CanBus::start);
+	CONNECT(&can, &CanBus::modulesDiscovered, &db, &DbMgr::upsertDiscovered);
+
+	/**************************************************************************\
+	|* .. and send output commands out through it, with the acks coming back
+	\**************************************************************************/
+	CONNECT(&ws, &Socket::setOutput, &can.tx(), &TxQueue::setOutput);
+	CONNECT(&can.tx(), &TxQueue::outputSet, &ws, &Socket::sendOutputResult);
+	CONNECT(&ws, &Socket::fetchOutputStats, &can.tx(), &TxQueue::fetchStats);
+	CONNECT(&can.tx(), &TxQueue::fetchedStats, &ws, &Socket::sendOutputStats);
+	CONNECT(&ws, &Socket::fetchBusStats, &can, &CanBus::fetchStats);
+	CONNECT(&can, &CanBus::fetchedStats, &ws, &Socket::sendBusStats);
+	canThread.start();
+
+	/**************************************************************************\
+	|* Make sure the last group of readings is synced before we go
+	\**************************************************************************/
+	CONNECT(&a, &QCoreApplication::aboutToQuit, [&]()
+		{
+		QMetaObject::invokeMethod(&can, "stop", Qt::BlockingQueuedConnection);
+		canThread.quit();
+		canThread.wait();
+
+		if (journalThread.isRunning())
+			{
+			QMetaObject::invokeMethod(&journal, "stop",
+									  Qt::BlockingQueuedConnection);
+			journalThread.quit();
+			journalThread.wait();
+			}
+		});
+
 	return a.exec();
 	}
@@ -1,5 +1,5 @@
 QT = core
-QT += websockets sql
+QT += network websockets sql
 
 CONFIG += c++17 cmdline sdk_no_version_check
 
@@ -8,10 +8,22 @@ CONFIG += c++17 cmdline sdk_no_version_check
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+        classes/canbus.cc \
+        classes/candecoder.cc \
+        classes/compactor.cc \
         classes/config.cc \
         classes/desktop.cc \
         classes/dmbgr.cc \
+        classes/exporter.cc \
+        classes/exportserver.cc \
+        classes/history.cc \
+        classes/importer.cc \
+        classes/journal.cc \
+        classes/migrator.cc \
         classes/socket.cc \
+        classes/sqlscript.cc \
+        classes/topology.cc \
+        classes/txqueue.cc \
         main.cc
 
 # Default rules for deployment.
@@ -19,15 +31,33 @@ qnx: target.path = /tmp/$${TARGET}/bin
 else: unix:!android: target.path = /opt/$${TARGET}/bin
 !isEmpty(target.path): INSTALLS += target
 
+LIBS += -lz
+
 INCLUDEPATH += \
 			classes \
 			include \
 
 HEADERS += \
+	classes/canbus.h \
+	classes/candecoder.h \
+	classes/compactor.h \
 	classes/config.h \
 	classes/desktop.h \
 	classes/dmbgr.h \
+	classes/exporter.h \
+	classes/exportserver.h \
+	classes/history.h \
+	classes/importer.h \
+	classes/journal.h \
+	classes/migrator.h \
+	classes/reading.h \
 	classes/socket.h \
+	classes/sqlscript.h \
+	classes/topology.h \
+	classes/txqueue.h \
+	include/command.h \
 	include/constants.h \
+	include/discovery.h \
 	include/properties.h \
-	include/singleton.h
+	include/singleton.h \
+	include/spyproto.h
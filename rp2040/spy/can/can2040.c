@@ -493,7 +493,34 @@ unstuf_restore_state(struct can2040_bitunstuffer *bu, uint32_t data)
     bu->stuffed_bits = (bu->stuffed_bits & ((1 << cs) - 1)) | (data << cs);
 }
 
+// Index of the highest set bit in a byte (for non-zero bytes)
+#define MSB2(n) n, n
+#define MSB4(n) MSB2(n), MSB2(n)
+#define MSB8(n) MSB4(n), MSB4(n)
+#define MSB16(n) MSB8(n), MSB8(n)
+#define MSB32(n) MSB16(n), MSB16(n)
+#define MSB64(n) MSB32(n), MSB32(n)
+#define MSB128(n) MSB64(n), MSB64(n)
+static const uint8_t unstuf_msb_table[256] = {
+    0, 0, MSB2(1), MSB4(2), MSB8(3), MSB16(4), MSB32(5), MSB64(6), MSB128(7)
+};
+
+// Index of the highest set bit in a (non-zero) 16-bit value
+static inline uint32_t
+unstuf_msb(uint32_t v)
+{
+    if (v >> 8)
+        return 8 + unstuf_msb_table[v >> 8];
+    return unstuf_msb_table[v];
+}
+
 // Pull bits from unstuffer (as specified in unstuf_set_count() )
+//
+// A bit is a stuff bit if the five bits before it are equal, which
+// gives a mask of all the stuff bit positions in one go.  Stuff bits
+// are at least five bits apart and at most PIO_RX_WAKE_BITS bits are
+// pending, so the data bits between them are copied in (at most three)
+// whole runs, rather than bit by bit.
 static int
 unstuf_pull_bits(struct can2040_bitunstuffer *bu)
 {
@@ -503,39 +530,39 @@ unstuf_pull_bits(struct can2040_bitunstuffer *bu)
     if (!cs)
         // Need more data
         return 1;
+    uint32_t stuff = (rm_bits >> 1) & ((1 << cs) - 1);
     for (;;) {
-        uint32_t try_cnt = cs > cu ? cu : cs;
-        for (;;) {
-            uint32_t try_mask = ((1 << try_cnt) - 1) << (cs + 1 - try_cnt);
-            if (likely(!(rm_bits & try_mask))) {
-                // No stuff bits in try_cnt bits - copy into unstuffed_bits
-                bu->count_unstuff = cu = cu - try_cnt;
-                bu->count_stuff = cs = cs - try_cnt;
-                bu->unstuffed_bits |= ((sb >> cs) & ((1 << try_cnt) - 1)) << cu;
-                if (! cu)
-                    // Extracted desired bits
-                    return 0;
-                break;
-            }
-            bu->count_stuff = cs = cs - 1;
-            if (rm_bits & (1 << (cs + 1))) {
-                // High bit is a stuff bit
-                if (unlikely(rm_bits & (1 << cs))) {
-                    // Six consecutive bits - a bitstuff error
-                    if (sb & (1 << cs))
-                        return -1;
-                    return -2;
-                }
-                break;
-            }
-            // High bit not a stuff bit - limit try_cnt and retry
-            bu->count_unstuff = cu = cu - 1;
-            bu->unstuffed_bits |= ((sb >> cs) & 1) << cu;
-            try_cnt /= 2;
+        // Copy data bits up to the next stuff bit (or all that's left)
+        uint32_t sp = stuff ? unstuf_msb(stuff) : 0;
+        uint32_t avail = stuff ? cs - 1 - sp : cs;
+        if (avail >= cu) {
+            // Extracted desired bits
+            bu->count_stuff = cs = cs - cu;
+            bu->unstuffed_bits |= (sb >> cs) & ((1 << cu) - 1);
+            bu->count_unstuff = 0;
+            return 0;
+        }
+        if (avail) {
+            bu->count_unstuff = cu = cu - avail;
+            bu->count_stuff = cs = cs - avail;
+            bu->unstuffed_bits |= ((sb >> cs) & ((1 << avail) - 1)) << cu;
         }
-        if (likely(!cs))
+        if (likely(!stuff))
             // Need more data
             return 1;
+
+        // Drop the stuff bit
+        bu->count_stuff = cs = sp;
+        if (unlikely(rm_bits & (1 << cs))) {
+            // Six consecutive bits - a bitstuff error
+            if (sb & (1 << cs))
+                return -1;
+            return -2;
+        }
+        if (!cs)
+            // Need more data
+            return 1;
+        stuff &= (1 << cs) - 1;
     }
 }
 
@@ -644,6 +671,10 @@ enum {
     TS_IDLE = 0, TS_QUEUED = 1, TS_ACKING_RX = 2, TS_CONFIRM_TX = 3
 };
 
+_Static_assert((CAN2040_TX_QUEUE_DEPTH & (CAN2040_TX_QUEUE_DEPTH - 1)) == 0
+               && CAN2040_TX_QUEUE_DEPTH <= 256
+               , "CAN2040_TX_QUEUE_DEPTH must be a power of two");
+
 // Calculate queue array position from a transmit index
 static uint32_t
 tx_qpos(struct can2040 *cd, uint32_t pos)
@@ -651,6 +682,56 @@ tx_qpos(struct can2040 *cd, uint32_t pos)
     return pos % ARRAY_SIZE(cd->tx_queue);
 }
 
+// Find the message at a transmit index
+//
+// The queue is a ring of indexes (tx_order) into tx_queue.  Entries
+// from tx_pull_pos up to tx_push_pos belong to the irq handler, which
+// may reorder them; the rest belong to can2040_transmit(), which fills
+// in the message at tx_push_pos before publishing it.  Neither side
+// ever touches the other's entries, so no locking is needed.
+static struct can2040_transmit *
+tx_slot(struct can2040 *cd, uint32_t pos)
+{
+    return &cd->tx_queue[cd->tx_order[tx_qpos(cd, pos)]];
+}
+
+#if CAN2040_TX_PRIORITY
+// Calculate a key that sorts messages the way bus arbitration would
+static uint32_t
+tx_arbitration_key(struct can2040_msg *msg)
+{
+    uint32_t id = msg->id, rtr = !!(id & CAN2040_ID_RTR);
+    if (!(id & CAN2040_ID_EFF))
+        // Base id, then RTR, then a dominant IDE
+        return ((id & 0x7ff) << 21) | (rtr << 19);
+    // Base id, recessive SRR and IDE, extended id, then RTR
+    return (((id >> 18) & 0x7ff) << 21) | (3 << 19)
+            | ((id & 0x3ffff) << 1) | rtr;
+}
+
+// Move the highest priority pending message to the head of the queue
+static void
+tx_prioritize(struct can2040 *cd, uint32_t tx_pull_pos, uint32_t tx_push_pos)
+{
+    uint32_t best = tx_pull_pos, pos;
+    uint32_t best_key = tx_arbitration_key(&tx_slot(cd, best)->msg);
+    for (pos = tx_pull_pos + 1; pos != tx_push_pos; pos++) {
+        uint32_t key = tx_arbitration_key(&tx_slot(cd, pos)->msg);
+        if (key < best_key) {
+            best = pos;
+            best_key = key;
+        }
+    }
+    if (best == tx_pull_pos)
+        return;
+    // Shift the others back one, so equal ids stay in queue order
+    uint8_t idx = cd->tx_order[tx_qpos(cd, best)];
+    for (pos = best; pos != tx_pull_pos; pos--)
+        cd->tx_order[tx_qpos(cd, pos)] = cd->tx_order[tx_qpos(cd, pos - 1)];
+    cd->tx_order[tx_qpos(cd, tx_pull_pos)] = idx;
+}
+#endif
+
 // Queue the next message for transmission in the PIO
 static uint32_t
 tx_schedule_transmit(struct can2040 *cd)
@@ -669,9 +750,14 @@ tx_schedule_transmit(struct can2040 *cd)
         // Raced with can2040_transmit() - msg is now available for transmit
         pio_signal_set_txpending(cd);
     }
+#if CAN2040_TX_PRIORITY
+    if (cd->tx_state != TS_CONFIRM_TX)
+        // Head isn't awaiting its eof - the highest priority message goes next
+        tx_prioritize(cd, tx_pull_pos, readl(&cd->tx_push_pos));
+#endif
     cd->tx_state = TS_QUEUED;
     cd->stats.tx_attempt++;
-    struct can2040_transmit *qt = &cd->tx_queue[tx_qpos(cd, tx_pull_pos)];
+    struct can2040_transmit *qt = tx_slot(cd, tx_pull_pos);
     pio_tx_send(cd, qt->stuffed_data, qt->stuffed_words);
     return 0;
 }
@@ -690,7 +776,7 @@ tx_check_local_message(struct can2040 *cd)
 {
     if (cd->tx_state != TS_QUEUED)
         return 0;
-    struct can2040_transmit *qt = &cd->tx_queue[tx_qpos(cd, cd->tx_pull_pos)];
+    struct can2040_transmit *qt = tx_slot(cd, cd->tx_pull_pos);
     struct can2040_msg *pm = &cd->parse_msg, *tm = &qt->msg;
     if (tm->id == pm->id) {
         if (qt->crc != cd->parse_crc || tm->dlc != pm->dlc
@@ -705,6 +791,30 @@ tx_check_local_message(struct can2040 *cd)
 }
 
 
+/****************************************************************
+ * Receive filtering
+ ****************************************************************/
+
+// Check if a received message passes the acceptance filter
+static int
+rx_accept(struct can2040 *cd, struct can2040_msg *msg)
+{
+    struct can2040_filter *f = &cd->filter;
+    if (!readl(&f->enabled))
+        return 1;
+    uint32_t id = msg->id;
+    if (!(id & CAN2040_ID_EFF)) {
+        uint32_t sid = id & 0x7ff;
+        return (f->std_bitmap[sid / 32] >> (sid % 32)) & 1;
+    }
+    uint32_t i, count = readl(&f->ext_count);
+    for (i=0; i<count; i++)
+        if (!((id ^ f->ext[i].id) & f->ext[i].mask))
+            return 1;
+    return 0;
+}
+
+
 /****************************************************************
  * Notification callbacks
  ****************************************************************/
@@ -731,6 +841,10 @@ static void
 report_callback_rx_msg(struct can2040 *cd)
 {
     cd->stats.rx_total++;
+    if (!rx_accept(cd, &cd->parse_msg)) {
+        cd->stats.rx_filtered++;
+        return;
+    }
     cd->rx_cb(cd, CAN2040_NOTIFY_RX, &cd->parse_msg);
 }
 
@@ -739,6 +853,8 @@ static void
 report_callback_tx_msg(struct can2040 *cd)
 {
     writel(&cd->tx_pull_pos, cd->tx_pull_pos + 1);
+    // Confirmed and retired - the new head may be reordered
+    cd->tx_state = TS_IDLE;
     cd->stats.tx_total++;
     cd->rx_cb(cd, CAN2040_NOTIFY_TX, &cd->parse_msg);
 }
@@ -939,11 +1055,22 @@ data_state_go_discard(struct can2040 *cd)
     report_note_discarding(cd);
 }
 
+// Parse error categories (for statistics)
+enum {
+    PE_OTHER, PE_STUFF, PE_CRC, PE_FORM, PE_ACK
+};
+
 // Note a data parse error and transition to discard state
 static void
-data_state_go_error(struct can2040 *cd)
+data_state_go_error(struct can2040 *cd, uint32_t kind)
 {
     cd->stats.parse_error++;
+    switch (kind) {
+    case PE_STUFF: cd->stats.stuff_error++; break;
+    case PE_CRC: cd->stats.crc_error++; break;
+    case PE_FORM: cd->stats.form_error++; break;
+    case PE_ACK: cd->stats.ack_error++; break;
+    }
     data_state_go_discard(cd);
 }
 
@@ -954,7 +1081,7 @@ data_state_line_error(struct can2040 *cd)
     if (cd->parse_state == MS_DISCARD)
         data_state_go_discard(cd);
     else
-        data_state_go_error(cd);
+        data_state_go_error(cd, PE_STUFF);
 }
 
 // Received six unexpected passive bits on the line
@@ -963,7 +1090,7 @@ data_state_line_passive(struct can2040 *cd)
 {
     if (cd->parse_state != MS_DISCARD && cd->parse_state != MS_START) {
         // Bitstuff error
-        data_state_go_error(cd);
+        data_state_go_error(cd, PE_STUFF);
         return;
     }
 
@@ -1001,7 +1128,7 @@ data_state_go_crc(struct can2040 *cd)
 
     int ret = report_note_crc_start(cd);
     if (ret) {
-        data_state_go_error(cd);
+        data_state_go_error(cd, PE_OTHER);
         return;
     }
     data_state_go_next(cd, MS_CRC, 16);
@@ -1094,7 +1221,8 @@ static void
 data_state_update_crc(struct can2040 *cd, uint32_t data)
 {
     if (((cd->parse_crc << 1) | 1) != data) {
-        data_state_go_error(cd);
+        // A bad crc delimiter is a form error, anything else a crc error
+        data_state_go_error(cd, (data & 1) ? PE_CRC : PE_FORM);
         return;
     }
 
@@ -1112,7 +1240,8 @@ data_state_update_ack(struct can2040 *cd, uint32_t data)
         // data_state_line_passive()
         unstuf_restore_state(&cd->unstuf, (cd->parse_crc_bits << 2) | data);
 
-        data_state_go_error(cd);
+        // Nobody acked (slot passive), or the ack delimiter was dominant
+        data_state_go_error(cd, (data & 1) ? PE_ACK : PE_FORM);
         return;
     }
     report_note_ack_success(cd);
@@ -1124,7 +1253,7 @@ static void
 data_state_update_eof0(struct can2040 *cd, uint32_t data)
 {
     if (data != 0x0f || pio_rx_check_stall(cd)) {
-        data_state_go_error(cd);
+        data_state_go_error(cd, data != 0x0f ? PE_FORM : PE_OTHER);
         return;
     }
     unstuf_clear_state(&cd->unstuf);
@@ -1144,7 +1273,7 @@ data_state_update_eof1(struct can2040 *cd, uint32_t data)
         report_note_eof_success(cd);
         data_state_go_discard(cd);
     } else {
-        data_state_go_error(cd);
+        data_state_go_error(cd, PE_FORM);
     }
 }
 
@@ -1184,6 +1313,7 @@ process_rx(struct can2040 *cd, uint32_t rx_data)
 {
     unstuf_add_bits(&cd->unstuf, rx_data, PIO_RX_WAKE_BITS);
     cd->raw_bit_count += PIO_RX_WAKE_BITS;
+    cd->stats.bus_bits += PIO_RX_WAKE_BITS;
 
     // undo bit stuffing
     for (;;) {
@@ -1248,19 +1378,10 @@ can2040_check_transmit(struct can2040 *cd)
     return pending < ARRAY_SIZE(cd->tx_queue);
 }
 
-// API function to transmit a message
-int
-can2040_transmit(struct can2040 *cd, struct can2040_msg *msg)
+// Normalize a message and calculate its crc and stuffed bits
+static void
+tx_encode(struct can2040_transmit *qt, struct can2040_msg *msg)
 {
-    uint32_t tx_pull_pos = readl(&cd->tx_pull_pos);
-    uint32_t tx_push_pos = cd->tx_push_pos;
-    uint32_t pending = tx_push_pos - tx_pull_pos;
-    if (pending >= ARRAY_SIZE(cd->tx_queue))
-        // Tx queue full
-        return -1;
-
-    // Copy msg into transmit queue
-    struct can2040_transmit *qt = &cd->tx_queue[tx_qpos(cd, tx_push_pos)];
     uint32_t id = msg->id;
     if (id & CAN2040_ID_EFF)
         qt->msg.id = id & ~0x20000000;
@@ -1303,14 +1424,106 @@ can2040_transmit(struct can2040 *cd, struct can2040_msg *msg)
     bs_push(&bs, qt->crc, 15);
     bs_pushraw(&bs, 1, 1);
     qt->stuffed_words = bs_finalize(&bs);
+}
+
+// Find the free queue entry for the next transmit (or NULL if full)
+static struct can2040_transmit *
+tx_claim(struct can2040 *cd)
+{
+    uint32_t tx_pull_pos = readl(&cd->tx_pull_pos);
+    uint32_t tx_push_pos = cd->tx_push_pos;
+    uint32_t pending = tx_push_pos - tx_pull_pos;
+    if (pending >= ARRAY_SIZE(cd->tx_queue))
+        // Tx queue full
+        return NULL;
+    return tx_slot(cd, tx_push_pos);
+}
 
-    // Submit
-    writel(&cd->tx_push_pos, tx_push_pos + 1);
+// Publish the entry returned by tx_claim()
+static void
+tx_submit(struct can2040 *cd)
+{
+    // The irq handler may be on the other core
+    __DMB();
+    writel(&cd->tx_push_pos, cd->tx_push_pos + 1);
 
     // Wakeup if in TS_IDLE state
     __DMB();
     pio_signal_set_txpending(cd);
+}
 
+// API function to transmit a message
+int
+can2040_transmit(struct can2040 *cd, struct can2040_msg *msg)
+{
+    struct can2040_transmit *qt = tx_claim(cd);
+    if (!qt)
+        return -1;
+    tx_encode(qt, msg);
+    tx_submit(cd);
+    return 0;
+}
+
+// API function to encode a message once for repeated transmits
+void
+can2040_prepare(struct can2040_prepared *pm, struct can2040_msg *msg)
+{
+    tx_encode(&pm->qt, msg);
+}
+
+// API function to transmit a message encoded by can2040_prepare()
+int
+can2040_transmit_prepared(struct can2040 *cd, struct can2040_prepared *pm)
+{
+    struct can2040_transmit *qt = tx_claim(cd);
+    if (!qt)
+        return -1;
+    *qt = pm->qt;
+    tx_submit(cd);
+    return 0;
+}
+
+
+/****************************************************************
+ * Acceptance filter configuration
+ ****************************************************************/
+
+// API function to accept all messages again
+void
+can2040_filter_reset(struct can2040 *cd)
+{
+    struct can2040_filter *f = &cd->filter;
+    writel(&f->enabled, 0);
+    writel(&f->ext_count, 0);
+    memset(f->std_bitmap, 0, sizeof(f->std_bitmap));
+}
+
+// API function to accept messages where (msg->id & mask) == (id & mask)
+//
+// The first filter added turns filtering on; from then on only
+// messages matching at least one filter reach the callback.  The
+// CAN2040_ID_EFF flag in 'id' selects standard or extended ids.
+// Messages are still acked on the bus either way.
+int
+can2040_filter_add(struct can2040 *cd, uint32_t id, uint32_t mask)
+{
+    struct can2040_filter *f = &cd->filter;
+    if (id & CAN2040_ID_EFF) {
+        uint32_t count = f->ext_count;
+        if (count >= ARRAY_SIZE(f->ext))
+            return -1;
+        f->ext[count].mask = mask & 0x1fffffff;
+        f->ext[count].id = id & f->ext[count].mask;
+        __DMB();
+        writel(&f->ext_count, count + 1);
+    } else {
+        uint32_t sid;
+        mask &= 0x7ff;
+        for (sid=0; sid<2048; sid++)
+            if (!((sid ^ id) & mask))
+                f->std_bitmap[sid / 32] |= 1 << (sid % 32);
+    }
+    writel(&f->enabled, 1);
     return 0;
 }
 
@@ -1324,6 +1537,9 @@ void
 can2040_setup(struct can2040 *cd, uint32_t pio_num)
 {
     memset(cd, 0, sizeof(*cd));
+    uint32_t i;
+    for (i=0; i<ARRAY_SIZE(cd->tx_order); i++)
+        cd->tx_order[i] = i;
     cd->pio_num = !!pio_num;
     cd->pio_hw = cd->pio_num ? pio1_hw : pio0_hw;
 }
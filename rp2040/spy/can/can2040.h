@@ -34,6 +34,12 @@ struct can2040_stats {
     uint32_t rx_total, tx_total;
     uint32_t tx_attempt;
     uint32_t parse_error;
+    uint32_t rx_filtered;
+    // parse_error broken down (the rest are overruns and tx mismatches)
+    uint32_t stuff_error, crc_error, form_error, ack_error;
+    // Raw (stuffed) bits sampled on the line - the bus is only sampled
+    // from start-of-frame until 10 passive bits, so this counts busy time
+    uint32_t bus_bits;
 };
 
 void can2040_setup(struct can2040 *cd, uint32_t pio_num);
@@ -45,6 +51,11 @@ void can2040_get_statistics(struct can2040 *cd, struct can2040_stats *stats);
 void can2040_pio_irq_handler(struct can2040 *cd);
 int can2040_check_transmit(struct can2040 *cd);
 int can2040_transmit(struct can2040 *cd, struct can2040_msg *msg);
+struct can2040_prepared;
+void can2040_filter_reset(struct can2040 *cd);
+int can2040_filter_add(struct can2040 *cd, uint32_t id, uint32_t mask);
+void can2040_prepare(struct can2040_prepared *pm, struct can2040_msg *msg);
+int can2040_transmit_prepared(struct can2040 *cd, struct can2040_prepared *pm);
 
 
 /****************************************************************
@@ -56,11 +67,39 @@ struct can2040_bitunstuffer {
     uint32_t unstuffed_bits, count_unstuff;
 };
 
+// Transmit queue depth (must be a power of two)
+#ifndef CAN2040_TX_QUEUE_DEPTH
+#define CAN2040_TX_QUEUE_DEPTH 4
+#endif
+
+// Number of extended id acceptance filters
+#ifndef CAN2040_FILTER_EXT
+#define CAN2040_FILTER_EXT 8
+#endif
+
+// Send queued messages in arbitration order rather than queue order
+#ifndef CAN2040_TX_PRIORITY
+#define CAN2040_TX_PRIORITY 0
+#endif
+
 struct can2040_transmit {
     struct can2040_msg msg;
     uint32_t crc, stuffed_words, stuffed_data[5];
 };
 
+struct can2040_prepared {
+    struct can2040_transmit qt;
+};
+
+struct can2040_filter {
+    uint32_t enabled;
+    uint32_t std_bitmap[2048 / 32];
+    uint32_t ext_count;
+    struct {
+        uint32_t id, mask;
+    } ext[CAN2040_FILTER_EXT];
+};
+
 struct can2040 {
     // Setup
     uint32_t pio_num;
@@ -80,11 +119,13 @@ struct can2040 {
 
     // Reporting
     uint32_t report_state;
+    struct can2040_filter filter;
 
     // Transmits
     uint32_t tx_state;
     uint32_t tx_pull_pos, tx_push_pos;
-    struct can2040_transmit tx_queue[4];
+    uint8_t tx_order[CAN2040_TX_QUEUE_DEPTH];
+    struct can2040_transmit tx_queue[CAN2040_TX_QUEUE_DEPTH];
 };
 
 #ifdef __cplusplus
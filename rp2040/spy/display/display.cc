@@ -85,14 +85,18 @@ Display::Display(i2c_inst *inst, uint16_t i2cAddr, Size size)
 		,_address(i2cAddr)
 		,_size(size)
 		,_fb(nullptr)
+		,_buf(nullptr)
 		,_width(128)
 		,_height(size == Size::W128xH32 ? 32 : 64)
 		,_inverted(false)
 	{
 	/**************************************************************************\
-	|* Create the framebuffer
+	|* Create the framebuffer, after the byte that tells the SSD1306 data
+	|* follows, so a whole screen can go straight from here
 	\**************************************************************************/
-    _fb = new uint8_t[FRAMEBUFFER_SIZE];
+    _buf	= new uint8_t[FRAMEBUFFER_SIZE + 1];
+    _buf[0]	= SSD1306_STARTLINE;
+    _fb		= _buf + 1;
 
 	/**************************************************************************\
 	|* Send all the startup commands
@@ -101,35 +105,50 @@ Display::Display(i2c_inst *inst, uint16_t i2cAddr, Size size)
 		_cmd(command);
 
 	/**************************************************************************\
-	|* Clear the buffer and send to the display
+	|* Clear the buffer and send all of it to the display
 	\**************************************************************************/
+	for (int page=0; page<DISPLAY_PAGES; page++)
+		{
+		_dirtyLo[page] = 0;
+		_dirtyHi[page] = _width - 1;
+		}
 	clear();
 	update();
 	}
 
 
 /******************************************************************************\
-|* Update the framebuffer
+|* Update the framebuffer. Each page with changes sends the span of columns
+|* that changed; runs of pages that changed all the way across go as one
+|* window, since they're contiguous in _fb
 \******************************************************************************/
 void Display::update(void)
 	{
-	_cmd(SSD1306_PAGEADDR); 		//Set page address from min to max
-	_cmd(0x00);
-	_cmd(0x07);
-	_cmd(SSD1306_COLUMNADDR); 		//Set column address from min to max
-	_cmd(0x00);
-	_cmd(127);
-
-	/**************************************************************************\
-	|* create a temporary buffer of size of buffer plus 1 byte for startline 
-	|* command aka 0x40
-	\**************************************************************************/
-	unsigned char data[FRAMEBUFFER_SIZE + 1];
-	data[0] = SSD1306_STARTLINE;
-	memcpy(data + 1, _fb, FRAMEBUFFER_SIZE);
-
-	// send data to device
-	i2c_write_blocking(_i2c, _address, data, FRAMEBUFFER_SIZE + 1, false);
+	int page = 0;
+	while (page < DISPLAY_PAGES)
+		{
+		uint8_t lo = _dirtyLo[page];
+		uint8_t hi = _dirtyHi[page];
+		if (hi < lo)
+			{
+			page ++;
+			continue;
+			}
+
+		int last = page;
+		if ((lo == 0) && (hi == _width - 1))
+			while ((last + 1 < DISPLAY_PAGES)
+				&& (_dirtyLo[last + 1] == 0)
+				&& (_dirtyHi[last + 1] == _width - 1))
+				last ++;
+
+		_flush(page, last, lo, hi);
+		for (; page<=last; page++)
+			{
+			_dirtyLo[page] = _width - 1;
+			_dirtyHi[page] = 0;
+			}
+		}
 	}
 
 
@@ -138,7 +157,12 @@ void Display::update(void)
 \******************************************************************************/
 void Display::clear(void)
 	{
-    memset(_fb, 0, FRAMEBUFFER_SIZE);
+	for (int n=0; n<FRAMEBUFFER_SIZE; n++)
+		if (_fb[n])
+			{
+			_fb[n] = 0;
+			_touch(n);
+			}
 	}
 
 /******************************************************************************\
@@ -426,8 +450,13 @@ void Display::setContrast(uint8_t contrast)
 \******************************************************************************/
 void Display::setBuffer(uint8_t *newBuffer)
 	{
-    delete[] _fb;
-    _fb = newBuffer;
+	for (int n=0; n<FRAMEBUFFER_SIZE; n++)
+		if (_fb[n] != newBuffer[n])
+			{
+			_fb[n] = newBuffer[n];
+			_touch(n);
+			}
+    delete[] newBuffer;
 	}
 
 /******************************************************************************\
@@ -453,14 +482,51 @@ void Display::_cmd(uint8_t cmd)
 	uint8_t data[2] = {0x00, cmd};
 	i2c_write_blocking(_i2c, _address, data, 2, false);
 	}
+
+/******************************************************************************\
+|* Send a run of commands: one control byte covers them all
+\******************************************************************************/
+void Display::_cmds(const uint8_t *cmds, int count)
+	{
+	uint8_t data[8];
+	data[0] = 0x00;
+	memcpy(data + 1, cmds, count);
+	i2c_write_blocking(_i2c, _address, data, count + 1, false);
+	}
+
+/******************************************************************************\
+|* Send a window of the framebuffer. The data control byte has to come just
+|* before it, so borrow the byte there (it's _buf[0] for the whole screen)
+|* rather than copying the window out
+\******************************************************************************/
+void Display::_flush(uint8_t p0, uint8_t p1, uint8_t c0, uint8_t c1)
+	{
+	const uint8_t window[] =
+		{
+		SSD1306_PAGEADDR, p0, p1,
+		SSD1306_COLUMNADDR, c0, c1
+		};
+	_cmds(window, sizeof(window));
+
+	uint8_t *data	= _fb + p0 * _width + c0 - 1;
+	int length		= (p1 - p0) * _width + (c1 - c0) + 2;
+
+	uint8_t borrowed = data[0];
+	data[0] = SSD1306_STARTLINE;
+	i2c_write_blocking(_i2c, _address, data, length, false);
+	data[0] = borrowed;
+	}
 	
 /******************************************************************************\
 |* OR data within the framebuffer
 \******************************************************************************/
 void Display::_byteOR(int n, uint8_t byte) 
 	{
-    if ((n >= 0) && n < (FRAMEBUFFER_SIZE))
+    if ((n >= 0) && n < (FRAMEBUFFER_SIZE) && ((_fb[n] | byte) != _fb[n]))
+    	{
 	    _fb[n] |= byte;
+	    _touch(n);
+	    }
 	}
 
 /******************************************************************************\
@@ -468,8 +534,11 @@ void Display::_byteOR(int n, uint8_t byte)
 \******************************************************************************/
 void Display::_byteAND(int n, uint8_t byte) 
 	{
-    if ((n >= 0) && n < (FRAMEBUFFER_SIZE))
+    if ((n >= 0) && n < (FRAMEBUFFER_SIZE) && ((_fb[n] & byte) != _fb[n]))
+    	{
 	    _fb[n] &= byte;
+	    _touch(n);
+	    }
 	}
 
 /******************************************************************************\
@@ -477,6 +546,9 @@ void Display::_byteAND(int n, uint8_t byte)
 \******************************************************************************/
 void Display::_byteXOR(int n, uint8_t byte) 
 	{
-    if ((n >= 0) && n < (FRAMEBUFFER_SIZE))
+    if ((n >= 0) && n < (FRAMEBUFFER_SIZE) && (byte != 0))
+    	{
 	    _fb[n] ^= byte;
+	    _touch(n);
+	    }
 	}
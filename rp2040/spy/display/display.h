@@ -9,6 +9,7 @@
 
 // For 128x32 displays it's still 1024 due to how memory mapping works on ssd1306.
 #define FRAMEBUFFER_SIZE 1024
+#define DISPLAY_PAGES	8				// Rows of 8 pixels, one byte tall
 
 
 // Include the 4 system fonts (different sizes)
@@ -57,15 +58,42 @@ class Display
 		uint16_t		_address;		// The I2C address
 		
 		Size			_size;			// Display width and height
+		uint8_t *		_buf;			// Data control byte, then _fb
 		//uint8_t *		_fb;			// Framebuffer
 		uint8_t 		_width;			// Framebuffer width
 		uint8_t			_height;		// Framebuffer height
 		bool			_inverted;		// Whether inverted
+
+		uint8_t			_dirtyLo[DISPLAY_PAGES];	// First changed column
+		uint8_t			_dirtyHi[DISPLAY_PAGES];	// Last. lo=127,hi=0 if none
 		
 		/**********************************************************************\
 		|* Private method: send a command to the SSD1306
 		\**********************************************************************/
 		void _cmd(uint8_t cmd);
+
+		/**********************************************************************\
+		|* Private method: send a run of commands in one transfer
+		\**********************************************************************/
+		void _cmds(const uint8_t *cmds, int count);
+
+		/**********************************************************************\
+		|* Private method: note that a byte in the framebuffer has changed
+		\**********************************************************************/
+		inline void _touch(int n)
+			{
+			uint8_t page	= n / 128;
+			uint8_t column	= n % 128;
+			if (column < _dirtyLo[page])
+				_dirtyLo[page] = column;
+			if (column > _dirtyHi[page])
+				_dirtyHi[page] = column;
+			}
+
+		/**********************************************************************\
+		|* Private method: send pages p0..p1, columns c0..c1 from _fb
+		\**********************************************************************/
+		void _flush(uint8_t p0, uint8_t p1, uint8_t c0, uint8_t c1);
 	
 		/**********************************************************************\
 		|* Private method: OR data within the framebuffer
@@ -132,7 +160,7 @@ class Display
 				   Rotation rotation = Rotation::deg0);
 
 		/**********************************************************************\
-		|* Set the buffer - ensure it's 1K long
+		|* Set the buffer - ensure it's 1K long. It's copied in, and deleted
 		\**********************************************************************/
         void setBuffer(uint8_t *buffer);
 
@@ -167,7 +195,8 @@ class Display
         void enable(bool enabled);
 
 		/**********************************************************************\
-		|* update the framebuffer ie: send to physical screen
+		|* update the framebuffer ie: send to physical screen. Only what's
+		|* changed since the last update is sent
 		\**********************************************************************/
 		void update(void);
 	};
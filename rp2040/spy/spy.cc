@@ -5,39 +5,227 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "can2040.h"
+#include "pico/multicore.h"
 #include "pico/stdlib.h"
 #include "hardware/i2c.h"
+#include "hardware/structs/pio.h"
+#include "hardware/sync.h"
 
 #include "display/display.h"
+#include "timing/timing.h"
 #include "properties.h"
+#include "spyproto.h"
 
 #include "RP2040.h" // hw_set_bits
 #include "irq.h"
 
+/******************************************************************************\
+|* The CAN interrupt runs on core 1, which does nothing else, so USB and the
+|* display (whose updates block for ~10ms) on core 0 can't delay it.
+|*
+|* Events from the CAN interrupt for the main loop to report. The IRQ only
+|* ever writes _evHead (and _evLost), the main loop only ever writes
+|* _evTail. The ring is sized to ride out a display update at full bus load.
+|* Each event wakes core 0 (__sev) if it's waiting in __wfe
+\******************************************************************************/
+#define EVENT_RING			256			// Power of two
+
+typedef struct
+	{
+	uint32_t			notify;			// CAN2040_NOTIFY_*
+	uint64_t			at;				// time_us_64() when it happened
+	struct can2040_msg	msg;			// The frame, if any
+	} Event;
+
+static Event				_events[EVENT_RING];
+static volatile uint32_t	_evHead		= 0;
+static volatile uint32_t	_evTail		= 0;
+static volatile uint32_t	_evLost		= 0;
+
+/******************************************************************************\
+|* Frames from the host waiting for room in can2040's queue, and the tags of
+|* those handed over, oldest first. can2040 sends in arbitration order
+|* (CAN2040_TX_PRIORITY), so a transmit is matched to the oldest tag with
+|* the same id. Both are only touched by the main loop
+\******************************************************************************/
+typedef struct
+	{
+	uint8_t				tag;			// Host's tag, echoed in the K
+	struct can2040_msg	msg;			// What to send
+	} Pending;
+
+static Pending				_txq[SPY_TX_QUEUE];
+static uint32_t				_txHead		= 0;
+static uint32_t				_txTail		= 0;
+
+typedef struct
+	{
+	uint8_t				tag;			// Host's tag
+	bool				periodic;		// Ours, so not reported
+	uint32_t			id;				// As can2040 will report it
+	} Sent;
+
+#define TAG_RING			(2 * CAN2040_TX_QUEUE_DEPTH)
+static Sent					_tags[TAG_RING];
+static uint32_t				_tagHead	= 0;
+static uint32_t				_tagTail	= 0;
+
+static uint32_t				_credits	= 0;	// Owed to the host
+
+/******************************************************************************\
+|* How long the interrupt was kept waiting, and how long it took, at worst.
+|* The wait is measured by the words already queued in the rx FIFO on entry,
+|* each of which is PIO_RX_WAKE_BITS bit times: it's accurate to a word,
+|* and the FIFO overflows at 8. Only written by the interrupt
+\******************************************************************************/
+#define CAN_BITRATE			1000000
+#define CAN_WORD_BITS		10			// can2040's PIO_RX_WAKE_BITS
+
+static volatile uint32_t	_irqBacklog	= 0;	// Most FIFO words waiting
+static volatile uint32_t	_irqLongest	= 0;	// us, longest in the handler
+
+/******************************************************************************\
+|* Frames the host wants sent at fixed intervals. Each is bit-stuffed once,
+|* when the host sets it up, so sending it is just a copy into can2040's
+|* queue. Due times advance by the period rather than from when it was
+|* actually sent, so they don't drift
+\******************************************************************************/
+typedef struct
+	{
+	uint32_t				period;		// us, 0 if the slot is free
+	uint32_t				due;		// time_us_32() when next due
+	uint32_t				id;			// As can2040 will report it
+	struct can2040_prepared	frame;		// Ready to queue
+	} Periodic;
+
+static Periodic				_periodic[SPY_PERIODIC];
+
+/******************************************************************************\
+|* Ids the host wants forwarded less often (Q). A frame held back is only
+|* counted, and the count goes with the next one forwarded. When only rate
+|* limited, the latest held back is kept, and sent when the period is up if
+|* nothing else has been by then. Only touched by the main loop
+\******************************************************************************/
+typedef struct
+	{
+	bool				used;			// Slot is taken
+	bool				seen;			// Have forwarded one yet
+	uint8_t				flags;			// SPY_FWD_*
+	uint8_t				dlc;			// Of the last one forwarded
+	uint8_t				data[8];		// .. and its payload
+	uint32_t			id;				// As can2040 will report it
+	uint32_t			period;			// us, 0 for no limit
+	uint32_t			held;			// Since the last one forwarded
+	uint64_t			sent;			// When that was
+	struct can2040_msg	latest;			// Last held back
+	uint64_t			latestAt;		// .. and when it arrived
+	} Forward;
+
+static Forward				_forward[SPY_FORWARD_RULES];
+
 static struct can2040 cbus;
 
+/******************************************************************************\
+|* Inter-arrival times of what we receive, and the busiest ids from the last
+|* window, for the display. Only touched by the main loop
+\******************************************************************************/
+#define TOP_TALKERS			3
+
+typedef struct
+	{
+	uint32_t			id;
+	uint32_t			frames;			// In the last window
+	uint32_t			average;		// us between them
+	} Talker;
+
+static Timing				_timing;
+static Talker				_top[TOP_TALKERS];
+static int					_topCount	= 0;
+
+/******************************************************************************\
+|* Bus load. can2040 counts the bits it samples, and it only samples from a
+|* start-of-frame until the bus has been idle for 10 bits, so the count is
+|* the stuffed bit-time of everything on the bus: frames (ours too, and ones
+|* the filters drop), error frames, and the EOF and interframe space. It's
+|* sampled every LOAD_SAMPLE_MS; the load is over the last LOAD_WINDOW
+|* samples, and each sample's own load goes into the sparkline
+\******************************************************************************/
+#define LOAD_SAMPLE_MS		100
+#define LOAD_WINDOW			10			// Samples, so a second
+#define SPARK_SAMPLES		86			// Columns on the display
+
+static uint32_t				_loadBits[LOAD_WINDOW];	// Sampled, per sample
+static uint32_t				_loadUs[LOAD_WINDOW];	// How long each took
+static uint32_t				_loadCount	= 0;		// Samples taken
+static uint32_t				_load		= 0;		// Per mille
+static uint8_t				_spark[SPARK_SAMPLES];	// Percent, per sample
+
+/******************************************************************************\
+|* The main loop sleeps (in __wfe) until there's something to do: an event
+|* from the CAN interrupt, a character from the host (the USB interrupt
+|* wakes it), or one of these timers (or a periodic frame) coming due. Each
+|* pass does at most a budget's worth from each source, so a flood from one
+|* can't hold up the others
+\******************************************************************************/
+#define HOST_BUDGET			8			// Lines from the host per pass
+#define EVENT_BUDGET		32			// Events from the CAN ring per pass
+#define DISPLAY_MS			500			// Display refresh
+#define MAX_SLEEP_US		100000		// In case we missed a wakeup
+
+typedef struct
+	{
+	uint32_t			due;			// time_us_32() when next due
+	uint32_t			period;			// us
+	} Timer;
+
+static Timer				_loadTimer		= {0, LOAD_SAMPLE_MS * 1000};
+static Timer				_statsTimer		= {0, SPY_STATS_MS * 1000};
+static Timer				_displayTimer	= {0, DISPLAY_MS * 1000};
+
+/******************************************************************************\
+|* CAN callback, in interrupt context: just queue it for the main loop
+\******************************************************************************/
 static void can2040_cb(struct can2040 *cd, uint32_t notify, struct can2040_msg *msg)
 	{
-	const char * remoteFrame = (msg->id & CAN2040_ID_RTR) ? ("[RMT]") : ("     ");
-	const char * extended    = (msg->id & CAN2040_ID_EFF) ? ("[EXT]") : ("     ");
-	
-    printf("CAN %x %s %s : ", remoteFrame, extended);
-    for (int i=0; i<msg->dlc; i++)
-    	printf(" %02x", msg->data[i]);
-    printf("\n");
+	uint32_t head = _evHead;
+	if (head - _evTail >= EVENT_RING)
+		{
+		_evLost = _evLost + 1;		// Only written here
+		return;
+		}
+
+	Event *ev	= &_events[head & (EVENT_RING - 1)];
+	ev->notify	= notify;
+	ev->at		= time_us_64();
+	ev->msg		= *msg;
+
+	__dmb();
+	_evHead = head + 1;
+	__sev();
 	}
 
 static void PIOx_IRQHandler(void)
 	{
+	uint32_t backlog	= (pio0_hw->flevel & PIO_FLEVEL_RX1_BITS)
+						>> PIO_FLEVEL_RX1_LSB;
+	uint32_t start		= time_us_32();
+
     can2040_pio_irq_handler(&cbus);
+
+	uint32_t took = time_us_32() - start;
+	if (backlog > _irqBacklog)
+		_irqBacklog = backlog;
+	if (took > _irqLongest)
+		_irqLongest = took;
 	}
 
 void canbus_setup(void)
 	{
     uint32_t pio_num = 0;
-    uint32_t sys_clock = 125000000, bitrate = 1000000;
+    uint32_t sys_clock = 125000000, bitrate = CAN_BITRATE;
     uint32_t gpio_rx = 28, gpio_tx = 29;
 
     // Setup canbus
@@ -53,41 +241,717 @@ void canbus_setup(void)
     can2040_start(&cbus, sys_clock, bitrate, gpio_rx, gpio_tx);
 	}
 
+/******************************************************************************\
+|* Write a line to the host
+\******************************************************************************/
+static void sendLine(char *line, char *end)
+	{
+	*end++ = '\n';
+	fwrite(line, 1, end - line, stdout);
+	}
+
+/******************************************************************************\
+|* Hand back credit once a batch has built up, or when the queue has drained
+|* so the host isn't left waiting on a part batch
+\******************************************************************************/
+static void returnCredits(void)
+	{
+	if ((_credits >= SPY_CREDIT_BATCH)
+	 || ((_credits > 0) && (_txHead == _txTail)))
+		{
+		char line[SPY_MAX_LINE];
+		line[0] = SPY_MSG_CREDIT;
+		sendLine(line, spy_put_hex(line + 1, _credits, 2));
+		_credits = 0;
+		}
+	}
 
-int main() 
+/******************************************************************************\
+|* Helper function: an id the way can2040 keeps (and reports) it
+\******************************************************************************/
+static uint32_t canonicalId(uint32_t id)
+	{
+	if (id & CAN2040_ID_EFF)
+		return id & (CAN2040_ID_EFF | CAN2040_ID_RTR | 0x1FFFFFFF);
+	return id & (CAN2040_ID_RTR | 0x7FF);
+	}
+
+/******************************************************************************\
+|* Handle a line from the host (without its '\n')
+\******************************************************************************/
+static void handleLine(const char *line, int len)
+	{
+	char out[SPY_MAX_LINE];
+
+	switch (line[0])
+		{
+		case SPY_MSG_HELLO:
+			// Start afresh: the host forgets what it had queued, and so do we
+			_txHead = _txTail = 0;
+			_credits = 0;
+			for (int i=0; i<SPY_PERIODIC; i++)
+				_periodic[i].period = 0;
+			can2040_filter_reset(&cbus);
+			_timing.reset();
+			for (int i=0; i<SPY_FORWARD_RULES; i++)
+				_forward[i].used = false;
+			out[0] = SPY_MSG_RESET;
+			sendLine(out, spy_put_hex(out + 1, SPY_TX_QUEUE, 2));
+			break;
+
+		case SPY_MSG_TRANSMIT:
+			{
+			uint32_t tag, id, dlc;
+			struct can2040_msg msg;
+			if ((len < 3) || !spy_get_hex(line + 1, 2, &tag)
+			 || !spy_get_frame(line + 3, len - 3, &id, &dlc, msg.data))
+				{
+				printf("# bad transmit: %.*s\n", len, line);
+				break;
+				}
+
+			if (_txHead - _txTail >= SPY_TX_QUEUE)
+				{
+				// The host has sent without credit
+				out[0] = SPY_MSG_DROPPED;
+				sendLine(out, spy_put_hex(out + 1, tag, 2));
+				break;
+				}
+
+			msg.id	= id;
+			msg.dlc	= dlc;
+
+			Pending *p	= &_txq[_txHead % SPY_TX_QUEUE];
+			p->tag		= (uint8_t)tag;
+			p->msg		= msg;
+			_txHead ++;
+			break;
+			}
+
+		case SPY_MSG_PERIODIC:
+			{
+			uint32_t slot, ms, id, dlc;
+			struct can2040_msg msg;
+			if ((len < 7) || !spy_get_hex(line + 1, 2, &slot)
+			 || (slot >= SPY_PERIODIC) || !spy_get_hex(line + 3, 4, &ms)
+			 || ((ms > 0) && !spy_get_frame(line + 7, len - 7, &id, &dlc,
+											msg.data)))
+				{
+				printf("# bad periodic: %.*s\n", len, line);
+				break;
+				}
+
+			Periodic *p = &_periodic[slot];
+			p->period = 0;
+			if (ms == 0)
+				break;
+
+			msg.id	= id;
+			msg.dlc	= dlc;
+			can2040_prepare(&p->frame, &msg);
+			p->id		= canonicalId(id);
+			p->due		= time_us_32();
+			p->period	= ms * 1000;
+			break;
+			}
+
+		case SPY_MSG_ACCEPT:
+			{
+			uint32_t id, mask;
+			if ((len != 17) || !spy_get_hex(line + 1, 8, &id)
+			 || !spy_get_hex(line + 9, 8, &mask))
+				printf("# bad accept: %.*s\n", len, line);
+			else if (can2040_filter_add(&cbus, id, mask) < 0)
+				printf("# too many filters: %.*s\n", len, line);
+			break;
+			}
+
+		case SPY_MSG_FORWARD:
+			{
+			uint32_t id, flags, ms;
+			if ((len != 14) || !spy_get_hex(line + 1, 8, &id)
+			 || !spy_get_hex(line + 9, 1, &flags)
+			 || !spy_get_hex(line + 10, 4, &ms))
+				{
+				printf("# bad forward: %.*s\n", len, line);
+				break;
+				}
+
+			// Replace any rule for this id, else take a free slot
+			id = canonicalId(id);
+			Forward *slot = nullptr;
+			for (int i=0; i<SPY_FORWARD_RULES; i++)
+				{
+				Forward *f = &_forward[i];
+				if (f->used && (f->id == id))
+					{
+					slot = f;
+					break;
+					}
+				if (!f->used && (slot == nullptr))
+					slot = f;
+				}
+
+			if ((flags == 0) && (ms == 0))
+				{
+				if ((slot != nullptr) && slot->used && (slot->id == id))
+					slot->used = false;
+				}
+			else if (slot == nullptr)
+				printf("# too many forwarding rules: %.*s\n", len, line);
+			else
+				{
+				memset(slot, 0, sizeof(*slot));
+				slot->used		= true;
+				slot->id		= id;
+				slot->flags		= (uint8_t)flags;
+				slot->period	= ms * 1000;
+				}
+			break;
+			}
+
+		default:
+			break;
+		}
+	}
+
+/******************************************************************************\
+|* Read what the host has sent, without blocking, up to HOST_BUDGET lines.
+|* Returns true if it stopped on the budget, so there may be more
+\******************************************************************************/
+static bool pollHost(void)
+	{
+	static char line[SPY_MAX_LINE];
+	static int len = 0;
+	static bool overlong = false;
+
+	int lines = 0;
+	int c;
+	while ((c = getchar_timeout_us(0)) != PICO_ERROR_TIMEOUT)
+		{
+		if ((c == '\n') || (c == '\r'))
+			{
+			if ((len > 0) && !overlong)
+				handleLine(line, len);
+			len			= 0;
+			overlong	= false;
+			if (++lines >= HOST_BUDGET)
+				return true;
+			}
+		else if (len < SPY_MAX_LINE - 1)
+			line[len++] = (char)c;
+		else
+			overlong = true;
+		}
+	return false;
+	}
+
+/******************************************************************************\
+|* Helper function: take the tag of the oldest frame handed to can2040 with
+|* this id, keeping the rest in order. Periodic frames have no tag
+\******************************************************************************/
+static uint8_t takeTag(uint32_t id, bool *periodic)
+	{
+	for (uint32_t i=_tagTail; i!=_tagHead; i++)
+		if (_tags[i % TAG_RING].id == id)
+			{
+			Sent sent = _tags[i % TAG_RING];
+			for (; i!=_tagTail; i--)
+				_tags[i % TAG_RING] = _tags[(i - 1) % TAG_RING];
+			_tagTail ++;
+			*periodic = sent.periodic;
+			return sent.tag;
+			}
+	*periodic = false;
+	return 0;
+	}
+
+/******************************************************************************\
+|* Helper function: note a frame handed to can2040, to match its transmit
+\******************************************************************************/
+static void noteSent(uint8_t tag, bool periodic, uint32_t id)
+	{
+	Sent *t		= &_tags[_tagHead % TAG_RING];
+	t->tag		= tag;
+	t->periodic	= periodic;
+	t->id		= id;
+	_tagHead ++;
+	}
+
+/******************************************************************************\
+|* Queue the periodic frames that are due. If the bus has fallen so far
+|* behind that one is a whole period late, skip what was missed
+\******************************************************************************/
+static void releasePeriodic(void)
+	{
+	uint32_t now = time_us_32();
+	for (int i=0; i<SPY_PERIODIC; i++)
+		{
+		Periodic *p = &_periodic[i];
+		if ((p->period == 0) || ((int32_t)(now - p->due) < 0))
+			continue;
+
+		if ((_tagHead - _tagTail >= TAG_RING)
+		 || (can2040_transmit_prepared(&cbus, &p->frame) < 0))
+			return;
+
+		noteSent(0, true, p->id);
+		p->due += p->period;
+		if ((int32_t)(now - p->due) >= 0)
+			p->due = now + p->period;
+		}
+	}
+
+/******************************************************************************\
+|* Move frames from our queue into can2040's while it has room. Each one
+|* moved frees a slot, and so earns the host a credit
+\******************************************************************************/
+static void feedCan(void)
+	{
+	while ((_txHead != _txTail)
+		&& (_tagHead - _tagTail < TAG_RING)
+		&& can2040_check_transmit(&cbus))
+		{
+		Pending *p = &_txq[_txTail % SPY_TX_QUEUE];
+		if (can2040_transmit(&cbus, &p->msg) < 0)
+			break;
+
+		noteSent(p->tag, false, canonicalId(p->msg.id));
+		_txTail ++;
+		_credits ++;
+		}
+	}
+
+/******************************************************************************\
+|* Helper function: whether to forward a received frame, given the Q rules.
+|* If so, 'held' is how many were held back before it
+\******************************************************************************/
+static bool forwardFrame(const Event *ev, uint32_t *held)
+	{
+	*held = 0;
+
+	Forward *f = nullptr;
+	for (int i=0; i<SPY_FORWARD_RULES; i++)
+		if (_forward[i].used && (_forward[i].id == ev->msg.id))
+			{
+			f = &_forward[i];
+			break;
+			}
+	if (f == nullptr)
+		return true;
+
+	uint32_t dlc = (ev->msg.id & CAN2040_ID_RTR) ? 0
+				 : (ev->msg.dlc > 8) ? 8 : ev->msg.dlc;
+	bool changed = !f->seen || (f->dlc != ev->msg.dlc)
+				|| (memcmp(f->data, ev->msg.data, dlc) != 0);
+	bool due = !f->seen || ((f->period > 0) && (ev->at - f->sent >= f->period));
+
+	if (!((f->flags & SPY_FWD_CHANGED) ? (changed || due) : due))
+		{
+		f->held ++;
+		f->latest	= ev->msg;
+		f->latestAt	= ev->at;
+		return false;
+		}
+
+	*held	= f->held;
+	f->held	= 0;
+	f->seen	= true;
+	f->sent	= ev->at;
+	f->dlc	= ev->msg.dlc;
+	memcpy(f->data, ev->msg.data, dlc);
+	return true;
+	}
+
+/******************************************************************************\
+|* Helper function: whether a rate-limited id has a held frame to send
+\******************************************************************************/
+static inline bool holding(const Forward *f)
+	{
+	return f->used && (f->held > 0) && !(f->flags & SPY_FWD_CHANGED);
+	}
+
+/******************************************************************************\
+|* Send the latest held back frame for each rate-limited id whose period is
+|* up, in case no frame comes along to carry it. The count is of the ones
+|* held back before it
+\******************************************************************************/
+static void releaseHeld(void)
+	{
+	char line[SPY_MAX_LINE];
+	uint64_t now = time_us_64();
+
+	for (int i=0; i<SPY_FORWARD_RULES; i++)
+		{
+		Forward *f = &_forward[i];
+		if (!holding(f) || (now - f->sent < f->period))
+			continue;
+
+		uint32_t dlc = (f->latest.id & CAN2040_ID_RTR) ? 0
+					 : (f->latest.dlc > 8) ? 8 : f->latest.dlc;
+
+		char *end;
+		line[0] = SPY_MSG_REPEATED;
+		end = spy_put_time(line + 1, f->latestAt);
+		end = spy_put_hex(end, f->held - 1, 8);
+		end = spy_put_frame(end, f->latest.id, f->latest.dlc, f->latest.data);
+		sendLine(line, end);
+
+		f->held	= 0;
+		f->sent	= now;
+		f->dlc	= f->latest.dlc;
+		memcpy(f->data, f->latest.data, dlc);
+		}
+	}
+
+/******************************************************************************\
+|* Report what the interrupt has seen, up to EVENT_BUDGET events. Returns
+|* true if there are more waiting
+\******************************************************************************/
+static bool reportEvents(void)
+	{
+	char line[SPY_MAX_LINE];
+
+	for (int i=0; (i<EVENT_BUDGET) && (_evTail != _evHead); i++)
+		{
+		__dmb();
+		Event *ev = &_events[_evTail & (EVENT_RING - 1)];
+		char *end;
+
+		if (ev->notify & CAN2040_NOTIFY_RX)
+			{
+			uint32_t held;
+			_timing.frame(ev->msg.id, ev->at);
+			if (forwardFrame(ev, &held))
+				{
+				line[0] = held ? SPY_MSG_REPEATED : SPY_MSG_FRAME;
+				end = spy_put_time(line + 1, ev->at);
+				if (held)
+					end = spy_put_hex(end, held, 8);
+				end = spy_put_frame(end, ev->msg.id, ev->msg.dlc,
+									ev->msg.data);
+				sendLine(line, end);
+				}
+			}
+		else if (ev->notify & CAN2040_NOTIFY_TX)
+			{
+			bool periodic;
+			uint8_t tag = takeTag(ev->msg.id, &periodic);
+			if (!periodic)
+				{
+				line[0] = SPY_MSG_SENT;
+				end = spy_put_hex(line + 1, tag, 2);
+				end = spy_put_time(end, ev->at);
+				sendLine(line, end);
+				}
+			}
+		else if (ev->notify & CAN2040_NOTIFY_ERROR)
+			{
+			line[0] = SPY_MSG_ERROR;
+			end = spy_put_time(line + 1, ev->at);
+			end = spy_put_hex(end, ev->notify & ~CAN2040_NOTIFY_ERROR, 8);
+			sendLine(line, end);
+			}
+
+		// Finish with the slot before the IRQ can have it back
+		__dmb();
+		_evTail = _evTail + 1;
+		}
+
+	// Only the IRQ writes _evLost, so keep our own note of what's reported
+	static uint32_t reported = 0;
+	uint32_t lost = _evLost;
+	if (lost != reported)
+		{
+		printf("# lost %u events\n", (unsigned)(lost - reported));
+		reported = lost;
+		}
+
+	return _evTail != _evHead;
+	}
+
+/******************************************************************************\
+|* Helper function: whether a timer has come due, moving it on if so. If
+|* we've fallen a whole period behind, skip what was missed
+\******************************************************************************/
+static bool timerDue(Timer *t, uint32_t now)
+	{
+	if ((int32_t)(now - t->due) < 0)
+		return false;
+
+	t->due += t->period;
+	if ((int32_t)(now - t->due) >= 0)
+		t->due = now + t->period;
+	return true;
+	}
+
+/******************************************************************************\
+|* Helper function: how long the main loop can sleep before a timer, a
+|* periodic frame, or a held back frame comes due
+\******************************************************************************/
+static uint32_t sleepFor(uint32_t now)
+	{
+	int32_t wait	= MAX_SLEEP_US;
+	uint64_t now64	= time_us_64();
+
+	const Timer *timers[] = {&_loadTimer, &_statsTimer, &_displayTimer};
+	for (const Timer *t : timers)
+		if ((int32_t)(t->due - now) < wait)
+			wait = (int32_t)(t->due - now);
+
+	for (int i=0; i<SPY_PERIODIC; i++)
+		if ((_periodic[i].period > 0)
+		 && ((int32_t)(_periodic[i].due - now) < wait))
+			wait = (int32_t)(_periodic[i].due - now);
+
+	for (int i=0; i<SPY_FORWARD_RULES; i++)
+		{
+		const Forward *f = &_forward[i];
+		if (!holding(f))
+			continue;
+		uint64_t gone = now64 - f->sent;
+		if (gone >= f->period)
+			return 0;
+		if ((int64_t)(f->period - gone) < wait)
+			wait = (int32_t)(f->period - gone);
+		}
+
+	return (wait > 0) ? (uint32_t)wait : 0;
+	}
+
+/******************************************************************************\
+|* Sample the bus load. The time is what actually passed, so a slow pass of
+|* the main loop doesn't read as a busy bus
+\******************************************************************************/
+static void sampleLoad(void)
+	{
+	static uint32_t last	= 0;
+	static uint32_t bits	= 0;
+
+	uint32_t now = time_us_32();
+	if (!timerDue(&_loadTimer, now))
+		return;
+	uint32_t us = now - last;
+	last = now;
+
+	struct can2040_stats stats;
+	can2040_get_statistics(&cbus, &stats);
+
+	uint32_t slot	= _loadCount % LOAD_WINDOW;
+	_loadBits[slot]	= stats.bus_bits - bits;
+	_loadUs[slot]	= us;
+	bits			= stats.bus_bits;
+	_loadCount ++;
+
+	uint64_t capacity = (uint64_t)us * CAN_BITRATE / 1000000;
+	uint32_t percent = (uint32_t)(_loadBits[slot] * 100ull / capacity);
+	_spark[_loadCount % SPARK_SAMPLES] = (percent > 100) ? 100 : percent;
+
+	uint64_t sumBits = 0, sumUs = 0;
+	for (int i=0; i<LOAD_WINDOW; i++)
+		{
+		sumBits	+= _loadBits[i];
+		sumUs	+= _loadUs[i];
+		}
+	capacity = sumUs * CAN_BITRATE / 1000000;
+	_load = (uint32_t)(sumBits * 1000 / capacity);
+	if (_load > 1000)
+		_load = 1000;
+	}
+
+/******************************************************************************\
+|* Send the statistics to the host, every SPY_STATS_MS
+\******************************************************************************/
+static void sendStat(uint32_t key, uint32_t value)
+	{
+	char line[SPY_MAX_LINE];
+	line[0] = SPY_MSG_STAT;
+	char *end = spy_put_hex(line + 1, key, 2);
+	sendLine(line, spy_put_hex(end, value, 8));
+	}
+
+static void reportTiming(void)
+	{
+	char line[SPY_MAX_LINE];
+	const Timing::Entry *entries = _timing.entries();
+	for (int i=0; i<TIMING_SLOTS; i++)
+		{
+		const Timing::Entry& e = entries[i];
+		if (!e.used || (e.frames == 0))
+			continue;
+
+		line[0] = SPY_MSG_TIMING;
+		char *end = spy_put_hex(line + 1, e.id, 8);
+		end = spy_put_hex(end, e.frames, 8);
+		end = spy_put_hex(end, e.intervals ? e.min : 0, 8);
+		end = spy_put_hex(end, Timing::average(e), 8);
+		end = spy_put_hex(end, e.max, 8);
+		end = spy_put_hex(end, Timing::jitter(e), 8);
+		sendLine(line, end);
+		}
+
+	// Keep the busiest for the display, then start the next window
+	const Timing::Entry *top[TOP_TALKERS];
+	_topCount = _timing.top(top, TOP_TALKERS);
+	for (int i=0; i<_topCount; i++)
+		{
+		_top[i].id		= top[i]->id;
+		_top[i].frames	= top[i]->frames;
+		_top[i].average	= Timing::average(*top[i]);
+		}
+	_timing.roll();
+	}
+
+static void reportStats(void)
+	{
+	if (!timerDue(&_statsTimer, time_us_32()))
+		return;
+
+	struct can2040_stats stats;
+	can2040_get_statistics(&cbus, &stats);
+
+	sendStat(SPY_STAT_RX,			stats.rx_total);
+	sendStat(SPY_STAT_TX,			stats.tx_total);
+	sendStat(SPY_STAT_TX_ATTEMPT,	stats.tx_attempt);
+	sendStat(SPY_STAT_PARSE_ERROR,	stats.parse_error);
+	sendStat(SPY_STAT_RX_FILTERED,	stats.rx_filtered);
+	sendStat(SPY_STAT_LOST,			_evLost);
+	sendStat(SPY_STAT_IRQ_LATENCY,
+			 _irqBacklog * CAN_WORD_BITS * 1000000 / CAN_BITRATE);
+	sendStat(SPY_STAT_IRQ_TIME,		_irqLongest);
+	sendStat(SPY_STAT_TIMING_FULL,	_timing.full());
+	sendStat(SPY_STAT_BUS_LOAD,		_load);
+	sendStat(SPY_STAT_STUFF_ERROR,	stats.stuff_error);
+	sendStat(SPY_STAT_CRC_ERROR,	stats.crc_error);
+	sendStat(SPY_STAT_FORM_ERROR,	stats.form_error);
+	sendStat(SPY_STAT_ACK_ERROR,	stats.ack_error);
+
+	reportTiming();
+	}
+
+/******************************************************************************\
+|* Show the bus load (now, and as a sparkline of the last few seconds), the
+|* counters and the busiest ids on the display, twice a second
+\******************************************************************************/
+static void refreshDisplay(Display& dpy)
+	{
+	if (!timerDue(&_displayTimer, time_us_32()))
+		return;
+
+	struct can2040_stats stats;
+	can2040_get_statistics(&cbus, &stats);
+
+	char text[28];
+	dpy.clear();
+	dpy.rect(0, 0, 127, 15);
+	snprintf(text, sizeof(text), "%3lu%%", (unsigned long)(_load + 5) / 10);
+	dpy.text(font_8x8, text, 3, 4);
+
+	// Oldest on the left, full height is 100%
+	for (int i=0; i<SPARK_SAMPLES; i++)
+		{
+		uint32_t percent = _spark[(_loadCount + 1 + i) % SPARK_SAMPLES];
+		uint8_t height = (uint8_t)(percent * 12 / 100);
+		if (height > 0)
+			dpy.line(40 + i, 13, 40 + i, 14 - height);
+		}
+
+	snprintf(text, sizeof(text), "rx %lu tx %lu lost %lu",
+			 (unsigned long)stats.rx_total, (unsigned long)stats.tx_total,
+			 (unsigned long)_evLost);
+	dpy.text(font_5x8, text, 0, 17);
+	snprintf(text, sizeof(text), "err s%lu c%lu f%lu a%lu",
+			 (unsigned long)stats.stuff_error, (unsigned long)stats.crc_error,
+			 (unsigned long)stats.form_error, (unsigned long)stats.ack_error);
+	dpy.text(font_5x8, text, 0, 25);
+	snprintf(text, sizeof(text), "irq %luus wait %luus",
+			 (unsigned long)_irqLongest,
+			 (unsigned long)(_irqBacklog * CAN_WORD_BITS * 1000000
+							 / CAN_BITRATE));
+	dpy.text(font_5x8, text, 0, 33);
+
+	// The top talkers, with their rate and average spacing
+	for (int i=0; i<_topCount; i++)
+		{
+		const Talker& t = _top[i];
+		snprintf(text, sizeof(text),
+				 (t.id & CAN2040_ID_EFF) ? "%08lx %lu/s %luus"
+										 : "%03lx %lu/s %luus",
+				 (unsigned long)(t.id & 0x1FFFFFFF),
+				 (unsigned long)(t.frames * 1000 / SPY_STATS_MS),
+				 (unsigned long)t.average);
+		dpy.text(font_5x8, text, 0, 41 + 8 * i);
+		}
+	dpy.update();
+	}
+
+/******************************************************************************\
+|* Core 1: own the CAN interrupt, and sleep between them. Tell core 0 when
+|* the bus is up, since it mustn't touch cbus before then
+\******************************************************************************/
+static void core1Main(void)
+	{
+	canbus_setup();
+	multicore_fifo_push_blocking(1);
+
+	while (1)
+		__wfi();
+	}
+
+int main()
 	{
 	stdio_init_all();
-	
+
 	// Initialise the I2C controller
     i2c_init(i2c1, 1000000);
- 
+
      // Set up pins 26 and 27
     gpio_set_function(26, GPIO_FUNC_I2C);
     gpio_set_function(27, GPIO_FUNC_I2C);
     gpio_pull_up(26);
     gpio_pull_up(27);
-    
+
     // If you don't do anything before initializing a display pi pico is too fast and starts sending
     // commands before the screen controller had time to set itself up, so we add an artificial delay for
     // ssd1306 to set itself up
     sleep_ms(250);
-    
-    
+
+
     Display dpy(i2c1, 0x3c, Display::Size::W128xH64);
     dpy.flip(false);
-   
+
 	dpy.rect(0,0,127,15);
 	//dpy.rect(10, 20, 117, 30);
-	
+
     // Send buffer to the display
     dpy.update();
-   
-   	canbus_setup();
 
-   	int count = 0;
+	// Start the bus on core 1, and wait for it
+	multicore_launch_core1(core1Main);
+	multicore_fifo_pop_blocking();
+
+	/**************************************************************************\
+	|* Shuttle between the host and the bus, sleeping when there's nothing to
+	|* do. An event that lands after we've looked still wakes the __wfe, as
+	|* the __sev sets the event register
+	\**************************************************************************/
    	while (1)
    		{
-  		sleep_ms(1000);
+		bool more = pollHost();
+		releasePeriodic();
+		feedCan();
+		more |= reportEvents();
+		releaseHeld();
+		returnCredits();
+		sampleLoad();
+		reportStats();
+		refreshDisplay(dpy);
+
+		if (more)
+			continue;
+
+		uint32_t wait = sleepFor(time_us_32());
+		if (wait > 0)
+			best_effort_wfe_or_timeout(make_timeout_time_us(wait));
    		}
    	}
-
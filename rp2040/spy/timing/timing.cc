@@ -0,0 +1,134 @@
+#include <string.h>
+
+#include "timing.h"
+
+/******************************************************************************\
+|* Constructor
+\******************************************************************************/
+Timing::Timing(void)
+	{
+	reset();
+	}
+
+/******************************************************************************\
+|* Private method: find the slot for an id, or a free one for it
+\******************************************************************************/
+Timing::Entry * Timing::_find(Entry *table, uint32_t id)
+	{
+	uint32_t slot = (id * 2654435761u) >> 16;
+	for (int i=0; i<TIMING_SLOTS; i++)
+		{
+		Entry *e = &table[(slot + i) & (TIMING_SLOTS - 1)];
+		if (!e->used || (e->id == id))
+			return e;
+		}
+	return nullptr;
+	}
+
+/******************************************************************************\
+|* Note a frame
+\******************************************************************************/
+void Timing::frame(uint32_t id, uint64_t at)
+	{
+	Entry *e = _find(_slots, id);
+	if (e == nullptr)
+		{
+		_full ++;
+		return;
+		}
+
+	if (!e->used)
+		{
+		memset(e, 0, sizeof(*e));
+		e->used	= true;
+		e->id	= id;
+		e->min	= UINT32_MAX;
+		}
+	else
+		{
+		uint64_t gap		= at - e->last;
+		uint32_t interval	= (gap > UINT32_MAX) ? UINT32_MAX : (uint32_t)gap;
+
+		if (e->interval > 0)
+			{
+			uint32_t d = (interval > e->interval) ? interval - e->interval
+												  : e->interval - interval;
+			e->jitter += d - ((e->jitter + 8) >> 4);
+			}
+
+		e->interval	= interval;
+		e->intervals ++;
+		e->sum		+= interval;
+		if (interval < e->min)
+			e->min = interval;
+		if (interval > e->max)
+			e->max = interval;
+		}
+
+	e->last		= at;
+	e->idle		= 0;
+	e->frames	++;
+	}
+
+/******************************************************************************\
+|* The busiest ids this window
+\******************************************************************************/
+int Timing::top(const Entry **out, int count) const
+	{
+	int found = 0;
+	for (int i=0; i<TIMING_SLOTS; i++)
+		{
+		const Entry *e = &_slots[i];
+		if (!e->used || (e->frames == 0))
+			continue;
+
+		// Insertion sort into the (short) list
+		int at = (found < count) ? found++ : count;
+		while ((at > 0) && (out[at-1]->frames < e->frames))
+			{
+			if (at < count)
+				out[at] = out[at-1];
+			at --;
+			}
+		if (at < count)
+			out[at] = e;
+		}
+	return found;
+	}
+
+/******************************************************************************\
+|* Start a new window. Dropping an id from the middle of a probe sequence
+|* would hide the ids after it, so the survivors go into a fresh table
+\******************************************************************************/
+void Timing::roll(void)
+	{
+	memset(_spare, 0, sizeof(_spare));
+	for (int i=0; i<TIMING_SLOTS; i++)
+		{
+		Entry *e = &_slots[i];
+		if (!e->used)
+			continue;
+
+		if (e->frames == 0)
+			e->idle ++;
+		if (e->idle >= TIMING_IDLE_WINDOWS)
+			continue;
+
+		e->frames		= 0;
+		e->intervals	= 0;
+		e->sum			= 0;
+		e->min			= UINT32_MAX;
+		e->max			= 0;
+		*_find(_spare, e->id) = *e;
+		}
+	memcpy(_slots, _spare, sizeof(_slots));
+	}
+
+/******************************************************************************\
+|* Forget everything
+\******************************************************************************/
+void Timing::reset(void)
+	{
+	memset(_slots, 0, sizeof(_slots));
+	_full = 0;
+	}
@@ -0,0 +1,102 @@
+#ifndef __timing_header__
+#define __timing_header__
+
+#include <cstdint>
+
+#include "properties.h"
+
+/******************************************************************************\
+|* Ids tracked at once (a power of two), and how many windows an id can be
+|* silent before its slot is given up
+\******************************************************************************/
+#define TIMING_SLOTS			64
+#define TIMING_IDLE_WINDOWS		10
+
+/******************************************************************************\
+|* Inter-arrival times of the frames on the bus, per id, over a window that
+|* the caller ends with roll(). Ids live in an open-addressed hash table, so
+|* a frame costs a hash and (usually) one probe. Jitter is the smoothed
+|* difference between successive intervals, as RFC 3550 does it, and carries
+|* over from one window to the next
+\******************************************************************************/
+class Timing
+	{
+	/**************************************************************************\
+	|* Typedefs and enums
+	\**************************************************************************/
+	public:
+		struct Entry
+			{
+			uint32_t	id;				// As can2040 reports it
+			bool		used;			// Slot is taken
+			uint8_t		idle;			// Windows without a frame
+			uint64_t	last;			// us, when the last frame arrived
+			uint32_t	interval;		// us, between the last two frames
+			uint32_t	jitter;			// us, x16
+			uint32_t	frames;			// In this window
+			uint32_t	intervals;		// Measured in this window
+			uint32_t	sum;			// us, of those intervals
+			uint32_t	min;			// us, shortest in this window
+			uint32_t	max;			// us, longest in this window
+			};
+
+	/**************************************************************************\
+	|* Properties
+	\**************************************************************************/
+	GET(uint32_t, full);				// Frames whose id didn't fit
+
+	private:
+		/**********************************************************************\
+		|* Private class members
+		\**********************************************************************/
+		Entry			_slots[TIMING_SLOTS];
+		Entry			_spare[TIMING_SLOTS];	// For rebuilding in roll()
+
+		/**********************************************************************\
+		|* Private method: find the slot for an id, or a free one for it.
+		|* Returns nullptr if it isn't there and there's no room
+		\**********************************************************************/
+		Entry * _find(Entry *table, uint32_t id);
+
+	public:
+		/**********************************************************************\
+		|* Constructor
+		\**********************************************************************/
+		explicit Timing(void);
+
+		/**********************************************************************\
+		|* Note a frame, received at 'at' us
+		\**********************************************************************/
+		void frame(uint32_t id, uint64_t at);
+
+		/**********************************************************************\
+		|* The entries, for reporting: skip the ones not used
+		\**********************************************************************/
+		inline const Entry * entries(void) const { return _slots; }
+
+		/**********************************************************************\
+		|* Fill in up to 'count' of the busiest ids this window, busiest first,
+		|* returning how many there were
+		\**********************************************************************/
+		int top(const Entry **out, int count) const;
+
+		/**********************************************************************\
+		|* Start a new window, dropping the ids that have gone quiet
+		\**********************************************************************/
+		void roll(void);
+
+		/**********************************************************************\
+		|* Forget everything
+		\**********************************************************************/
+		void reset(void);
+
+		/**********************************************************************\
+		|* Helper: the average and jitter of an entry, in us
+		\**********************************************************************/
+		static inline uint32_t average(const Entry& e)
+			{ return e.intervals ? e.sum / e.intervals : 0; }
+		static inline uint32_t jitter(const Entry& e)
+			{ return e.jitter >> 4; }
+	};
+
+#endif // ! __timing_header__
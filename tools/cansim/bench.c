@@ -0,0 +1,278 @@
+/*****************************************************************************\
+|* cansim: check can2040's receive path against frames encoded from the
+|* spec, then time it. Each scenario is turned into PIO words up front, so
+|* the timing is just the parser (and the callback)
+|*
+|*   valid     standard and extended frames, random ids, lengths and data
+|*   stuffed   frames that need the most stuff bits (all 0s, all 1s)
+|*   corrupt   every other frame has one bit flipped, then an error flag
+|*   random    noise of random length, an error flag, then a good frame
+|*
+|* First the unstuffer is checked against the original, bit-at-a-time one.
+|* Then every good frame must come out intact and in order, after whatever
+|* went before it. With -f, a filter like reefd's is set and only frames it
+|* passes are expected; comparing with a run without -f shows what the
+|* filter saves per frame. That's only the callback: a filtered frame is
+|* still parsed and its CRC checked, as it must be acked like any other.
+|* Each repeat is timed on its own and the fastest reported, as the
+|* difference is small next to the noise of an average.
+|*
+|* Build with cansim.pro, then eg: cansim -n 100000 -r 20
+\*****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cansim.h"
+
+typedef enum
+	{
+	SCENARIO_VALID = 0,
+	SCENARIO_STUFFED,
+	SCENARIO_CORRUPT,
+	SCENARIO_RANDOM,
+	SCENARIOS
+	} Scenario;
+
+static const char * _names[SCENARIOS] = {"valid", "stuffed", "corrupt", "random"};
+
+/*****************************************************************************\
+|* The filter set by -f: standard ids 0x100..0x1FF, and discovery frames
+\*****************************************************************************/
+#define FILTER_STD_ID		0x100
+#define FILTER_STD_MASK		0x700
+#define FILTER_EXT_ID		0x1F000000
+#define FILTER_EXT_MASK		0x1FFF0000
+
+static int passes(const struct can2040_msg *msg)
+	{
+	if (msg->id & CAN2040_ID_EFF)
+		return ((msg->id ^ FILTER_EXT_ID) & FILTER_EXT_MASK) == 0;
+	return ((msg->id ^ FILTER_STD_ID) & FILTER_STD_MASK) == 0;
+	}
+
+/*****************************************************************************\
+|* Helper function: monotonic ns
+\*****************************************************************************/
+static int64_t now(void)
+	{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	}
+
+/*****************************************************************************\
+|* Helper function: a random frame. Some extended ones are discovery frames
+|* so the filter has something to pass
+\*****************************************************************************/
+static void randomFrame(uint64_t *seed, struct can2040_msg *msg)
+	{
+	uint32_t r = cansim_random(seed);
+	memset(msg, 0, sizeof(*msg));
+	if (r & 1)
+		{
+		msg->id = CAN2040_ID_EFF | (cansim_random(seed) & 0x1FFFFFFF);
+		if (r & 2)
+			msg->id = CAN2040_ID_EFF | FILTER_EXT_ID | (msg->id & 0xFFFF);
+		}
+	else
+		msg->id = cansim_random(seed) & 0x7FF;
+	if ((r & 0x1C) == 0)
+		msg->id |= CAN2040_ID_RTR;
+	msg->dlc		= (r >> 8) % 9;
+	msg->data32[0]	= cansim_random(seed);
+	msg->data32[1]	= cansim_random(seed);
+	}
+
+/*****************************************************************************\
+|* Build a scenario's wire, and the frames that should come out of it
+\*****************************************************************************/
+static size_t build(Scenario scenario, int frames, uint64_t *seed, int filter,
+					CanSimWire *w, struct can2040_msg *expect)
+	{
+	size_t expected = 0;
+
+	cansim_wire_clear(w);
+	cansim_idle(w, 11);
+	for (int i=0; i<frames; i++)
+		{
+		struct can2040_msg msg;
+		randomFrame(seed, &msg);
+
+		switch (scenario)
+			{
+			case SCENARIO_STUFFED:
+				msg.id		&= ~CAN2040_ID_RTR;
+				msg.id		= (msg.id & CAN2040_ID_EFF)
+							? (CAN2040_ID_EFF | ((i & 2) ? 0x1FFFFFFF : 0))
+							: ((i & 2) ? 0x7FF : 0);
+				msg.dlc		= 8;
+				msg.data32[0] = msg.data32[1] = (i & 1) ? 0xFFFFFFFF : 0;
+				break;
+
+			case SCENARIO_CORRUPT:
+				if (i & 1)
+					{
+					cansim_frame(w, &msg, cansim_random(seed) & 0xFF);
+					cansim_idle(w, 11);
+					continue;
+					}
+				break;
+
+			case SCENARIO_RANDOM:
+				{
+				int noise = 20 + cansim_random(seed) % 180;
+				for (; noise > 0; noise -= 16)
+					cansim_bits(w, cansim_random(seed), noise > 16 ? 16 : noise);
+				cansim_error_flag(w);
+				cansim_idle(w, 11);
+				break;
+				}
+
+			default:
+				break;
+			}
+
+		cansim_frame(w, &msg, -1);
+		if (!filter || passes(&msg))
+			expect[expected++] = msg;
+		}
+	cansim_idle(w, 11);
+	cansim_flush(w);
+	return expected;
+	}
+
+/*****************************************************************************\
+|* Check everything expected came out, in order. Anything else that came
+|* out (noise that happened to make a frame) is counted, not failed
+\*****************************************************************************/
+static int check(const struct can2040_msg *expect, size_t expected,
+				 size_t *spurious)
+	{
+	size_t count;
+	const struct can2040_msg *got = cansim_received(&count);
+
+	size_t g = 0;
+	for (size_t e=0; e<expected; e++)
+		{
+		while ((g < count) && !cansim_same(&got[g], &expect[e]))
+			g ++;
+		if (g == count)
+			{
+			fprintf(stderr, "  frame %zu (id %08x dlc %u) missing\n",
+					e, expect[e].id, expect[e].dlc);
+			return 0;
+			}
+		g ++;
+		}
+	*spurious = count - expected;
+	return 1;
+	}
+
+static void usage(const char *name)
+	{
+	fprintf(stderr,
+			"Usage: %s [-n frames] [-r repeats] [-s seed] [-f]\n"
+			"  -n  frames per scenario (100000)\n"
+			"  -r  times to run each scenario, timing the fastest (10)\n"
+			"  -s  random seed (1)\n"
+			"  -f  set an acceptance filter, and expect only what it passes\n",
+			name);
+	}
+
+int main(int argc, char *argv[])
+	{
+	int frames		= 100000;
+	int repeats		= 10;
+	uint64_t seed	= 1;
+	int filter		= 0;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:r:s:fh")) != -1)
+		switch (opt)
+			{
+			case 'n': frames	= atoi(optarg);					break;
+			case 'r': repeats	= atoi(optarg);					break;
+			case 's': seed		= strtoull(optarg, NULL, 0);	break;
+			case 'f': filter	= 1;							break;
+			default:
+				usage(argv[0]);
+				return (opt == 'h') ? 0 : 1;
+			}
+
+	if ((frames < 1) || (repeats < 1) || (seed == 0))
+		{
+		usage(argv[0]);
+		return 1;
+		}
+
+	CanSimWire w;
+	cansim_wire_init(&w);
+	struct can2040_msg *expect = (struct can2040_msg *)
+								 calloc(frames, sizeof(*expect));
+	if (expect == NULL)
+		return 1;
+
+	uint64_t differ = cansim_check_unstuffer(1000000, &seed);
+	printf("Unstuffer: %s\n\n", differ ? "DIFFERS from the original" : "ok");
+	int failed = differ ? 1 : 0;
+
+	printf("%-8s %10s %10s %10s %10s %12s %10s\n",
+		   "", "frames", "filtered", "spurious", "bits/frame", "frames/s",
+		   "ns/frame");
+
+	for (int s=0; s<SCENARIOS; s++)
+		{
+		size_t expected = build((Scenario)s, frames, &seed, filter, &w, expect);
+
+		// Once to check it
+		cansim_reset(frames * 2);
+		if (filter)
+			{
+			can2040_filter_add(cansim_bus(), FILTER_STD_ID, FILTER_STD_MASK);
+			can2040_filter_add(cansim_bus(), CAN2040_ID_EFF | FILTER_EXT_ID,
+							   FILTER_EXT_MASK);
+			}
+		cansim_feed(w.words, w.count);
+
+		size_t spurious = 0;
+		if (!check(expect, expected, &spurious))
+			{
+			printf("%-8s FAILED\n", _names[s]);
+			failed = 1;
+			continue;
+			}
+
+		// Then to time it, carrying on from where the check left off
+		int64_t took = INT64_MAX;
+		for (int r=0; r<repeats; r++)
+			{
+			int64_t start = now();
+			cansim_feed(w.words, w.count);
+			int64_t pass = now() - start;
+			if (pass < took)
+				took = pass;
+			}
+
+		struct can2040_stats stats;
+		can2040_get_statistics(cansim_bus(), &stats);
+
+		double total = (double)frames;
+		printf("%-8s %10d %10u %10zu %10.1f %12.0f %10.1f\n",
+			   _names[s], frames, (unsigned)stats.rx_filtered / (repeats + 1),
+			   spurious, (double)stats.bus_bits / (frames * (repeats + 1)),
+			   total * 1e9 / took, took / total);
+		if (stats.parse_error)
+			printf("%-8s errors: %u stuff, %u crc, %u form, %u ack, %u other\n",
+				   "", stats.stuff_error, stats.crc_error, stats.form_error,
+				   stats.ack_error,
+				   stats.parse_error - stats.stuff_error - stats.crc_error
+				   - stats.form_error - stats.ack_error);
+		}
+
+	cansim_wire_free(&w);
+	free(expect);
+	return failed;
+	}
@@ -0,0 +1,484 @@
+/*****************************************************************************\
+|* cansim: can2040's receive path on the host. See cansim.h
+\*****************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+
+#include "cansim.h"
+
+/*****************************************************************************\
+|* The device code itself, built against the stand-in headers in mock/. It's
+|* included rather than linked so its static parser functions can be driven
+|* directly
+\*****************************************************************************/
+#include "can2040.c"
+
+pio_hw_t			cansim_pio[2];
+iobank0_hw_t		cansim_iobank0;
+padsbank0_hw_t		cansim_padsbank0;
+resets_hw_t			cansim_resets;
+
+/*****************************************************************************\
+|* The simulated controller and what it has received
+\*****************************************************************************/
+static struct can2040		_bus;
+static struct can2040_msg *	_log		= NULL;
+static size_t				_logSize	= 0;
+static size_t				_logCount	= 0;
+static uint64_t				_received	= 0;
+static uint64_t				_errors		= 0;
+static uint64_t				_sent		= 0;
+static struct can2040_msg	_lastSent;
+static struct can2040_transmit *	_claimed	= NULL;
+
+#define CANSIM_CRC_POLY		0x4599
+#define CANSIM_MAX_FRAME	160		// Unstuffed bits, SOF to CRC, and more
+
+/*****************************************************************************\
+|* Start, finish, and empty a wire
+\*****************************************************************************/
+void cansim_wire_init(CanSimWire *w)
+	{
+	memset(w, 0, sizeof(*w));
+	}
+
+void cansim_wire_free(CanSimWire *w)
+	{
+	free(w->words);
+	memset(w, 0, sizeof(*w));
+	}
+
+void cansim_wire_clear(CanSimWire *w)
+	{
+	w->count		= 0;
+	w->partial		= 0;
+	w->partialBits	= 0;
+	w->recessive	= 0;
+	}
+
+/*****************************************************************************\
+|* Helper function: add a sampled bit
+\*****************************************************************************/
+static void _sample(CanSimWire *w, uint32_t bit)
+	{
+	w->partial = (w->partial << 1) | bit;
+	if (++ w->partialBits == CANSIM_WORD_BITS)
+		{
+		if (w->count == w->size)
+			{
+			w->size		= w->size ? w->size * 2 : 4096;
+			w->words	= (uint32_t *)realloc(w->words,
+											  w->size * sizeof(uint32_t));
+			if (w->words == NULL)
+				abort();
+			}
+		w->words[w->count++]	= w->partial;
+		w->partial				= 0;
+		w->partialBits			= 0;
+		}
+	}
+
+/*****************************************************************************\
+|* Append bits, most significant first, as the PIO would sample them
+\*****************************************************************************/
+void cansim_bits(CanSimWire *w, uint32_t value, int count)
+	{
+	for (int i=count-1; i>=0; i--)
+		{
+		uint32_t bit = (value >> i) & 1;
+		if (!bit)
+			w->recessive = 0;
+		else if (w->recessive < CANSIM_IDLE_BITS)
+			w->recessive ++;
+		else
+			continue;
+		_sample(w, bit);
+		}
+	}
+
+void cansim_idle(CanSimWire *w, int count)
+	{
+	for (; count > 0; count -= 32)
+		cansim_bits(w, 0xFFFFFFFF, count > 32 ? 32 : count);
+	}
+
+void cansim_error_flag(CanSimWire *w)
+	{
+	cansim_bits(w, 0, 6);			// Flag
+	cansim_idle(w, 8 + 3);			// Delimiter, inter-frame space
+	}
+
+void cansim_flush(CanSimWire *w)
+	{
+	while (w->partialBits)
+		_sample(w, 1);
+	}
+
+/*****************************************************************************\
+|* Helper function: append to an array of bits
+\*****************************************************************************/
+static int _push(uint8_t *bits, int at, uint32_t value, int count)
+	{
+	for (int i=count-1; i>=0; i--)
+		bits[at++] = (value >> i) & 1;
+	return at;
+	}
+
+/*****************************************************************************\
+|* Append a frame, encoded straight from the spec
+\*****************************************************************************/
+int cansim_frame(CanSimWire *w, const struct can2040_msg *msg, int flip)
+	{
+	uint8_t raw[CANSIM_MAX_FRAME];
+	uint8_t stuffed[CANSIM_MAX_FRAME * 6 / 5 + 2];
+
+	uint32_t id		= msg->id;
+	uint32_t rtr	= (id & CAN2040_ID_RTR) ? 1 : 0;
+	uint32_t dlc	= msg->dlc & 0x0F;
+	uint32_t bytes	= rtr ? 0 : (dlc > 8 ? 8 : dlc);
+
+	int n = _push(raw, 0, 0, 1);								// SOF
+	if (id & CAN2040_ID_EFF)
+		{
+		n = _push(raw, n, (id >> 18) & 0x7FF, 11);				// Base id
+		n = _push(raw, n, 3, 2);								// SRR, IDE
+		n = _push(raw, n, id & 0x3FFFF, 18);					// Extension
+		n = _push(raw, n, rtr, 1);
+		n = _push(raw, n, 0, 2);								// r1, r0
+		}
+	else
+		{
+		n = _push(raw, n, id & 0x7FF, 11);
+		n = _push(raw, n, rtr, 1);
+		n = _push(raw, n, 0, 2);								// IDE, r0
+		}
+	n = _push(raw, n, dlc, 4);
+	for (uint32_t i=0; i<bytes; i++)
+		n = _push(raw, n, msg->data[i], 8);
+
+	uint32_t crc = 0;
+	for (int i=0; i<n; i++)
+		{
+		uint32_t next = raw[i] ^ ((crc >> 14) & 1);
+		crc = (crc << 1) & 0x7FFF;
+		if (next)
+			crc ^= CANSIM_CRC_POLY;
+		}
+	n = _push(raw, n, crc, 15);
+
+	// Stuff: after five equal bits, one of the opposite
+	int len = 0, run = 0;
+	for (int i=0; i<n; i++)
+		{
+		if ((len > 0) && (raw[i] == stuffed[len - 1]))
+			run ++;
+		else
+			run = 1;
+		stuffed[len++] = raw[i];
+		if (run == 5)
+			{
+			stuffed[len] = !raw[i];
+			len ++;
+			run = 1;
+			}
+		}
+	stuffed[len++] = 1;											// CRC delimiter
+
+	if (flip >= 0)
+		stuffed[flip % len] ^= 1;
+
+	for (int i=0; i<len; i++)
+		cansim_bits(w, stuffed[i], 1);
+
+	if (flip >= 0)
+		cansim_error_flag(w);
+	else
+		{
+		cansim_bits(w, 0, 1);									// Ack
+		cansim_idle(w, 1 + 7 + 3);								// Delim, EOF, IFS
+		}
+	return len;
+	}
+
+/*****************************************************************************\
+|* Callback: keep what was received
+\*****************************************************************************/
+static void _callback(struct can2040 *cd, uint32_t notify,
+					  struct can2040_msg *msg)
+	{
+	(void)cd;
+	if (notify & CAN2040_NOTIFY_RX)
+		{
+		if (_logCount < _logSize)
+			_log[_logCount++] = *msg;
+		_received ++;
+		}
+	else if (notify & CAN2040_NOTIFY_TX)
+		{
+		_lastSent = *msg;
+		_sent ++;
+		}
+	else if (notify & CAN2040_NOTIFY_ERROR)
+		_errors ++;
+	}
+
+/*****************************************************************************\
+|* Start a fresh controller
+\*****************************************************************************/
+void cansim_reset(size_t logSize)
+	{
+	memset(cansim_pio, 0, sizeof(cansim_pio));
+	memset(&cansim_iobank0, 0, sizeof(cansim_iobank0));
+	memset(&cansim_padsbank0, 0, sizeof(cansim_padsbank0));
+	memset(&cansim_resets, 0, sizeof(cansim_resets));
+
+	if (logSize != _logSize)
+		{
+		free(_log);
+		_log		= logSize ? (struct can2040_msg *)
+								calloc(logSize, sizeof(*_log)) : NULL;
+		_logSize	= _log ? logSize : 0;
+		}
+	_logCount	= 0;
+	_received	= 0;
+	_sent		= 0;
+	_claimed	= NULL;
+
+	can2040_setup(&_bus, 0);
+	can2040_callback_config(&_bus, _callback);
+	can2040_start(&_bus, 125000000, 1000000, 28, 29);
+
+	// Starting up "clears" the sticky PIO flags, which here just sets them
+	_errors = 0;
+	}
+
+struct can2040 * cansim_bus(void)
+	{
+	return &_bus;
+	}
+
+/*****************************************************************************\
+|* Hand words to the parser, as the interrupt handler would. On the chip
+|* FDEBUG is write-one-to-clear; here it's plain memory, so it's cleared
+|* before each word to stop a PIO reset looking like an overrun
+\*****************************************************************************/
+void cansim_feed(const uint32_t *words, size_t count)
+	{
+	pio_hw_t *pio_hw = _bus.pio_hw;
+	for (size_t i=0; i<count; i++)
+		{
+		pio_hw->fdebug = 0;
+		process_rx(&_bus, words[i]);
+		}
+	}
+
+const struct can2040_msg * cansim_received(size_t *count)
+	{
+	*count = _logCount;
+	return _log;
+	}
+
+uint64_t cansim_received_total(void)
+	{
+	return _received;
+	}
+
+uint64_t cansim_errors(void)
+	{
+	return _errors;
+	}
+
+/*****************************************************************************\
+|* The transmit queue, the producer's side
+\*****************************************************************************/
+void cansim_tx_start(uint32_t pos)
+	{
+	_bus.tx_pull_pos = _bus.tx_push_pos = pos;
+	}
+
+int cansim_tx_claim(void)
+	{
+	_claimed = tx_claim(&_bus);
+	return _claimed != NULL;
+	}
+
+void cansim_tx_fill(const struct can2040_msg *msg)
+	{
+	struct can2040_msg copy = *msg;
+	tx_encode(_claimed, &copy);
+	}
+
+void cansim_tx_publish(void)
+	{
+	tx_submit(&_bus);
+	_claimed = NULL;
+	}
+
+/*****************************************************************************\
+|* The interrupt handler's side. The PIO registers are plain memory here, so
+|* a lost arbitration is shown to tx_schedule_transmit() as the "tx" state
+|* machine's FIFO having drained with the line free, and a win is fed to the
+|* report code as the parser would: CRC start, ack, then "matched"
+\*****************************************************************************/
+void cansim_tx_schedule(void)
+	{
+	tx_schedule_transmit(&_bus);
+	}
+
+void cansim_tx_lose(void)
+	{
+	pio_hw_t *pio_hw = _bus.pio_hw;
+	pio_hw->flevel	= 0;
+	pio_hw->intr	= SI_MAYTX;
+	report_line_maytx(&_bus);
+	pio_hw->intr	= 0;
+	}
+
+void cansim_tx_win(void)
+	{
+	struct can2040_transmit *qt = tx_slot(&_bus, _bus.tx_pull_pos);
+	_bus.parse_msg	= qt->msg;
+	_bus.parse_crc	= qt->crc;
+	if (report_note_crc_start(&_bus) != 0)
+		abort();
+	report_note_ack_success(&_bus);
+	report_line_matched(&_bus);
+	}
+
+int cansim_tx_queued(struct can2040_msg *msg)
+	{
+	if (_bus.tx_state != TS_QUEUED)
+		return 0;
+	*msg = tx_slot(&_bus, _bus.tx_pull_pos)->msg;
+	return 1;
+	}
+
+uint64_t cansim_tx_sent(struct can2040_msg *last)
+	{
+	if (last != NULL)
+		*last = _lastSent;
+	return _sent;
+	}
+
+uint32_t cansim_tx_attempts(void)
+	{
+	return _bus.stats.tx_attempt;
+	}
+
+/*****************************************************************************\
+|* can2040's original unstuffer, which takes stuff bits one at a time, as a
+|* reference for the one it has now
+\*****************************************************************************/
+static int _reference_unstuf_pull_bits(struct can2040_bitunstuffer *bu)
+{
+    uint32_t sb = bu->stuffed_bits, edges = sb ^ (sb >> 1);
+    uint32_t e2 = edges | (edges >> 1), e4 = e2 | (e2 >> 2), rm_bits = ~e4;
+    uint32_t cs = bu->count_stuff, cu = bu->count_unstuff;
+    if (!cs)
+        // Need more data
+        return 1;
+    for (;;) {
+        uint32_t try_cnt = cs > cu ? cu : cs;
+        for (;;) {
+            uint32_t try_mask = ((1 << try_cnt) - 1) << (cs + 1 - try_cnt);
+            if (likely(!(rm_bits & try_mask))) {
+                // No stuff bits in try_cnt bits - copy into unstuffed_bits
+                bu->count_unstuff = cu = cu - try_cnt;
+                bu->count_stuff = cs = cs - try_cnt;
+                bu->unstuffed_bits |= ((sb >> cs) & ((1 << try_cnt) - 1)) << cu;
+                if (! cu)
+                    // Extracted desired bits
+                    return 0;
+                break;
+            }
+            bu->count_stuff = cs = cs - 1;
+            if (rm_bits & (1 << (cs + 1))) {
+                // High bit is a stuff bit
+                if (unlikely(rm_bits & (1 << cs))) {
+                    // Six consecutive bits - a bitstuff error
+                    if (sb & (1 << cs))
+                        return -1;
+                    return -2;
+                }
+                break;
+            }
+            // High bit not a stuff bit - limit try_cnt and retry
+            bu->count_unstuff = cu = cu - 1;
+            bu->unstuffed_bits |= ((sb >> cs) & 1) << cu;
+            try_cnt /= 2;
+        }
+        if (likely(!cs))
+            // Need more data
+            return 1;
+    }
+}
+
+/*****************************************************************************\
+|* Compare the two unstuffers, pulling fields from random states (biased
+|* towards long runs, where the stuff bits are) until each needs more data
+\*****************************************************************************/
+uint64_t cansim_check_unstuffer(uint64_t iterations, uint64_t *seed)
+	{
+	uint64_t differ = 0;
+	for (uint64_t i=0; i<iterations; i++)
+		{
+		struct can2040_bitunstuffer a;
+		uint32_t r			= cansim_random(seed);
+		a.stuffed_bits		= cansim_random(seed);
+		if (r & 1)
+			a.stuffed_bits	= (r & 2) ? 0xFFFFFFFF : 0;
+		if ((r & 0x0C) == 0x04)
+			a.stuffed_bits	^= 1u << (cansim_random(seed) % 32);
+		a.count_stuff		= (r >> 4) % (PIO_RX_WAKE_BITS + 1);
+		a.count_unstuff		= 1 + (r >> 8) % 32;
+		a.unstuffed_bits	= 0;
+
+		struct can2040_bitunstuffer b = a;
+		for (;;)
+			{
+			int got		= unstuf_pull_bits(&a);
+			int want	= _reference_unstuf_pull_bits(&b);
+			if ((got != want) || memcmp(&a, &b, sizeof(a)))
+				{
+				differ ++;
+				break;
+				}
+			if (got != 0)
+				break;
+
+			unstuf_set_count(&a, 1 + cansim_random(seed) % 32);
+			unstuf_set_count(&b, a.count_unstuff);
+			}
+		}
+	return differ;
+	}
+
+/*****************************************************************************\
+|* Helper function: are two frames the same, as can2040 would report them
+\*****************************************************************************/
+int cansim_same(const struct can2040_msg *a, const struct can2040_msg *b)
+	{
+	uint32_t ida = (a->id & CAN2040_ID_EFF) ? (a->id & ~0x20000000u)
+											: (a->id & (CAN2040_ID_RTR | 0x7FF));
+	uint32_t idb = (b->id & CAN2040_ID_EFF) ? (b->id & ~0x20000000u)
+											: (b->id & (CAN2040_ID_RTR | 0x7FF));
+	if ((ida != idb) || ((a->dlc & 0x0F) != (b->dlc & 0x0F)))
+		return 0;
+
+	uint32_t bytes = (ida & CAN2040_ID_RTR) ? 0
+					: ((a->dlc & 0x0F) > 8 ? 8 : (a->dlc & 0x0F));
+	return memcmp(a->data, b->data, bytes) == 0;
+	}
+
+/*****************************************************************************\
+|* Helper function: xorshift64*
+\*****************************************************************************/
+uint32_t cansim_random(uint64_t *state)
+	{
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return (uint32_t)((x * 0x2545F4914F6CDD1DULL) >> 32);
+	}
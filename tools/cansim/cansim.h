@@ -0,0 +1,140 @@
+/*****************************************************************************\
+|* cansim: can2040's receive path on the host. can2040.c is built against
+|* stand-in SDK headers (mock/), and the bits a PIO "rx" state machine would
+|* have sampled off the wire are handed to the parser 10 at a time, exactly
+|* as the interrupt handler does on the chip.
+|*
+|* Frames are turned into wire bits here, independently of can2040's own
+|* encoder (bitwise CRC, simple bit stuffing), so the two check each other
+\*****************************************************************************/
+#ifndef CANSIM_H
+#define CANSIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "can2040.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*****************************************************************************\
+|* Bits as the PIO would push them: 10 to a word, the first on the wire in
+|* the top bit. Like the PIO "sync" machine, sampling stops after 10
+|* recessive bits in a row and starts again at the next dominant one, so an
+|* idle bus only ever shows up as 10 recessive bits
+\*****************************************************************************/
+#define CANSIM_WORD_BITS		10
+#define CANSIM_IDLE_BITS		10
+
+typedef struct
+	{
+	uint32_t *	words;				// Complete words
+	size_t		count;				// Words used
+	size_t		size;				// Words allocated
+	uint32_t	partial;			// Bits not yet making up a word
+	int			partialBits;		// How many
+	int			recessive;			// Recessive bits in a row
+	} CanSimWire;
+
+/*****************************************************************************\
+|* Building the wire
+\*****************************************************************************/
+void cansim_wire_init(CanSimWire *w);
+void cansim_wire_free(CanSimWire *w);
+void cansim_wire_clear(CanSimWire *w);
+
+/*****************************************************************************\
+|* Append 'count' bits of 'value', most significant first
+\*****************************************************************************/
+void cansim_bits(CanSimWire *w, uint32_t value, int count);
+
+/*****************************************************************************\
+|* Append 'count' recessive bits: an idle bus
+\*****************************************************************************/
+void cansim_idle(CanSimWire *w, int count);
+
+/*****************************************************************************\
+|* Append an error flag, its delimiter and the inter-frame space
+\*****************************************************************************/
+void cansim_error_flag(CanSimWire *w);
+
+/*****************************************************************************\
+|* Append a frame as another node would send it, acked, with its EOF and
+|* inter-frame space. If flip >= 0, that bit of the stuffed frame (counting
+|* from SOF, modulo its length) is inverted and an error flag follows
+|* instead of the ack. Returns the stuffed length, SOF to CRC delimiter
+\*****************************************************************************/
+int cansim_frame(CanSimWire *w, const struct can2040_msg *msg, int flip);
+
+/*****************************************************************************\
+|* Pad the last word out with recessive bits, as if more had been sampled
+\*****************************************************************************/
+void cansim_flush(CanSimWire *w);
+
+/*****************************************************************************\
+|* The simulated controller. Reset starts a fresh one (as can2040_start
+|* would) with room to log 'logSize' received frames
+\*****************************************************************************/
+void cansim_reset(size_t logSize);
+struct can2040 * cansim_bus(void);
+
+/*****************************************************************************\
+|* Hand words to the parser
+\*****************************************************************************/
+void cansim_feed(const uint32_t *words, size_t count);
+
+/*****************************************************************************\
+|* What the parser has passed to the callback since the reset. Only the
+|* first logSize frames are kept, but all are counted
+\*****************************************************************************/
+const struct can2040_msg * cansim_received(size_t *count);
+uint64_t cansim_received_total(void);
+uint64_t cansim_errors(void);
+
+/*****************************************************************************\
+|* The transmit queue, a step at a time, so a test can interleave the
+|* producer (can2040_transmit, split into its claim, fill and publish) with
+|* what the interrupt handler does. Start sets both queue positions, so the
+|* wrap can be reached quickly
+\*****************************************************************************/
+void cansim_tx_start(uint32_t pos);
+int cansim_tx_claim(void);
+void cansim_tx_fill(const struct can2040_msg *msg);
+void cansim_tx_publish(void);
+
+/*****************************************************************************\
+|* The interrupt handler's side: a txpending signal, the frame on the PIO
+|* losing arbitration (so it's rescheduled), and it going out (parsed back,
+|* acked, and reported). Queued gives the frame on the PIO, if there is one;
+|* sent counts the frames reported, and gives the last
+\*****************************************************************************/
+void cansim_tx_schedule(void);
+void cansim_tx_lose(void);
+void cansim_tx_win(void);
+int cansim_tx_queued(struct can2040_msg *msg);
+uint64_t cansim_tx_sent(struct can2040_msg *last);
+uint32_t cansim_tx_attempts(void);
+
+/*****************************************************************************\
+|* Check can2040's unstuffer gives exactly what the original did, from
+|* 'iterations' random states. Returns how many differed
+\*****************************************************************************/
+uint64_t cansim_check_unstuffer(uint64_t iterations, uint64_t *seed);
+
+/*****************************************************************************\
+|* Helper function: are two frames the same, as can2040 would report them
+\*****************************************************************************/
+int cansim_same(const struct can2040_msg *a, const struct can2040_msg *b);
+
+/*****************************************************************************\
+|* Helper function: a small, fast, seedable random number generator
+\*****************************************************************************/
+uint32_t cansim_random(uint64_t *state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CANSIM_H */
@@ -0,0 +1,16 @@
+TEMPLATE = app
+CONFIG += console
+CONFIG -= qt app_bundle
+
+QMAKE_CFLAGS += -std=gnu11
+
+SOURCES += \
+		bench.c \
+		cansim.c
+
+HEADERS += \
+		cansim.h
+
+INCLUDEPATH += \
+			mock \
+			../../rp2040/spy/can
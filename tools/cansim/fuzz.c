@@ -0,0 +1,71 @@
+/*****************************************************************************\
+|* cansim: libFuzzer target for can2040's receive path. The input is taken
+|* as raw bits off the wire. Whatever it does to the parser, an error flag
+|* and a good frame after it must always get through: the parser can never
+|* be left stuck.
+|*
+|* Build with fuzz.pro (clang, -fsanitize=fuzzer). With CONFIG+=replay it's
+|* built without libFuzzer instead, to run saved inputs: cansim_fuzz file..
+\*****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cansim.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+	{
+	static CanSimWire w;
+	cansim_wire_clear(&w);
+
+	cansim_idle(&w, CANSIM_IDLE_BITS);
+	for (size_t i=0; i<size; i++)
+		cansim_bits(&w, data[i], 8);
+
+	struct can2040_msg msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.id			= CAN2040_ID_EFF | 0x1F000123;
+	msg.dlc			= 8;
+	msg.data32[0]	= 0x55AA00FF;
+	msg.data32[1]	= 0x0F0F3C3C;
+
+	cansim_error_flag(&w);
+	cansim_idle(&w, CANSIM_IDLE_BITS);
+	cansim_frame(&w, &msg, -1);
+	cansim_flush(&w);
+
+	cansim_reset(1024);
+	cansim_feed(w.words, w.count);
+
+	size_t count;
+	const struct can2040_msg *got = cansim_received(&count);
+	if ((count == 0) || !cansim_same(&got[count - 1], &msg))
+		{
+		fprintf(stderr, "Frame after %zu bytes of noise was lost\n", size);
+		abort();
+		}
+	return 0;
+	}
+
+#ifdef CANSIM_REPLAY
+int main(int argc, char *argv[])
+	{
+	for (int i=1; i<argc; i++)
+		{
+		FILE *fp = fopen(argv[i], "rb");
+		if (fp == NULL)
+			{
+			perror(argv[i]);
+			return 1;
+			}
+
+		uint8_t data[65536];
+		size_t size = fread(data, 1, sizeof(data), fp);
+		fclose(fp);
+
+		LLVMFuzzerTestOneInput(data, size);
+		printf("%s: ok\n", argv[i]);
+		}
+	return 0;
+	}
+#endif
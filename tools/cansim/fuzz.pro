@@ -0,0 +1,29 @@
+TEMPLATE = app
+TARGET = cansim_fuzz
+CONFIG += console
+CONFIG -= qt app_bundle
+
+QMAKE_CFLAGS += -std=gnu11 -g -O1
+
+# CONFIG+=replay builds without libFuzzer, to rerun saved inputs
+replay {
+	DEFINES += CANSIM_REPLAY
+	QMAKE_CFLAGS += -fsanitize=address,undefined
+	QMAKE_LFLAGS += -fsanitize=address,undefined
+} else {
+	QMAKE_CC = clang
+	QMAKE_LINK = clang++
+	QMAKE_CFLAGS += -fsanitize=fuzzer,address,undefined
+	QMAKE_LFLAGS += -fsanitize=fuzzer,address,undefined
+}
+
+SOURCES += \
+		cansim.c \
+		fuzz.c
+
+HEADERS += \
+		cansim.h
+
+INCLUDEPATH += \
+			mock \
+			../../rp2040/spy/can
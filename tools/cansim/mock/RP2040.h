@@ -0,0 +1,22 @@
+/*****************************************************************************\
+|* Stand-in for the Pico SDK's RP2040.h, so can2040.c builds on the host.
+|* Only what can2040.c uses is here
+\*****************************************************************************/
+#ifndef CANSIM_RP2040_H
+#define CANSIM_RP2040_H
+
+#include <stdint.h>
+
+#define __DMB()			__atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+static inline void hw_set_bits(volatile uint32_t *addr, uint32_t mask)
+	{
+	*addr |= mask;
+	}
+
+static inline void hw_clear_bits(volatile uint32_t *addr, uint32_t mask)
+	{
+	*addr &= ~mask;
+	}
+
+#endif /* CANSIM_RP2040_H */
@@ -0,0 +1,7 @@
+/*****************************************************************************\
+|* Stand-in for the Pico SDK header: can2040.c includes it but uses nothing
+\*****************************************************************************/
+#ifndef CANSIM_DMA_H
+#define CANSIM_DMA_H
+
+#endif /* CANSIM_DMA_H */
@@ -0,0 +1,24 @@
+/*****************************************************************************\
+|* Stand-in for the Pico SDK header. The registers are plain memory, owned
+|* by the simulator
+\*****************************************************************************/
+#ifndef CANSIM_IOBANK0_H
+#define CANSIM_IOBANK0_H
+
+#include <stdint.h>
+
+#define IO_BANK0_GPIO0_CTRL_FUNCSEL_LSB		0
+
+typedef struct
+	{
+	struct
+		{
+		uint32_t status;
+		uint32_t ctrl;
+		} io[30];
+	} iobank0_hw_t;
+
+extern iobank0_hw_t cansim_iobank0;
+#define iobank0_hw				(&cansim_iobank0)
+
+#endif /* CANSIM_IOBANK0_H */
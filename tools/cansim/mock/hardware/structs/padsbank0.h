@@ -0,0 +1,25 @@
+/*****************************************************************************\
+|* Stand-in for the Pico SDK header. The registers are plain memory, owned
+|* by the simulator
+\*****************************************************************************/
+#ifndef CANSIM_PADSBANK0_H
+#define CANSIM_PADSBANK0_H
+
+#include <stdint.h>
+
+#define PADS_BANK0_GPIO0_IE_BITS			0x00000040
+#define PADS_BANK0_GPIO0_DRIVE_MSB			5
+#define PADS_BANK0_GPIO0_DRIVE_VALUE_4MA	0x1
+#define PADS_BANK0_GPIO0_PUE_BITS			0x00000008
+#define PADS_BANK0_GPIO0_PDE_BITS			0x00000004
+
+typedef struct
+	{
+	uint32_t voltage_select;
+	uint32_t io[30];
+	} padsbank0_hw_t;
+
+extern padsbank0_hw_t cansim_padsbank0;
+#define padsbank0_hw			(&cansim_padsbank0)
+
+#endif /* CANSIM_PADSBANK0_H */
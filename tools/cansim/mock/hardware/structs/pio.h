@@ -0,0 +1,80 @@
+/*****************************************************************************\
+|* Stand-in for the Pico SDK header. The PIO blocks are plain memory, owned
+|* by the simulator: whatever can2040.c writes to them is simply kept, and
+|* the simulator hands received bits straight to the parser rather than
+|* through rxf[]. Bit values match the SDK
+\*****************************************************************************/
+#ifndef CANSIM_PIO_H
+#define CANSIM_PIO_H
+
+#include <stdint.h>
+
+#define PIO_CTRL_SM_ENABLE_LSB				0
+#define PIO_CTRL_SM_RESTART_LSB				4
+#define PIO_CTRL_SM_RESTART_BITS			0x000000f0
+#define PIO_CTRL_CLKDIV_RESTART_BITS		0x00000f00
+
+#define PIO_FDEBUG_RXSTALL_LSB				0
+#define PIO_FLEVEL_TX3_BITS					0x0f000000
+
+#define PIO_IRQ0_INTE_SM1_RXNEMPTY_BITS		0x00000002
+#define PIO_IRQ0_INTE_SM0_BITS				0x00000100
+#define PIO_IRQ0_INTE_SM1_BITS				0x00000200
+#define PIO_IRQ0_INTE_SM2_BITS				0x00000400
+#define PIO_IRQ0_INTE_SM3_BITS				0x00000800
+
+#define PIO_SM0_CLKDIV_FRAC_LSB				8
+#define PIO_SM0_EXECCTRL_JMP_PIN_LSB		24
+#define PIO_SM0_EXECCTRL_WRAP_TOP_LSB		12
+#define PIO_SM0_EXECCTRL_WRAP_BOTTOM_LSB	7
+#define PIO_SM0_PINCTRL_OUT_BASE_LSB		0
+#define PIO_SM0_PINCTRL_SET_BASE_LSB		5
+#define PIO_SM0_PINCTRL_IN_BASE_LSB			15
+#define PIO_SM0_PINCTRL_OUT_COUNT_LSB		20
+#define PIO_SM0_PINCTRL_SET_COUNT_LSB		26
+#define PIO_SM0_SHIFTCTRL_AUTOPUSH_BITS		0x00010000
+#define PIO_SM0_SHIFTCTRL_AUTOPULL_BITS		0x00020000
+#define PIO_SM0_SHIFTCTRL_PUSH_THRESH_LSB	20
+#define PIO_SM0_SHIFTCTRL_FJOIN_TX_BITS		0x40000000
+#define PIO_SM0_SHIFTCTRL_FJOIN_RX_BITS		0x80000000
+
+struct pio_sm_hw
+	{
+	uint32_t clkdiv;
+	uint32_t execctrl;
+	uint32_t shiftctrl;
+	uint32_t addr;
+	uint32_t instr;
+	uint32_t pinctrl;
+	};
+
+typedef struct
+	{
+	uint32_t ctrl;
+	uint32_t fstat;
+	uint32_t fdebug;
+	uint32_t flevel;
+	uint32_t txf[4];
+	uint32_t rxf[4];
+	uint32_t irq;
+	uint32_t irq_force;
+	uint32_t input_sync_bypass;
+	uint32_t dbg_padout;
+	uint32_t dbg_padoe;
+	uint32_t dbg_cfginfo;
+	uint32_t instr_mem[32];
+	struct pio_sm_hw sm[4];
+	uint32_t intr;
+	uint32_t inte0;
+	uint32_t intf0;
+	uint32_t ints0;
+	uint32_t inte1;
+	uint32_t intf1;
+	uint32_t ints1;
+	} pio_hw_t;
+
+extern pio_hw_t cansim_pio[2];
+#define pio0_hw					(&cansim_pio[0])
+#define pio1_hw					(&cansim_pio[1])
+
+#endif /* CANSIM_PIO_H */
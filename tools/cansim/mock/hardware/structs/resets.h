@@ -0,0 +1,23 @@
+/*****************************************************************************\
+|* Stand-in for the Pico SDK header. The registers are plain memory, owned
+|* by the simulator, and nothing is ever held in reset
+\*****************************************************************************/
+#ifndef CANSIM_RESETS_H
+#define CANSIM_RESETS_H
+
+#include <stdint.h>
+
+#define RESETS_RESET_PIO0_BITS		0x00000400
+#define RESETS_RESET_PIO1_BITS		0x00000800
+
+typedef struct
+	{
+	uint32_t reset;
+	uint32_t wdsel;
+	uint32_t reset_done;
+	} resets_hw_t;
+
+extern resets_hw_t cansim_resets;
+#define resets_hw				(&cansim_resets)
+
+#endif /* CANSIM_RESETS_H */
@@ -0,0 +1,284 @@
+/*****************************************************************************\
+|* cansim: can2040's transmit queue, driven through random interleavings of
+|* the producer and the interrupt handler. can2040_transmit() is split into
+|* its claim, fill and publish, and between any two steps the handler may
+|* signal txpending, lose arbitration or get its frame out, so the
+|* handler reorders the queue while a frame is half written.
+|*
+|* Whatever happens, every frame published goes out exactly once, the queue
+|* takes exactly CAN2040_TX_QUEUE_DEPTH frames, and each frame put on the
+|* PIO is the one that ought to be next: with CAN2040_TX_PRIORITY the one
+|* that would win arbitration among those waiting (the earliest of equals),
+|* else the earliest. The queue positions start just short of the wrap.
+|*
+|* Build with txqueue.pro (priority mode, depth 8, as the spy has it; add
+|* CONFIG+=fifo for can2040's own FIFO), then eg: cansim_txqueue -n 1000000
+\*****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cansim.h"
+
+#define QUEUE_DEPTH			CAN2040_TX_QUEUE_DEPTH
+#define IDS					6			// Few, so equal ids are common
+
+/*****************************************************************************\
+|* What the producer has published and not yet seen go out, in order
+\*****************************************************************************/
+typedef struct
+	{
+	struct can2040_msg	msg;
+	uint32_t			key;			// Arbitration order, lowest first
+	} Pending;
+
+static Pending			_pending[QUEUE_DEPTH];
+static int				_count		= 0;
+static uint64_t			_published	= 0;
+
+/*****************************************************************************\
+|* Helper function: the order frames win arbitration in, from the bits on
+|* the wire: the base id, then RTR and a dominant IDE for a standard frame,
+|* or a recessive SRR and IDE, the extended id and RTR for an extended one
+\*****************************************************************************/
+static uint32_t arbitration(const struct can2040_msg *msg)
+	{
+	uint32_t rtr = (msg->id & CAN2040_ID_RTR) ? 1 : 0;
+	if (!(msg->id & CAN2040_ID_EFF))
+		return ((msg->id & 0x7FF) << 21) | (rtr << 20);
+	return (((msg->id >> 18) & 0x7FF) << 21) | (1 << 20) | (1 << 19)
+		 | ((msg->id & 0x3FFFF) << 1) | rtr;
+	}
+
+/*****************************************************************************\
+|* Helper function: which pending frame should go next
+\*****************************************************************************/
+static int expected(void)
+	{
+	int best = 0;
+#if CAN2040_TX_PRIORITY
+	for (int i=1; i<_count; i++)
+		if (_pending[i].key < _pending[best].key)
+			best = i;
+#endif
+	return best;
+	}
+
+/*****************************************************************************\
+|* Helper function: a random frame. The ids come from a small set, standard
+|* and extended with the same base id among them; the payload carries a
+|* serial number so each frame can be told apart, bar remote frames
+\*****************************************************************************/
+static void randomFrame(struct can2040_msg *msg, uint64_t *seed)
+	{
+	static const uint32_t ids[IDS] =
+		{
+		0x123,
+		0x124,
+		CAN2040_ID_EFF | (0x123 << 18) | 0x00001,
+		CAN2040_ID_EFF | (0x122 << 18) | 0x3FFFF,
+		CAN2040_ID_EFF | (0x124 << 18),
+		0x7FF
+		};
+
+	memset(msg, 0, sizeof(*msg));
+	msg->id = ids[cansim_random(seed) % IDS];
+	if ((cansim_random(seed) % 8) == 0)
+		{
+		msg->id |= CAN2040_ID_RTR;
+		msg->dlc = cansim_random(seed) % 9;
+		}
+	else
+		{
+		msg->dlc		= 4 + cansim_random(seed) % 5;
+		msg->data32[0]	= (uint32_t)_published;
+		msg->data32[1]	= cansim_random(seed) & ((msg->dlc > 4)
+						? (0xFFFFFFFFu >> (8 * (8 - msg->dlc))) : 0);
+		}
+	}
+
+/*****************************************************************************\
+|* Helper function: check the frame on the PIO (if a new one went on) is
+|* the one that should have
+\*****************************************************************************/
+static int checkQueued(uint32_t *attempts, uint64_t step)
+	{
+	uint32_t now = cansim_tx_attempts();
+	if (now == *attempts)
+		return 1;
+	*attempts = now;
+
+	struct can2040_msg msg;
+	if (!cansim_tx_queued(&msg) || (_count == 0))
+		{
+		fprintf(stderr, "Step %llu: attempt with nothing queued\n",
+				(unsigned long long)step);
+		return 0;
+		}
+
+	const Pending *want = &_pending[expected()];
+	if (!cansim_same(&msg, &want->msg))
+		{
+		fprintf(stderr, "Step %llu: sending %08x, expected %08x\n",
+				(unsigned long long)step, msg.id, want->msg.id);
+		return 0;
+		}
+	return 1;
+	}
+
+/*****************************************************************************\
+|* Helper function: check the frame reported sent is one we were waiting
+|* for (the first match, as equal frames go in order), and forget it
+\*****************************************************************************/
+static int checkSent(uint64_t *sent, uint64_t step)
+	{
+	struct can2040_msg msg;
+	uint64_t now = cansim_tx_sent(&msg);
+	if (now == *sent)
+		return 1;
+	if (now != *sent + 1)
+		{
+		fprintf(stderr, "Step %llu: %llu frames reported at once\n",
+				(unsigned long long)step, (unsigned long long)(now - *sent));
+		return 0;
+		}
+	*sent = now;
+
+	for (int i=0; i<_count; i++)
+		if (cansim_same(&msg, &_pending[i].msg))
+			{
+			memmove(&_pending[i], &_pending[i + 1],
+					(_count - i - 1) * sizeof(Pending));
+			_count --;
+			return 1;
+			}
+
+	fprintf(stderr, "Step %llu: sent %08x, which wasn't waiting\n",
+			(unsigned long long)step, msg.id);
+	return 0;
+	}
+
+static void usage(const char *name)
+	{
+	fprintf(stderr, "Usage: %s [-n steps] [-s seed]\n", name);
+	}
+
+int main(int argc, char *argv[])
+	{
+	uint64_t steps	= 1000000;
+	uint64_t seed	= 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:s:h")) != -1)
+		switch (opt)
+			{
+			case 'n': steps	= strtoull(optarg, NULL, 0);	break;
+			case 's': seed	= strtoull(optarg, NULL, 0);	break;
+			default:
+				usage(argv[0]);
+				return (opt == 'h') ? 0 : 1;
+			}
+
+	if ((steps < 1) || (seed == 0))
+		{
+		usage(argv[0]);
+		return 1;
+		}
+
+	cansim_reset(0);
+	cansim_tx_start(0xFFFFFFFFu - 1000);
+
+	enum { IDLE, CLAIMED, FILLED } producer = IDLE;
+	struct can2040_msg next, queued;
+	uint32_t attempts	= cansim_tx_attempts();
+	uint64_t sent		= 0;
+	uint64_t full		= 0;
+	uint64_t lost		= 0;
+
+	/*************************************************************************\
+	|* Random steps, then drain what's left
+	\*************************************************************************/
+	for (uint64_t step=0; step<steps + 4 * QUEUE_DEPTH; step++)
+		{
+		int draining	= (step >= steps);
+		uint32_t what	= draining ? 6 + (step & 1) : cansim_random(&seed) % 8;
+
+		switch (what)
+			{
+			case 0:
+			case 1:
+			case 2:
+			case 3:
+				if (producer == IDLE)
+					{
+					int claimed = cansim_tx_claim();
+					if (claimed != (_count < QUEUE_DEPTH))
+						{
+						fprintf(stderr, "Step %llu: claim %s with %d "
+								"waiting\n", (unsigned long long)step,
+								claimed ? "worked" : "failed", _count);
+						return 1;
+						}
+					if (claimed)
+						producer = CLAIMED;
+					else
+						full ++;
+					}
+				else if (producer == CLAIMED)
+					{
+					randomFrame(&next, &seed);
+					cansim_tx_fill(&next);
+					producer = FILLED;
+					}
+				else
+					{
+					_pending[_count].msg	= next;
+					_pending[_count].key	= arbitration(&next);
+					_count ++;
+					_published ++;
+					cansim_tx_publish();
+					producer = IDLE;
+					}
+				break;
+
+			case 4:
+				cansim_tx_schedule();
+				break;
+
+			case 5:
+			case 6:
+				if (cansim_tx_queued(&queued))
+					{
+					cansim_tx_lose();
+					lost ++;
+					}
+				else
+					cansim_tx_schedule();
+				break;
+
+			default:
+				if (cansim_tx_queued(&queued))
+					cansim_tx_win();
+				else
+					cansim_tx_schedule();
+				break;
+			}
+
+		if (!checkSent(&sent, step) || !checkQueued(&attempts, step))
+			return 1;
+		}
+
+	if ((_count != 0) || (sent != _published))
+		{
+		fprintf(stderr, "%d frames never went out\n", _count);
+		return 1;
+		}
+
+	printf("%s queue, depth %d: %llu frames out of %llu steps, %llu lost "
+		   "arbitration, %llu found the queue full\n",
+		   CAN2040_TX_PRIORITY ? "priority" : "FIFO", QUEUE_DEPTH,
+		   (unsigned long long)sent, (unsigned long long)steps,
+		   (unsigned long long)lost, (unsigned long long)full);
+	return 0;
+	}
@@ -0,0 +1,24 @@
+TEMPLATE = app
+TARGET = cansim_txqueue
+CONFIG += console
+CONFIG -= qt app_bundle
+
+QMAKE_CFLAGS += -std=gnu11
+
+# The spy's priority queue by default; CONFIG+=fifo for can2040's own
+fifo {
+	DEFINES += CAN2040_TX_QUEUE_DEPTH=8
+} else {
+	DEFINES += CAN2040_TX_PRIORITY=1 CAN2040_TX_QUEUE_DEPTH=8
+}
+
+SOURCES += \
+		cansim.c \
+		txqueue.c
+
+HEADERS += \
+		cansim.h
+
+INCLUDEPATH += \
+			mock \
+			../../rp2040/spy/can
@@ -0,0 +1,389 @@
+/*****************************************************************************\
+|* dispsim: the spy's display driver on the host, talking to an emulated
+|* SSD1306. The emulation keeps its own display RAM and follows the command
+|* stream as the controller would (page and column windows, horizontal
+|* addressing, arguments that arrive in later transfers), so after every
+|* update() it should hold exactly what's in the framebuffer.
+|*
+|* Random drawing is done between updates, and each update is checked:
+|*
+|*   - the emulated RAM matches the framebuffer, so every change was sent
+|*   - each data transfer exactly fills the window set before it
+|*   - the framebuffer is as it was before the update, so the byte borrowed
+|*     for each transfer's control byte was put back
+|*
+|* Then the cost of changing one line of status text is reported, which is
+|* what the spy does most.
+|*
+|* Build with dispsim.pro, then eg: dispsim -n 100000 -s 7
+\*****************************************************************************/
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+#include "display.h"
+
+/*****************************************************************************\
+|* SSD1306 control bytes and the commands that matter here
+\*****************************************************************************/
+#define CTRL_COMMAND			0x00
+#define CTRL_DATA				0x40
+
+#define CMD_MEMORYMODE			0x20
+#define CMD_COLUMNADDR			0x21
+#define CMD_PAGEADDR			0x22
+
+#define RAM_PAGES				8
+#define RAM_COLUMNS				128
+
+/*****************************************************************************\
+|* The emulated controller
+\*****************************************************************************/
+static struct
+	{
+	uint8_t		ram[RAM_PAGES * RAM_COLUMNS];
+	uint8_t		mode;					// Addressing mode, 0 = horizontal
+	uint8_t		p0, p1, c0, c1;			// Window
+	uint8_t		page, column;			// Where the next data byte goes
+	uint8_t		command;				// Command waiting for arguments
+	uint8_t		args[2];
+	int			have;					// Arguments received
+	int			need;					// Arguments it takes
+	bool		windowed;				// Window set since the last data
+	long		bytes;					// Bytes over the bus, with addresses
+	long		data;					// Display data bytes
+	long		transfers;
+	const char *fault;					// First thing it didn't like
+	} _oled;
+
+/*****************************************************************************\
+|* Helper function: how many argument bytes follow a command
+\*****************************************************************************/
+static int argumentsFor(uint8_t command)
+	{
+	switch (command)
+		{
+		case CMD_COLUMNADDR:
+		case CMD_PAGEADDR:
+			return 2;
+
+		case CMD_MEMORYMODE:
+		case 0x81:						// Contrast
+		case 0x8D:						// Charge pump
+		case 0xA8:						// Multiplex
+		case 0xD3:						// Display offset
+		case 0xD5:						// Clock divide
+		case 0xD9:						// Precharge
+		case 0xDA:						// COM pins
+		case 0xDB:						// VCOM detect
+			return 1;
+
+		default:
+			return 0;
+		}
+	}
+
+/*****************************************************************************\
+|* Helper function: a command byte, or an argument to the last command
+\*****************************************************************************/
+static void command(uint8_t byte)
+	{
+	if (_oled.have < _oled.need)
+		{
+		_oled.args[_oled.have++] = byte;
+		if (_oled.have < _oled.need)
+			return;
+
+		switch (_oled.command)
+			{
+			case CMD_MEMORYMODE:
+				_oled.mode		= _oled.args[0];
+				break;
+
+			case CMD_COLUMNADDR:
+				_oled.c0		= _oled.args[0];
+				_oled.c1		= _oled.args[1];
+				_oled.column	= _oled.c0;
+				_oled.windowed	= true;
+				break;
+
+			case CMD_PAGEADDR:
+				_oled.p0		= _oled.args[0];
+				_oled.p1		= _oled.args[1];
+				_oled.page		= _oled.p0;
+				_oled.windowed	= true;
+				break;
+			}
+		return;
+		}
+
+	_oled.command	= byte;
+	_oled.have		= 0;
+	_oled.need		= argumentsFor(byte);
+	}
+
+/*****************************************************************************\
+|* Helper function: note the first fault
+\*****************************************************************************/
+static void fault(const char *what)
+	{
+	if (_oled.fault == nullptr)
+		_oled.fault = what;
+	}
+
+/*****************************************************************************\
+|* The I2C write display.cc calls. A control byte, then commands or data
+\*****************************************************************************/
+int i2c_write_blocking(i2c_inst *i2c, uint8_t addr, const uint8_t *src,
+					   size_t len, bool nostop)
+	{
+	(void)i2c;
+	(void)addr;
+	(void)nostop;
+
+	_oled.transfers ++;
+	_oled.bytes += len + 1;
+	if (len < 2)
+		{
+		fault("transfer with nothing after the control byte");
+		return (int)len;
+		}
+
+	if (src[0] == CTRL_COMMAND)
+		{
+		for (size_t i=1; i<len; i++)
+			command(src[i]);
+		return (int)len;
+		}
+
+	if (src[0] != CTRL_DATA)
+		{
+		fault("unknown control byte");
+		return (int)len;
+		}
+
+	/*************************************************************************\
+	|* Data, written through the window in horizontal addressing mode. Each
+	|* transfer should fill the window it was given exactly
+	\*************************************************************************/
+	if (_oled.mode != 0)
+		fault("data outside horizontal addressing mode");
+	if (!_oled.windowed)
+		fault("data without a window set first");
+	if ((_oled.p1 < _oled.p0) || (_oled.p1 >= RAM_PAGES)
+	 || (_oled.c1 < _oled.c0) || (_oled.c1 >= RAM_COLUMNS))
+		fault("bad window");
+
+	size_t window = (size_t)(_oled.p1 - _oled.p0 + 1)
+				  * (size_t)(_oled.c1 - _oled.c0 + 1);
+	if (len - 1 != window)
+		fault("data doesn't fill its window");
+
+	for (size_t i=1; i<len; i++)
+		{
+		_oled.ram[(_oled.page % RAM_PAGES) * RAM_COLUMNS
+				  + (_oled.column % RAM_COLUMNS)] = src[i];
+		if (_oled.column++ == _oled.c1)
+			{
+			_oled.column = _oled.c0;
+			if (_oled.page++ == _oled.p1)
+				_oled.page = _oled.p0;
+			}
+		}
+
+	_oled.data		+= len - 1;
+	_oled.windowed	= false;
+	return (int)len;
+	}
+
+/*****************************************************************************\
+|* Helper function: xorshift64*
+\*****************************************************************************/
+static uint32_t random32(uint64_t *state)
+	{
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return (uint32_t)((x * 0x2545F4914F6CDD1DULL) >> 32);
+	}
+
+/*****************************************************************************\
+|* Helper function: update, and check what came of it
+\*****************************************************************************/
+static bool update(Display& display, long step)
+	{
+	uint8_t before[FRAMEBUFFER_SIZE];
+	memcpy(before, display.fb(), FRAMEBUFFER_SIZE);
+
+	display.update();
+
+	if (_oled.fault != nullptr)
+		fprintf(stderr, "Step %ld: %s\n", step, _oled.fault);
+	else if (memcmp(before, display.fb(), FRAMEBUFFER_SIZE) != 0)
+		fprintf(stderr, "Step %ld: update changed the framebuffer\n", step);
+	else if (memcmp(_oled.ram, display.fb(), FRAMEBUFFER_SIZE) != 0)
+		{
+		int n = 0;
+		while (_oled.ram[n] == display.fb()[n])
+			n ++;
+		fprintf(stderr, "Step %ld: display differs at page %d column %d\n",
+				step, n / RAM_COLUMNS, n % RAM_COLUMNS);
+		}
+	else
+		return true;
+	return false;
+	}
+
+/*****************************************************************************\
+|* Helper function: draw something at random
+\*****************************************************************************/
+static void draw(Display& display, uint64_t *seed)
+	{
+	static const Display::WriteMode modes[] =
+		{
+		Display::WriteMode::ADD,
+		Display::WriteMode::SUBTRACT,
+		Display::WriteMode::INVERT
+		};
+	static const uint8_t *fonts[] =
+		{
+		font_5x8,
+		font_8x8,
+		font_12x16,
+		font_16x32
+		};
+
+	Display::WriteMode mode = modes[random32(seed) % 3];
+	uint8_t x0	= random32(seed) % 128;
+	uint8_t y0	= random32(seed) % 64;
+	uint8_t x1	= random32(seed) % 128;
+	uint8_t y1	= random32(seed) % 64;
+
+	switch (random32(seed) % 8)
+		{
+		case 0:
+			display.plot(x0, y0, mode);
+			break;
+
+		case 1:
+			display.line(x0, y0, x1, y1, mode);
+			break;
+
+		case 2:
+			display.rect(x0, y0, x1, y1, mode);
+			break;
+
+		case 3:
+			display.fill(x0, y0, x1, y1, mode);
+			break;
+
+		case 4:
+			{
+			char text[12];
+			snprintf(text, sizeof(text), "rx %u", random32(seed) % 100000);
+			display.text(fonts[random32(seed) % 4], text, x0, y0, mode);
+			break;
+			}
+
+		case 5:
+			{
+			uint8_t *buffer = new uint8_t[FRAMEBUFFER_SIZE];
+			memcpy(buffer, display.fb(), FRAMEBUFFER_SIZE);
+			for (int i=random32(seed) % 64; i>0; i--)
+				buffer[random32(seed) % FRAMEBUFFER_SIZE] = random32(seed);
+			display.setBuffer(buffer);
+			break;
+			}
+
+		case 6:
+			if ((random32(seed) % 16) == 0)
+				display.clear();
+			else
+				display.setContrast(random32(seed));
+			break;
+
+		default:
+			break;						// Update with nothing to send
+		}
+	}
+
+static void usage(const char *name)
+	{
+	fprintf(stderr, "Usage: %s [-n steps] [-s seed]\n", name);
+	}
+
+int main(int argc, char *argv[])
+	{
+	long steps		= 100000;
+	uint64_t seed	= 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:s:h")) != -1)
+		switch (opt)
+			{
+			case 'n': steps	= atol(optarg);					break;
+			case 's': seed	= strtoull(optarg, NULL, 0);	break;
+			default:
+				usage(argv[0]);
+				return (opt == 'h') ? 0 : 1;
+			}
+
+	if ((steps < 1) || (seed == 0))
+		{
+		usage(argv[0]);
+		return 1;
+		}
+
+	// Power-on RAM is whatever it is; the first update has to cover it all
+	for (int n=0; n<RAM_PAGES * RAM_COLUMNS; n++)
+		_oled.ram[n] = random32(&seed);
+	_oled.mode = 2;
+
+	i2c_inst i2c;
+	Display display(&i2c, 0x3C, Display::Size::W128xH64);
+	if (!update(display, 0))
+		return 1;
+	printf("Start:       %6ld bytes, %4ld transfers\n",
+		   _oled.bytes, _oled.transfers);
+
+	/*************************************************************************\
+	|* Random drawing, updating after each
+	\*************************************************************************/
+	long bytes = 0, data = 0, transfers = 0;
+	for (long step=1; step<=steps; step++)
+		{
+		_oled.bytes = _oled.data = _oled.transfers = 0;
+		for (int i=random32(&seed) % 4; i>=0; i--)
+			draw(display, &seed);
+		if (!update(display, step))
+			return 1;
+
+		bytes		+= _oled.bytes;
+		data		+= _oled.data;
+		transfers	+= _oled.transfers;
+		}
+	printf("Random:      %6.1f bytes, %4.1f transfers per update, "
+		   "%.0f%% of it display data\n", (double)bytes / steps,
+		   (double)transfers / steps, bytes ? 100.0 * data / bytes : 0.0);
+
+	/*************************************************************************\
+	|* One status line changing, as the spy's does
+	\*************************************************************************/
+	display.clear();
+	display.text(font_5x8, "rx 1234", 0, 16);
+	if (!update(display, steps + 1))
+		return 1;
+
+	_oled.bytes = _oled.transfers = 0;
+	display.fill(0, 16, 127, 23, Display::WriteMode::SUBTRACT);
+	display.text(font_5x8, "rx 1235", 0, 16);
+	if (!update(display, steps + 2))
+		return 1;
+	printf("Status line: %6ld bytes, %4ld transfers (a full screen is %d)\n",
+		   _oled.bytes, _oled.transfers, FRAMEBUFFER_SIZE + 2);
+	return 0;
+	}
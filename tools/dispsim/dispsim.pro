@@ -0,0 +1,13 @@
+TEMPLATE = app
+TARGET = dispsim
+CONFIG += console c++17
+CONFIG -= qt app_bundle
+
+SOURCES += \
+		dispsim.cc \
+		../../rp2040/spy/display/display.cc
+
+INCLUDEPATH += \
+			mock \
+			../../include \
+			../../rp2040/spy/display
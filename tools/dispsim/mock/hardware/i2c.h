@@ -0,0 +1,19 @@
+/*****************************************************************************\
+|* dispsim: just enough of the SDK's I2C interface for display.cc. Writes go
+|* to the emulated SSD1306 in dispsim.cc
+\*****************************************************************************/
+#ifndef HARDWARE_I2C_H
+#define HARDWARE_I2C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct i2c_inst
+	{
+	int			unused;
+	} i2c_inst;
+
+int i2c_write_blocking(i2c_inst *i2c, uint8_t addr, const uint8_t *src,
+					   size_t len, bool nostop);
+
+#endif // HARDWARE_I2C_H
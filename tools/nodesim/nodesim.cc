@@ -0,0 +1,327 @@
+/*****************************************************************************\
+|* nodesim: pretend to be a bus full of nodes, for testing discovery without
+|* the hardware. Each simulated node announces itself and then sends a
+|* heartbeat every period, with the nodes spread evenly across the period
+|* the way real ones drift apart. Optionally the whole bus reboots at once
+|* every so often, to check reefd copes with the storm. Output commands to
+|* any simulated node are acknowledged, after an optional delay, so the
+|* transmit queue can be exercised too.
+|*
+|* Set up a virtual bus first:
+|*
+|*   sudo modprobe vcan
+|*   sudo ip link add dev vcan0 type vcan
+|*   sudo ip link set up vcan0
+|*
+|* then eg: nodesim -i vcan0 -n 500 -r 30
+\*****************************************************************************/
+
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#include <getopt.h>
+#include <unistd.h>
+#include <linux/can.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include "command.h"
+#include "discovery.h"
+
+/*****************************************************************************\
+|* How finely we schedule frames
+\*****************************************************************************/
+#define SIM_TICK_NS			1000000L
+
+/*****************************************************************************\
+|* Drivers handed out to the nodes, round-robin
+\*****************************************************************************/
+static const char * _drivers[] = {"light", "pump", "temp", "ph", "doser",
+								  "level", "orp"};
+#define SIM_DRIVERS			(sizeof(_drivers) / sizeof(_drivers[0]))
+
+typedef struct
+	{
+	uint16_t	node;				// Node number
+	const char *driver;				// What it announces as
+	int64_t		bootedAt;			// ms, on the sim clock
+	int64_t		nextAt;				// ms, when it next sends
+	bool		announced;			// Has sent its announce since boot
+	} SimNode;
+
+static volatile sig_atomic_t _stop = 0;
+
+/*****************************************************************************\
+|* Helper function: monotonic ms
+\*****************************************************************************/
+static int64_t now(void)
+	{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+	}
+
+/*****************************************************************************\
+|* Helper function: send a frame, waiting for room if the queue is full
+\*****************************************************************************/
+static bool send(int fd, uint32_t id, const uint8_t *data, int len)
+	{
+	struct can_frame frame;
+	memset(&frame, 0, sizeof(frame));
+	frame.can_id	= id | CAN_EFF_FLAG;
+	frame.can_dlc	= len;
+	memcpy(frame.data, data, len);
+
+	while (write(fd, &frame, sizeof(frame)) != sizeof(frame))
+		{
+		if ((errno != ENOBUFS) && (errno != EAGAIN))
+			{
+			perror("write");
+			return false;
+			}
+		usleep(200);
+		}
+	return true;
+	}
+
+/*****************************************************************************\
+|* Helper function: open the interface
+\*****************************************************************************/
+static int openBus(const char *interface)
+	{
+	int fd = socket(PF_CAN, SOCK_RAW | SOCK_NONBLOCK, CAN_RAW);
+	if (fd < 0)
+		{
+		perror("socket");
+		return -1;
+		}
+
+	struct ifreq ifr;
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, interface, IFNAMSIZ - 1);
+	if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0)
+		{
+		fprintf(stderr, "No such interface: %s\n", interface);
+		close(fd);
+		return -1;
+		}
+
+	struct sockaddr_can addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.can_family		= AF_CAN;
+	addr.can_ifindex	= ifr.ifr_ifindex;
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		{
+		perror("bind");
+		close(fd);
+		return -1;
+		}
+	return fd;
+	}
+
+/*****************************************************************************\
+|* Helper function: acknowledge any commands for our nodes
+\*****************************************************************************/
+static bool answer(int fd, int first, int count, int delayMs, int64_t t,
+				   std::vector<struct can_frame>& later,
+				   std::vector<int64_t>& laterAt)
+	{
+	struct can_frame frame;
+	while (read(fd, &frame, sizeof(frame)) == sizeof(frame))
+		{
+		uint32_t id = frame.can_id & CAN_EFF_MASK;
+		int node = id & COMMAND_NODE_MASK;
+		if (!(frame.can_id & CAN_EFF_FLAG)
+		 || ((id & COMMAND_ID_MASK) != COMMAND_ID_BASE)
+		 || (frame.can_dlc < COMMAND_SET_LEN)
+		 || (node < first) || (node >= first + count))
+			continue;
+
+		struct can_frame ack;
+		memset(&ack, 0, sizeof(ack));
+		ack.can_id	= COMMAND_ACK_BASE | node;
+		ack.can_dlc	= COMMAND_ACK_LEN;
+		ack.data[0]	= frame.data[0];
+		ack.data[1]	= frame.data[1];
+		ack.data[2]	= COMMAND_STATUS_OK;
+		later.push_back(ack);
+		laterAt.push_back(t + delayMs);
+		}
+
+	for (size_t i=0; i<later.size(); )
+		if (laterAt[i] <= t)
+			{
+			if (!send(fd, later[i].can_id, later[i].data, later[i].can_dlc))
+				return false;
+			later.erase(later.begin() + i);
+			laterAt.erase(laterAt.begin() + i);
+			}
+		else
+			i ++;
+	return true;
+	}
+
+static void usage(const char *name)
+	{
+	fprintf(stderr,
+			"Usage: %s [-i interface] [-n nodes] [-f first] [-p period-ms]\n"
+			"          [-r reboot-every-s] [-a ack-delay-ms]\n"
+			"  -i  CAN interface (vcan0)\n"
+			"  -n  number of nodes (256)\n"
+			"  -f  first node number (1)\n"
+			"  -p  heartbeat period in ms (%d)\n"
+			"  -r  reboot every node at once this often, 0 for never (0)\n"
+			"  -a  delay before acknowledging an output command (0)\n",
+			name, DISCOVERY_PERIOD_MS);
+	}
+
+int main(int argc, char *argv[])
+	{
+	const char *interface	= "vcan0";
+	int count				= 256;
+	int first				= 1;
+	int period				= DISCOVERY_PERIOD_MS;
+	int rebootEvery			= 0;
+	int ackDelay			= 0;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "i:n:f:p:r:a:h")) != -1)
+		switch (opt)
+			{
+			case 'i': interface		= optarg;		break;
+			case 'n': count			= atoi(optarg);	break;
+			case 'f': first			= atoi(optarg);	break;
+			case 'p': period		= atoi(optarg);	break;
+			case 'r': rebootEvery	= atoi(optarg);	break;
+			case 'a': ackDelay		= atoi(optarg);	break;
+			default:
+				usage(argv[0]);
+				return (opt == 'h') ? 0 : 1;
+			}
+
+	if ((count < 1) || (first < 0) || (first + count > 0x10000) || (period < 1))
+		{
+		usage(argv[0]);
+		return 1;
+		}
+
+	int fd = openBus(interface);
+	if (fd < 0)
+		return 1;
+
+	signal(SIGINT,  [](int) { _stop = 1; });
+	signal(SIGTERM, [](int) { _stop = 1; });
+
+	/*************************************************************************\
+	|* Everyone boots together, then spreads out over the period
+	\*************************************************************************/
+	int64_t start = now();
+	std::vector<SimNode> nodes(count);
+	for (int i=0; i<count; i++)
+		{
+		nodes[i].node		= (uint16_t)(first + i);
+		nodes[i].driver		= _drivers[i % SIM_DRIVERS];
+		nodes[i].bootedAt	= start;
+		nodes[i].nextAt		= start;
+		nodes[i].announced	= false;
+		}
+
+	printf("Simulating %d nodes (%04X..%04X) on %s, heartbeat every %d ms\n",
+		   count, first, first + count - 1, interface, period);
+
+	int64_t nextReboot	= rebootEvery ? start + rebootEvery * 1000LL : INT64_MAX;
+	int64_t nextReport	= start + 10000;
+	long sent			= 0;
+
+	std::vector<struct can_frame> acks;
+	std::vector<int64_t> acksAt;
+
+	struct timespec tick;
+	clock_gettime(CLOCK_MONOTONIC, &tick);
+	while (!_stop)
+		{
+		int64_t t = now();
+
+		if (t >= nextReboot)
+			{
+			printf("Rebooting all %d nodes\n", count);
+			for (SimNode& n : nodes)
+				{
+				n.bootedAt	= t;
+				n.nextAt	= t;
+				n.announced	= false;
+				}
+			nextReboot += rebootEvery * 1000LL;
+			}
+
+		for (int i=0; i<count; i++)
+			{
+			SimNode& n = nodes[i];
+			if (t < n.nextAt)
+				continue;
+
+			uint8_t data[8];
+			memset(data, 0, sizeof(data));
+			if (!n.announced)
+				{
+				data[0] = DISCOVERY_ANNOUNCE;
+				memcpy(data + 1, n.driver,
+					   strnlen(n.driver, DISCOVERY_DRIVER_LEN));
+				n.announced = true;
+
+				// First heartbeat lands in this node's slot in the period
+				n.nextAt = n.bootedAt + (int64_t)period * i / count;
+				}
+			else
+				{
+				uint32_t uptime = (uint32_t)((t - n.bootedAt) / 1000);
+				data[0] = DISCOVERY_HEARTBEAT;
+				data[1] = DISCOVERY_STATE_RUN;
+				data[2] = uptime & 0xFF;
+				data[3] = (uptime >> 8) & 0xFF;
+				data[4] = (uptime >> 16) & 0xFF;
+				data[5] = (uptime >> 24) & 0xFF;
+				n.nextAt += period;
+				}
+
+			if (!send(fd, DISCOVERY_ID_BASE | n.node, data,
+					  (data[0] == DISCOVERY_ANNOUNCE) ? 8 : 6))
+				{
+				close(fd);
+				return 1;
+				}
+			sent ++;
+			}
+
+		if (!answer(fd, first, count, ackDelay, t, acks, acksAt))
+			{
+			close(fd);
+			return 1;
+			}
+
+		if (t >= nextReport)
+			{
+			printf("%ld frames sent\n", sent);
+			nextReport += 10000;
+			}
+
+		tick.tv_nsec += SIM_TICK_NS;
+		if (tick.tv_nsec >= 1000000000L)
+			{
+			tick.tv_nsec -= 1000000000L;
+			tick.tv_sec ++;
+			}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tick, NULL);
+		}
+
+	printf("%ld frames sent\n", sent);
+	close(fd);
+	return 0;
+	}
@@ -0,0 +1,9 @@
+TEMPLATE = app
+CONFIG += console c++17
+CONFIG -= qt app_bundle
+
+SOURCES += \
+        nodesim.cc
+
+INCLUDEPATH += \
+			../../include